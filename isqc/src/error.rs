@@ -32,6 +32,14 @@ pub struct NoISQv2RootError;
 )]
 pub struct QCISConfigNotSpecified;
 
+#[derive(Error, Debug, Diagnostic)]
+#[error("--qcis-binary cannot be used with --qcis-config.")]
+#[diagnostic(
+    code(isqv2::qcis_binary_with_config),
+    help("Routed QCIS is written as isQ MLIR, which has no binary form. Drop one of the two options.")
+)]
+pub struct QCISBinaryWithConfig;
+
 #[derive(Error, Debug, Diagnostic)]
 #[error("qcis generate error.")]
 #[diagnostic(
@@ -59,12 +59,22 @@ pub enum Commands{
         target: CompileTarget,
         #[clap(long)]
         qcis_config: Option<String>,
+        // Write the QCIS output in the compact binary format.
+        #[clap(long)]
+        qcis_binary: bool,
+        // Route with `isq-opt --isq-route-qubits` instead of the Python plugin. Needs --qcis-config.
+        #[clap(long)]
+        qcis_native_route: bool,
         #[clap(long, short='I', action=ArgAction::Append)]
         inc_path: Option<Vec<String>>,
         #[clap(long, short, action=ArgAction::Append, allow_negative_numbers(true))]
         int_par: Option<Vec<i64>>,
         #[clap(long, short, action=ArgAction::Append, allow_negative_numbers(true))]
-        double_par: Option<Vec<f64>>
+        double_par: Option<Vec<f64>>,
+        #[clap(long)]
+        static_qubits: bool,
+        #[clap(long)]
+        batch_gates: bool
     },
     #[clap(group(
         ArgGroup::new("simulator_type")
@@ -78,6 +88,9 @@ pub enum Commands{
         cuda: Option<usize>,
         #[clap(long)]
         qcis: bool,
+        // With --qcis, the input is binary QCIS.
+        #[clap(long)]
+        qcis_binary: bool,
         #[clap(long)]
         shots: Option<i64>,
         #[clap(long)]
@@ -166,15 +179,18 @@ fn main()->miette::Result<()> {
                 let so_path = default_output_path.to_string_lossy().to_string();
                 queue.push_back(Commands::Compile { 
                     input: input_path.to_string_lossy().to_string(), output: Some(so_path.clone()),
-                    opt_level: None, emit: EmitMode::Out, target: CompileTarget::QIR, qcis_config: None,
-                    inc_path: None, int_par: None, double_par: None 
+                    opt_level: None, emit: EmitMode::Out, target: CompileTarget::QIR, qcis_config: None, qcis_binary: false, qcis_native_route: false,
+                    inc_path: None, int_par: None, double_par: None, static_qubits: false, batch_gates: false
                 });
                 queue.push_back(Commands::Simulate { 
-                    qir_object: so_path, cuda: None, qcis: false, shots: shots, debug: debug, int_par: None, 
+                    qir_object: so_path, cuda: None, qcis: false, qcis_binary: false, shots: shots, debug: debug, int_par: None, 
                     double_par: None, np: np, qn: qn 
                 })
             }
-            Commands::Compile{input, output, opt_level, emit, target, qcis_config, inc_path, int_par, double_par}=>'command:{
+            Commands::Compile{input, output, opt_level, emit, target, qcis_config, qcis_binary, qcis_native_route, inc_path, int_par, double_par, static_qubits, batch_gates}=>'command:{
+                if qcis_binary && qcis_config.is_some(){
+                    return Err(QCISBinaryWithConfig)?
+                }
                 let (input_path, default_output_path) = resolve_input_path(&input, match emit{
                     EmitMode::Binary=>"so",
                     EmitMode::Out=> "so",
@@ -210,9 +226,9 @@ fn main()->miette::Result<()> {
                     break 'command;
                 }
                 
-                let qcis_flags = "-pass-pipeline=builtin.module(cse,logic-lower-to-isq,isq-state-preparation,isq-remove-reset,func.func(affine-loop-unroll),isq-canonicalize,canonicalize,isq-oracle-decompose,isq-lower-switch,isq-recognize-famous-gates,isq-eliminate-neg-ctrl,isq-convert-famous-rot,canonicalize,cse,isq-pure-gate-detection,canonicalize,isq-fold-decorated-gates,canonicalize,isq-decompose-ctrl-u3,isq-convert-famous-rot,isq-decompose-known-gates-qsd,isq-remove-trivial-sq-gates,isq-target-qcis,isq-expand-decomposition,canonicalize,cse,canonicalize,cse)";
-                let normal_flags = "-pass-pipeline=builtin.module(cse,logic-lower-to-isq,isq-state-preparation,isq-oracle-decompose,isq-lower-switch,isq-recognize-famous-gates,isq-eliminate-neg-ctrl,isq-convert-famous-rot,canonicalize,cse,isq-pure-gate-detection,canonicalize,isq-fold-decorated-gates,canonicalize,isq-decompose-ctrl-u3,isq-convert-famous-rot,isq-decompose-known-gates-qsd,isq-remove-trivial-sq-gates,isq-expand-decomposition,canonicalize,cse)";
-                let qasm_flags = "-pass-pipeline=builtin.module(cse,logic-lower-to-isq,isq-state-preparation,isq-oracle-decompose,isq-lower-switch,isq-recognize-famous-gates,isq-eliminate-neg-ctrl,canonicalize,cse,isq-pure-gate-detection,canonicalize,isq-fold-decorated-gates,canonicalize,isq-decompose-ctrl-u3,isq-decompose-known-gates-qsd,isq-remove-trivial-sq-gates,isq-expand-decomposition,isq-cancel-redundant,canonicalize,cse)";
+                let qcis_flags = "-pass-pipeline=builtin.module(cse,logic-lower-to-isq,isq-state-preparation,isq-remove-reset,isq-hoist-gates,func.func(affine-loop-unroll),isq-canonicalize,canonicalize,isq-oracle-decompose,isq-lower-switch,isq-recognize-famous-gates,isq-eliminate-neg-ctrl,isq-convert-famous-rot,canonicalize,cse,isq-pure-gate-detection,canonicalize,isq-fold-decorated-gates,canonicalize,isq-decompose-ctrl-u3,isq-convert-famous-rot,isq-decompose-known-gates-qsd,isq-tpar,isq-fuse-sq-gates,isq-remove-trivial-sq-gates,isq-target-qcis,isq-expand-decomposition,canonicalize,cse,isq-cancel-gates,canonicalize,cse)";
+                let normal_flags = "-pass-pipeline=builtin.module(cse,logic-lower-to-isq,isq-state-preparation,isq-oracle-decompose,isq-lower-switch,isq-recognize-famous-gates,isq-eliminate-neg-ctrl,isq-convert-famous-rot,canonicalize,cse,isq-pure-gate-detection,canonicalize,isq-fold-decorated-gates,canonicalize,isq-decompose-ctrl-u3,isq-convert-famous-rot,isq-decompose-known-gates-qsd,isq-remove-trivial-sq-gates,isq-expand-decomposition,canonicalize,cse,isq-cancel-gates,isq-fuse-sq-gates,canonicalize,cse)";
+                let qasm_flags = "-pass-pipeline=builtin.module(cse,logic-lower-to-isq,isq-state-preparation,isq-oracle-decompose,isq-lower-switch,isq-recognize-famous-gates,isq-eliminate-neg-ctrl,canonicalize,cse,isq-pure-gate-detection,canonicalize,isq-fold-decorated-gates,canonicalize,isq-decompose-ctrl-u3,isq-decompose-known-gates-qsd,isq-remove-trivial-sq-gates,isq-expand-decomposition,isq-cancel-gates,isq-cancel-redundant,canonicalize,cse)";
 
                 let flags = match target {
                     CompileTarget::QCIS => qcis_flags,
@@ -257,10 +273,13 @@ fn main()->miette::Result<()> {
                 }
 
 
+                let lower_to_qir = if static_qubits {"isq-lower-to-qir-rep{static-qubits=1}"} else {"isq-lower-to-qir-rep"};
+                // isq-run (mlir/tools/run.cpp, LOWER_TO_LLVM) copies this pipeline without global-thread-local. Keep the two in sync.
+                let llvm_flags = format!("-pass-pipeline=builtin.module(cse,isq-remove-gphase,lower-affine,{},cse,canonicalize,func.func(convert-math-to-llvm),arith-expand,expand-strided-metadata,memref-expand,convert-math-to-funcs,isq-lower-qir-rep-to-llvm,canonicalize,cse,symbol-dce,llvm-legalize-for-export,global-thread-local)", lower_to_qir);
                 let llvm_mlir = exec::exec_command_text(&root, "isq-opt", &[
                     // Todo: add symbol-dce pass back
                     //"-pass-pipeline=symbol-dce,cse,isq-remove-gphase,lower-affine,isq-lower-to-qir-rep,cse,canonicalize,builtin.func(convert-math-to-llvm),isq-lower-qir-rep-to-llvm,canonicalize,cse,symbol-dce,llvm-legalize-for-export",
-                    "-pass-pipeline=builtin.module(cse,isq-remove-gphase,lower-affine,isq-lower-to-qir-rep,cse,canonicalize,func.func(convert-math-to-llvm),arith-expand,expand-strided-metadata,memref-expand,convert-math-to-funcs,isq-lower-qir-rep-to-llvm,canonicalize,cse,symbol-dce,llvm-legalize-for-export,global-thread-local)",
+                    llvm_flags.as_str(),
                     "--mlir-print-debuginfo",
                     "--format-out"
                 ], &resolved_mlir_opt).map_err(io_error_when("Calling isq-opt"))?;
@@ -283,12 +302,18 @@ fn main()->miette::Result<()> {
                     break 'command;
                 }
                 // linking with stub. This step we use byte output.
+                // The batched stub writes gates into a simulator-owned buffer from inlined code.
+                let stub = if batch_gates {"isq-simulator-batched.bc"} else {"isq-simulator.bc"};
                 let linked_llvm = exec::exec_command("", &llvm_tool("llvm-link"), &[
                     format!("-"),
-                    format!("{}/share/isq-simulator/isq-simulator.bc", &root)
+                    format!("{}/share/isq-simulator/{}", &root, stub)
                 ], llvm.as_bytes()).map_err(io_error_when("Calling llvm-link"))?;
                 let mut opt_args: Vec<String> = Vec::new();
-                if let Some(o) = opt_level{
+                if batch_gates{
+                    // Whole-program optimization: only the entry is called by the simulator.
+                    opt_args.push("-internalize-public-api-list=__isq__entry".into());
+                    opt_args.push(format!("-passes=internalize,default<O{}>", opt_level.unwrap_or(3)));
+                }else if let Some(o) = opt_level{
                     opt_args.push(format!("-O{}", o));
                 }
                 let optimized_llvm = exec::exec_command("", &llvm_tool("opt"), &opt_args, &linked_llvm).map_err(io_error_when("Calling opt"))?;
@@ -316,7 +341,7 @@ fn main()->miette::Result<()> {
                             None => vec![]
                         };
                         // run simulator 
-                        let (_, qcis_output_path) = resolve_input_path(&input, "qcis")?;
+                        let (_, qcis_output_path) = resolve_input_path(&input, if qcis_binary {"qcisb"} else {"qcis"})?;
                         let mut qcis_out = MayDropFile::new(&qcis_output_path)?;
                         let qir_object = output.to_str().unwrap();
                         let qir_object = if qir_object.starts_with("/"){
@@ -327,6 +352,9 @@ fn main()->miette::Result<()> {
                         
                         let mut v = vec!["-e".into(), "__isq__entry".into()];
                         v.push("--qcisgen".into());
+                        if qcis_binary{
+                            v.push("--qcis-binary".into());
+                        }
                         v.push(qir_object);
                         for val in par_int{
                             v.push("-i".into());
@@ -337,18 +365,41 @@ fn main()->miette::Result<()> {
                             v.push(format!("{}", val))
                         }
                         let config_file = qcis_config;//ok_or(QCISConfigNotSpecified)?;
-                        let output = if let Some(s) = config_file {
+                        if qcis_native_route && config_file.is_none(){
+                            return Err(QCISConfigNotSpecified)?
+                        }
+                        let output = if let Some(s) = &config_file {
                             exec::exec_command_with_decorator(&root, "simulator", &v, &[], |child|{
-                                child.env("QCIS_ROUTE_CONFIG", &s);
+                                child.env("QCIS_ROUTE_CONFIG", s);
+                                if qcis_native_route{
+                                    child.env("QCIS_ROUTE_NATIVE", "1");
+                                }
                             }).map_err(io_error_when("running qcis classical part"))?
                         }else{
                             exec::exec_command(&root, "simulator", &v, &[]).map_err(io_error_when("running qcis classical part"))?
                         };
                         
-                        let outs = std::str::from_utf8(&output).unwrap();
-                        if outs.contains("Error"){
-                            return Err(QCISGenerateError(outs.to_string()))?
+                        if qcis_binary{
+                            // Errors are reported as text before any binary output.
+                            if !output.starts_with(b"QCIS"){
+                                return Err(QCISGenerateError(String::from_utf8_lossy(&output).to_string()))?
+                            }
+                        }else{
+                            let outs = std::str::from_utf8(&output).unwrap();
+                            if outs.contains("Error"){
+                                return Err(QCISGenerateError(outs.to_string()))?
+                            }
                         }
+                        // The simulator only translates the program; the routing pass inserts the swaps.
+                        let output = match (qcis_native_route, &config_file){
+                            (true, Some(config)) => {
+                                let route_flags = format!("-pass-pipeline=builtin.module(isq-recognize-famous-gates,isq-route-qubits{{config={}}})", config);
+                                let routed = exec::exec_command_text(&root, "isq-opt", &[route_flags.as_str(), "--format-out"], std::str::from_utf8(&output).unwrap()).map_err(io_error_when("Calling isq-opt"))?;
+                                let routed = resolve_mlir_output(&routed, "qcis routing failed.".into())?;
+                                format!("{}\n", routed).into_bytes()
+                            }
+                            _ => output
+                        };
 
                         qcis_out.get_file_mut().write_all(&output).map_err(IoError)?;
                         qcis_out.finalize();
@@ -358,7 +409,7 @@ fn main()->miette::Result<()> {
                 }
 
             }
-            Commands::Simulate{qir_object, cuda, qcis, shots, debug, int_par, double_par, np, qn}=>{
+            Commands::Simulate{qir_object, cuda, qcis, qcis_binary, shots, debug, int_par, double_par, np, qn}=>{
 
                 let qir_object = if qir_object.starts_with("/"){
                     qir_object
@@ -372,6 +423,9 @@ fn main()->miette::Result<()> {
                 }else{
                     if qcis{
                         v.push("--qcis".into());
+                        if qcis_binary{
+                            v.push("--qcis-binary".into());
+                        }
                     }else{
                         v.push("--naive".into());
                     }
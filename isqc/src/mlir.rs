@@ -12,7 +12,8 @@ pub fn resolve_mlir_output(input: &str, err_msg: String)->miette::Result<String>
     //let src = NamedSource::new(name.to_owned(), source.to_owned());
     let json = serde_json::from_str(input).map_err(|_| InvalidMLIRJson)?;
     if let V::Object(kv) = json{
-        if let Some(V::String(s)) = kv.get("Right"){
+        // Errors raised while the output was being streamed come with a partial "Right".
+        if let Some(V::String(s)) = kv.get("Right").filter(|_| !kv.contains_key("Left")){
             return Ok(String::from(s));
         }else{
             if let Some(V::Array(err)) = kv.get("Left"){
@@ -3,12 +3,13 @@
 #include "mlir/IR/BuiltinOps.h"
 #include <mlir/Support/LogicalResult.h>
 #include <mlir/IR/MLIRContext.h>
+#include <llvm/ADT/StringRef.h>
 #include <llvm/Support/raw_os_ostream.h>
 namespace isq{
 namespace ir{
-mlir::LogicalResult generateOpenQASM3Logic(mlir::MLIRContext &context, mlir::ModuleOp &module, llvm::raw_string_ostream &os);
-mlir::LogicalResult generateQCIS(mlir::MLIRContext &context, mlir::ModuleOp &module, llvm::raw_string_ostream &os, bool printast);
-mlir::LogicalResult generateEQASM(mlir::MLIRContext &context, mlir::ModuleOp &module, llvm::raw_string_ostream &os, bool printast);
+mlir::LogicalResult generateOpenQASM3Logic(mlir::MLIRContext &context, mlir::ModuleOp &module, llvm::raw_ostream &os);
+mlir::LogicalResult generateQCIS(mlir::MLIRContext &context, mlir::ModuleOp &module, llvm::raw_ostream &os, bool printast, bool layers, bool binary, llvm::StringRef timing);
+mlir::LogicalResult generateEQASM(mlir::MLIRContext &context, mlir::ModuleOp &module, llvm::raw_ostream &os, bool printast, int registers);
 }
 }
 #endif
\ No newline at end of file
@@ -0,0 +1,77 @@
+#ifndef _ISQ_PASSES_CIRCUITDAG_H
+#define _ISQ_PASSES_CIRCUITDAG_H
+#include <limits>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <mlir/IR/Operation.h>
+#include <mlir/Pass/AnalysisManager.h>
+#include <optional>
+#include <vector>
+namespace isq{
+namespace ir{
+namespace passes{
+
+// Layered gate dependency DAG of a function.
+//
+// Nodes are `isq.apply` and `isq.call_qop` ops in program order. Every qubit is a wire:
+// qstate values are followed through gate results and through affine load/store to statically known
+// locations (see `resolveMemLocation`). Each node keeps one predecessor and one successor per wire it touches.
+//
+// Different memrefs, including memref arguments of the function, are assumed not to alias each other: each
+// (memref, indices) location is its own wire, so dependencies through aliasing memrefs are missed.
+//
+// Ops that may touch unknown qubits (calls, region ops containing quantum ops, accesses with dynamic indices)
+// become barrier nodes. A barrier follows the previous barrier and has a slot for each wire used since then;
+// every later node on any wire depends on it, through its slot or, for other wires, with a NONE predecessor
+// slot in the barrier.
+//
+// Usage: `getAnalysis<CircuitDAG>()` in a function pass, or `getChildAnalysis<CircuitDAG>(func)` in a module pass.
+class CircuitDAG{
+public:
+    using NodeId = unsigned;
+    static constexpr NodeId NONE = std::numeric_limits<NodeId>::max();
+
+    explicit CircuitDAG(mlir::Operation* op);
+    bool isInvalidated(const mlir::AnalysisManager::PreservedAnalyses& pa){
+        return !pa.isPreserved<CircuitDAG>();
+    }
+
+    unsigned size() const { return ops.size(); }
+    unsigned numWires() const { return wireCount; }
+    // Number of layers. Barriers take one layer each.
+    unsigned depth() const { return layerStart.size()-1; }
+    mlir::Operation* getOp(NodeId id) const { return ops[id]; }
+    std::optional<NodeId> lookup(mlir::Operation* op) const;
+    bool isBarrier(NodeId id) const { return barrier[id]; }
+    // Earliest and latest layer the node may be placed in without increasing depth.
+    unsigned asap(NodeId id) const { return asapLayer[id]; }
+    unsigned alap(NodeId id) const { return alapLayer[id]; }
+    // One entry per touched wire, NONE if the node is the first on the wire.
+    llvm::ArrayRef<NodeId> predecessors(NodeId id) const;
+    // One entry per touched wire, NONE if the node is the last on the wire.
+    llvm::ArrayRef<NodeId> successors(NodeId id) const;
+    llvm::ArrayRef<unsigned> wires(NodeId id) const;
+    // Nodes with the given ASAP layer, in program order.
+    llvm::ArrayRef<NodeId> layer(unsigned l) const;
+private:
+    std::vector<mlir::Operation*> ops;
+    std::vector<bool> barrier;
+    std::vector<unsigned> asapLayer;
+    std::vector<unsigned> alapLayer;
+    // Per-wire slots of node i are [slotStart[i], slotStart[i+1]).
+    std::vector<unsigned> slotStart;
+    std::vector<NodeId> preds;
+    std::vector<NodeId> succs;
+    std::vector<unsigned> slotWire;
+    // Nodes sorted by ASAP layer; layer l is [layerStart[l], layerStart[l+1]).
+    std::vector<NodeId> layerNodes;
+    std::vector<unsigned> layerStart;
+    llvm::DenseMap<mlir::Operation*, NodeId> index;
+    unsigned wireCount = 0;
+    friend struct CircuitDAGBuilder;
+};
+
+}
+}
+}
+#endif
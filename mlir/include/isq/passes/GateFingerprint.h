@@ -0,0 +1,53 @@
+#ifndef _ISQ_PASSES_GATEFINGERPRINT_H
+#define _ISQ_PASSES_GATEFINGERPRINT_H
+#include <complex>
+#include <cstddef>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallVector.h>
+#include <optional>
+#include <unordered_map>
+namespace isq{
+namespace ir{
+namespace passes{
+
+// Same layout as `DenseComplexF64MatrixAttr::MatrixVal`.
+using GateMatrix = llvm::SmallVector<llvm::SmallVector<std::complex<double>>>;
+
+// Hash of a unitary up to global phase.
+// Entries are rotated by the phase of the first large entry and rounded to a grid much coarser than
+// the matching tolerance, so gates equal up to phase get equal fingerprints.
+std::size_t fingerprintMatrix(const GateMatrix& m);
+// Whether a and b are equal up to global phase.
+bool equalUpToPhase(const GateMatrix& a, const GateMatrix& b);
+// The gate that applies `m` on qubits (perm[0], ..., perm[n-1]). Qubit 0 is the most significant bit.
+GateMatrix permuteQubits(const GateMatrix& m, llvm::ArrayRef<unsigned> perm);
+
+// Known gate matrices indexed by fingerprint, so that finding the gate equal to a matrix takes one
+// hash lookup however many gates are known.
+class GateMatrixIndex{
+public:
+    struct Match{
+        unsigned id;
+        // The input gate is gate `id` applied on qubits (perm[0], ..., perm[n-1]).
+        llvm::SmallVector<unsigned> perm;
+        // The input gate is `phase` times the indexed one.
+        std::complex<double> phase = 1.0;
+        bool isIdentityPermutation() const;
+    };
+    // With `permutations`, `m` is also indexed under every ordering of its qubits.
+    void insert(unsigned id, const GateMatrix& m, bool permutations = true);
+    std::optional<Match> lookup(const GateMatrix& m) const;
+    std::size_t size() const { return numEntries; }
+private:
+    struct Entry{
+        Match match;
+        GateMatrix matrix;
+    };
+    std::unordered_map<std::size_t, llvm::SmallVector<Entry, 1>> buckets;
+    std::size_t numEntries = 0;
+};
+
+}
+}
+}
+#endif
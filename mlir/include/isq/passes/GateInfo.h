@@ -0,0 +1,88 @@
+#ifndef _ISQ_PASSES_GATEINFO_H
+#define _ISQ_PASSES_GATEINFO_H
+#include "isq/Operations.h"
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <mlir/IR/Block.h>
+#include <mlir/IR/SymbolTable.h>
+#include <mlir/IR/Value.h>
+#include <mlir/IR/AffineMap.h>
+#include <optional>
+#include <vector>
+namespace isq{
+namespace ir{
+namespace passes{
+
+// The basis in which a gate acts on one of its qubits.
+// Two gates sharing a qubit commute on that qubit if they act in the same non-general basis.
+enum class WireBasis{
+    General,
+    Z,
+    X,
+    Y
+};
+
+// Summary of an `isq.apply` whose gate is an `isq.use`, possibly decorated.
+struct AppliedGate{
+    ApplyGateOp op;
+    UseGateOp use;
+    DefgateOp defgate;
+    // Lower-case famous name (e.g. "cnot"), empty if the gate is not builtin.
+    mlir::StringRef famous;
+    bool adjoint = false;
+    llvm::SmallVector<bool> ctrl;
+    // Hints of the applied (decorated) gate type.
+    GateTrait hints = GateTrait::General;
+
+    bool isBuiltin() const { return !famous.empty(); }
+    // Basis on the i-th qubit operand of the apply.
+    WireBasis basisOn(unsigned i) const;
+    // The i-th gate parameter, if it is a constant.
+    std::optional<double> constantParam(unsigned i) const;
+};
+
+std::optional<AppliedGate> analyzeAppliedGate(ApplyGateOp op, mlir::SymbolTableCollection& symbols);
+std::optional<double> getConstantF64(mlir::Value v);
+bool commuteOnWire(WireBasis a, WireBasis b);
+// Whether applying `first` then `second` on the same qubits (in the same order) is identity.
+bool isInversePair(const AppliedGate& first, const AppliedGate& second);
+
+// A memory location holding a qstate, resolved through subviews and casts.
+struct MemLocation{
+    // Identity of the underlying memory.
+    const void* root;
+    // Whether the root is a global or a local allocation. Distinct roots never alias each other.
+    bool distinct;
+    // Element indices into the root, if statically known.
+    std::optional<std::vector<int64_t>> indices;
+    bool mayAlias(const MemLocation& other) const;
+};
+// Location accessed by an affine load/store.
+MemLocation resolveMemLocation(mlir::Value memref, mlir::AffineMap map, mlir::ValueRange operands);
+// The whole memory behind a memref.
+MemLocation resolveMemLocation(mlir::Value memref);
+// The memref viewed through subviews and casts.
+mlir::Value baseMemRef(mlir::Value memref);
+
+// Store-to-load forwarding of qstates inside one block.
+// Every `affine.load` of a qstate is matched with the latest `affine.store` to the same constant
+// location, as long as no possibly-aliasing write happens in between.
+// This lets chain-walking passes see through the load-apply-store sequences emitted by the frontend.
+class QStateForwarding{
+    // Stores are kept as operations: the stored value may be rewritten by the user.
+    llvm::DenseMap<mlir::Value, mlir::Operation*> loadToStored;
+    llvm::DenseMap<mlir::Operation*, mlir::Value> storedToLoad;
+public:
+    QStateForwarding() = default;
+    explicit QStateForwarding(mlir::Block* block);
+    // The value stored before the given load, or null.
+    mlir::Value storedBefore(mlir::Value loaded) const;
+    // The load reading back the given stored value, or null.
+    mlir::Value loadedAfter(mlir::Value stored) const;
+};
+
+}
+}
+}
+#endif
@@ -0,0 +1,43 @@
+#ifndef _ISQ_PASSES_LAYERSCHEDULER_H
+#define _ISQ_PASSES_LAYERSCHEDULER_H
+#include "isq/passes/GateInfo.h"
+#include <llvm/ADT/ArrayRef.h>
+#include <set>
+#include <vector>
+namespace isq{
+namespace ir{
+namespace passes{
+
+// Greedy layer assignment of a gate stream given in program order.
+//
+// Consecutive gates acting in the same basis on a wire commute there (see `commuteOnWire`) and form a group.
+// A gate waits for the previous group on each of its wires rather than for the previous gate, and takes the
+// earliest layer that is free on all its wires. Without commuting gates this is plain ASAP scheduling.
+// Feeding the stream in reverse order gives ALAP layers counted from the end.
+class LayerScheduler{
+public:
+    // Places a gate acting on `wires`, in basis `basis[i]` on `wires[i]`, and returns its layer.
+    unsigned place(llvm::ArrayRef<unsigned> wires, llvm::ArrayRef<WireBasis> basis);
+    // Places an op that stays after everything placed before and before everything placed after.
+    unsigned placeBarrier();
+    unsigned depth() const { return layers; }
+private:
+    struct Wire{
+        WireBasis basis = WireBasis::General;
+        // Earliest layer for gates joining the current group.
+        unsigned groupStart = 0;
+        // One past the last layer of the current group.
+        unsigned end = 0;
+        // Layers taken by the current group.
+        std::set<unsigned> used;
+    };
+    Wire& wire(unsigned w);
+    std::vector<Wire> wireStates;
+    unsigned floor = 0;
+    unsigned layers = 0;
+};
+
+}
+}
+}
+#endif
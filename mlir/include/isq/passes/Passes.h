@@ -29,6 +29,14 @@ void registerAffineSWP();
 void registerGlobalThreadLocal();
 void registerReuseQubit();
 void registerRedundant();
+void registerCancelGates();
+void registerFuseSQGates();
+void registerPrintCircuitDepth();
+void registerSchedule();
+void registerRouteQubits();
+void registerHoistGates();
+void registerPhasePolynomial();
+void registerRewriteRules();
 
 void addLegalizeTraitsRules(mlir::RewritePatternSet& patterns);
 
@@ -39,6 +47,9 @@ void emitBuiltinGate(mlir::OpBuilder& builder, const char* famous_gate, mlir::Ar
 
 
 extern const char* ISQ_GPHASE_REMOVED;
+extern const char* ISQ_FAMOUS;
+extern const char* ISQ_LAYER;
+extern const char* ISQ_STATIC_QUBIT;
 
 }
 
@@ -0,0 +1,61 @@
+#ifndef _ISQ_PASSES_QUBITROUTER_H
+#define _ISQ_PASSES_QUBITROUTER_H
+#include <limits>
+#include <optional>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallVector.h>
+#include <utility>
+#include <vector>
+namespace isq{
+namespace ir{
+namespace passes{
+
+// Physical qubits and the pairs of them that support two-qubit gates.
+class CouplingGraph{
+public:
+    static constexpr unsigned UNREACHABLE = std::numeric_limits<unsigned>::max();
+    // Qubits are numbered from 0.
+    CouplingGraph(unsigned size, llvm::ArrayRef<std::pair<unsigned, unsigned>> edges);
+    unsigned size() const { return numQubits; }
+    unsigned distance(unsigned a, unsigned b) const { return dist[a*numQubits+b]; }
+    llvm::ArrayRef<unsigned> neighbors(unsigned q) const { return adjacency[q]; }
+    bool isConnected() const;
+private:
+    unsigned numQubits;
+    std::vector<std::vector<unsigned>> adjacency;
+    // All-pairs shortest path lengths, computed by BFS from every qubit.
+    std::vector<unsigned> dist;
+};
+
+// Swap-based qubit router with lookahead.
+//
+// Gates are routed in program order. Before a two-qubit gate on non-adjacent qubits, swaps are inserted
+// one at a time, each moving one of its qubits a step closer to the other along a shortest path. Among those
+// candidates the swap minimizing the distance of the next `lookahead` two-qubit gates is taken, so
+// routing terminates after exactly distance-1 swaps per gate.
+//
+// Measured physical qubits cannot be used again, so swaps never touch them and distances are taken around
+// them once any qubit is measured.
+class QubitRouter{
+public:
+    using Swap = std::pair<unsigned, unsigned>;
+    QubitRouter(const CouplingGraph& graph, unsigned lookahead, double lookaheadWeight);
+    // `gates` lists the logical qubits of every gate: two for gates to route, one for a measurement, and none
+    // for gates that need no routing. `mapping` maps logical to physical qubits and holds the final mapping on
+    // return. Returns, for every gate, the physical swaps to execute right before it, or std::nullopt if
+    // measured qubits cut the operands of a gate apart.
+    std::optional<std::vector<llvm::SmallVector<Swap>>> route(llvm::ArrayRef<llvm::SmallVector<unsigned, 2>> gates, std::vector<unsigned>& mapping) const;
+    // Improves an initial mapping by routing the circuit forward and backward and keeping the final mapping.
+    void refineInitialMapping(llvm::ArrayRef<llvm::SmallVector<unsigned, 2>> gates, std::vector<unsigned>& mapping, unsigned rounds) const;
+private:
+    // Distances from `src` over qubits that are not `dead`.
+    std::vector<unsigned> liveDistances(unsigned src, const std::vector<bool>& dead) const;
+    const CouplingGraph& graph;
+    unsigned lookahead;
+    double lookaheadWeight;
+};
+
+}
+}
+}
+#endif
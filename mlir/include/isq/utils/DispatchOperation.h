@@ -1,40 +1,62 @@
 #ifndef _ISQ_UTILS_DISPATCHOPERATION_H
 #define _ISQ_UTILS_DISPATCHOPERATION_H
 
+#include "llvm/ADT/DenseMap.h"
 #include "mlir/IR/Operation.h"
 #include "mlir/Support/LLVM.h"
 #include "mlir/Support/LogicalResult.h"
+#include "mlir/Support/TypeID.h"
 namespace isq{
 namespace ir{
+// Visits operations by their type. Each type in OpTypes gets a virtual `visitOp` to override, which
+// succeeds by default; other operations go to `visitOp(mlir::Operation*)`, which fails by default.
+// OpTypes must be concrete ops (not interfaces): `visitOperation` finds the overload through a table
+// keyed by the op's TypeID, built once per visitor type.
 template<typename ... OpTypes> class OpVisitor{};
 template<> class OpVisitor<>{
 protected:
+    using Thunk = mlir::LogicalResult (*)(OpVisitor<>*, mlir::Operation*);
+    using DispatchTable = llvm::DenseMap<mlir::TypeID, Thunk>;
+    static void registerOps(DispatchTable& table){}
     mlir::LogicalResult visitOperation(mlir::Operation* op){
         return visitOp(op);
     }
     virtual mlir::LogicalResult visitOp(mlir::Operation* op){
         return mlir::failure();
     }
+    virtual ~OpVisitor() = default;
 };
 template<typename CurrOp, typename ...OpTypes>
 class OpVisitor<CurrOp, OpTypes...>: protected OpVisitor<OpTypes...>{
 private:
     using Parent = OpVisitor<OpTypes...>;
+    using Base = OpVisitor<>;
 protected:
     using Parent::visitOp;
     virtual mlir::LogicalResult visitOp(CurrOp op){
         return mlir::success();
     }
+    // Earlier types win, as with the dyn_cast chain this replaces.
+    static void registerOps(typename Base::DispatchTable& table){
+        table.try_emplace(mlir::TypeID::get<CurrOp>(), [](Base* self, mlir::Operation* op){
+            return static_cast<OpVisitor*>(self)->visitOp(mlir::cast<CurrOp>(op));
+        });
+        Parent::registerOps(table);
+    }
     mlir::LogicalResult visitOperation(mlir::Operation* op){
-        CurrOp wrapped = mlir::dyn_cast<CurrOp>(op);
-        if(wrapped){
-            return visitOp(wrapped);
-        }else{
-            return Parent::visitOperation(op);
+        static const typename Base::DispatchTable table = [](){
+            typename Base::DispatchTable table;
+            registerOps(table);
+            return table;
+        }();
+        auto iter = table.find(op->getName().getTypeID());
+        if(iter == table.end()){
+            return visitOp(op);
         }
+        return iter->second(this, op);
     }
 };
 }
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,23 @@
+#ifndef _ISQ_UTILS_JSONSTREAM_H
+#define _ISQ_UTILS_JSONSTREAM_H
+#include <llvm/Support/raw_ostream.h>
+namespace isq{
+    namespace ir{
+        // Writes the text streamed into it to `os` as the body of a JSON string, escaping as it goes.
+        // The caller writes the surrounding quotes. The stream is flushed when destroyed.
+        class JsonStringStream : public llvm::raw_ostream{
+            llvm::raw_ostream& os;
+            uint64_t pos = 0;
+            void write_impl(const char* ptr, size_t size) override;
+            uint64_t current_pos() const override{
+                return pos;
+            }
+        public:
+            explicit JsonStringStream(llvm::raw_ostream& os): os(os){}
+            ~JsonStringStream() override{
+                flush();
+            }
+        };
+    }
+}
+#endif
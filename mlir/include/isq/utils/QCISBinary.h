@@ -0,0 +1,22 @@
+#ifndef _ISQ_UTILS_QCISBINARY_H
+#define _ISQ_UTILS_QCISBINARY_H
+#include <cstdint>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+namespace isq{
+    namespace ir{
+        // Compact binary QCIS: the magic "QCIS" and a version byte, then per instruction an opcode byte,
+        // its qubits as ULEB128 (the n of Qn) and its parameters as little-endian f64. M has a ULEB128
+        // count before its qubits; Layer separates the layers of --qcis-layers output.
+        // The simulator reads it (simulator/src/sim/qcisbin.rs); the opcodes must stay in sync.
+        enum class QCISOpcode : uint8_t{
+            X, Y, Z, H, S, SD, T, TD, X2P, X2M, Y2P, Y2M, CZ, RX, RY, RZ, RXY, M, Layer,
+            Invalid = 0xff
+        };
+        QCISOpcode qcisOpcode(llvm::StringRef gate);
+        void writeQCISHeader(llvm::raw_ostream& os);
+        void writeQCISInstruction(llvm::raw_ostream& os, QCISOpcode op, llvm::ArrayRef<int64_t> qubits, llvm::ArrayRef<double> params = {});
+    }
+}
+#endif
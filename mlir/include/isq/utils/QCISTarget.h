@@ -0,0 +1,27 @@
+#ifndef _ISQ_UTILS_QCISTARGET_H
+#define _ISQ_UTILS_QCISTARGET_H
+#include <cstdint>
+#include <optional>
+#include <set>
+#include <utility>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <mlir/IR/Location.h>
+#include <mlir/Support/LogicalResult.h>
+namespace isq{
+    namespace ir{
+        // A QCIS device for timed output (isq-opt --qcis-timing). It extends the mapping config of
+        // isq-route-qubits: `qbit_num` and 1-based `topo` edges, plus `durations` giving each QCIS gate
+        // (and M) its duration in ns. A `default` entry covers the gates that are not listed.
+        struct QCISTarget{
+            unsigned size = 0;
+            // Coupled pairs, smaller qubit first.
+            std::set<std::pair<unsigned, unsigned>> couplers;
+            llvm::StringMap<uint64_t> durations;
+            bool coupled(unsigned a, unsigned b) const;
+            std::optional<uint64_t> duration(llvm::StringRef gate) const;
+        };
+        mlir::FailureOr<QCISTarget> loadQCISTarget(llvm::StringRef path, mlir::Location loc);
+    }
+}
+#endif
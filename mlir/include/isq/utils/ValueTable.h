@@ -0,0 +1,68 @@
+#ifndef _ISQ_UTILS_VALUETABLE_H
+#define _ISQ_UTILS_VALUETABLE_H
+#include <algorithm>
+#include <vector>
+#include <llvm/ADT/DenseMap.h>
+#include <mlir/IR/Value.h>
+namespace isq{
+    namespace ir{
+        // Numbers SSA values densely, in the order they are first seen. Code generators key their per-value
+        // tables by these numbers: the tables are then flat vectors and, unlike with hash_value, never collide.
+        class ValueNumbering{
+            llvm::DenseMap<mlir::Value, size_t> ids;
+        public:
+            size_t operator()(mlir::Value v){
+                return ids.try_emplace(v, ids.size()).first->second;
+            }
+            void clear(){
+                ids.clear();
+            }
+        };
+
+        // A table indexed by value numbers, with the subset of std::map operations the code generators use.
+        template<typename T>
+        class ValueTable{
+            std::vector<T> values;
+            std::vector<bool> present;
+            void grow(size_t id){
+                if(id >= values.size()){
+                    auto size = std::max(id + 1, values.size() * 2);
+                    values.resize(size);
+                    present.resize(size);
+                }
+            }
+        public:
+            // The entry of `id`, or null if there is none.
+            T* find(size_t id){
+                return id < present.size() && present[id] ? &values[id] : nullptr;
+            }
+            bool count(size_t id) const{
+                return id < present.size() && present[id];
+            }
+            // Adds the entry unless `id` already has one. Returns whether it was added.
+            bool insert(size_t id, T value){
+                grow(id);
+                if(present[id]) return false;
+                values[id] = std::move(value);
+                present[id] = true;
+                return true;
+            }
+            T& operator[](size_t id){
+                grow(id);
+                present[id] = true;
+                return values[id];
+            }
+            void erase(size_t id){
+                if(id < present.size()){
+                    present[id] = false;
+                    values[id] = T();
+                }
+            }
+            void clear(){
+                values.clear();
+                present.clear();
+            }
+        };
+    }
+}
+#endif
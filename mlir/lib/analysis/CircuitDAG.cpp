@@ -0,0 +1,251 @@
+#include "isq/passes/CircuitDAG.h"
+#include "isq/Operations.h"
+#include "isq/QTypes.h"
+#include "isq/passes/GateInfo.h"
+#include <algorithm>
+#include <map>
+#include <mlir/Dialect/Affine/IR/AffineOps.h>
+#include <mlir/Dialect/MemRef/IR/MemRef.h>
+#include <mlir/Interfaces/CallInterfaces.h>
+namespace isq{
+namespace ir{
+namespace passes{
+
+struct CircuitDAGBuilder{
+    using NodeId = CircuitDAG::NodeId;
+    CircuitDAG& dag;
+    llvm::DenseMap<mlir::Value, unsigned> valueWire;
+    std::map<std::pair<const void*, std::vector<int64_t>>, unsigned> locationWire;
+    // Last node on each wire and its slot for that wire, valid only if set after the last barrier.
+    std::vector<std::pair<NodeId, unsigned>> front;
+    std::vector<unsigned> frontEpoch;
+    // Wires with a node since the last barrier.
+    std::vector<unsigned> touched;
+    NodeId lastBarrier = CircuitDAG::NONE;
+    unsigned epoch = 0;
+
+    CircuitDAGBuilder(CircuitDAG& dag): dag(dag){}
+
+    unsigned newWire(){
+        front.push_back({CircuitDAG::NONE, CircuitDAG::NONE});
+        frontEpoch.push_back(epoch);
+        return dag.wireCount++;
+    }
+    bool touchedSinceBarrier(unsigned w){
+        return frontEpoch[w]==epoch && front[w].first!=CircuitDAG::NONE;
+    }
+    // A wire without nodes since the last barrier continues from the barrier. The barrier has a slot for it
+    // only if it was used before the barrier.
+    std::pair<NodeId, unsigned> frontOf(unsigned w){
+        if(touchedSinceBarrier(w)) return front[w];
+        if(lastBarrier!=CircuitDAG::NONE && front[w].first==lastBarrier) return front[w];
+        return {lastBarrier, CircuitDAG::NONE};
+    }
+    // Wire of a qstate value. Returns std::nullopt if the value may alias any qubit.
+    std::optional<unsigned> wireOf(mlir::Value val){
+        auto it = valueWire.find(val);
+        if(it!=valueWire.end()) return it->second;
+        if(auto load = val.getDefiningOp<mlir::AffineLoadOp>()){
+            auto loc = resolveMemLocation(load.getMemRef(), load.getAffineMap(), load.getMapOperands());
+            if(!loc.indices) return std::nullopt;
+            auto key = std::make_pair(loc.root, *loc.indices);
+            auto found = locationWire.find(key);
+            unsigned wire = found==locationWire.end() ? (locationWire[key] = newWire()) : found->second;
+            valueWire[val] = wire;
+            return wire;
+        }
+        if(val.getDefiningOp<mlir::memref::LoadOp>()){
+            return std::nullopt;
+        }
+        // Block arguments, results of calls and region ops.
+        auto wire = newWire();
+        valueWire[val] = wire;
+        return wire;
+    }
+
+    NodeId addNode(mlir::Operation* op, llvm::ArrayRef<unsigned> wires, bool is_barrier){
+        NodeId id = dag.ops.size();
+        dag.ops.push_back(op);
+        dag.barrier.push_back(is_barrier);
+        dag.index[op] = id;
+        // A barrier only waits for the wires used since the previous barrier; the others already wait for that one.
+        // Later nodes find the barrier through `frontOf`, so barriers cost O(wires touched) rather than O(all wires).
+        std::vector<unsigned> barrier_wires;
+        if(is_barrier){
+            barrier_wires = std::move(touched);
+            touched.clear();
+            for(auto w: wires){
+                if(!touchedSinceBarrier(w)) barrier_wires.push_back(w);
+            }
+            wires = barrier_wires;
+        }
+        unsigned asap = 0;
+        // Barriers follow the previous barrier even if no wire connects them.
+        if(is_barrier && lastBarrier!=CircuitDAG::NONE){
+            asap = dag.asapLayer[lastBarrier]+1;
+        }
+        for(auto w: wires){
+            auto [pred, pred_slot] = frontOf(w);
+            unsigned slot = dag.preds.size();
+            dag.preds.push_back(pred);
+            dag.succs.push_back(CircuitDAG::NONE);
+            dag.slotWire.push_back(w);
+            if(pred!=CircuitDAG::NONE){
+                asap = std::max(asap, dag.asapLayer[pred]+1);
+                if(pred_slot!=CircuitDAG::NONE) dag.succs[pred_slot] = id;
+            }
+            if(!is_barrier && !touchedSinceBarrier(w)) touched.push_back(w);
+            front[w] = {id, slot};
+            frontEpoch[w] = epoch;
+        }
+        dag.asapLayer.push_back(asap);
+        dag.slotStart.push_back(dag.preds.size());
+        if(is_barrier){
+            lastBarrier = id;
+            epoch++;
+        }
+        return id;
+    }
+
+    // Adds a gate-like op whose first `qstates.size()` results continue the wires of `qstates`.
+    void addQuantumOp(mlir::Operation* op, mlir::ValueRange qstates){
+        llvm::SmallVector<unsigned> wires;
+        // Ops without qubits (e.g. printing) only keep their order against other side effects.
+        auto is_barrier = qstates.empty();
+        for(auto v: qstates){
+            auto w = wireOf(v);
+            if(w){
+                wires.push_back(*w);
+            }else{
+                // Still give the chain its own wire. The barrier orders it against everything else.
+                auto fresh = newWire();
+                valueWire[v] = fresh;
+                wires.push_back(fresh);
+                is_barrier = true;
+            }
+        }
+        addNode(op, wires, is_barrier);
+        for(auto i=0; i<qstates.size(); i++){
+            valueWire[op->getResult(i)] = wires[i];
+        }
+    }
+
+    static bool containsQuantumOps(mlir::Operation* op){
+        auto found = false;
+        op->walk([&](mlir::Operation* inner){
+            if(inner!=op && (llvm::isa<ApplyGateOp, CallQOpOp, mlir::CallOpInterface>(inner))){
+                found = true;
+                return mlir::WalkResult::interrupt();
+            }
+            return mlir::WalkResult::advance();
+        });
+        return found;
+    }
+
+    void visit(mlir::Operation* op){
+        if(auto apply = llvm::dyn_cast<ApplyGateOp>(op)){
+            addQuantumOp(op, apply.getArgs());
+            return;
+        }
+        if(auto call = llvm::dyn_cast<CallQOpOp>(op)){
+            addQuantumOp(op, call.getArgs());
+            return;
+        }
+        if(auto store = llvm::dyn_cast<mlir::AffineStoreOp>(op)){
+            auto val = store.getValueToStore();
+            if(!val.getType().isa<QStateType>()) return;
+            auto loc = resolveMemLocation(store.getMemRef(), store.getAffineMap(), store.getMapOperands());
+            auto w = wireOf(val);
+            if(!loc.indices || !w){
+                addNode(op, {}, true);
+                return;
+            }
+            locationWire[std::make_pair(loc.root, *loc.indices)] = *w;
+            return;
+        }
+        if(auto store = llvm::dyn_cast<mlir::memref::StoreOp>(op)){
+            if(store.getValueToStore().getType().isa<QStateType>()){
+                addNode(op, {}, true);
+            }
+            return;
+        }
+        if(llvm::isa<mlir::CallOpInterface>(op) || (op->getNumRegions()>0 && containsQuantumOps(op))){
+            addNode(op, {}, true);
+            return;
+        }
+    }
+
+    void finish(){
+        auto n = dag.ops.size();
+        unsigned depth = 0;
+        for(auto a: dag.asapLayer) depth = std::max(depth, a+1);
+        dag.alapLayer.assign(n, depth==0 ? 0 : depth-1);
+        std::vector<NodeId> prev_barrier(n, CircuitDAG::NONE);
+        NodeId last = CircuitDAG::NONE;
+        for(NodeId id=0; id<n; id++){
+            if(!dag.barrier[id]) continue;
+            prev_barrier[id] = last;
+            last = id;
+        }
+        for(NodeId id = n; id-- > 0;){
+            for(auto pred: dag.predecessors(id)){
+                if(pred!=CircuitDAG::NONE){
+                    dag.alapLayer[pred] = std::min(dag.alapLayer[pred], dag.alapLayer[id]-1);
+                }
+            }
+            // Barriers keep their order even if no wire connects them.
+            if(prev_barrier[id]!=CircuitDAG::NONE){
+                auto prev = prev_barrier[id];
+                dag.alapLayer[prev] = std::min(dag.alapLayer[prev], dag.alapLayer[id]-1);
+            }
+        }
+        // Counting sort by ASAP layer.
+        dag.layerStart.assign(depth+1, 0);
+        for(auto a: dag.asapLayer) dag.layerStart[a+1]++;
+        for(unsigned l=0; l<depth; l++) dag.layerStart[l+1]+=dag.layerStart[l];
+        dag.layerNodes.resize(n);
+        std::vector<unsigned> fill(dag.layerStart.begin(), dag.layerStart.end()-1);
+        for(NodeId id=0; id<n; id++){
+            dag.layerNodes[fill[dag.asapLayer[id]]++] = id;
+        }
+    }
+};
+
+CircuitDAG::CircuitDAG(mlir::Operation* op){
+    CircuitDAGBuilder builder(*this);
+    slotStart.push_back(0);
+    for(auto& region: op->getRegions()){
+        for(auto& block: region){
+            for(auto& inner: block){
+                builder.visit(&inner);
+            }
+            // Control flow between blocks is not tracked. Keep blocks ordered.
+            if(region.getBlocks().size()>1 && block.mightHaveTerminator()){
+                builder.addNode(block.getTerminator(), {}, true);
+            }
+        }
+    }
+    builder.finish();
+}
+
+std::optional<CircuitDAG::NodeId> CircuitDAG::lookup(mlir::Operation* op) const{
+    auto it = index.find(op);
+    if(it==index.end()) return std::nullopt;
+    return it->second;
+}
+llvm::ArrayRef<CircuitDAG::NodeId> CircuitDAG::predecessors(NodeId id) const{
+    return llvm::ArrayRef<NodeId>(preds).slice(slotStart[id], slotStart[id+1]-slotStart[id]);
+}
+llvm::ArrayRef<CircuitDAG::NodeId> CircuitDAG::successors(NodeId id) const{
+    return llvm::ArrayRef<NodeId>(succs).slice(slotStart[id], slotStart[id+1]-slotStart[id]);
+}
+llvm::ArrayRef<unsigned> CircuitDAG::wires(NodeId id) const{
+    return llvm::ArrayRef<unsigned>(slotWire).slice(slotStart[id], slotStart[id+1]-slotStart[id]);
+}
+llvm::ArrayRef<CircuitDAG::NodeId> CircuitDAG::layer(unsigned l) const{
+    return llvm::ArrayRef<NodeId>(layerNodes).slice(layerStart[l], layerStart[l+1]-layerStart[l]);
+}
+
+}
+}
+}
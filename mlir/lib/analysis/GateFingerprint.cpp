@@ -0,0 +1,116 @@
+#include "isq/passes/GateFingerprint.h"
+#include <algorithm>
+#include <cmath>
+#include <llvm/ADT/Hashing.h>
+#include <numeric>
+#define EPS (1e-6)
+// Grid of the fingerprint. Must be much coarser than EPS.
+#define FINGERPRINT_GRID (1024.0)
+namespace isq{
+namespace ir{
+namespace passes{
+
+std::size_t fingerprintMatrix(const GateMatrix& m){
+    auto dim = m.size();
+    llvm::hash_code hash = llvm::hash_value(dim);
+    // The first entry far from zero fixes the phase.
+    std::complex<double> phase = 1.0;
+    auto threshold = 0.5 / std::sqrt((double)std::max<std::size_t>(dim, 1));
+    for(auto& row: m){
+        auto it = std::find_if(row.begin(), row.end(), [&](auto v){ return std::abs(v) > threshold; });
+        if(it!=row.end()){
+            phase = std::conj(*it) / std::abs(*it);
+            break;
+        }
+    }
+    for(auto& row: m){
+        for(auto v: row){
+            auto w = v * phase;
+            hash = llvm::hash_combine(hash, std::llround(w.real() * FINGERPRINT_GRID), std::llround(w.imag() * FINGERPRINT_GRID));
+        }
+    }
+    return hash;
+}
+
+bool equalUpToPhase(const GateMatrix& a, const GateMatrix& b){
+    if(a.size()!=b.size()) return false;
+    std::complex<double> tr = 0.0;
+    for(auto i=0; i<a.size(); i++){
+        if(a[i].size()!=b[i].size()) return false;
+        for(auto j=0; j<a[i].size(); j++){
+            tr += std::conj(a[i][j]) * b[i][j];
+        }
+    }
+    // The trace fixes the phase. |tr| alone is too loose: diag(1, e^{i(pi/4+4e-4)}) would match T.
+    if(std::abs(tr) < EPS) return false;
+    auto phase = tr / std::abs(tr);
+    for(auto i=0; i<a.size(); i++){
+        for(auto j=0; j<a[i].size(); j++){
+            if(std::abs(b[i][j] - phase * a[i][j]) >= EPS) return false;
+        }
+    }
+    return true;
+}
+
+GateMatrix permuteQubits(const GateMatrix& m, llvm::ArrayRef<unsigned> perm){
+    auto n = perm.size();
+    // Basis index of the permuted gate -> basis index of `m`.
+    auto mapIndex = [&](std::size_t x){
+        std::size_t y = 0;
+        for(auto j=0; j<n; j++){
+            auto bit = (x >> (n-1-perm[j])) & 1;
+            y |= bit << (n-1-j);
+        }
+        return y;
+    };
+    GateMatrix result(m.size(), llvm::SmallVector<std::complex<double>>(m.size()));
+    for(auto x=0; x<m.size(); x++){
+        for(auto y=0; y<m.size(); y++){
+            result[x][y] = m[mapIndex(x)][mapIndex(y)];
+        }
+    }
+    return result;
+}
+
+bool GateMatrixIndex::Match::isIdentityPermutation() const{
+    for(auto i=0; i<perm.size(); i++){
+        if(perm[i]!=i) return false;
+    }
+    return true;
+}
+
+void GateMatrixIndex::insert(unsigned id, const GateMatrix& m, bool permutations){
+    unsigned n = 0;
+    while((std::size_t(1) << n) < m.size()) n++;
+    llvm::SmallVector<unsigned> perm(n);
+    std::iota(perm.begin(), perm.end(), 0);
+    do{
+        auto permuted = permuteQubits(m, perm);
+        // Symmetric gates produce the same matrix under several orderings. Keep the first.
+        if(lookup(permuted)) continue;
+        buckets[fingerprintMatrix(permuted)].push_back(Entry{Match{id, perm}, std::move(permuted)});
+        numEntries++;
+    }while(permutations && std::next_permutation(perm.begin(), perm.end()));
+}
+
+std::optional<GateMatrixIndex::Match> GateMatrixIndex::lookup(const GateMatrix& m) const{
+    auto it = buckets.find(fingerprintMatrix(m));
+    if(it==buckets.end()) return std::nullopt;
+    for(auto& entry: it->second){
+        if(!equalUpToPhase(entry.matrix, m)) continue;
+        auto match = entry.match;
+        std::complex<double> tr = 0.0;
+        for(auto i=0; i<m.size(); i++){
+            for(auto j=0; j<m.size(); j++){
+                tr += std::conj(entry.matrix[i][j]) * m[i][j];
+            }
+        }
+        match.phase = tr / std::abs(tr);
+        return match;
+    }
+    return std::nullopt;
+}
+
+}
+}
+}
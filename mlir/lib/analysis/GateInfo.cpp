@@ -0,0 +1,327 @@
+#include "isq/passes/GateInfo.h"
+#include "isq/Enums.h"
+#include "isq/Operations.h"
+#include "isq/QTypes.h"
+#include "isq/passes/Passes.h"
+#include <cmath>
+#include <llvm/ADT/StringSwitch.h>
+#include <map>
+#include <mlir/Dialect/Affine/IR/AffineOps.h>
+#include <mlir/Dialect/Arith/IR/Arith.h>
+#include <mlir/Dialect/MemRef/IR/MemRef.h>
+#include <mlir/Dialect/Utils/StaticValueUtils.h>
+#include <mlir/Interfaces/CallInterfaces.h>
+#include <mlir/Interfaces/SideEffectInterfaces.h>
+#include <vector>
+#define EPS (1e-6)
+namespace isq{
+namespace ir{
+namespace passes{
+
+std::optional<double> getConstantF64(mlir::Value v){
+    if(!v) return std::nullopt;
+    if(auto cop = mlir::dyn_cast_or_null<mlir::arith::ConstantFloatOp>(v.getDefiningOp())){
+        return cop.value().convertToDouble();
+    }
+    return std::nullopt;
+}
+
+std::optional<AppliedGate> analyzeAppliedGate(ApplyGateOp op, mlir::SymbolTableCollection& symbols){
+    AppliedGate info;
+    info.op = op;
+    auto gate_type = op.getGate().getType().dyn_cast<GateType>();
+    if(!gate_type) return std::nullopt;
+    info.hints = gate_type.getHints();
+    // Peel decorations from the outermost one. Outer controls come first in the operand list.
+    auto gate = op.getGate();
+    while(true){
+        auto def = gate.getDefiningOp();
+        if(!def) return std::nullopt;
+        if(auto decorate = llvm::dyn_cast<DecorateOp>(def)){
+            info.adjoint ^= decorate.getAdjoint();
+            for(auto c: decorate.getCtrl().getAsValueRange<mlir::BoolAttr>()){
+                info.ctrl.push_back(c);
+            }
+            gate = decorate.getArgs();
+        }else if(auto downgrade = llvm::dyn_cast<DowngradeGateOp>(def)){
+            gate = downgrade.getArgs();
+        }else if(auto use = llvm::dyn_cast<UseGateOp>(def)){
+            info.use = use;
+            break;
+        }else{
+            return std::nullopt;
+        }
+    }
+    info.defgate = llvm::dyn_cast_or_null<DefgateOp>(symbols.lookupNearestSymbolFrom(info.use, info.use.getName()));
+    if(info.defgate){
+        if(auto famous = info.defgate->getAttrOfType<mlir::StringAttr>(ISQ_FAMOUS)){
+            info.famous = famous.strref();
+        }
+    }
+    return info;
+}
+
+std::optional<double> AppliedGate::constantParam(unsigned i) const{
+    auto params = use.getParameters();
+    if(i>=params.size()) return std::nullopt;
+    return getConstantF64(params[i]);
+}
+
+WireBasis AppliedGate::basisOn(unsigned i) const{
+    if(i<ctrl.size()) return WireBasis::Z;
+    auto j = i - ctrl.size();
+    auto basis = llvm::StringSwitch<WireBasis>(famous)
+        .Cases("z", "s", "t", "sinv", "tinv", WireBasis::Z)
+        .Cases("rz", "cz", WireBasis::Z)
+        .Cases("x", "rx", "x2p", "x2m", WireBasis::X)
+        .Cases("y", "ry", "y2p", "y2m", WireBasis::Y)
+        .Case("cnot", j==0 ? WireBasis::Z : WireBasis::X)
+        .Case("toffoli", j<2 ? WireBasis::Z : WireBasis::X)
+        .Default(WireBasis::General);
+    if(basis!=WireBasis::General) return basis;
+    if(famous=="u3"){
+        auto theta = constantParam(0);
+        if(theta && std::abs(*theta)<EPS) return WireBasis::Z;
+    }
+    // Diagonal hint of the undecorated gate.
+    auto inner_type = use.getResult().getType().dyn_cast<GateType>();
+    if(inner_type && bitEnumContainsAll(inner_type.getHints(), GateTrait::Diagonal)) return WireBasis::Z;
+    return WireBasis::General;
+}
+
+bool commuteOnWire(WireBasis a, WireBasis b){
+    return a!=WireBasis::General && a==b;
+}
+
+static bool isHermitianFamous(mlir::StringRef name){
+    return llvm::StringSwitch<bool>(name)
+        .Cases("h", "x", "y", "z", true)
+        .Cases("cnot", "cz", "swap", "toffoli", true)
+        .Default(false);
+}
+static mlir::StringRef inverseFamous(mlir::StringRef name){
+    return llvm::StringSwitch<mlir::StringRef>(name)
+        .Case("s", "sinv").Case("sinv", "s")
+        .Case("t", "tinv").Case("tinv", "t")
+        .Case("x2p", "x2m").Case("x2m", "x2p")
+        .Case("y2p", "y2m").Case("y2m", "y2p")
+        .Default("");
+}
+static bool sameParam(mlir::Value a, mlir::Value b){
+    if(a==b) return true;
+    auto ca = getConstantF64(a);
+    auto cb = getConstantF64(b);
+    return ca && cb && std::abs(*ca-*cb)<EPS;
+}
+static bool sameUse(UseGateOp a, UseGateOp b){
+    if(a==b) return true;
+    if(a.getName()!=b.getName()) return false;
+    auto pa = a.getParameters();
+    auto pb = b.getParameters();
+    if(pa.size()!=pb.size()) return false;
+    for(auto i=0; i<pa.size(); i++){
+        if(!sameParam(pa[i], pb[i])) return false;
+    }
+    return true;
+}
+
+bool isInversePair(const AppliedGate& first, const AppliedGate& second){
+    if(first.ctrl!=second.ctrl) return false;
+    if(first.op.getArgs().size()!=second.op.getArgs().size()) return false;
+    if(first.isBuiltin() && second.isBuiltin()){
+        auto a = first.famous;
+        auto b = second.famous;
+        if(a==b && isHermitianFamous(a)) return true;
+        // S and Sinv etc. Adjoint flips the name.
+        auto ea = first.adjoint ? inverseFamous(a) : a;
+        auto eb = second.adjoint ? inverseFamous(b) : b;
+        if(!ea.empty() && !eb.empty() && inverseFamous(ea)==eb) return true;
+        if(a==b && (a=="rx" || a=="ry" || a=="rz")){
+            auto ta = first.constantParam(0);
+            auto tb = second.constantParam(0);
+            if(ta && tb){
+                auto sa = first.adjoint ? -*ta : *ta;
+                auto sb = second.adjoint ? -*tb : *tb;
+                if(std::abs(sa+sb)<EPS) return true;
+            }
+        }
+    }
+    if(!sameUse(first.use, second.use)) return false;
+    if(first.adjoint!=second.adjoint) return true;
+    return bitEnumContainsAll(first.hints, GateTrait::Hermitian);
+}
+
+bool MemLocation::mayAlias(const MemLocation& other) const{
+    if(distinct && other.distinct && root!=other.root) return false;
+    if(root==other.root && indices && other.indices) return *indices==*other.indices;
+    return true;
+}
+
+static std::optional<std::vector<int64_t>> getConstantIndices(mlir::AffineMap map, mlir::ValueRange operands){
+    std::vector<int64_t> indices;
+    for(auto expr: map.getResults()){
+        if(auto cst = expr.dyn_cast<mlir::AffineConstantExpr>()){
+            indices.push_back(cst.getValue());
+            continue;
+        }
+        mlir::Value operand;
+        if(auto dim = expr.dyn_cast<mlir::AffineDimExpr>()){
+            operand = operands[dim.getPosition()];
+        }else if(auto sym = expr.dyn_cast<mlir::AffineSymbolExpr>()){
+            operand = operands[map.getNumDims() + sym.getPosition()];
+        }else{
+            return std::nullopt;
+        }
+        auto cst = mlir::getConstantIntValue(operand);
+        if(!cst) return std::nullopt;
+        indices.push_back(*cst);
+    }
+    return indices;
+}
+
+static MemLocation resolveMemLocationImpl(mlir::Value memref, std::optional<std::vector<int64_t>> indices){
+    while(true){
+        if(auto cast = memref.getDefiningOp<mlir::memref::CastOp>()){
+            memref = cast.getSource();
+            continue;
+        }
+        if(auto subview = memref.getDefiningOp<mlir::memref::SubViewOp>()){
+            auto offsets = subview.getMixedOffsets();
+            auto strides = subview.getMixedStrides();
+            // Rank-reducing subviews drop dimensions. Only keep track of indices for the simple case.
+            if(indices && subview.getSourceType().getRank()==indices->size()){
+                for(auto i=0; indices && i<indices->size(); i++){
+                    auto offset = mlir::getConstantIntValue(offsets[i]);
+                    auto stride = mlir::getConstantIntValue(strides[i]);
+                    if(offset && stride){
+                        (*indices)[i] = *offset + (*indices)[i] * *stride;
+                    }else{
+                        indices = std::nullopt;
+                    }
+                }
+            }else{
+                indices = std::nullopt;
+            }
+            memref = subview.getSource();
+            continue;
+        }
+        break;
+    }
+    if(auto get_global = memref.getDefiningOp<mlir::memref::GetGlobalOp>()){
+        return MemLocation{get_global.getNameAttr().getAsOpaquePointer(), true, indices};
+    }
+    if(auto alloc = memref.getDefiningOp<mlir::memref::AllocOp>()){
+        return MemLocation{alloc.getOperation(), true, indices};
+    }
+    if(auto alloca = memref.getDefiningOp<mlir::memref::AllocaOp>()){
+        return MemLocation{alloca.getOperation(), true, indices};
+    }
+    return MemLocation{memref.getAsOpaquePointer(), false, indices};
+}
+
+MemLocation resolveMemLocation(mlir::Value memref, mlir::AffineMap map, mlir::ValueRange operands){
+    return resolveMemLocationImpl(memref, getConstantIndices(map, operands));
+}
+MemLocation resolveMemLocation(mlir::Value memref){
+    return resolveMemLocationImpl(memref, std::nullopt);
+}
+mlir::Value baseMemRef(mlir::Value memref){
+    while(true){
+        if(auto subview = memref.getDefiningOp<mlir::memref::SubViewOp>()){
+            memref = subview.getSource();
+        }else if(auto cast = memref.getDefiningOp<mlir::memref::CastOp>()){
+            memref = cast.getSource();
+        }else{
+            return memref;
+        }
+    }
+}
+
+namespace{
+struct LastStores{
+    using Key = std::pair<const void*, std::vector<int64_t>>;
+    std::map<Key, std::pair<MemLocation, mlir::Operation*>> stores;
+    void clobber(const MemLocation& loc){
+        // Fast path: a known element of a global or local allocation only aliases itself.
+        if(loc.distinct && loc.indices){
+            stores.erase(Key{loc.root, *loc.indices});
+            return;
+        }
+        for(auto it = stores.begin(); it!=stores.end();){
+            if(it->second.first.mayAlias(loc)){
+                it = stores.erase(it);
+            }else{
+                ++it;
+            }
+        }
+    }
+    void clobberAll(){
+        stores.clear();
+    }
+};
+}
+
+QStateForwarding::QStateForwarding(mlir::Block* block){
+    LastStores last;
+    for(auto& op: *block){
+        if(auto store = llvm::dyn_cast<mlir::AffineStoreOp>(op)){
+            auto loc = resolveMemLocation(store.getMemRef(), store.getAffineMap(), store.getMapOperands());
+            last.clobber(loc);
+            if(loc.indices && store.getValueToStore().getType().isa<QStateType>()){
+                last.stores[LastStores::Key{loc.root, *loc.indices}] = {loc, store.getOperation()};
+            }
+            continue;
+        }
+        if(auto load = llvm::dyn_cast<mlir::AffineLoadOp>(op)){
+            if(!load.getResult().getType().isa<QStateType>()) continue;
+            auto loc = resolveMemLocation(load.getMemRef(), load.getAffineMap(), load.getMapOperands());
+            if(!loc.indices) continue;
+            auto it = last.stores.find(LastStores::Key{loc.root, *loc.indices});
+            if(it==last.stores.end()) continue;
+            loadToStored[load.getResult()] = it->second.second;
+            storedToLoad[it->second.second] = load.getResult();
+            // The location is consumed. A second load must not see the same store.
+            last.stores.erase(it);
+            continue;
+        }
+        if(op.getNumRegions()>0 || llvm::isa<mlir::CallOpInterface>(op)){
+            last.clobberAll();
+            continue;
+        }
+        if(auto effects = llvm::dyn_cast<mlir::MemoryEffectOpInterface>(op)){
+            mlir::SmallVector<mlir::MemoryEffects::EffectInstance> instances;
+            effects.getEffects(instances);
+            for(auto& instance: instances){
+                if(!llvm::isa<mlir::MemoryEffects::Write, mlir::MemoryEffects::Free>(instance.getEffect())) continue;
+                if(auto value = instance.getValue()){
+                    last.clobber(resolveMemLocation(value));
+                }else{
+                    last.clobberAll();
+                }
+            }
+            continue;
+        }
+        for(auto operand: op.getOperands()){
+            if(operand.getType().isa<mlir::MemRefType>()){
+                last.clobber(resolveMemLocation(operand));
+            }
+        }
+    }
+}
+
+mlir::Value QStateForwarding::storedBefore(mlir::Value loaded) const{
+    auto it = loadToStored.find(loaded);
+    if(it==loadToStored.end()) return nullptr;
+    return llvm::cast<mlir::AffineStoreOp>(it->second).getValueToStore();
+}
+
+mlir::Value QStateForwarding::loadedAfter(mlir::Value stored) const{
+    if(!stored.hasOneUse()) return nullptr;
+    auto it = storedToLoad.find(*stored.getUsers().begin());
+    if(it==storedToLoad.end()) return nullptr;
+    return it->second;
+}
+
+}
+}
+}
@@ -0,0 +1,55 @@
+#include "isq/passes/LayerScheduler.h"
+#include <algorithm>
+namespace isq{
+namespace ir{
+namespace passes{
+
+LayerScheduler::Wire& LayerScheduler::wire(unsigned w){
+    if(w>=wireStates.size()) wireStates.resize(w+1);
+    return wireStates[w];
+}
+
+unsigned LayerScheduler::place(llvm::ArrayRef<unsigned> wires, llvm::ArrayRef<WireBasis> basis){
+    llvm::SmallVector<bool> joins;
+    unsigned layer = floor;
+    for(auto i=0; i<wires.size(); i++){
+        auto& w = wire(wires[i]);
+        auto join = commuteOnWire(w.basis, basis[i]);
+        joins.push_back(join);
+        layer = std::max(layer, join ? w.groupStart : w.end);
+    }
+    // Only gates joining a group can hit a taken layer; all other layers are past `end`.
+    auto taken = true;
+    while(taken){
+        taken = false;
+        for(auto i=0; i<wires.size(); i++){
+            if(joins[i] && wire(wires[i]).used.count(layer)){
+                layer++;
+                taken = true;
+            }
+        }
+    }
+    for(auto i=0; i<wires.size(); i++){
+        auto& w = wire(wires[i]);
+        if(!joins[i]){
+            w.basis = basis[i];
+            w.groupStart = w.end;
+            w.used.clear();
+        }
+        w.used.insert(layer);
+        w.end = std::max(w.end, layer+1);
+    }
+    layers = std::max(layers, layer+1);
+    return layer;
+}
+
+unsigned LayerScheduler::placeBarrier(){
+    auto layer = std::max(floor, layers);
+    floor = layer+1;
+    layers = layer+1;
+    return layer;
+}
+
+}
+}
+}
@@ -38,6 +38,7 @@
 
 #include "llvm/Support/raw_ostream.h"
 #include "isq/Backends.h"
+#include "isq/utils/ValueTable.h"
 #include "mlir/AsmParser/AsmParser.h"
 
 #define TRY(x) if(mlir::failed(x)) return mlir::failure();
@@ -99,6 +100,8 @@ using CodegenOpVisitor = OpVisitor<
 #define QNUM "RN"
 #define CMEMSTART 0
 #define QMEMSTART 1000
+// Classical values are allocated registers R<REGFIRST>, R<REGFIRST+1>, ...
+#define REGFIRST 3
 
 struct varValue{
     
@@ -161,7 +164,7 @@ struct tempValue{
 /// Code generator from isQ MLIR Dialect to EQASM.
 class MLIRPassImplEQASM: public details::CodegenOpVisitor{
 public:
-    MLIRPassImplEQASM(mlir::MLIRContext &context, mlir::ModuleOp &module, llvm::raw_ostream &os, bool printast) : context(&context), theModule(&module), os(os), printast(printast) {};
+    MLIRPassImplEQASM(mlir::MLIRContext &context, mlir::ModuleOp &module, llvm::raw_ostream &os, bool printast, int registers) : context(&context), theModule(&module), os(os), printast(printast), registers(registers) {};
     
 
     mlir::LogicalResult mlirPass(){
@@ -190,6 +193,7 @@ private:
     mlir::ModuleOp* theModule;
     llvm::raw_ostream& os;
     bool printast;
+    int registers;
     
     int indent;
 
@@ -201,9 +205,12 @@ private:
     map<string, int> callCnt;
     map<string, pair<int, int>> funcStack;
     map<string, int> globalSymbol;
-    map<size_t, tempValue> tempSymbol;
-    map<size_t, varValue> valueTable;
-    map<size_t, pair<string, vector<double>>> gateTable;
+    // Per-function tables, indexed by valueId.
+    ValueNumbering valueId;
+    ValueTable<tempValue> tempSymbol;
+    ValueTable<string> regSymbol;
+    ValueTable<varValue> valueTable;
+    ValueTable<pair<string, vector<double>>> gateTable;
 
     void printOperation(mlir::Operation *op){
         
@@ -413,10 +420,15 @@ private:
         // visit func body
         auto func_name = func_op.getSymName().str();
         print_label(func_name);
+        valueId.clear();
+        tempSymbol.clear();
+        valueTable.clear();
+        gateTable.clear();
+        allocateRegisters(func_op);
         int cnt = 0;
         for (auto &block: func_op.getBlocks()){
             for (auto &arg: block.getArguments()){
-                auto code = size_t(mlir::hash_value(arg));
+                auto code = valueId(arg);
                 if (arg.use_empty()){
                     continue;
                 }
@@ -426,10 +438,10 @@ private:
                         type = arg.getType().dyn_cast<mlir::MemRefType>().getElementType();
                     }
                     if (type.isa<mlir::IndexType>() || arg.getType().isa<mlir::IntegerType>()){
-                        tempSymbol.insert(make_pair(code, funcStack[nowfunc].first));
+                        tempSymbol.insert(code, funcStack[nowfunc].first);
                         funcStack[nowfunc].first += 1;
                     }else if (type.isa<QStateType>()){
-                        tempSymbol.insert(make_pair(code, funcStack[nowfunc].second));
+                        tempSymbol.insert(code, funcStack[nowfunc].second);
                         funcStack[nowfunc].second += 1;
                     }else{
                         return error(func_op.getLoc(), "eqasm only support 'qbit'/'int' paramters.");
@@ -458,7 +470,7 @@ private:
 
     mlir::LogicalResult visitOp(mlir::arith::ConstantOp op) override{
 
-        auto code = size_t(mlir::hash_value(op->getOpResult(0)));
+        auto code = valueId(op->getOpResult(0));
         auto attr = op.getValueAttr().dyn_cast_or_null<mlir::IntegerAttr>();
         if (attr != nullptr){
             valueTable[code] = varValue(int(attr.getInt()));
@@ -477,12 +489,12 @@ private:
     mlir::LogicalResult visitOp(mlir::memref::AllocOp op) override{
         // create new var name
         // store to symbolTable and indexTable
-        auto code = size_t(mlir::hash_value(op->getOpResult(0)));
+        auto code = valueId(op->getOpResult(0));
         auto type = op.getResult().getType().dyn_cast<mlir::MemRefType>();
         int size = type.getShape()[0];
 
         if (type.getElementType().isa<QStateType>()){
-            tempSymbol.insert(make_pair(code, funcStack[nowfunc].second));
+            tempSymbol.insert(code, funcStack[nowfunc].second);
             // alloc qbit id in QMEM
             print_op(MOV, {SPEC2, "0"});
             print_label("alloc_start_"+to_string(label_cnt));
@@ -502,7 +514,7 @@ private:
             funcStack[nowfunc].second += size;
 
         }else if(type.getElementType().isa<mlir::IndexType>() || type.getElementType().isa<mlir::IntegerType>()){
-            tempSymbol.insert(make_pair(code, funcStack[nowfunc].first));
+            tempSymbol.insert(code, funcStack[nowfunc].first);
             funcStack[nowfunc].first += size;
         }else{
             return error(op.getLoc(), "'double' type is not allowed in eqasm.");
@@ -514,7 +526,7 @@ private:
     mlir::LogicalResult visitOp(mlir::memref::DeallocOp op) override{
         // create new var name
         // store to symbolTable and indexTable
-        auto code = size_t(mlir::hash_value(op.getMemref()));
+        auto code = valueId(op.getMemref());
         auto type = op.getMemref().getType().dyn_cast<mlir::MemRefType>();
         int size = type.getShape()[0];
 
@@ -535,32 +547,38 @@ private:
     }
 
     mlir::LogicalResult visitOp(mlir::memref::CastOp op) override{
-        auto icode = size_t(mlir::hash_value(op.getSource()));
-        auto ocode = size_t(mlir::hash_value(op.getDest()));
-        tempSymbol.insert(make_pair(ocode, tempSymbol[icode]));
+        auto icode = valueId(op.getSource());
+        auto ocode = valueId(op.getDest());
+        tempSymbol.insert(ocode, tempSymbol[icode]);
         return mlir::success();
     }
 
     mlir::LogicalResult visitOp(mlir::arith::IndexCastOp op) override{
-        auto icode = size_t(mlir::hash_value(op.getIn()));
-        auto ocode = size_t(mlir::hash_value(op.getOut()));
+        auto icode = valueId(op.getIn());
+        auto ocode = valueId(op.getOut());
         auto v = getValue(icode);
         if (v.first){
-            valueTable[ocode] = valueTable[icode].ival;
+            valueTable[ocode] = v.second.ival;
+        }else if (auto reg = regSymbol.find(icode)){
+            string r = *reg;
+            regSymbol[ocode] = r;
         }else{
-            tempSymbol.insert(make_pair(ocode, tempSymbol[icode]));
+            tempSymbol.insert(ocode, tempSymbol[icode]);
         }
         return mlir::success();
     }
 
     mlir::LogicalResult visitOp(mlir::arith::ExtUIOp op) override{
-        auto icode = size_t(mlir::hash_value(op.getIn()));
-        auto ocode = size_t(mlir::hash_value(op.getOut()));
+        auto icode = valueId(op.getIn());
+        auto ocode = valueId(op.getOut());
         auto v = getValue(icode);
         if (v.first){
-            valueTable[ocode] = valueTable[icode].ival;
+            valueTable[ocode] = v.second.ival;
+        }else if (auto reg = regSymbol.find(icode)){
+            string r = *reg;
+            regSymbol[ocode] = r;
         }else{
-            tempSymbol.insert(make_pair(ocode, tempSymbol[icode]));
+            tempSymbol.insert(ocode, tempSymbol[icode]);
         }
         return mlir::success();
     }
@@ -568,58 +586,58 @@ private:
     mlir::LogicalResult visitBinaryOp(char op, size_t lcode, size_t rcode, size_t res){
         
         // get lhs's and rhs's value from intValueTable
-        TRY(print_load_value(SPEC1, CSTACK, lcode));
-        TRY(print_load_value(SPEC2, CSTACK, rcode));
+        string lreg, rreg;
+        TRY(get_operand(lreg, SPEC1, lcode));
+        TRY(get_operand(rreg, SPEC2, rcode));
+        auto dst = result_reg(res, SPEC1);
         switch (op)
         {
         case '+':
-            print_op(ADD, {SPEC1, SPEC1, SPEC2});
+            print_op(ADD, {dst, lreg, rreg});
             break;
         case '-':
-            print_op(SUB, {SPEC1, SPEC1, SPEC2});
+            print_op(SUB, {dst, lreg, rreg});
             break;
         case '&':
-            print_op(AND, {SPEC1, SPEC1, SPEC2});
+            print_op(AND, {dst, lreg, rreg});
             break;
         case '*':
-            print_op(MUL, {SPEC1, SPEC1, SPEC2});
+            print_op(MUL, {dst, lreg, rreg});
             break;
         default:
             return mlir::failure();
             break;
         }
-        get_store(SPEC1, SPEC2, CSTACK, funcStack[nowfunc].first);
-        tempSymbol.insert(make_pair(res, funcStack[nowfunc].first));
-        funcStack[nowfunc].first += 1;
+        store_result(dst, SPEC2, res);
 
         return mlir::success();
     }
     
     mlir::LogicalResult visitOp(mlir::arith::AddIOp op) override{
-        auto lcode = size_t(mlir::hash_value(op.getLhs()));
-        auto rcode = size_t(mlir::hash_value(op.getRhs()));
-        auto res = size_t(mlir::hash_value(op.getResult()));
+        auto lcode = valueId(op.getLhs());
+        auto rcode = valueId(op.getRhs());
+        auto res = valueId(op.getResult());
         return visitBinaryOp('+', lcode, rcode, res);
     }
 
     mlir::LogicalResult visitOp(mlir::arith::SubIOp op) override{
-        auto lcode = size_t(mlir::hash_value(op.getLhs()));
-        auto rcode = size_t(mlir::hash_value(op.getRhs()));
-        auto res = size_t(mlir::hash_value(op.getResult()));
+        auto lcode = valueId(op.getLhs());
+        auto rcode = valueId(op.getRhs());
+        auto res = valueId(op.getResult());
         return visitBinaryOp('-', lcode, rcode, res);
     }
 
     mlir::LogicalResult visitOp(mlir::arith::AndIOp op) override{
-        auto lcode = size_t(mlir::hash_value(op.getLhs()));
-        auto rcode = size_t(mlir::hash_value(op.getRhs()));
-        auto res = size_t(mlir::hash_value(op.getResult()));
+        auto lcode = valueId(op.getLhs());
+        auto rcode = valueId(op.getRhs());
+        auto res = valueId(op.getResult());
         return visitBinaryOp('&', lcode, rcode, res);
     }
 
     mlir::LogicalResult visitOp(mlir::arith::MulIOp op) override{
-        auto lcode = size_t(mlir::hash_value(op.getLhs()));
-        auto rcode = size_t(mlir::hash_value(op.getRhs()));
-        auto res = size_t(mlir::hash_value(op.getResult()));
+        auto lcode = valueId(op.getLhs());
+        auto rcode = valueId(op.getRhs());
+        auto res = valueId(op.getResult());
         return visitBinaryOp('*', lcode, rcode, res);
     }
 
@@ -629,13 +647,15 @@ private:
         // get cmp's lhs and rhs value
         for (auto indexOperand : llvm::enumerate(op->getOperands())){
             auto operand = indexOperand.value();
-            size_t code = size_t(mlir::hash_value(operand));
-            auto r = reg[indexOperand.index()];
-            TRY(print_load_value(r, CSTACK, code));
+            size_t code = valueId(operand);
+            auto& r = reg[indexOperand.index()];
+            TRY(get_operand(r, r, code));
         }
 
-        print_op(CMP, {SPEC1, SPEC2});
-        print_op(MOV, {SPEC1, "1"});
+        auto code = valueId(op->getOpResult(0));
+        auto dst = result_reg(code, SPEC1);
+        print_op(CMP, {reg[0], reg[1]});
+        print_op(MOV, {dst, "1"});
         string br;
         int pred = static_cast<int>(op.getPredicate());
         switch (pred)
@@ -663,12 +683,9 @@ private:
             break;
         }
         print_op(BR, {br, "cmp_value_"+to_string(label_cnt)});
-        print_op(MOV, {SPEC1, "0"});
+        print_op(MOV, {dst, "0"});
         print_label("cmp_value_"+to_string(label_cnt));
-        get_store(SPEC1, SPEC2, CSTACK, funcStack[nowfunc].first);
-        auto code = mlir::hash_value(op->getOpResult(0));
-        tempSymbol.insert(make_pair(code, funcStack[nowfunc].first));
-        funcStack[nowfunc].first += 1;
+        store_result(dst, SPEC2, code);
         label_cnt += 1;
 
         return mlir::success();
@@ -676,14 +693,13 @@ private:
 
     mlir::LogicalResult visitOp(mlir::scf::IfOp if_stmt) override{
         // get condition value
-        auto condition_code = mlir::hash_value(if_stmt.getCondition());
-        auto b_i = getSymbolIndex(condition_code).index;
-        if (b_i < 0) return error(if_stmt.getLoc(), "if need a determined condition");
+        auto condition_code = valueId(if_stmt.getCondition());
+        string creg;
+        if (mlir::failed(get_operand(creg, SPEC1, condition_code))) return error(if_stmt.getLoc(), "if need a determined condition");
         int now_label_cnt = label_cnt;
         label_cnt += 1;
-        get_load(SPEC1, CSTACK, b_i);
         print_op(MOV, {SPEC2, "1"});
-        print_op(CMP, {SPEC1, SPEC2});
+        print_op(CMP, {creg, SPEC2});
         print_op(BR, {"NEQ", "else_block_"+to_string(now_label_cnt)});
         TRY(visitBlock(if_stmt.thenBlock()));
         print_op(BR, {"ALWAYS", "end_if_"+to_string(now_label_cnt)});
@@ -698,31 +714,32 @@ private:
         
         auto block = for_stmt.getBody();
 
-        // get left value
-        auto lcode = size_t(mlir::hash_value(for_stmt.getLowerBound()));
-        TRY(print_load_value(SPEC1, CSTACK, lcode));
-        // store left value to for's arg
-        auto arg_code = size_t(mlir::hash_value(block->getArgument(0)));
-        get_store(SPEC1, SPEC2, CSTACK, funcStack[nowfunc].first);
-        tempSymbol.insert(make_pair(arg_code, funcStack[nowfunc].first));
-        funcStack[nowfunc].first += 1;
+        // get left value and store it to for's arg
+        auto lcode = valueId(for_stmt.getLowerBound());
+        auto arg_code = valueId(block->getArgument(0));
+        auto ireg = result_reg(arg_code, SPEC1);
+        bool spilled = ireg == SPEC1;
+        TRY(print_load_value(ireg, CSTACK, lcode));
+        store_result(ireg, SPEC2, arg_code);
         int now_label_cnt = label_cnt;
         label_cnt += 1;
         // begin for loop
         print_label("forloop_start_"+to_string(now_label_cnt));
         // get right value, then cmp
-        auto rcode = size_t(mlir::hash_value(for_stmt.getUpperBound()));
-        TRY(print_load_value(SPEC2, CSTACK, rcode));
-        print_op(CMP, {SPEC1, SPEC2});
+        auto rcode = valueId(for_stmt.getUpperBound());
+        string rreg;
+        TRY(get_operand(rreg, SPEC2, rcode));
+        print_op(CMP, {ireg, rreg});
         print_op(BR, {"GEQ", "forloop_end_"+to_string(now_label_cnt)});
         // visit loop body
         TRY(visitBlock(block));
         // update arg value and goto start
-        get_load(SPEC1, CSTACK, getSymbolIndex(arg_code).index);
-        auto scode = size_t(mlir::hash_value(for_stmt.getStep()));
-        TRY(print_load_value(SPEC2, CSTACK, scode));
-        print_op(ADD, {SPEC1, SPEC1, SPEC2});
-        get_store(SPEC1, SPEC2, CSTACK, getSymbolIndex(arg_code).index);
+        if (spilled) get_load(SPEC1, CSTACK, getSymbolIndex(arg_code).index);
+        auto scode = valueId(for_stmt.getStep());
+        string sreg;
+        TRY(get_operand(sreg, SPEC2, scode));
+        print_op(ADD, {ireg, ireg, sreg});
+        if (spilled) get_store(SPEC1, SPEC2, CSTACK, getSymbolIndex(arg_code).index);
         print_op(BR, {"ALWAYS", "forloop_start_"+to_string(now_label_cnt)});
         print_label("forloop_end_"+to_string(now_label_cnt));
 
@@ -742,7 +759,7 @@ private:
         // load value from symbolTable using var_name and index
         for (auto indexOperand : llvm::enumerate(op->getOperands())){
             auto operand = indexOperand.value();
-            size_t code = size_t(mlir::hash_value(operand));
+            size_t code = valueId(operand);
             if (indexOperand.index() == 0){
                 auto tv = getSymbolIndex(code);
                 index = tv.index;
@@ -756,20 +773,19 @@ private:
         }
 
         auto type = op.getMemRefType().getElementType();
-        auto code = size_t(mlir::hash_value(op->getOpResult(0)));
+        auto code = valueId(op->getOpResult(0));
         
         if (type.isa<QStateType>()){
             get_load(SPEC1, QSTACK, index);
             if (is_addr) print_op(LOAD, {SPEC1, SPEC1});
             get_store(SPEC1, SPEC2, QSTACK, funcStack[nowfunc].second);
-            tempSymbol.insert(make_pair(code, funcStack[nowfunc].second));
+            tempSymbol.insert(code, funcStack[nowfunc].second);
             funcStack[nowfunc].second += 1;
         }else{
-            get_load(SPEC1, CSTACK, index);
-            if (is_addr) print_op(LOAD, {SPEC1, SPEC1});
-            get_store(SPEC1, SPEC2, CSTACK, funcStack[nowfunc].first);
-            tempSymbol.insert(make_pair(code, funcStack[nowfunc].first));
-            funcStack[nowfunc].first += 1;
+            auto dst = result_reg(code, SPEC1);
+            get_load(dst, CSTACK, index);
+            if (is_addr) print_op(LOAD, {dst, dst});
+            store_result(dst, SPEC2, code);
         }
 
         return mlir::success();
@@ -780,14 +796,15 @@ private:
         bool is_addr = false;
         varValue val;
         string var_name;
+        string vreg;
         auto type = op.getMemRefType().getElementType();
         // store index value to symtable, qbit ignore
         for (auto indexOperand : llvm::enumerate(op->getOperands())){
             auto operand = indexOperand.value();
-            size_t code = size_t(mlir::hash_value(operand));
+            size_t code = valueId(operand);
             if (indexOperand.index() == 0){
                 if(operand.getType().isa<QStateType>()) return mlir::success();
-                TRY(print_load_value(SPEC2, CSTACK, code));
+                TRY(get_operand(vreg, SPEC2, code));
             }else if (indexOperand.index() == 1){
                 auto tv = getSymbolIndex(code);
                 index = tv.index;
@@ -808,9 +825,9 @@ private:
             }else{
                 print_op(LOAD, {SPEC1, CSTACK});
             }
-            print_op(STORE, {SPEC2, SPEC1});
+            print_op(STORE, {vreg, SPEC1});
         }else{
-            get_store(SPEC2, SPEC1, CSTACK, index);
+            get_store(vreg, SPEC1, CSTACK, index);
         }
         return mlir::success();
     }
@@ -819,17 +836,17 @@ private:
     mlir::LogicalResult visitOp(mlir::memref::GetGlobalOp op) override{
         auto name = op.getNameAttr().getValue().str();
         auto type = op.getResult().getType().dyn_cast<mlir::MemRefType>();
-        auto code = size_t(mlir::hash_value(op.getResult()));
+        auto code = valueId(op.getResult());
         // save address to the mem
         if (type.getElementType().isa<QStateType>()){
             print_op(MOV, {SPEC1, to_string(globalSymbol[name] + QMEMSTART)});
             get_store(SPEC1, SPEC2, QSTACK, funcStack[nowfunc].second);
-            tempSymbol.insert(make_pair(code, tempValue(funcStack[nowfunc].second, true)));
+            tempSymbol.insert(code, tempValue(funcStack[nowfunc].second, true));
             funcStack[nowfunc].second += 1;
         }else{
             print_op(MOV, {SPEC1, to_string(globalSymbol[name] + CMEMSTART)});
             get_store(SPEC1, SPEC2, CSTACK, funcStack[nowfunc].first);
-            tempSymbol.insert(make_pair(code, tempValue(funcStack[nowfunc].first, true)));
+            tempSymbol.insert(code, tempValue(funcStack[nowfunc].first, true));
             funcStack[nowfunc].first += 1;
         }
 
@@ -844,36 +861,37 @@ private:
         if (type.getElementType().isa<QStateType>()) stack = QSTACK;
         
         // get offset
+        string oreg = SPEC1;
         if (op.offsets().size() > 0){
-            auto fcode = mlir::hash_value(op.offsets()[0]);
-            TRY(print_load_value(SPEC1, CSTACK, fcode));
+            auto fcode = valueId(op.offsets()[0]);
+            TRY(get_operand(oreg, SPEC1, fcode));
         }else{
             auto offset = op.static_offsets()[0];
             print_op(MOV, {SPEC1, to_string(offset)});
         }
         // get address
-        auto scode = mlir::hash_value(op.getSource());
+        auto scode = valueId(op.getSource());
         auto tv = getSymbolIndex(scode);
         if (tv.is_addr){
             get_load(SPEC2, stack, tv.index);   
         }else{
             print_op(MOV, {SPEC2, to_string(tv.index)});
         }
-        print_op(ADD, {SPEC1, SPEC2, SPEC1});
+        print_op(ADD, {SPEC1, SPEC2, oreg});
 
         // save address to the mem
-        auto rcode = mlir::hash_value(op.getResult());
+        auto rcode = valueId(op.getResult());
         if (type.getElementType().isa<QStateType>()){
             if (!tv.is_addr) {
                 print_op(MOV, {SPEC2, to_string(QMEMSTART)});
                 print_op(ADD, {SPEC1, SPEC1, SPEC2});
             }
             get_store(SPEC1, SPEC2, QSTACK, funcStack[nowfunc].second);
-            tempSymbol.insert(make_pair(rcode, tempValue(funcStack[nowfunc].second, true)));
+            tempSymbol.insert(rcode, tempValue(funcStack[nowfunc].second, true));
             funcStack[nowfunc].second += 1;
         }else{
             get_store(SPEC1, SPEC2, CSTACK, funcStack[nowfunc].first);
-            tempSymbol.insert(make_pair(rcode, tempValue(funcStack[nowfunc].first, true)));
+            tempSymbol.insert(rcode, tempValue(funcStack[nowfunc].first, true));
             funcStack[nowfunc].first += 1;
         }
         
@@ -893,11 +911,12 @@ private:
         int qi = funcStack[nowfunc].second;
         for (auto indexOperand : ::llvm::enumerate(op.getOperands())){
             auto operand = indexOperand.value();
-            auto code = mlir::hash_value(operand);
+            auto code = valueId(operand);
             auto type = operand.getType();
             if (type.isa<mlir::IndexType>() || type.isa<mlir::IntegerType>()){
-                TRY(print_load_value(SPEC2, CSTACK, code));
-                get_store(SPEC2, SPEC1, CSTACK, ci);
+                string vreg;
+                TRY(get_operand(vreg, SPEC2, code));
+                get_store(vreg, SPEC1, CSTACK, ci);
                 ci += 1;
             }else if (type.isa<mlir::MemRefType>() || type.isa<QStateType>()){
                 if (type.isa<mlir::MemRefType>()){
@@ -949,8 +968,8 @@ private:
         for (auto indexResult : llvm::enumerate(op->getResults())){
             auto index = indexResult.index();
             auto result = indexResult.value();
-            auto code = mlir::hash_value(result);
-            tempSymbol.insert(make_pair(code, args[index]));
+            auto code = valueId(result);
+            tempSymbol.insert(code, args[index]);
         }
         return mlir::success();
     }
@@ -959,10 +978,10 @@ private:
         // save gate name in gateTable
         auto attr = op.getNameAttr();
         auto gate = attr.getLeafReference().str();
-        auto rcode = mlir::hash_value(op.getResult());
+        auto rcode = valueId(op.getResult());
         vector<double> angle;
         for (auto par : op.getParameters()){
-            size_t code = size_t(mlir::hash_value(par));
+            size_t code = valueId(par);
             auto b_f = getValue(code);
             if (b_f.first == false) return error(op.getLoc(), "gate need a determined angle");
             angle.push_back(b_f.second.dval);
@@ -975,7 +994,7 @@ private:
 
     mlir::LogicalResult visitOp(ApplyGateOp op) override{
 
-        auto code = mlir::hash_value(op.getGate());
+        auto code = valueId(op.getGate());
         auto gate = gateTable[code].first;
         auto param = gateTable[code].second;
 
@@ -983,7 +1002,7 @@ private:
         for (auto indexed_operand : ::llvm::enumerate(op.getArgs())){
             auto index = indexed_operand.index();
             auto operand = indexed_operand.value();
-            auto b_i = getSymbolIndex(mlir::hash_value(operand)).index;
+            auto b_i = getSymbolIndex(valueId(operand)).index;
             if (b_i < 0) return error(op.getLoc(), "gate operate need use determined qbit");
             args.push_back(b_i);
         }
@@ -999,8 +1018,8 @@ private:
         for (auto indexed_result : ::llvm::enumerate(op.getR())){
             auto index = indexed_result.index();
             auto result = indexed_result.value();
-            auto code = mlir::hash_value(result);
-            tempSymbol.insert(make_pair(code, args[index]));
+            auto code = valueId(result);
+            tempSymbol.insert(code, args[index]);
         }
 
         return mlir::success();
@@ -1014,14 +1033,14 @@ private:
         // if qbit has already measured, error
         for (auto indexOperand : llvm::enumerate(op->getOperands())){
             auto operand = indexOperand.value();
-            size_t code = size_t(mlir::hash_value(operand));
+            size_t code = valueId(operand);
             TRY(print_load_value(SPEC1, QSTACK, code));
             print_op(MEASE, {SPEC1});
         }
-        auto rcode = mlir::hash_value(op.getResult(1));
-        get_store(SPEC1, SPEC2, CSTACK, funcStack[nowfunc].first);
-        tempSymbol.insert(make_pair(rcode, funcStack[nowfunc].first));
-        funcStack[nowfunc].first += 1;
+        auto rcode = valueId(op.getResult(1));
+        auto dst = result_reg(rcode, SPEC1);
+        print_copy(dst, SPEC1);
+        store_result(dst, SPEC2, rcode);
         return mlir::success();
     }
 
@@ -1053,23 +1072,197 @@ private:
 
     tempValue getSymbolIndex(size_t code){
         
-        auto iter = tempSymbol.find(code);
-        if (iter != tempSymbol.end()){
-            return iter->second;
+        if (auto v = tempSymbol.find(code)){
+            return *v;
         }
         return -1;
     }
 
     pair<bool, varValue> getValue(size_t code){
 
-        auto iter = valueTable.find(code);
-        if (iter != valueTable.end()){
-            return make_pair(true, iter->second);
+        if (auto v = valueTable.find(code)){
+            return make_pair(true, *v);
         }
         return make_pair(false, -1);
     }
 
 
+    // Register allocation.
+    // Classical scalars (arithmetic, comparison and measurement results, loaded values and loop counters)
+    // are kept in registers, assigned by linear scan over live intervals computed on the function's ops
+    // in emission order. Values live across a call, since the callee uses the same registers, and
+    // values that do not fit are spilled to CSTACK as before.
+    struct LiveInterval{
+        size_t code;
+        int start, end;
+    };
+
+    static bool isLoop(mlir::Operation* op){
+        return mlir::isa<mlir::scf::ForOp, mlir::scf::WhileOp>(op);
+    }
+
+    // Values that share the storage of their source.
+    static mlir::Value aliasRoot(mlir::Value v){
+        while (auto op = v.getDefiningOp()){
+            if (auto cast = mlir::dyn_cast<mlir::arith::IndexCastOp>(op)){
+                v = cast.getIn();
+            }else if (auto ext = mlir::dyn_cast<mlir::arith::ExtUIOp>(op)){
+                v = ext.getIn();
+            }else{
+                break;
+            }
+        }
+        return v;
+    }
+
+    static bool isRegisterCandidate(mlir::Value v){
+        if (!v.getType().isa<mlir::IndexType>() && !v.getType().isa<mlir::IntegerType>()) return false;
+        // Only values in regions the code generator emits.
+        for (auto parent = v.getParentRegion()->getParentOp(); !mlir::isa<mlir::func::FuncOp>(parent); parent = parent->getParentOp()){
+            if (!mlir::isa<mlir::scf::ForOp, mlir::scf::IfOp>(parent)) return false;
+        }
+        if (auto arg = v.dyn_cast<mlir::BlockArgument>()){
+            return mlir::isa<mlir::scf::ForOp>(arg.getOwner()->getParentOp()) && arg.getArgNumber() == 0;
+        }
+        return mlir::isa<mlir::arith::AddIOp, mlir::arith::SubIOp, mlir::arith::AndIOp, mlir::arith::MulIOp,
+            mlir::arith::CmpIOp, mlir::AffineLoadOp, CallQOpOp>(v.getDefiningOp());
+    }
+
+    // Numbers `op` and the ops nested in it in emission order; `span` maps each op to its number and
+    // the last number inside it.
+    void numberOps(mlir::Operation* op, map<mlir::Operation*, pair<int, int>>& span, vector<int>& calls, int& n){
+        int id = n++;
+        if (mlir::isa<mlir::func::CallOp>(op)) calls.push_back(id);
+        for (auto& region: op->getRegions()){
+            for (auto& block: region){
+                for (auto& child: block){
+                    numberOps(&child, span, calls, n);
+                }
+            }
+        }
+        span[op] = make_pair(id, n - 1);
+    }
+
+    void allocateRegisters(mlir::func::FuncOp func_op){
+        regSymbol.clear();
+        // Branches between blocks are not followed, so multi-block functions keep everything on the stack.
+        if (registers <= 0 || !func_op.getBody().hasOneBlock()) return;
+
+        map<mlir::Operation*, pair<int, int>> span;
+        vector<int> calls;
+        int n = 0;
+        numberOps(func_op, span, calls, n);
+
+        map<size_t, LiveInterval> live;
+        auto define = [&](mlir::Value v, int start, int end){
+            if (isRegisterCandidate(v)){
+                size_t code = valueId(v);
+                live[code] = LiveInterval{code, start, end};
+            }
+        };
+        func_op.walk([&](mlir::Operation* op){
+            if (op == func_op.getOperation()) return;
+            auto pos = span[op].first;
+            for (auto result: op->getResults()){
+                define(result, pos, pos);
+            }
+            if (auto for_stmt = mlir::dyn_cast<mlir::scf::ForOp>(op)){
+                // The loop increments and compares the counter after the body, even if the body does not read it.
+                define(for_stmt.getInductionVar(), pos, span[op].second);
+            }
+        });
+        func_op.walk([&](mlir::Operation* op){
+            for (auto operand: op->getOperands()){
+                auto root = aliasRoot(operand);
+                auto iter = live.find(valueId(root));
+                if (iter == live.end()) continue;
+                // Loop operands are read again on every iteration.
+                auto end = isLoop(op) ? span[op].second : span[op].first;
+                // A value defined outside a loop and used in it lives until the loop ends.
+                auto def = root.getDefiningOp();
+                if (!def) def = root.cast<mlir::BlockArgument>().getOwner()->getParentOp();
+                for (auto parent = op->getParentOp(); parent && parent != func_op.getOperation(); parent = parent->getParentOp()){
+                    if (isLoop(parent) && !parent->isProperAncestor(def)){
+                        end = std::max(end, span[parent].second);
+                    }
+                }
+                iter->second.end = std::max(iter->second.end, end);
+            }
+        });
+
+        vector<LiveInterval> intervals;
+        for (auto& v: live){
+            auto& interval = v.second;
+            auto crosses_call = std::any_of(calls.begin(), calls.end(), [&](int c){
+                return interval.start < c && c < interval.end;
+            });
+            if (!crosses_call) intervals.push_back(interval);
+        }
+        std::sort(intervals.begin(), intervals.end(), [](const LiveInterval& a, const LiveInterval& b){
+            return a.start < b.start || (a.start == b.start && a.code < b.code);
+        });
+
+        // Linear scan: `active` holds the intervals in registers, ordered by end.
+        vector<string> free_regs;
+        for (int i = registers - 1; i >= 0; i--){
+            free_regs.push_back("R" + to_string(REGFIRST + i));
+        }
+        vector<LiveInterval> active;
+        for (auto& interval: intervals){
+            // An operand's register may be reused by the result of the op reading it last.
+            while (!active.empty() && active.front().end <= interval.start){
+                free_regs.push_back(regSymbol[active.front().code]);
+                active.erase(active.begin());
+            }
+            if (free_regs.empty()){
+                // Spill the interval ending last.
+                auto& last = active.back();
+                if (last.end <= interval.end) continue;
+                string reg = regSymbol[last.code];
+                regSymbol.erase(last.code);
+                regSymbol[interval.code] = reg;
+                active.pop_back();
+            }else{
+                regSymbol[interval.code] = free_regs.back();
+                free_regs.pop_back();
+            }
+            auto pos = std::upper_bound(active.begin(), active.end(), interval, [](const LiveInterval& a, const LiveInterval& b){
+                return a.end < b.end;
+            });
+            active.insert(pos, interval);
+        }
+    }
+
+    // The register holding the value `code`: its own register, or `creg` after loading the value there.
+    mlir::LogicalResult get_operand(string& reg, string creg, size_t code){
+        if (auto r = regSymbol.find(code)){
+            reg = *r;
+            return mlir::success();
+        }
+        reg = creg;
+        return print_load_value(creg, CSTACK, code);
+    }
+
+    // The register to compute the value `code` in: its own register, or `creg` to be spilled by store_result.
+    string result_reg(size_t code, string creg){
+        if (auto reg = regSymbol.find(code)) return *reg;
+        return creg;
+    }
+
+    // Spills the value `code`, computed in `reg`, unless it has a register. `creg` is clobbered.
+    void store_result(string reg, string creg, size_t code){
+        if (regSymbol.count(code)) return;
+        get_store(reg, creg, CSTACK, funcStack[nowfunc].first);
+        tempSymbol.insert(code, funcStack[nowfunc].first);
+        funcStack[nowfunc].first += 1;
+    }
+
+    void print_copy(string dst, string src){
+        if (dst == src) return;
+        print_op(MOV, {dst, "0"});
+        print_op(ADD, {dst, dst, src});
+    }
+
     void print_label(string lable){
         os << lable << ":\n"; 
     }
@@ -1100,8 +1293,11 @@ private:
 
     mlir::LogicalResult print_load_value(string creg, string stack, size_t code){
         auto v = getValue(code);
+        auto reg = regSymbol.find(code);
         if (v.first){
             print_op(MOV, {creg, to_string(v.second.ival)});
+        }else if (reg){
+            print_copy(creg, *reg);
         }else{
             auto offset = getSymbolIndex(code).index;
             if (offset < 0) return mlir::failure();
@@ -1183,8 +1379,8 @@ private:
 
 namespace isq {
 namespace ir{
-mlir::LogicalResult generateEQASM(mlir::MLIRContext &context, mlir::ModuleOp &module, llvm::raw_string_ostream &os, bool printast) {
-    return MLIRPassImplEQASM(context, module, os, printast).mlirPass();
+mlir::LogicalResult generateEQASM(mlir::MLIRContext &context, mlir::ModuleOp &module, llvm::raw_ostream &os, bool printast, int registers) {
+    return MLIRPassImplEQASM(context, module, os, printast, registers).mlirPass();
 }
 }
 }
\ No newline at end of file
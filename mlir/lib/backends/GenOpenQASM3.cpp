@@ -3,9 +3,11 @@
 #include <set>
 #include <vector>
 #include <algorithm>
+#include <cstdlib>
 
 #include "isq/Dialect.h"
 #include <isq/utils/DispatchOperation.h>
+#include <isq/utils/ValueTable.h>
 #include <isq/IR.h>
 
 #include "isq/Operations.h"
@@ -84,7 +86,7 @@ using CodegenOpVisitor = OpVisitor<
     UseGateOp, DecorateOp, ApplyGateOp, CallQOpOp, AccumulateGPhase, DeclareQOpOp, AssertOp,
     mlir::func::CallOp, mlir::func::ReturnOp, DefgateOp, scf::WhileOp, scf::ConditionOp,
     ModuleOp, PassOp, AffineYieldOp, scf::YieldOp,
-    mlir::cf::CondBranchOp, mlir::cf::BranchOp, AffineLoadOp, AffineStoreOp
+    mlir::cf::CondBranchOp, mlir::cf::BranchOp, AffineLoadOp, AffineStoreOp, AffineForOp
     >;
 }
 
@@ -119,7 +121,7 @@ public:
         buildCallDic();
         
 
-        for (auto f: callfunc){
+        for (auto f: funcOrder){
             nowfunc = f;
             if (nowfunc == "__isq__main") continue;
             TRY(visitOp(funcMap[nowfunc].second));
@@ -162,14 +164,19 @@ private:
     
     set<string> baseGate;
     map<string, string> gateMap;
-    set<size_t> argSet;
-    map<size_t, tuple<OpType, int, string>> symbolTable;
+    // Per-function tables, indexed by valueId.
+    ValueNumbering valueId;
+    ValueTable<bool> argSet;
+    ValueTable<tuple<OpType, int, string>> symbolTable;
     map<size_t, tuple<bool, int, int>> ctrlGate;
 
 
     map<string, pair<set<string>, mlir::func::FuncOp>> funcMap;
     map<string, int> globalSymbol;
     set<string> callfunc;
+    vector<string> funcOrder;
+    // Functions emitted as `gate` definitions; see isGateFunc.
+    map<string, bool> gateFuncs;
     string nowfunc;
 
     size_t yieldRes;
@@ -360,6 +367,64 @@ private:
             }
             now = tmp;
         }
+        set<string> visited;
+        orderFunc("__isq__main", visited);
+        for (auto& fn: funcOrder){
+            isGateFunc(fn);
+        }
+    }
+
+    // Orders the reachable functions so that callees are defined before their callers.
+    void orderFunc(const string& fn, set<string>& visited){
+        if (!visited.insert(fn).second) return;
+        for (auto& nfn: funcMap[fn].first){
+            orderFunc(nfn, visited);
+        }
+        funcOrder.push_back(fn);
+    }
+
+    static bool isQubitMemref(mlir::Type type){
+        auto memref = type.dyn_cast<mlir::MemRefType>();
+        return memref && memref.getElementType().isa<QStateType>();
+    }
+
+    // Whether `fn` can be written as an OpenQASM 3 `gate`: no results, single-qubit or float arguments
+    // with at least one qubit, and a straight-line body of unitaries and calls to other such functions.
+    bool isGateFunc(const string& fn){
+        auto iter = gateFuncs.find(fn);
+        if (iter != gateFuncs.end()) return iter->second;
+        // Recursive calls stay `def`s.
+        gateFuncs[fn] = false;
+        auto func_op = funcMap[fn].second;
+        if (fn == "__isq__main" || !func_op || !func_op.getBody().hasOneBlock() || func_op.getFunctionType().getNumResults() != 0){
+            return false;
+        }
+        bool has_qubit = false;
+        for (auto type: func_op.getArgumentTypes()){
+            if (type.isa<mlir::Float64Type>()) continue;
+            auto memref = type.dyn_cast<mlir::MemRefType>();
+            if (!type.isa<QStateType>() && !(isQubitMemref(type) && memref.getShape().size() == 1 && memref.getShape()[0] == 1)){
+                return false;
+            }
+            has_qubit = true;
+        }
+        if (!has_qubit) return false;
+        for (auto& op: func_op.getBody().front()){
+            if (mlir::isa<UseGateOp, DecorateOp, ApplyGateOp, PassOp, mlir::func::ReturnOp, mlir::arith::ConstantOp,
+                    mlir::arith::IndexCastOp, mlir::arith::SIToFPOp, mlir::arith::AddFOp, mlir::arith::SubFOp,
+                    mlir::arith::MulFOp, mlir::arith::DivFOp, mlir::arith::AddIOp, mlir::arith::SubIOp, mlir::arith::MulIOp>(op)){
+                continue;
+            }
+            if (mlir::isa<mlir::AffineLoadOp, mlir::AffineStoreOp, mlir::memref::SubViewOp, mlir::memref::CastOp>(op)
+                    && llvm::all_of(op.getOperandTypes(), [](mlir::Type t){ return !t.isa<mlir::MemRefType>() || isQubitMemref(t); })){
+                continue;
+            }
+            auto call = mlir::dyn_cast<mlir::func::CallOp>(op);
+            if (call && isGateFunc(call.getCallee().str())) continue;
+            return false;
+        }
+        gateFuncs[fn] = true;
+        return true;
     }
 
     mlir::LogicalResult error(mlir::Location loc, string msg){
@@ -463,7 +528,7 @@ private:
             if (cnt == 1){
                 TRY(visitBlock(&*pb));
                 auto var = getSymbol(yieldRes);
-                TRY(symbolInsert(mlir::hash_value(op->getOpResult(0)), OpType::VAR, 1, get<2>(var)));
+                TRY(symbolInsert(valueId(op->getOpResult(0)), OpType::VAR, 1, get<2>(var)));
             }
             cnt += 1;
         }
@@ -486,6 +551,9 @@ private:
         qVarCnt = 1;
         argCnt = 1;
         hasRes = false;
+        valueId.clear();
+        argSet.clear();
+        symbolTable.clear();
         string rty;
 
         auto attr = func_op.getSymNameAttr();
@@ -504,6 +572,7 @@ private:
         }
         // update_region
         auto not_main = func_op.getSymName() != "__isq__main";
+        auto is_gate = gateFuncs[func_op.getSymName().str()];
         set<size_t> block_args;
         auto& func_body = func_op.getBody();
         /*
@@ -530,13 +599,17 @@ private:
                 TRY(getVarType(type, var_type, func_op.getLoc()));
                 arglist.push_back(make_tuple("arg"+to_string(argCnt), var_type, shape));
 
-                size_t code = size_t(mlir::hash_value(arg));
-                argSet.insert(code);
+                size_t code = valueId(arg);
+                argSet.insert(code, true);
                 block_args.insert(code);
                 TRY(symbolInsert(code, OpType::VAR, shape, "arg"+to_string(argCnt++)));
             }
 
-            openQasmFunc(funcName, arglist, rty);
+            if (is_gate){
+                openQasmGateFunc(funcName, arglist);
+            }else{
+                openQasmFunc(funcName, arglist, rty);
+            }
             
             indent += 1;
         }
@@ -566,7 +639,7 @@ private:
         string rval = get<2>(getSymbol(for_stmt.getUpperBound()));
         string step = get<2>(getSymbol(for_stmt.getStep()));
         
-        openQasmFor("arg"+to_string(argCnt), lval, rval, step);
+        openQasmFor("arg"+to_string(argCnt), lval, step, rangeEnd(rval));
 
         // update_symbol_use_block
         auto block = for_stmt.getLoopBody().getBlocks().begin();
@@ -574,7 +647,7 @@ private:
             for_stmt->emitError("for-loop with more than 1 arguments (a.k.a. for-body yielding) is not supported");
             return mlir::failure();
         }
-        TRY(symbolInsert(size_t(mlir::hash_value((*block).getArgument(0))), OpType::VAR, 1, "arg"+to_string(argCnt++)));
+        TRY(symbolInsert(valueId((*block).getArgument(0)), OpType::VAR, 1, "arg"+to_string(argCnt++)));
         indent += 1;
         TRY(visitBlock(&*block));
         indent -= 1;
@@ -582,6 +655,76 @@ private:
         
         return mlir::success();
     }
+
+    mlir::LogicalResult visitOp(mlir::AffineForOp for_stmt) override{
+        auto lmap = for_stmt.getLowerBoundMap();
+        auto rmap = for_stmt.getUpperBoundMap();
+        if (lmap.getNumResults() != 1 || rmap.getNumResults() != 1){
+            for_stmt->emitError("for-loop with max/min bounds is not supported");
+            return mlir::failure();
+        }
+        if (for_stmt.getNumIterOperands() != 0){
+            for_stmt->emitError("for-loop with more than 1 arguments (a.k.a. for-body yielding) is not supported");
+            return mlir::failure();
+        }
+        string lval = affineMapStr(lmap, for_stmt.getLowerBoundOperands());
+        string rval = affineMapStr(rmap, for_stmt.getUpperBoundOperands());
+
+        openQasmFor("arg"+to_string(argCnt), lval, to_string(for_stmt.getStep()), rangeEnd(rval));
+
+        TRY(symbolInsert(for_stmt.getInductionVar(), OpType::VAR, 1, "arg"+to_string(argCnt++)));
+        indent += 1;
+        TRY(visitBlock(for_stmt.getBody()));
+        indent -= 1;
+        printIndent() << "}\n";
+        return mlir::success();
+    }
+
+    // OpenQASM 3 ranges include their end, MLIR loops exclude it.
+    string rangeEnd(string end){
+        char* rest;
+        auto value = strtoll(end.c_str(), &rest, 10);
+        if (!end.empty() && *rest == '\0'){
+            return to_string(value - 1);
+        }
+        return end + "-1";
+    }
+
+    // Renders an affine expression over the symbols of its operands.
+    string affineExprStr(mlir::AffineExpr expr, mlir::ValueRange dims, mlir::ValueRange syms){
+        if (auto c = expr.dyn_cast<mlir::AffineConstantExpr>()){
+            return to_string(c.getValue());
+        }
+        if (auto d = expr.dyn_cast<mlir::AffineDimExpr>()){
+            return get<2>(getSymbol(dims[d.getPosition()]));
+        }
+        if (auto s = expr.dyn_cast<mlir::AffineSymbolExpr>()){
+            return get<2>(getSymbol(syms[s.getPosition()]));
+        }
+        auto bin = expr.cast<mlir::AffineBinaryOpExpr>();
+        auto lhs = affineExprStr(bin.getLHS(), dims, syms);
+        auto c = bin.getRHS().dyn_cast<mlir::AffineConstantExpr>();
+        if (expr.getKind() == mlir::AffineExprKind::Add && c && c.getValue() < 0){
+            return "(" + lhs + "-" + to_string(-c.getValue()) + ")";
+        }
+        auto rhs = affineExprStr(bin.getRHS(), dims, syms);
+        switch (expr.getKind()){
+            case mlir::AffineExprKind::Add: return "(" + lhs + "+" + rhs + ")";
+            case mlir::AffineExprKind::Mul: return "(" + lhs + "*" + rhs + ")";
+            case mlir::AffineExprKind::Mod: return "(" + lhs + "%" + rhs + ")";
+            case mlir::AffineExprKind::FloorDiv: return "(" + lhs + "/" + rhs + ")";
+            default: return "((" + lhs + "+" + rhs + "-1)/" + rhs + ")";
+        }
+    }
+    string affineMapStr(mlir::AffineMap map, mlir::ValueRange operands){
+        auto dims = operands.take_front(map.getNumDims());
+        auto syms = operands.drop_front(map.getNumDims());
+        string str;
+        for (auto expr: map.getResults()){
+            str += (str.empty() ? "" : ", ") + affineExprStr(expr, dims, syms);
+        }
+        return str;
+    }
     // Then we handle blockless operations.
 
     std::string next_tempInt(){
@@ -619,16 +762,16 @@ private:
         auto attr = op.getNameAttr();
         //os << "global var: " << attr.getValue().str() << endl;
         auto type = op.getResult().getType().dyn_cast<mlir::MemRefType>();
-        return symbolInsert(size_t(mlir::hash_value(op.getResult())), OpType::VAR, type.getShape()[0], getQasmName(attr.getValue().str()));
+        return symbolInsert(valueId(op.getResult()), OpType::VAR, type.getShape()[0], getQasmName(attr.getValue().str()));
     }
     mlir::LogicalResult visitOp(mlir::arith::ConstantOp op) override{
         auto ci_attr = op.getValueAttr().dyn_cast<mlir::IntegerAttr>();
         if (ci_attr != nullptr){
-            return symbolInsert(size_t(mlir::hash_value(op->getOpResult(0))), OpType::VAR, 1, to_string(ci_attr.getInt()));
+            return symbolInsert(valueId(op->getOpResult(0)), OpType::VAR, 1, to_string(ci_attr.getInt()));
         }
         auto fi_attr = op.getValueAttr().dyn_cast<mlir::FloatAttr>();
         if (fi_attr != nullptr){
-            return symbolInsert(size_t(mlir::hash_value(op->getOpResult(0))), OpType::VAR, 1, to_string(fi_attr.getValueAsDouble()));
+            return symbolInsert(valueId(op->getOpResult(0)), OpType::VAR, 1, to_string(fi_attr.getValueAsDouble()));
         }
         op->emitError("invalid value type in OpenQASM3");
         return mlir::failure();
@@ -650,10 +793,10 @@ private:
             //os << "first user: " << first_use->getName().getStringRef().str() << endl;
             if (auto first_store = llvm::dyn_cast<mlir::AffineStoreOp>(first_use)){
                 auto operand = first_use->getOperand(0);
-                size_t code = size_t(mlir::hash_value(operand));
+                size_t code = valueId(operand);
                 if (argSet.count(code) != 0){
                     auto res = getSymbol(code);
-                    return symbolInsert(size_t(mlir::hash_value(op->getOpResult(0))), OpType::VAR, type.getShape()[0], get<2>(res));
+                    return symbolInsert(valueId(op->getOpResult(0)), OpType::VAR, type.getShape()[0], get<2>(res));
                 } 
             }
         }
@@ -668,88 +811,44 @@ private:
             var_name = tmpVarHead+to_string(tmpVarCnt++);      
         }
         openQasmVarDefine(var_name, var_type, type.getShape()[0]);
-        return symbolInsert(size_t(mlir::hash_value(op->getOpResult(0))), OpType::VAR, type.getShape()[0], var_name);
+        return symbolInsert(valueId(op->getOpResult(0)), OpType::VAR, type.getShape()[0], var_name);
     }
 
-    mlir::LogicalResult visitOp(mlir::AffineLoadOp op) override{
-        string loadstr = "";
-        for (auto indexOperand : llvm::enumerate(op->getOperands())){
-            auto operand = indexOperand.value();
-            size_t code = size_t(mlir::hash_value(operand));
-            auto res = getSymbol(code);
-            //std::cout << "operand " << indexOperand.index() << ": (" << get<1>(res) << ", " << get<2>(res) << ")\n";
-            if (indexOperand.index() == 0){
-                loadstr += get<2>(res);
-                //if (get<1>(res) == 1)
-                //    break;
-            }
+    // Single-element memrefs are scalars; others are indexed by the rendered access map.
+    string affineAccessStr(mlir::Value memref, mlir::AffineMap map, mlir::ValueRange operands){
+        auto res = getSymbol(memref);
+        if (get<1>(res) > 1){
+            return get<2>(res) + "[" + affineMapStr(map, operands) + "]";
         }
-        /*
-        if(op->getOperands().size()==2){
-            if(op.getAffineMap().isConstant()){
-                loadstr += "[" + to_string(op.getAffineMap().getConstantResults()[0]) + "]";
-            }
-        }*/
-        //std::cout << "loadstr: " << loadstr << "\n";
-        return symbolInsert(size_t(mlir::hash_value(op.getResult())), OpType::VAR, 1, loadstr);
+        return get<2>(res);
+    }
+    mlir::LogicalResult visitOp(mlir::AffineLoadOp op) override{
+        string loadstr = affineAccessStr(op.getMemRef(), op.getAffineMap(), op.getMapOperands());
+        return symbolInsert(valueId(op.getResult()), OpType::VAR, 1, loadstr);
     }
     mlir::LogicalResult visitOp(mlir::AffineStoreOp op) override{
-        string lval = "", rval = "";
-        for (auto indexOperand : llvm::enumerate(op->getOperands())){
-            auto operand = indexOperand.value();
-            
-            auto type = operand.getType().dyn_cast<mlir::MemRefType>();
-            if (type != nullptr) if (type.getElementType().isa<QStateType>()) return mlir::success();
-
-            size_t code = size_t(mlir::hash_value(operand));
-            auto res = getSymbol(code);
-            //os << ", operand " << indexOperand.index() << ": (" << get<1>(res) << ", " << get<2>(res) << ")";
-
-            /*
-            if (get<0>(res) == OpType::EMPTY){
-                op->emitError("Can't backtrace operand ")<<operand;
-                return mlir::failure();
-            }*/
-            
-            if (indexOperand.index() == 0){                    
-                rval = get<2>(res);
-            }else if (indexOperand.index() == 1){
-                lval = get<2>(res);
-                //if (get<1>(res) == 1)
-                //    break;
-            }else{
-                if (get<1>(res) > 1){
-                    lval += "[" + get<2>(res) + "]";
-                }
-            }
-        }
-
-        /*
-        if(op->getOperands().size()==2){
-            if(op.getAffineMap().isConstant()){
-                lval += "[" + to_string(op.getAffineMap().getConstantResults()[0]) + "]";
-            }
-        }*/
-
+        if (isQubitMemref(op.getMemRef().getType())) return mlir::success();
+        string lval = affineAccessStr(op.getMemRef(), op.getAffineMap(), op.getMapOperands());
+        string rval = get<2>(getSymbol(op.getValueToStore()));
         if (lval != rval)
             openQasmAssign(lval, rval);
         return mlir::success();
     }
     mlir::LogicalResult visitOp(mlir::arith::IndexCastOp op) override{
         auto res = getSymbol(op.getIn());
-        return symbolInsert(size_t(mlir::hash_value(op.getOut())), OpType::VAR, 1, get<2>(res));
+        return symbolInsert(valueId(op.getOut()), OpType::VAR, 1, get<2>(res));
     }
     mlir::LogicalResult visitOp(mlir::arith::ExtUIOp op) override{
         auto in_var = getSymbol(op.getIn());
-        return symbolInsert(size_t(mlir::hash_value(op.getOut())), OpType::VAR, 1, get<2>(in_var));
+        return symbolInsert(valueId(op.getOut()), OpType::VAR, 1, get<2>(in_var));
     }
     mlir::LogicalResult visitOp(mlir::arith::SIToFPOp op) override{
         auto in_var = getSymbol(op.getIn());
-        return symbolInsert(size_t(mlir::hash_value(op.getOut())), OpType::VAR, 1, get<2>(in_var));
+        return symbolInsert(valueId(op.getOut()), OpType::VAR, 1, get<2>(in_var));
     }
     mlir::LogicalResult visitBinaryOp(OpType op_t, char op, mlir::Value lhs, mlir::Value rhs, mlir::Value ret){
-        auto lhs_s = get<2>(getSymbol(mlir::hash_value(lhs)));
-        auto rhs_s = get<2>(getSymbol(mlir::hash_value(rhs)));
+        auto lhs_s = get<2>(getSymbol(valueId(lhs)));
+        auto rhs_s = get<2>(getSymbol(valueId(rhs)));
         //auto temp = next_tempInt();
         //openQasmAssign(temp, lhs_s+op+rhs_s);
         return symbolInsert(ret, op_t, 1, "(" + lhs_s + op + rhs_s + ")");
@@ -828,10 +927,26 @@ private:
     }
     mlir::LogicalResult visitOp(mlir::func::CallOp op) override{
         auto func_name = op.getCalleeAttr().getValue().str();
+        if (gateFuncs[func_name]){
+            vector<string> qlist;
+            string params;
+            for (auto operand: op->getOperands()){
+                auto name = get<2>(getSymbol(operand));
+                if (operand.getType().isa<mlir::Float64Type>()){
+                    params += (params.empty() ? "" : ", ") + name;
+                }else{
+                    qlist.push_back(name);
+                }
+            }
+            auto gate = getQasmName(func_name);
+            if (!params.empty()) gate += "(" + params + ")";
+            openQasmUnitary(gate, qlist);
+            return mlir::success();
+        }
         string call_str = getQasmName(func_name) + "(";
         for (auto indexOperand : llvm::enumerate(op->getOperands())){
             auto operand = indexOperand.value();
-            size_t code = size_t(mlir::hash_value(operand));
+            size_t code = valueId(operand);
             auto res = getSymbol(code);
             if (indexOperand.index() > 0){
                 call_str += ", ";
@@ -849,14 +964,14 @@ private:
                     openQasmCall(call_str);
                     return mlir::success();
                 }else{
-                    return symbolInsert(size_t(mlir::hash_value(result)), OpType::VAR, 1, call_str);
+                    return symbolInsert(valueId(result), OpType::VAR, 1, call_str);
                 }
             }
             /*
             if (result.getType().isa<mlir::IndexType>()){
                 auto tmp = next_tempInt();
                 openQasmAssign(tmp+"[0]", call_str);
-                return symbolInsert(size_t(mlir::hash_value(result)), OpType::VAR, 1, tmp);
+                return symbolInsert(valueId(result), OpType::VAR, 1, tmp);
             }*/
         }
 
@@ -874,7 +989,7 @@ private:
 
             for (auto indexOperand : llvm::enumerate(op->getOperands())){
                 auto operand = indexOperand.value();
-                size_t code = size_t(mlir::hash_value(operand));
+                size_t code = valueId(operand);
                 auto res = getSymbol(code);
                 if (indexOperand.index() > 0){
                     call_qop_str += ", ";
@@ -900,7 +1015,7 @@ private:
                     //auto temp_int = next_tempInt();
                     openQasmAssign("bit "+temp_bool, call_qop_str);
                     //openQasmAssign(temp_int+"[0]", (string("(int)"))+temp_bool+"[0]");
-                    return symbolInsert(size_t(mlir::hash_value(result)), OpType::VAR, 1, temp_bool);
+                    return symbolInsert(valueId(result), OpType::VAR, 1, temp_bool);
                 }
             }
             // consider reset
@@ -914,7 +1029,7 @@ private:
     }
     mlir::LogicalResult visitOp(mlir::func::ReturnOp op) override{
         if (hasRes){
-            size_t opcode = size_t(mlir::hash_value(op->getOperand(0)));
+            size_t opcode = valueId(op->getOperand(0));
             auto res = getSymbol(opcode);
             openQasmReturn(get<2>(res));
         }
@@ -990,7 +1105,7 @@ private:
         string cmp_str = "";
         for (auto indexOperand : llvm::enumerate(op->getOperands())){
             auto operand = indexOperand.value();
-            size_t code = size_t(mlir::hash_value(operand));
+            size_t code = valueId(operand);
             auto res = getSymbol(code);
             cmp_str += get<2>(res);
             if (indexOperand.index() == 0){
@@ -999,7 +1114,7 @@ private:
         }
         //auto temp_bool = next_tempBit();
         //openQasmAssign(temp_bool, cmp_str);
-        return symbolInsert(size_t(mlir::hash_value(op->getOpResult(0))), OpType::VAR, 1, cmp_str);
+        return symbolInsert(valueId(op->getOpResult(0)), OpType::VAR, 1, cmp_str);
     }
     string memrefObtainArg(mlir::Operation::operand_range args, mlir::ArrayRef<int64_t> static_args, size_t index){
         if(index>=args.size()){
@@ -1024,7 +1139,7 @@ private:
         
         auto source_var = getSymbol(arr_in);
         if (get<1>(source_var) == 1){
-            return symbolInsert(size_t(mlir::hash_value(op->getOpResult(0))), OpType::VAR, 1, get<2>(source_var));
+            return symbolInsert(valueId(op->getOpResult(0)), OpType::VAR, 1, get<2>(source_var));
         }else{
             string offset;
             if (op.offsets().size() > 0){
@@ -1033,7 +1148,7 @@ private:
                 auto offset_val = op.static_offsets()[0];
                 offset = to_string(offset_val);
             }
-            return symbolInsert(size_t(mlir::hash_value(op->getOpResult(0))), OpType::VAR, 1, get<2>(source_var)+"["+offset+"]");
+            return symbolInsert(valueId(op->getOpResult(0)), OpType::VAR, 1, get<2>(source_var)+"["+offset+"]");
         }
         /*
         auto offset = memrefObtainArg(op.offsets(), op.static_offsets(), 0);
@@ -1041,7 +1156,7 @@ private:
         auto stride = memrefObtainArg(op.strides(), op.static_strides(), 0);
         auto temp_val = next_tempName();
         openQasmSlice(temp_val, get<2>(getSymbol(arr_in)), offset, string(offset)+"+"+size, stride);
-        return symbolInsert(size_t(mlir::hash_value(op->getOpResult(0))), OpType::VAR, -1, temp_val);
+        return symbolInsert(valueId(op->getOpResult(0)), OpType::VAR, -1, temp_val);
         */
     }
     mlir::LogicalResult visitOp(PassOp op) override{
@@ -1052,14 +1167,14 @@ private:
     }
     mlir::LogicalResult visitOp(mlir::scf::YieldOp op) override{
         for (auto operand: op.getOperands()){
-            yieldRes = mlir::hash_value(operand);
+            yieldRes = valueId(operand);
         }
         return mlir::success();
     }
     mlir::LogicalResult visitOp(mlir::memref::CastOp op) override{
         // todo: we hope it is identical cast.
         auto symbol = getSymbol(op.getSource());
-        return symbolInsert(size_t(mlir::hash_value(op->getOpResult(0))), get<0>(symbol), get<1>(symbol), get<2>(symbol));
+        return symbolInsert(valueId(op->getOpResult(0)), get<0>(symbol), get<1>(symbol), get<2>(symbol));
     }
     mlir::LogicalResult visitOp(mlir::Operation* op) override{
         op->emitOpError("is unsupported in code generation");
@@ -1083,7 +1198,7 @@ private:
     }
 
     void openQasmHead(){
-        os << "OpenQasm 3.0;\ninclude \"stdgates.inc\";\n\n";
+        os << "OPENQASM 3.0;\ninclude \"stdgates.inc\";\n\n";
     }
 
     void openQasmNewLine(){
@@ -1135,6 +1250,18 @@ private:
         os << " {\n";
     }
 
+    void openQasmGateFunc(string name, vector<tuple<string, string, int>> &arglist){
+        openQasmNewLine();
+        string params, qubits;
+        for (auto& arg: arglist){
+            auto& list = get<1>(arg) == "qubit" ? qubits : params;
+            list += (list.empty() ? "" : ", ") + get<0>(arg);
+        }
+        os << "gate " << name;
+        if (!params.empty()) os << "(" << params << ")";
+        os << " " << qubits << " {\n";
+    }
+
     void openQasmAssign(string lval, string rval){
         openQasmNewLine();
         os << lval << " = " << rval << ";\n";
@@ -1173,11 +1300,11 @@ private:
         os << "if (" << cond << ")";
     }
 
-    void openQasmFor(string arg, string lval, string rval, string step){
+    void openQasmFor(string arg, string start, string step, string stop){
         openQasmNewLine();
-        os << "for " << arg << " in [" << lval << ":" << rval;
-        if (step != "1") os << ':' << step;
-        os << "] {\n";
+        os << "for int " << arg << " in [" << start << ":";
+        if (step != "1") os << step << ":";
+        os << stop << "] {\n";
     }
 
     void openQasmWhile(string cond){
@@ -1190,26 +1317,22 @@ private:
     }
 
     mlir::LogicalResult symbolInsert(::mlir::Value v, OpType type, int shape, string str){
-        return symbolInsert(mlir::hash_value(v), type, shape, str);
+        return symbolInsert(valueId(v), type, shape, str);
     }
     mlir::LogicalResult symbolInsert(size_t code, OpType type, int shape, string str){
         
-        auto iter = symbolTable.find(code);
-        if (iter != symbolTable.end()){
+        if (!symbolTable.insert(code, make_tuple(type, shape, str))){
             os << "Error: symbol is already defined\n";
             return mlir::failure();
         }
-        
-        symbolTable.insert(make_pair(code, make_tuple(type, shape, str)));
         return mlir::success();
     }
     tuple<OpType, int, string> getSymbol(mlir::Value val){
-        return getSymbol(mlir::hash_value(val));
+        return getSymbol(valueId(val));
     }
     tuple<OpType, int, string> getSymbol(size_t code){
-        auto iter = symbolTable.find(code);
-        if (iter != symbolTable.end()){
-            return iter->second;
+        if (auto symbol = symbolTable.find(code)){
+            return *symbol;
         }
 
         return make_tuple(OpType::EMPTY, 0, "");
@@ -1241,7 +1364,7 @@ private:
 
 namespace isq {
 namespace ir{
-mlir::LogicalResult generateOpenQASM3Logic(mlir::MLIRContext &context, mlir::ModuleOp &module, llvm::raw_string_ostream &os) {
+mlir::LogicalResult generateOpenQASM3Logic(mlir::MLIRContext &context, mlir::ModuleOp &module, llvm::raw_ostream &os) {
     return MLIRPassImpl(context, module, os).mlirPass();
 }
 }
@@ -2,9 +2,11 @@
 #include <map> 
 #include <mlir/AsmParser/AsmParser.h>
 #include <mlir/Dialect/Func/IR/FuncOps.h>
+#include <memory>
 #include <set>
 #include <vector>
 #include <algorithm>
+#include <cstring>
 
 #include "isq/Dialect.h"
 #include <isq/utils/DispatchOperation.h>
@@ -13,6 +15,10 @@
 #include "isq/Operations.h"
 #include "isq/QAttrs.h"
 #include "isq/utils/Decomposition.h"
+#include "isq/utils/QCISBinary.h"
+#include "isq/utils/QCISTarget.h"
+#include "isq/passes/LayerScheduler.h"
+#include "isq/passes/Passes.h"
 #include "mlir/Dialect/Arith/IR/Arith.h"
 #include "mlir/Dialect/ControlFlow/IR/ControlFlow.h"
 #include "mlir/Dialect/ControlFlow/IR/ControlFlowOps.h"
@@ -35,6 +41,9 @@
 #include "mlir/Support/LogicalResult.h"
 
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/ScopedHashTable.h"
 
@@ -43,6 +52,8 @@
 
 #define TRY(x) if(mlir::failed(x)) return mlir::failure();
 #define EPS (1e-6)
+// Gates kept for replaying function calls.
+#define MEMO_LIMIT (size_t(1) << 24)
 
 using namespace isq::ir;
 using namespace isq;
@@ -68,16 +79,9 @@ using namespace mlir::arith;
 using namespace mlir::memref;
 using namespace mlir::scf;
 using namespace mlir::cf;
+// Only module-level ops are visited. Function bodies are compiled to `Instr` arrays.
 using CodegenOpVisitor = OpVisitor<
-    func::FuncOp, scf::IfOp, AffineForOp, scf::ExecuteRegionOp,
-    GetGlobalOp, GlobalOp,
-    mlir::arith::ConstantOp, mlir::arith::ExtUIOp, mlir::arith::IndexCastOp, mlir::arith::SIToFPOp,
-    memref::AllocOp, memref::DeallocOp, memref::LoadOp, memref::StoreOp, SubViewOp, memref::CastOp, CmpIOp,
-    AddIOp, SubIOp, MulIOp, DivSIOp, RemSIOp, AddFOp, SubFOp, MulFOp, DivFOp, NegFOp,
-    UseGateOp, DecorateOp, ApplyGateOp, CallQOpOp, AccumulateGPhase, DeclareQOpOp,
-    func::CallOp, func::ReturnOp, DefgateOp, scf::WhileOp, ConditionOp,
-    ModuleOp, PassOp, AffineYieldOp, scf::YieldOp,
-    mlir::cf::CondBranchOp, BranchOp
+    func::FuncOp, GlobalOp, DefgateOp, DeclareQOpOp, ModuleOp
     >;
 }
 
@@ -127,26 +131,38 @@ struct varValue{
 };
 
 /// Code generator from isQ MLIR Dialect to QCIS.
+/// The classical part of the program is evaluated at compile time. Each function is lowered once to
+/// a flat array of register instructions over dense value slots, and the array is then executed, so
+/// loop bodies and repeated calls are not re-dispatched or re-hashed per iteration.
 class MLIRPassImpl: public details::CodegenOpVisitor{
 public:
-    MLIRPassImpl(mlir::MLIRContext &context, mlir::ModuleOp &module, llvm::raw_ostream &os, bool printast) : context(&context), theModule(&module), os(os), printast(printast) {};
+    MLIRPassImpl(mlir::MLIRContext &context, mlir::ModuleOp &module, llvm::raw_ostream &os, bool printast, bool layers, bool binary, llvm::StringRef timing) : context(&context), theModule(&module), os(os), printast(printast), layers(layers), binary(binary), timing(timing.str()) {};
     
 
     mlir::LogicalResult mlirPass(){
         
         indent = 0;
         qbitSize = 0;
-        tmp_cnt = 0;
-        tmp_head = "tmp_";
         if (printast) printOperation(theModule->getOperation());
         initGate();
         initializeIntegerSets();
+        if (!timing.empty()){
+            auto loaded = loadQCISTarget(timing, theModule->getLoc());
+            if (mlir::failed(loaded)) return mlir::failure();
+            target = std::move(*loaded);
+            ready.assign(target->size+1, 0);
+        }
         auto val = visitOperation(theModule->getOperation());
         if(mlir::failed(val)) return mlir::failure();
-        // find main function, and visit it's body
+        // find main function, compile it with its callees and run it
         auto iter = funcMap.find("__isq__main");
         if (iter != funcMap.end()){
-            return visitOp(funcMap["__isq__main"]);
+            if (binary) writeQCISHeader(os);
+            TRY(enter(*getFunction(iter->second)));
+            if (!timingError.empty()) return error(theModule->getLoc(), timingError);
+            if (target) printTimed();
+            else if (layers) printLayers();
+            return mlir::success();
         }
         return mlir::failure();
     }
@@ -171,24 +187,151 @@ private:
     mlir::ModuleOp* theModule;
     llvm::raw_ostream& os;
     bool printast;
+    // Emit gates grouped by parallel layer instead of in program order.
+    bool layers;
+    // Emit compact binary QCIS (see QCISBinary.h) instead of text.
+    bool binary;
+    passes::LayerScheduler scheduler;
+    vector<string> layerText;
+    // Target description for timed output; gates are then printed by start time instead.
+    string timing;
+    std::optional<QCISTarget> target;
+    struct Timed{
+        uint64_t start;
+        string line;
+    };
+    vector<Timed> timed;
+    // Time each qubit becomes free. Qubits start from 1, so index 0 is unused.
+    vector<uint64_t> ready;
+    // Results are reported in the order of M ops, so an M never starts before an earlier one.
+    uint64_t lastMeasure = 0;
+    uint64_t makespan = 0;
+    string timingError;
     
     int indent;
 
     set<string> baseGate;
     map<string, string> gateMap; //decomposition_raw gate
-    map<string, map<int, varValue>> symbolTable;
     set<int> measured;
     map<string, mlir::func::FuncOp> funcMap;
-    set<string> visitFunc;
-    map<string, int> funcArgs;
-
-    map<size_t, varValue> valueTable;
-    map<size_t, pair<string, int>> indexTable;
-    map<size_t, pair<string, vector<double>>> gateTable;
     int qbitSize;
-    string tmp_head;
-    int tmp_cnt;
     varValue func_res;
+
+    // Arrays: globals, one per alloc op and one per qubit argument of a function.
+    vector<vector<varValue>> symbols;
+    map<string, int> symbolIds;
+
+    // A memref value: element `index` of symbol `sym`.
+    struct View{
+        int sym = -1;
+        int index = 0;
+    };
+    // Runtime value of an SSA value. Slots keep their value across calls, like SSA values did in the
+    // old hash tables; recursion is rejected, so a function never overwrites its own live slots.
+    struct Slot{
+        bool defined = false;
+        varValue val;
+        View view;
+        // Index into `gates`, -1 if no gate was used.
+        int gate = -1;
+        vector<double> angles;
+    };
+    vector<Slot> slots;
+    llvm::DenseMap<mlir::Value, int> slotIds;
+
+    enum class Code{
+        Const, Copy, IToF, NegF, Binary, CmpI,
+        Global, Alloc, SubView, Load, Store,
+        UseGate, SetGate, Apply, Measure, Call, Return,
+        Jump, Branch, If, ForInit, ForCheck, ForNext, Error
+    };
+    struct Function;
+    // Operands are slot indices unless noted otherwise.
+    //   Const: a <- imm.                       Copy, IToF, NegF: b <- f(a).
+    //   Binary: c <- a (imm.ival) b.           CmpI: c <- a (predicate imm.ival) b.
+    //   Global, Alloc: c <- view of symbol a.  SubView: c <- a + (b, or imm.ival if b < 0).
+    //   Load: c <- a[args].                    Store: b[args] <- a.
+    //   UseGate: c <- gate a with angles args. SetGate: c <- gate a.
+    //   Apply: res <- gate a on args.          Measure: measure args, c <- 0.
+    //   Call: c <- func(args), args converted by kinds.  Return: result a, if any.
+    //   Jump: to a.                            Branch: to b if a, else to c.
+    //   If: to b unless a is 1.
+    //   ForInit: a <- args[0] or imm.ival, b <- args[1] or c, step d.
+    //   ForCheck: to c if a >= b.              ForNext: a += d, to c.
+    //   Error: fails, with messages[a] if a >= 0.
+    struct Instr{
+        Code code;
+        mlir::Operation* op;
+        int a = -1, b = -1, c = -1, d = 0;
+        varValue imm;
+        llvm::SmallVector<int, 4> args;
+        llvm::SmallVector<int, 2> res;
+        llvm::SmallVector<char, 4> kinds;
+        Function* func = nullptr;
+        // Layer from isq-schedule{tag-layers} for Apply and Measure, -1 if untagged.
+        int layer = -1;
+    };
+    enum ArgKind: char { ScalarArg, QubitArg, BadArg };
+    // A gate emitted while a memoizable call runs. Qubits are argument indices once memoized.
+    struct Emitted{
+        llvm::StringRef gate;
+        llvm::SmallVector<int, 2> qubits;
+        mlir::Operation* op;
+    };
+    // Gates and result of a pure call, replayed on the qubits of later calls with the same key.
+    struct Memo{
+        vector<Emitted> gates;
+        varValue result;
+    };
+    enum class Purity{ Unknown, Computing, Pure, Impure };
+    struct Function{
+        mlir::func::FuncOp op;
+        bool isPrivate = false;
+        // Set while the function runs, to reject recursion.
+        bool active = false;
+        struct Arg{
+            int slot;
+            // One-element symbol holding the qubit of a memref argument, -1 for scalars.
+            int sym;
+            bool used;
+            bool array;
+            bool qubit;
+        };
+        vector<Arg> args;
+        vector<Instr> code;
+        // Pure functions read no global and measure nothing, so their gates depend only on the arguments.
+        Purity purity = Purity::Unknown;
+        // Keyed by classical argument values and the aliasing of qubit arguments.
+        map<vector<int64_t>, Memo> memos;
+    };
+    // A gate of a tagged op, held back by the running function until the next flush.
+    struct Pending{
+        unsigned layer;
+        llvm::StringRef gate;
+        llvm::SmallVector<varValue, 2> qubits;
+    };
+    vector<Pending>* pending = nullptr;
+    // Layer of the tagged op running, -1 if none.
+    int pendingLayer = -1;
+    // Gates emitted since the outermost memoizable call started.
+    vector<Emitted> trace;
+    int recording = 0;
+    // Set once the trace would pass MEMO_LIMIT. The trace is dropped and no running call is memoized.
+    bool traceOverflow = false;
+    // Total gates kept in memos, bounded by MEMO_LIMIT.
+    size_t memoGates = 0;
+    llvm::DenseMap<mlir::Operation*, std::unique_ptr<Function>> functions;
+    vector<string> messages;
+
+    enum class GateKind{ Base, Deriving, Rotation, Unsupported };
+    struct GateDesc{
+        string name;
+        GateKind kind;
+        // Body of a deriving gate.
+        Function* func;
+    };
+    vector<GateDesc> gates;
+    map<string, int> gateIds;
     
     //isqTools isqtool;
 
@@ -316,39 +459,23 @@ private:
         return mlir::success();
     }
 
-    mlir::LogicalResult visitOp(mlir::cf::CondBranchOp op) override{
-        
-        auto code = size_t(mlir::hash_value(op.getCondition()));
-        auto b_i = getValue(code);
-        if (b_i.first == false) return error(op.getLoc(), "jump condition must be a determined boolean");
-        if (b_i.second.ival == 0){
-            return visitBlock(op.getFalseDest());
-        }else{
-            return visitBlock(op.getTrueDest());
-        }
-    }
-
-    mlir::LogicalResult visitOp(mlir::cf::BranchOp op) override{
-        return visitBlock(op.getDest());
-    }
-
-
     mlir::LogicalResult visitOp(mlir::memref::GlobalOp op) override{
-        // store global var to symbolTable
+        // store global var to symbols
         auto id = op.getSymName();
         auto type = op.getType();
         int size = type.getShape()[0];
-        map<int, varValue> vmap;
+        vector<varValue> vals(size);
         if (type.getElementType().isa<QStateType>()){
-            for (int i = 0; i < size; i++) vmap[i] = varValue(qbitSize+1+i);
+            for (int i = 0; i < size; i++) vals[i] = varValue(qbitSize+1+i);
             qbitSize += size;
-        }else if (type.getElementType().isa<mlir::IndexType>() || type.getElementType().isa<mlir::FloatType>()){
-            for (int i = 0; i < size; i++) vmap[i] = varValue();
-        }else{
+        }else if (!type.getElementType().isa<mlir::IndexType>() && !type.getElementType().isa<mlir::FloatType>()){
             return error(op.getLoc(), "qcis can only define 'qbit', 'int' or 'double' var.");
         }
 
-        symbolTable.insert(make_pair(id.str(), vmap));
+        if (symbolIds.count(id.str()) == 0){
+            symbolIds[id.str()] = symbols.size();
+            symbols.push_back(std::move(vals));
+        }
         return mlir::success();
     }
     
@@ -370,566 +497,865 @@ private:
     }
 
     mlir::LogicalResult visitOp(mlir::func::FuncOp func_op) override{
-        // visit func body
-        auto func_name = func_op.getSymName().str();
-        auto visibility = func_op.getSymVisibility();
-        llvm::StringRef s = "public";
-        if(visibility.has_value()){
-            s = *visibility;
-        }
-        if (s == "private") return mlir::success();
-        auto func_block = func_op.getBody().getBlocks().begin();
-        return visitBlock(&*func_block);
-    }
-
-    mlir::LogicalResult visitOp(mlir::memref::GetGlobalOp op) override{
-        auto attr = op.getNameAttr();
-        auto type = op.getResult().getType().dyn_cast<mlir::MemRefType>();
-        auto code = size_t(mlir::hash_value(op.getResult()));
-        indexTable[code] = make_pair(attr.getValue().str(), 0);
+        // function bodies are compiled when they are first called
         return mlir::success();
     }
 
-    mlir::LogicalResult visitOp(mlir::arith::ConstantOp op) override{
-        auto code = size_t(mlir::hash_value(op->getOpResult(0)));
-        auto attr = op.getValueAttr().dyn_cast_or_null<mlir::IntegerAttr>();
-        if (attr != nullptr){
-            valueTable[code] = varValue(int(attr.getInt()));
-        }else{
-            auto attr = op.getValueAttr().dyn_cast_or_null<mlir::FloatAttr>();
-            if (attr != nullptr){
-                valueTable[code] = varValue(attr.getValue().convertToDouble());
-            }else{
-                return error(op.getLoc(), "error type");
-            }
-        }
-        
-        return mlir::success();
+    int slotOf(mlir::Value value){
+        auto [iter, inserted] = slotIds.try_emplace(value, slots.size());
+        if (inserted) slots.emplace_back();
+        return iter->second;
     }
 
-    mlir::LogicalResult visitOp(mlir::arith::ExtUIOp op) override{
-        auto icode = size_t(mlir::hash_value(op.getIn()));
-        auto ocode = size_t(mlir::hash_value(op.getOut()));
-        valueTable[ocode] = valueTable[icode];
-        return mlir::success();
+    int newSlot(){
+        slots.emplace_back();
+        return slots.size() - 1;
     }
 
-    mlir::LogicalResult visitOp(mlir::arith::IndexCastOp op) override{
-        auto icode = size_t(mlir::hash_value(op.getIn()));
-        auto ocode = size_t(mlir::hash_value(op.getOut()));
-        valueTable[ocode] = valueTable[icode];
-        return mlir::success();
+    int newSymbol(int size){
+        symbols.emplace_back(size);
+        return symbols.size() - 1;
     }
 
-    mlir::LogicalResult visitOp(mlir::arith::SIToFPOp op) override{
-        auto icode = size_t(mlir::hash_value(op.getIn()));
-        auto ocode = size_t(mlir::hash_value(op.getOut()));
-        valueTable[ocode] = varValue(double(valueTable[icode].ival));
-        return mlir::success();
+    int message(string msg){
+        messages.push_back(std::move(msg));
+        return messages.size() - 1;
     }
 
-    mlir::LogicalResult visitOp(mlir::arith::NegFOp op) override{
-        auto icode = size_t(mlir::hash_value(op.getOperand()));
-        auto ocode = size_t(mlir::hash_value(op.getResult()));
-        valueTable[ocode] = varValue(-1.0 * valueTable[icode].dval);
-        return mlir::success();
-    }
-
-    mlir::LogicalResult visitOp(mlir::memref::AllocOp op) override{
-        // create new var name
-        // store to symbolTable and indexTable
-        auto result = op.getResult();
-        if (result.use_empty()){
-            return mlir::success();
+    int gateId(const string& gate){
+        auto iter = gateIds.find(gate);
+        if (iter != gateIds.end()) return iter->second;
+        GateDesc desc{gate, GateKind::Unsupported, nullptr};
+        if (baseGate.count(gate) == 1){
+            desc.kind = GateKind::Base;
+        }else if (gateMap.count(gate) == 1){
+            desc.kind = GateKind::Deriving;
+            auto func = funcMap.find(gateMap[gate]);
+            if (func != funcMap.end()) desc.func = getFunction(func->second);
+        }else if (gate == "Rx" || gate == "Ry"){
+            desc.kind = GateKind::Rotation;
         }
-
-        auto type = op.getResult().getType().dyn_cast<mlir::MemRefType>();
-        if (type.getElementType().isa<QStateType>()) return error(op.getLoc(), "sorry, qbit var must define at global area");
-        
-        string var_name = getTmpName();
-        int size = type.getShape()[0];
-        map<int, varValue> vmap;
-        for (int i = 0; i < size; i++) vmap[i] = varValue();
-        symbolTable.insert(make_pair(var_name, vmap));
-    
-        auto code = size_t(mlir::hash_value(op->getOpResult(0)));
-        indexTable[code] = make_pair(var_name, 0);
-
-        return mlir::success();
+        // getFunction may have added gates used by the body
+        int id = gates.size();
+        gates.push_back(desc);
+        gateIds[gate] = id;
+        return id;
+    }
+
+    // Compiles a function on first use. Callees are compiled before the caller runs, so no slot is
+    // allocated while code is executing.
+    Function* getFunction(mlir::func::FuncOp func_op){
+        auto& entry = functions[func_op.getOperation()];
+        if (entry) return entry.get();
+        entry = std::make_unique<Function>();
+        auto f = entry.get();
+        f->op = func_op;
+        auto visibility = func_op.getSymVisibility();
+        f->isPrivate = visibility.has_value() && *visibility == "private";
+        if (func_op.getBody().empty()) return f;
+        auto func_block = func_op.getBody().getBlocks().begin();
+        for (auto &arg: func_block->getArguments()){
+            Function::Arg a{slotOf(arg), -1, !arg.use_empty(), false, arg.getType().isa<QStateType>()};
+            if (auto type = arg.getType().dyn_cast<mlir::MemRefType>()){
+                a.array = type.getShape()[0] != 1;
+                a.qubit = type.getElementType().isa<QStateType>();
+                a.sym = newSymbol(1);
+            }
+            f->args.push_back(a);
+        }
+        if (!f->isPrivate) compileRegion(*f, func_op.getBody());
+        return f;
     }
 
-    mlir::LogicalResult visitOp(mlir::memref::DeallocOp op) override{
-        // every local var has unique var_name in symbolTable, just jump it.
-        return mlir::success();
-    }
+    // Jump whose target block is known once the whole region is compiled. A null block is the region end.
+    struct BlockRef{
+        int instr;
+        int Instr::*field;
+        mlir::Block* block;
+    };
 
-    mlir::LogicalResult visitOp(mlir::memref::SubViewOp op) override{
-        // update index in indexTable
-        auto scode = mlir::hash_value(op.getSource());
-        auto fcode = mlir::hash_value(op.offsets()[0]);
-        auto rcode = mlir::hash_value(op.getResult());
-        auto s_i = getIndex(scode);
-        if (s_i.second == -1) return error(op.getLoc(), "get var error");
-        auto f_v = getValue(fcode);
-        if (f_v.first == false) return error(op.getLoc(), "index must a determined number");
-        int index = s_i.second + f_v.second.ival;
-        if (outOfBorder(s_i.first, index)) return error(op.getLoc(), "index out of border");
-        indexTable[rcode] = make_pair(s_i.first, index);
-        return mlir::success();
+    void compileRegion(Function& f, mlir::Region& region){
+        llvm::DenseMap<mlir::Block*, int> labels;
+        vector<BlockRef> refs;
+        for (auto &block: region){
+            labels[&block] = f.code.size();
+            for (auto &op: block) compileOp(f, &op, refs);
+        }
+        int end = f.code.size();
+        for (auto &ref: refs){
+            f.code[ref.instr].*ref.field = ref.block ? labels[ref.block] : end;
+        }
     }
 
-    mlir::LogicalResult visitOp(mlir::memref::LoadOp op) override{
-        string var_name;
-        int index = 0;
-        // load value from symbolTable using var_name and index
-        for (auto indexOperand : llvm::enumerate(op->getOperands())){
-            auto operand = indexOperand.value();
-            size_t code = size_t(mlir::hash_value(operand));
-            if (indexOperand.index() == 0){
-                auto s_i = getIndex(code);
-                if (s_i.second < 0) return error(op.getLoc(), "load value error");
-                var_name = s_i.first;
-                index = s_i.second;
+    static int layerOf(mlir::Operation* op){
+        auto layer = op->getAttrOfType<mlir::IntegerAttr>(passes::ISQ_LAYER);
+        return layer ? layer.getInt() : -1;
+    }
+
+    void compileOp(Function& f, mlir::Operation* op, vector<BlockRef>& refs){
+        auto emit = [&](Code code) -> Instr& {
+            f.code.push_back(Instr{code, op});
+            return f.code.back();
+        };
+        auto emitFailure = [&](string msg){
+            emit(Code::Error).a = message(std::move(msg));
+        };
+        auto emitBinary = [&](char binop, mlir::Value lhs, mlir::Value rhs, mlir::Value ret){
+            int l = slotOf(lhs), r = slotOf(rhs), res = slotOf(ret);
+            auto &in = emit(Code::Binary);
+            in.a = l;
+            in.b = r;
+            in.c = res;
+            in.imm = varValue(int(binop));
+        };
+        auto emitCast = [&](Code code, mlir::Value in_value, mlir::Value out_value){
+            int i = slotOf(in_value), o = slotOf(out_value);
+            auto &in = emit(code);
+            in.a = i;
+            in.b = o;
+        };
+
+        if (auto const_op = mlir::dyn_cast<mlir::arith::ConstantOp>(op)){
+            int res = slotOf(const_op.getResult());
+            if (auto attr = const_op.getValueAttr().dyn_cast_or_null<mlir::IntegerAttr>()){
+                auto &in = emit(Code::Const);
+                in.a = res;
+                in.imm = varValue(int(attr.getInt()));
+            }else if (auto attr = const_op.getValueAttr().dyn_cast_or_null<mlir::FloatAttr>()){
+                auto &in = emit(Code::Const);
+                in.a = res;
+                in.imm = varValue(attr.getValue().convertToDouble());
             }else{
-                auto b_i = getValue(code);
-                if (b_i.first == false) return error(op.getLoc(), "index must a determined number");
-                index += b_i.second.ival;
+                emitFailure("error type");
             }
-        }
-        //std::cout << var_name << ": " << index << std::endl;
-        if (outOfBorder(var_name, index)) return error(op.getLoc(), "index out of border");
-
-        auto type = op.getMemRefType().getElementType();
-        auto code = size_t(mlir::hash_value(op->getOpResult(0)));
-        valueTable[code] = getVarValue(var_name, index);
-        return mlir::success();
-    }
-
-    mlir::LogicalResult visitOp(mlir::memref::StoreOp op) override{
-        int index;
-        varValue val;
-        string var_name;
-        auto type = op.getMemRefType().getElementType();
-        // store index value to symtable, qbit ignore
-        for (auto indexOperand : llvm::enumerate(op->getOperands())){
-            auto operand = indexOperand.value();
-            size_t code = size_t(mlir::hash_value(operand));
-            if (indexOperand.index() == 0){
-                if(operand.getType().isa<QStateType>()) return mlir::success();
-                auto b_v = getValue(code);
-                if (b_v.first == false) return error(op.getLoc(), "must assign a determined int value");
-                val = b_v.second;
-            }else if (indexOperand.index() == 1){
-                auto s_i = getIndex(code);
-                if (s_i.second < 0) return error(op.getLoc(), "get left var error");
-                var_name = s_i.first;
-                index = s_i.second;
+        }else if (auto ext = mlir::dyn_cast<mlir::arith::ExtUIOp>(op)){
+            emitCast(Code::Copy, ext.getIn(), ext.getOut());
+        }else if (auto cast = mlir::dyn_cast<mlir::arith::IndexCastOp>(op)){
+            emitCast(Code::Copy, cast.getIn(), cast.getOut());
+        }else if (auto cast = mlir::dyn_cast<mlir::arith::SIToFPOp>(op)){
+            emitCast(Code::IToF, cast.getIn(), cast.getOut());
+        }else if (auto neg = mlir::dyn_cast<mlir::arith::NegFOp>(op)){
+            emitCast(Code::NegF, neg.getOperand(), neg.getResult());
+        }else if (auto add = mlir::dyn_cast<mlir::arith::AddIOp>(op)){
+            emitBinary('+', add.getLhs(), add.getRhs(), add.getResult());
+        }else if (auto sub = mlir::dyn_cast<mlir::arith::SubIOp>(op)){
+            emitBinary('-', sub.getLhs(), sub.getRhs(), sub.getResult());
+        }else if (auto mul = mlir::dyn_cast<mlir::arith::MulIOp>(op)){
+            emitBinary('*', mul.getLhs(), mul.getRhs(), mul.getResult());
+        }else if (auto div = mlir::dyn_cast<mlir::arith::DivSIOp>(op)){
+            emitBinary('/', div.getLhs(), div.getRhs(), div.getResult());
+        }else if (auto rem = mlir::dyn_cast<mlir::arith::RemSIOp>(op)){
+            emitBinary('%', rem.getLhs(), rem.getRhs(), rem.getResult());
+        }else if (auto add = mlir::dyn_cast<mlir::arith::AddFOp>(op)){
+            emitBinary('+', add.getLhs(), add.getRhs(), add.getResult());
+        }else if (auto sub = mlir::dyn_cast<mlir::arith::SubFOp>(op)){
+            emitBinary('-', sub.getLhs(), sub.getRhs(), sub.getResult());
+        }else if (auto mul = mlir::dyn_cast<mlir::arith::MulFOp>(op)){
+            emitBinary('*', mul.getLhs(), mul.getRhs(), mul.getResult());
+        }else if (auto div = mlir::dyn_cast<mlir::arith::DivFOp>(op)){
+            emitBinary('/', div.getLhs(), div.getRhs(), div.getResult());
+        }else if (auto cmp = mlir::dyn_cast<mlir::arith::CmpIOp>(op)){
+            int l = slotOf(cmp.getLhs()), r = slotOf(cmp.getRhs()), res = slotOf(cmp.getResult());
+            auto &in = emit(Code::CmpI);
+            in.a = l;
+            in.b = r;
+            in.c = res;
+            in.imm = varValue(static_cast<int>(cmp.getPredicate()));
+        }else if (auto get_global = mlir::dyn_cast<mlir::memref::GetGlobalOp>(op)){
+            auto iter = symbolIds.find(get_global.getNameAttr().getValue().str());
+            int res = slotOf(get_global.getResult());
+            auto &in = emit(Code::Global);
+            in.a = iter != symbolIds.end() ? iter->second : -1;
+            in.c = res;
+        }else if (auto alloc = mlir::dyn_cast<mlir::memref::AllocOp>(op)){
+            // every execution of the alloc gets a fresh, zeroed array
+            if (alloc.getResult().use_empty()) return;
+            auto type = alloc.getResult().getType().dyn_cast<mlir::MemRefType>();
+            if (type.getElementType().isa<QStateType>()) return emitFailure("sorry, qbit var must define at global area");
+            int sym = newSymbol(type.getShape()[0]);
+            int res = slotOf(alloc.getResult());
+            auto &in = emit(Code::Alloc);
+            in.a = sym;
+            in.c = res;
+        }else if (auto subview = mlir::dyn_cast<mlir::memref::SubViewOp>(op)){
+            int src = slotOf(subview.getSource()), res = slotOf(subview.getResult());
+            auto offset = subview.getMixedOffsets()[0];
+            int offset_slot = -1;
+            int offset_value = 0;
+            if (auto value = offset.dyn_cast<mlir::Value>()){
+                offset_slot = slotOf(value);
             }else{
-                auto b_i = getValue(code);
-                if (b_i.first == false) return error(op.getLoc(), "index must be a determined value");
-                index += b_i.second.ival;
+                offset_value = offset.get<mlir::Attribute>().cast<mlir::IntegerAttr>().getInt();
             }
+            auto &in = emit(Code::SubView);
+            in.a = src;
+            in.b = offset_slot;
+            in.c = res;
+            in.imm = varValue(offset_value);
+        }else if (auto load = mlir::dyn_cast<mlir::memref::LoadOp>(op)){
+            int mem = slotOf(load.getMemRef()), res = slotOf(load.getResult());
+            llvm::SmallVector<int, 4> indices;
+            for (auto index: load.getIndices()) indices.push_back(slotOf(index));
+            auto &in = emit(Code::Load);
+            in.a = mem;
+            in.c = res;
+            in.args = indices;
+        }else if (auto store = mlir::dyn_cast<mlir::memref::StoreOp>(op)){
+            // qbit stores do not change the qubit a memref holds
+            if (store.getValue().getType().isa<QStateType>()) return;
+            int val = slotOf(store.getValue()), mem = slotOf(store.getMemRef());
+            llvm::SmallVector<int, 4> indices;
+            for (auto index: store.getIndices()) indices.push_back(slotOf(index));
+            auto &in = emit(Code::Store);
+            in.a = val;
+            in.b = mem;
+            in.args = indices;
+        }else if (mlir::isa<mlir::memref::CastOp>(op)){
+            emitFailure("qcis don't support dynamic array");
+        }else if (auto use = mlir::dyn_cast<UseGateOp>(op)){
+            int gate = gateId(use.getNameAttr().getLeafReference().str());
+            int res = slotOf(use.getResult());
+            llvm::SmallVector<int, 4> params;
+            for (auto par: use.getParameters()) params.push_back(slotOf(par));
+            auto &in = emit(Code::UseGate);
+            in.a = gate;
+            in.c = res;
+            in.args = params;
+        }else if (auto decorate = mlir::dyn_cast<DecorateOp>(op)){
+            if (decorate.getCtrl().size()!=0) return emitFailure("qcis don't support 'ctrl' and 'nctrl' decorate");
+            auto usegate_op = llvm::dyn_cast_or_null<UseGateOp>(decorate.getArgs().getDefiningOp());
+            if (!usegate_op){
+                emit(Code::Error);
+                return;
+            }
+            auto gate = usegate_op.getNameAttr().getLeafReference().str();
+            if (!decorate.getAdjoint()) return emitFailure("invalid decorate");
+            if (gate != "T" && gate != "S") return emitFailure("decorate 'inv' can only use at 'T' or 'S' gate");
+            int id = gateId(gate == "T" ? "TD" : "SD");
+            int res = slotOf(decorate.getResult());
+            auto &in = emit(Code::SetGate);
+            in.a = id;
+            in.c = res;
+        }else if (auto apply = mlir::dyn_cast<ApplyGateOp>(op)){
+            int gate = slotOf(apply.getGate());
+            llvm::SmallVector<int, 4> args;
+            llvm::SmallVector<int, 2> results;
+            for (auto arg: apply.getArgs()) args.push_back(slotOf(arg));
+            for (auto result: apply->getResults()) results.push_back(slotOf(result));
+            auto &in = emit(Code::Apply);
+            in.a = gate;
+            in.args = args;
+            in.res = results;
+            in.layer = layerOf(op);
+        }else if (auto qop = mlir::dyn_cast<CallQOpOp>(op)){
+            string qop_name = qop->getAttr(llvm::StringRef("callee")).dyn_cast<mlir::SymbolRefAttr>().getLeafReference().str();
+            // only measure support
+            if (qop_name != "__isq__builtin__measure") return emitFailure("sorry, qcis can only do measure qop");
+            llvm::SmallVector<int, 4> args;
+            for (auto operand: qop->getOperands()) args.push_back(slotOf(operand));
+            int res = slotOf(qop.getResult(1));
+            auto &in = emit(Code::Measure);
+            in.args = args;
+            in.c = res;
+            in.layer = layerOf(op);
+        }else if (auto call = mlir::dyn_cast<mlir::func::CallOp>(op)){
+            // index and double args pass values, qbit memrefs pass the qubit they point to
+            llvm::SmallVector<int, 4> args;
+            llvm::SmallVector<char, 4> kinds;
+            for (auto operand: call.getOperands()){
+                auto type = operand.getType();
+                char kind = BadArg;
+                if (type.isa<mlir::IndexType>() || type.isa<mlir::FloatType>()){
+                    kind = ScalarArg;
+                }else if (type.isa<mlir::MemRefType>() && type.dyn_cast<mlir::MemRefType>().getElementType().isa<QStateType>()){
+                    kind = QubitArg;
+                }
+                args.push_back(slotOf(operand));
+                kinds.push_back(kind);
+            }
+            auto iter = funcMap.find(call.getCalleeAttr().getValue().str());
+            Function* callee = iter != funcMap.end() ? getFunction(iter->second) : nullptr;
+            int res = call.getNumResults() > 0 ? slotOf(call.getResult(0)) : -1;
+            auto &in = emit(Code::Call);
+            in.args = args;
+            in.kinds = kinds;
+            in.func = callee;
+            in.c = res;
+        }else if (auto ret = mlir::dyn_cast<mlir::func::ReturnOp>(op)){
+            int res = ret.getOperands().size() > 0 ? slotOf(ret.getOperand(0)) : -1;
+            emit(Code::Return).a = res;
+        }else if (mlir::isa<mlir::AffineYieldOp, mlir::scf::YieldOp>(op)){
+            // leave the region, unless this already is its last block
+            if (op->getBlock() != &op->getParentRegion()->back()){
+                refs.push_back(BlockRef{int(f.code.size()), &Instr::a, nullptr});
+                emit(Code::Jump);
+            }
+        }else if (auto br = mlir::dyn_cast<mlir::cf::BranchOp>(op)){
+            refs.push_back(BlockRef{int(f.code.size()), &Instr::a, br.getDest()});
+            emit(Code::Jump);
+        }else if (auto cond_br = mlir::dyn_cast<mlir::cf::CondBranchOp>(op)){
+            int cond = slotOf(cond_br.getCondition());
+            refs.push_back(BlockRef{int(f.code.size()), &Instr::b, cond_br.getTrueDest()});
+            refs.push_back(BlockRef{int(f.code.size()), &Instr::c, cond_br.getFalseDest()});
+            emit(Code::Branch).a = cond;
+        }else if (auto exec = mlir::dyn_cast<mlir::scf::ExecuteRegionOp>(op)){
+            compileRegion(f, exec.getRegion());
+        }else if (auto if_stmt = mlir::dyn_cast<mlir::scf::IfOp>(op)){
+            int cond = slotOf(if_stmt.getCondition());
+            int check = f.code.size();
+            emit(Code::If).a = cond;
+            compileRegion(f, if_stmt.getThenRegion());
+            int skip = f.code.size();
+            emit(Code::Jump);
+            f.code[check].b = f.code.size();
+            compileRegion(f, if_stmt.getElseRegion());
+            f.code[skip].a = f.code.size();
+        }else if (auto for_stmt = mlir::dyn_cast<mlir::AffineForOp>(op)){
+            // get start, end, step value
+            int iv = slotOf(for_stmt.getBody()->getArgument(0));
+            int end = newSlot();
+            int lslot = -1, rslot = -1, lval = 0, rval = 0;
+            auto lmap = for_stmt.getLowerBoundMap();
+            if (lmap != singleSymbol){
+                lval = lmap.getSingleConstantResult();
+            }else{
+                lslot = slotOf(for_stmt.getLowerBound().getOperand(0));
+            }
+            auto rmap = for_stmt.getUpperBoundMap();
+            if (rmap != singleSymbol){
+                rval = rmap.getSingleConstantResult();
+            }else{
+                rslot = slotOf(for_stmt.getUpperBound().getOperand(0));
+            }
+            auto &init = emit(Code::ForInit);
+            init.a = iv;
+            init.b = end;
+            init.c = rval;
+            init.d = for_stmt.getStep();
+            init.imm = varValue(lval);
+            init.args = {lslot, rslot};
+            int check = f.code.size();
+            auto &cond = emit(Code::ForCheck);
+            cond.a = iv;
+            cond.b = end;
+            compileRegion(f, *for_stmt.getBody()->getParent());
+            auto &next = emit(Code::ForNext);
+            next.a = iv;
+            next.c = check;
+            next.d = for_stmt.getStep();
+            f.code[check].c = f.code.size();
+        }else if (mlir::isa<mlir::scf::WhileOp>(op)){
+            // while stmt may in dead cycle, user can use for stmt instead.
+            emitFailure("qcis don't support while stmt yet, you can use for stmt instead");
+        }else if (mlir::isa<mlir::memref::DeallocOp, AccumulateGPhase, DeclareQOpOp, PassOp, mlir::scf::ConditionOp>(op)){
+            // every alloc has its own array, and qcis has no gphase, just jump them
+        }else{
+            emit(Code::Error);
         }
-        
-        if (outOfBorder(var_name, index)) return error(op.getLoc(), "index out of border");
-        setVarValue(var_name, index, val);
-        
-        return mlir::success();
     }
 
-    mlir::LogicalResult visitOp(mlir::memref::CastOp op) override{
-        return error(op.getLoc(), "qcis don't support dynamic array");
+    void define(int slot, varValue val){
+        slots[slot].defined = true;
+        slots[slot].val = val;
     }
 
-    mlir::LogicalResult visitBinaryOp(char op, mlir::Value lhs, mlir::Value rhs, mlir::Value ret){
-        
-        // get lhs's and rhs's value from intValueTable
-        auto lhs_v = getValue(mlir::hash_value(lhs)).second;
-        auto rhs_v = getValue(mlir::hash_value(rhs)).second;
-        varValue val;
-        switch (op)
-        {
-        case '+':
-            val = lhs_v + rhs_v;
-            break;
-        case '-':
-            val = lhs_v - rhs_v;
-            break;
-        case '*':
-            val = lhs_v * rhs_v;
-            break;
-        case '/':
-            val = lhs_v / rhs_v;
-            break;
-        case '%':
-            val = lhs_v % rhs_v;
-            break;
-        default:
-            return mlir::failure();
-            break;
-        }
-        auto code = mlir::hash_value(ret);
-        valueTable[code] = val;
-        return mlir::success();
+    // Undefined values read as -1.
+    varValue peek(int slot){
+        return slots[slot].defined ? slots[slot].val : varValue(-1);
     }
 
-    mlir::LogicalResult visitOp(mlir::arith::AddIOp op) override{
-        return visitBinaryOp('+', op.getLhs(), op.getRhs(), op.getResult());
-    }
-    mlir::LogicalResult visitOp(mlir::arith::SubIOp op) override{
-        return visitBinaryOp('-', op.getLhs(), op.getRhs(), op.getResult());
-    }
-    mlir::LogicalResult visitOp(mlir::arith::MulIOp op) override{
-        return visitBinaryOp('*', op.getLhs(), op.getRhs(), op.getResult());
-    }
-    mlir::LogicalResult visitOp(mlir::arith::DivSIOp op) override{
-        return visitBinaryOp('/', op.getLhs(), op.getRhs(), op.getResult());
-    }
-    mlir::LogicalResult visitOp(mlir::arith::RemSIOp op) override{
-        return visitBinaryOp('%', op.getLhs(), op.getRhs(), op.getResult());
-    }
-    mlir::LogicalResult visitOp(mlir::arith::AddFOp op) override{
-        return visitBinaryOp('+', op.getLhs(), op.getRhs(), op.getResult());
-    }
-    mlir::LogicalResult visitOp(mlir::arith::SubFOp op) override{
-        return visitBinaryOp('-', op.getLhs(), op.getRhs(), op.getResult());
-    }
-    mlir::LogicalResult visitOp(mlir::arith::MulFOp op) override{
-        return visitBinaryOp('*', op.getLhs(), op.getRhs(), op.getResult());
-    }
-    mlir::LogicalResult visitOp(mlir::arith::DivFOp op) override{
-        return visitBinaryOp('/', op.getLhs(), op.getRhs(), op.getResult());
+    // Adds the values of `indices` to `index`.
+    bool addIndices(llvm::ArrayRef<int> indices, int& index){
+        for (auto slot: indices){
+            if (!slots[slot].defined) return false;
+            index += slots[slot].val.ival;
+        }
+        return true;
+    }
+
+    bool isPure(Function& f){
+        if (f.purity == Purity::Pure) return true;
+        // a function on a call cycle is not memoized
+        if (f.purity != Purity::Unknown) return false;
+        f.purity = Purity::Computing;
+        bool pure = true;
+        for (auto &in: f.code){
+            if (in.code == Code::Global || in.code == Code::Measure){
+                pure = false;
+            }else if (in.code == Code::Call){
+                pure = in.func && isPure(*in.func);
+            }else if ((in.code == Code::UseGate || in.code == Code::SetGate) && gates[in.a].kind == GateKind::Deriving){
+                pure = gates[in.a].func && isPure(*gates[in.a].func);
+            }
+            if (!pure) break;
+        }
+        f.purity = pure ? Purity::Pure : Purity::Impure;
+        return pure;
+    }
+
+    // Classical argument values, and for each qubit argument the first argument holding the same qubit.
+    // Unused arguments are left out.
+    vector<int64_t> memoKey(Function& f, llvm::ArrayRef<varValue> args){
+        vector<int64_t> key;
+        for (auto i = 0; i < f.args.size(); i++){
+            if (!f.args[i].used){
+                key.push_back(-1);
+            }else if (f.args[i].qubit){
+                int first = 0;
+                while (args[first].ival != args[i].ival || !f.args[first].qubit) first++;
+                key.push_back(first);
+            }else{
+                int64_t bits;
+                memcpy(&bits, &args[i].dval, sizeof(bits));
+                key.push_back(args[i].ival);
+                key.push_back(bits);
+            }
+        }
+        return key;
+    }
+
+    // Calls `f`, replaying the gates of an earlier call with the same key if `f` is pure.
+    mlir::LogicalResult call(Function& f, llvm::ArrayRef<varValue> args, mlir::Operation* site){
+        if (f.active) return error(site->getLoc(), "qcis don't support two function call each other");
+        if (f.isPrivate || args.size() < f.args.size() || !isPure(f)) return bindAndEnter(f, args, site);
+        auto key = memoKey(f, args);
+        auto iter = f.memos.find(key);
+        if (iter != f.memos.end()) return replay(iter->second, args);
+        auto start = trace.size();
+        recording++;
+        auto result = bindAndEnter(f, args, site);
+        recording--;
+        if (mlir::succeeded(result)) memoize(f, std::move(key), args, start);
+        if (recording == 0){
+            trace.clear();
+            traceOverflow = false;
+        }
+        return result;
+    }
+
+    void memoize(Function& f, vector<int64_t> key, llvm::ArrayRef<varValue> args, size_t start){
+        if (traceOverflow || memoGates + trace.size() - start > MEMO_LIMIT) return;
+        Memo memo;
+        memo.result = func_res;
+        for (auto i = start; i < trace.size(); i++){
+            auto emitted = trace[i];
+            for (auto &q: emitted.qubits){
+                int k = 0;
+                while (k < args.size() && (!f.args[k].qubit || args[k].ival != q)) k++;
+                // a qubit not passed as argument, keep the call unmemoized
+                if (k == args.size()) return;
+                q = k;
+            }
+            memo.gates.push_back(std::move(emitted));
+        }
+        memoGates += memo.gates.size();
+        f.memos.emplace(std::move(key), std::move(memo));
     }
 
-    mlir::LogicalResult visitOp(UseGateOp op) override{
-        // save gate name in gateTable
-        auto attr = op.getNameAttr();
-        auto gate = attr.getLeafReference().str();
-        auto rcode = mlir::hash_value(op.getResult());
-        vector<double> angle;
-        for (auto par : op.getParameters()){
-            size_t code = size_t(mlir::hash_value(par));
-            auto b_f = getValue(code);
-            if (b_f.first == false) return error(op.getLoc(), "gate need a determined angle");
-            angle.push_back(b_f.second.dval);
+    mlir::LogicalResult replay(const Memo& memo, llvm::ArrayRef<varValue> args){
+        llvm::SmallVector<varValue, 4> qbit;
+        for (auto &emitted: memo.gates){
+            qbit.clear();
+            for (auto k: emitted.qubits){
+                if (measured.count(args[k].ival) == 1) return error(emitted.op->getLoc(), "qbit has already measured, can not use again.");
+                qbit.push_back(args[k]);
+            }
+            emitGate(emitted.gate, qbit, emitted.op);
         }
-        gateTable[rcode] = make_pair(gate, angle);
+        func_res = memo.result;
         return mlir::success();
     }
 
-    mlir::LogicalResult visitOp(DecorateOp op) override{
-        if (op.getCtrl().size()!=0) return error(op.getLoc(), "qcis don't support 'ctrl' and 'nctrl' decorate");
-        auto usegate_op = llvm::dyn_cast<UseGateOp>(op.getArgs().getDefiningOp());
-        if(!usegate_op) return mlir::failure();
-        auto gate = usegate_op.getNameAttr().getLeafReference().str();
-        auto rcode = mlir::hash_value(op.getResult());
-        vector<double> angle;
-        if (op.getAdjoint() == true){    
-            if (gate == "T"){
-                gateTable[rcode] = make_pair("TD", angle);
-            }else if (gate == "S"){
-                gateTable[rcode] = make_pair("SD", angle);
+    // Binds args and runs a function called from `site`.
+    mlir::LogicalResult bindAndEnter(Function& f, llvm::ArrayRef<varValue> args, mlir::Operation* site){
+        for (auto indexed_arg: llvm::enumerate(f.args)){
+            auto &arg = indexed_arg.value();
+            auto idx = indexed_arg.index();
+            if (arg.array) return error(f.op->getLoc(), "qcis func don't support array as arg");
+            if (!arg.used) continue;
+            if (idx >= args.size()) return error(site->getLoc(), "wrong number of args");
+            if (arg.sym >= 0){
+                symbols[arg.sym][0] = args[idx];
+                slots[arg.slot].view = View{arg.sym, 0};
             }else{
-                return error(op.getLoc(), "decorate 'inv' can only use at 'T' or 'S' gate");
+                define(arg.slot, args[idx]);
             }
-            return mlir::success();
-        }
-        return error(op.getLoc(), "invalid decorate");
-    }
-
-    mlir::LogicalResult visitOp(ApplyGateOp op) override{
-
-        auto gate = gateTable[mlir::hash_value(op.getGate())].first;
-        // get args
-        // qbit <memref> : get value from symbolTable
-        // if qbit has already measured, error
-        vector<varValue> args;
-        for (auto indexed_operand : ::llvm::enumerate(op.getArgs())){
-            auto index = indexed_operand.index();
-            auto operand = indexed_operand.value();
-            auto b_i = getValue(mlir::hash_value(operand));
-            if (b_i.first == false) return error(op.getLoc(), "gate operate need use determined qbit");
-            if (measured.count(b_i.second.ival) == 1) return error(op.getLoc(), "qbit has already measured, can not use again.");
-            args.push_back(b_i.second);
         }
-        if (baseGate.count(gate) == 1){
-            // baseGate direct print qcis
-            QcisPrint(gate, args);
-        }else if(derivingGate(gate)) {
-            // deriving gate visit func body
-            auto func_name = gateMap[gate];
-            if (visitFunc.count(func_name) == 1) return error(op.getLoc(), "qcis don't support two function call each other");
-            if (mlir::failed(updateArgs(funcMap[func_name], args))) return mlir::failure();
-            visitFunc.insert(func_name);
-            if (mlir::failed(visitOp(funcMap[func_name]))) return mlir::failure();
-            visitFunc.erase(func_name);
-        }else{
-            if (gate == "Rx" || gate == "Ry"){
-                auto angle = gateTable[mlir::hash_value(op.getGate())].second[0];
-                if (abs(abs(angle) - M_PI / 2) < EPS){
-                    if (gate == "Rx"){
-                        if (angle > 0) QcisPrint("X2P", args);
-                        if (angle < 0) QcisPrint("X2M", args);
+        return enter(f);
+    }
+
+    mlir::LogicalResult enter(Function& f){
+        if (f.isPrivate) return mlir::success();
+        f.active = true;
+        auto result = run(f);
+        f.active = false;
+        return result;
+    }
+
+    // Runs `f`. Gates of ops tagged by isq-schedule are held back and emitted in layer order, up to the
+    // next point where control flow or a call may emit other gates.
+    mlir::LogicalResult run(Function& f){
+        // Inside a tagged op, the gates of the callee share the layer of the op.
+        if (pendingLayer >= 0) return runCode(f);
+        vector<Pending> buffer;
+        auto outer = pending;
+        pending = &buffer;
+        auto result = runCode(f);
+        flushPending();
+        pending = outer;
+        return result;
+    }
+
+    mlir::LogicalResult runCode(Function& f){
+        auto &code = f.code;
+        int pc = 0;
+        int size = code.size();
+        while (pc < size){
+            auto &in = code[pc++];
+            if (pendingLayer < 0 && breaksLayers(in.code)) flushPending();
+            switch (in.code)
+            {
+            case Code::Const:
+                define(in.a, in.imm);
+                break;
+            case Code::Copy:
+            case Code::IToF:
+            case Code::NegF:{
+                if (!slots[in.a].defined) define(in.a, varValue());
+                auto val = slots[in.a].val;
+                if (in.code == Code::IToF) val = varValue(double(val.ival));
+                if (in.code == Code::NegF) val = varValue(-1.0 * val.dval);
+                define(in.b, val);
+                break;
+            }
+            case Code::Binary:{
+                auto lhs_v = peek(in.a);
+                auto rhs_v = peek(in.b);
+                varValue val;
+                switch (in.imm.ival)
+                {
+                case '+':
+                    val = lhs_v + rhs_v;
+                    break;
+                case '-':
+                    val = lhs_v - rhs_v;
+                    break;
+                case '*':
+                    val = lhs_v * rhs_v;
+                    break;
+                case '/':
+                    val = lhs_v / rhs_v;
+                    break;
+                default:
+                    val = lhs_v % rhs_v;
+                    break;
+                }
+                define(in.c, val);
+                break;
+            }
+            case Code::CmpI:{
+                if (!slots[in.a].defined || !slots[in.b].defined) return error(in.op->getLoc(), "condition need determined value");
+                int lval = slots[in.a].val.ival, rval = slots[in.b].val.ival;
+                bool ans;
+                switch (in.imm.ival)
+                {
+                case 0:
+                    ans = (lval == rval);
+                    break;
+                case 1:
+                    ans = (lval != rval);
+                    break;
+                case 2:
+                    ans = (lval < rval);
+                    break;
+                case 3:
+                    ans = (lval <= rval);
+                    break;
+                case 4:
+                    ans = (lval > rval);
+                    break;
+                case 5:
+                    ans = (lval >= rval);
+                    break;
+                default:
+                    return error(in.op->getLoc(), "condition is not support in qcis");
+                }
+                define(in.c, varValue(int(ans)));
+                break;
+            }
+            case Code::Global:
+                slots[in.c].view = View{in.a, 0};
+                break;
+            case Code::Alloc:
+                std::fill(symbols[in.a].begin(), symbols[in.a].end(), varValue());
+                slots[in.c].view = View{in.a, 0};
+                break;
+            case Code::SubView:{
+                auto src = slots[in.a].view;
+                if (src.sym < 0) return error(in.op->getLoc(), "get var error");
+                int offset = in.imm.ival;
+                if (in.b >= 0){
+                    if (!slots[in.b].defined) return error(in.op->getLoc(), "index must a determined number");
+                    offset = slots[in.b].val.ival;
+                }
+                int index = src.index + offset;
+                if (outOfBorder(src.sym, index)) return error(in.op->getLoc(), "index out of border");
+                slots[in.c].view = View{src.sym, index};
+                break;
+            }
+            case Code::Load:{
+                auto mem = slots[in.a].view;
+                if (mem.sym < 0) return error(in.op->getLoc(), "load value error");
+                int index = mem.index;
+                if (!addIndices(in.args, index)) return error(in.op->getLoc(), "index must a determined number");
+                if (outOfBorder(mem.sym, index)) return error(in.op->getLoc(), "index out of border");
+                define(in.c, symbols[mem.sym][index]);
+                break;
+            }
+            case Code::Store:{
+                if (!slots[in.a].defined) return error(in.op->getLoc(), "must assign a determined int value");
+                auto mem = slots[in.b].view;
+                if (mem.sym < 0) return error(in.op->getLoc(), "get left var error");
+                int index = mem.index;
+                if (!addIndices(in.args, index)) return error(in.op->getLoc(), "index must be a determined value");
+                if (outOfBorder(mem.sym, index)) return error(in.op->getLoc(), "index out of border");
+                symbols[mem.sym][index] = slots[in.a].val;
+                break;
+            }
+            case Code::UseGate:{
+                auto &gate = slots[in.c];
+                gate.gate = in.a;
+                gate.angles.clear();
+                for (auto par: in.args){
+                    if (!slots[par].defined) return error(in.op->getLoc(), "gate need a determined angle");
+                    gate.angles.push_back(slots[par].val.dval);
+                }
+                break;
+            }
+            case Code::SetGate:
+                slots[in.c].gate = in.a;
+                slots[in.c].angles.clear();
+                break;
+            case Code::Apply:
+                if (in.layer >= 0 && pending && pendingLayer < 0){
+                    pendingLayer = in.layer;
+                    auto result = runApply(in);
+                    pendingLayer = -1;
+                    TRY(result);
+                }else{
+                    TRY(runApply(in));
+                }
+                break;
+            case Code::Measure:
+                // if qbit has already measured, error
+                for (auto slot: in.args){
+                    if (!slots[slot].defined) return error(in.op->getLoc(), "measure a determined qbit");
+                    auto qbit = slots[slot].val;
+                    if (measured.count(qbit.ival) == 1) return error(in.op->getLoc(), "qbit has already measured, can not use again.");
+                    emitMeasure(qbit, in);
+                    measured.insert(qbit.ival);
+                }
+                define(in.c, varValue());
+                break;
+            case Code::Call:{
+                llvm::SmallVector<varValue, 4> args;
+                for (auto i = 0; i < in.args.size(); i++){
+                    auto &slot = slots[in.args[i]];
+                    if (in.kinds[i] == ScalarArg){
+                        if (!slot.defined) return error(in.op->getLoc(), "call func args need use determined value");
+                        args.push_back(slot.val);
+                    }else if (in.kinds[i] == QubitArg){
+                        if (slot.view.sym < 0) return error(in.op->getLoc(), "call func args need use determined qbit");
+                        if (outOfBorder(slot.view.sym, slot.view.index)) return error(in.op->getLoc(), "index out of border");
+                        args.push_back(symbols[slot.view.sym][slot.view.index]);
                     }else{
-                        if (angle > 0) QcisPrint("Y2P", args);
-                        if (angle < 0) QcisPrint("Y2M", args);
+                        return error(in.op->getLoc(), "qcis func args only support 'int', 'double' and 'qbit' type");
                     }
-                    return mlir::success();
                 }
-                return error(op.getLoc(), "in qcis, gate "+gate+" only support +-pi/2");
+                if (!in.func) return error(in.op->getLoc(), "qcis can not find the called function");
+                TRY(call(*in.func, args, in.op));
+                if (in.c >= 0) define(in.c, func_res);
+                break;
             }
-            return error(op.getLoc(), "gate "+gate+" is not support in qcis.");
-        }
-
-        for (auto indexed_result : ::llvm::enumerate(op->getResults())){
-            auto index = indexed_result.index();
-            auto result = indexed_result.value();
-            auto code = mlir::hash_value(result);
-            valueTable[code] = args[index];
-        }
-
-        return mlir::success();
-    }
-
-    mlir::LogicalResult updateArgs(mlir::func::FuncOp op, vector<varValue>& args){
-        // store args
-        // index: store in intValueTable
-        // qbit: store in symbolTable and indexTable
-        auto func_block = op.getBody().getBlocks().begin();
-        int idx = 0;
-        for (auto &arg: func_block->getArguments()){
-            if (arg.getType().isa<mlir::MemRefType>()){
-                if (arg.getType().dyn_cast<mlir::MemRefType>().getShape()[0] != 1) return error(op->getLoc(), "qcis func don't support array as arg");
-                if (!arg.use_empty()){
-                    auto code = mlir::hash_value(arg);
-                    string arg_name = getTmpName();
-                    symbolTable[arg_name] = {{0, args[idx]}};
-                    indexTable[code] = make_pair(arg_name, 0);
+            case Code::Return:
+                if (in.a >= 0){
+                    if (!slots[in.a].defined) return error(in.op->getLoc(), "func return need be a deternimed value");
+                    func_res = slots[in.a].val;
                 }
-            }else{
-                if (!arg.use_empty()){
-                    auto code = mlir::hash_value(arg);
-                    valueTable[code] = args[idx];
+                return mlir::success();
+            case Code::Jump:
+                pc = in.a;
+                break;
+            case Code::Branch:
+                if (!slots[in.a].defined) return error(in.op->getLoc(), "jump condition must be a determined boolean");
+                pc = slots[in.a].val.ival == 0 ? in.c : in.b;
+                break;
+            case Code::If:
+                if (!slots[in.a].defined) return error(in.op->getLoc(), "if need a determined condition");
+                if (slots[in.a].val.ival != 1) pc = in.b;
+                break;
+            case Code::ForInit:{
+                int lval = in.imm.ival, rval = in.c;
+                if (in.args[0] >= 0){
+                    if (!slots[in.args[0]].defined) return error(in.op->getLoc(), "for start need a determined value");
+                    lval = slots[in.args[0]].val.ival;
+                }
+                if (in.args[1] >= 0){
+                    if (!slots[in.args[1]].defined) return error(in.op->getLoc(), "for end need a determined value");
+                    rval = slots[in.args[1]].val.ival;
                 }
+                if (in.d == 0) return error(in.op->getLoc(), "for-loop in dead loop, please set step a positive number");
+                define(in.a, varValue(lval));
+                define(in.b, varValue(rval));
+                break;
+            }
+            case Code::ForCheck:
+                if (slots[in.a].val.ival >= slots[in.b].val.ival) pc = in.c;
+                break;
+            case Code::ForNext:
+                slots[in.a].val.ival += in.d;
+                pc = in.c;
+                break;
+            case Code::Error:
+                if (in.a >= 0) return error(in.op->getLoc(), messages[in.a]);
+                return mlir::failure();
             }
-            idx += 1;
         }
-
         return mlir::success();
     }
 
-    mlir::LogicalResult visitOp(CallQOpOp op) override {
-        string qop_name = op->getAttr(llvm::StringRef("callee")).dyn_cast<mlir::SymbolRefAttr>().getLeafReference().str();
-        // only measure support
-        if (qop_name != "__isq__builtin__measure") return error(op.getLoc(), "sorry, qcis can only do measure qop");
-        // get measure qbit
+    mlir::LogicalResult runApply(const Instr& in){
         // if qbit has already measured, error
-        for (auto indexOperand : llvm::enumerate(op->getOperands())){
-            auto operand = indexOperand.value();
-            size_t code = size_t(mlir::hash_value(operand));
-            auto b_i  = getValue(code);
-            if (b_i.first == false) return error(op.getLoc(), "measure a determined qbit");
-            if (measured.count(b_i.second.ival) == 1) return error(op.getLoc(), "qbit has already measured, can not use again.");
-            QcisPrint("M", {b_i.second});
-            measured.insert(b_i.second.ival);
-        }
-        auto rcode = mlir::hash_value(op.getResult(1));
-        valueTable[rcode] = varValue();
-        return mlir::success();
-    }
-
-    mlir::LogicalResult visitOp(AccumulateGPhase op) override {
-        // qcis don't has gphase, just jump it
-        return mlir::success();
-    }
-
-    mlir::LogicalResult visitOp(DeclareQOpOp op) override {
-        return mlir::success();
-    }
-
-    mlir::LogicalResult visitOp(mlir::func::CallOp op) override{
-        auto func_name = op.getCalleeAttr().getValue().str();
-        // get args
-        // index : get value from intValueTable
-        // qbit <memref> : get value from symbolTable
-        vector<varValue> args;
-        for (auto indexOperand : ::llvm::enumerate(op.getOperands())){
-            auto operand = indexOperand.value();
-            if (operand.getType().isa<mlir::IndexType>() || operand.getType().isa<mlir::FloatType>()){
-                auto b_i = getValue(mlir::hash_value(operand));
-                if (b_i.first == false) return error(op.getLoc(), "call func args need use determined value");
-                args.push_back(b_i.second);
-            }else if (operand.getType().isa<mlir::MemRefType>()){
-                if (operand.getType().dyn_cast<mlir::MemRefType>().getElementType().isa<QStateType>()){
-                    auto s_i = getIndex(mlir::hash_value(operand));
-                    if (s_i.second < 0) return error(op.getLoc(), "call func args need use determined qbit");
-                    args.push_back(getVarValue(s_i.first, s_i.second));
+        llvm::SmallVector<varValue, 4> args;
+        for (auto slot: in.args){
+            if (!slots[slot].defined) return error(in.op->getLoc(), "gate operate need use determined qbit");
+            if (measured.count(slots[slot].val.ival) == 1) return error(in.op->getLoc(), "qbit has already measured, can not use again.");
+            args.push_back(slots[slot].val);
+        }
+        auto &gate = slots[in.a];
+        if (gate.gate < 0) return error(in.op->getLoc(), "gate  is not support in qcis.");
+        auto &desc = gates[gate.gate];
+        switch (desc.kind)
+        {
+        case GateKind::Base:
+            // baseGate direct print qcis
+            emitGate(desc.name, args, in.op);
+            break;
+        case GateKind::Deriving:
+            // deriving gate runs func body
+            if (!desc.func) return error(in.op->getLoc(), "qcis can not find the body of gate "+desc.name);
+            TRY(call(*desc.func, args, in.op));
+            break;
+        case GateKind::Rotation:{
+            if (gate.angles.empty()) return error(in.op->getLoc(), "gate "+desc.name+" need a determined angle");
+            auto angle = gate.angles[0];
+            if (abs(abs(angle) - M_PI / 2) < EPS){
+                if (desc.name == "Rx"){
+                    if (angle > 0) emitGate("X2P", args, in.op);
+                    if (angle < 0) emitGate("X2M", args, in.op);
                 }else{
-                    return error(op.getLoc(), "qcis func args only support 'int', 'double' and 'qbit' type");
+                    if (angle > 0) emitGate("Y2P", args, in.op);
+                    if (angle < 0) emitGate("Y2M", args, in.op);
                 }
-            }else{
-                return error(op.getLoc(), "qcis func args only support 'int', 'double' and 'qbit' type");
+                return mlir::success();
             }
+            return error(in.op->getLoc(), "in qcis, gate "+desc.name+" only support +-pi/2");
         }
-        
-        // visit func body
-        if (visitFunc.count(func_name) == 1) return error(op.getLoc(), "qcis don't support two function call each other");
-        if (mlir::failed(updateArgs(funcMap[func_name], args))) return mlir::failure();
-        visitFunc.insert(func_name);
-        if (mlir::failed(visitOp(funcMap[func_name]))) return mlir::failure();
-        visitFunc.erase(func_name);
-
-        if (op.getNumResults() > 0){
-            auto code = mlir::hash_value(op.getResult(0));
-            valueTable[code] = func_res;
+        case GateKind::Unsupported:
+            return error(in.op->getLoc(), "gate "+desc.name+" is not support in qcis.");
         }
-
-        return mlir::success();
-    }
-
-    mlir::LogicalResult visitOp(mlir::func::ReturnOp op) override{
-        if (op.getOperands().size() > 0){
-            auto code = mlir::hash_value(op.getOperand(0));
-            auto b_v = getValue(code);
-            if (b_v.first == false) return error(op.getLoc(), "func return need be a deternimed value");
-            func_res = b_v.second;
+        for (auto i = 0; i < in.res.size(); i++){
+            define(in.res[i], args[i]);
         }
         return mlir::success();
     }
-    mlir::LogicalResult visitOp(PassOp op) override{
-        return mlir::success();
-    }
-    mlir::LogicalResult visitOp(mlir::AffineYieldOp op) override{
-        return mlir::success();
-    }
-    mlir::LogicalResult visitOp(mlir::scf::YieldOp op) override{
-        return mlir::success();
-    }
 
-    mlir::LogicalResult visitOp(mlir::scf::ExecuteRegionOp op) override{
-
-        auto exec_block = op.getRegion().getBlocks().begin();
-        return visitBlock(&*exec_block);
+    mlir::LogicalResult error(mlir::Location loc, string msg){
+        emitError(loc, msg);
+        return mlir::failure();
     }
 
-    mlir::LogicalResult visitOp(mlir::AffineForOp for_stmt) override{
-        
-        int lval, rval, step;
-        // get start, end, step value
-        auto lmap = for_stmt.getLowerBoundMap();
-        if (lmap != singleSymbol){
-            lval = lmap.getSingleConstantResult();
-        }else{
-            size_t opcode = size_t(mlir::hash_value(for_stmt.getLowerBound().getOperand(0)));
-            auto b_i = getValue(opcode);
-            if (b_i.first == false) return error(for_stmt.getLoc(), "for start need a determined value");
-            lval = b_i.second.ival;
+    // Prints a gate applied by `op`, and traces it for the memoizable calls running.
+    // Traces keep program order; gates of a tagged op are held back until the next flush.
+    void emitGate(llvm::StringRef gate, llvm::ArrayRef<varValue> qbit, mlir::Operation* op){
+        if (recording && !traceOverflow && memoGates + trace.size() >= MEMO_LIMIT){
+            traceOverflow = true;
+            vector<Emitted>().swap(trace);
         }
-
-        auto rmap = for_stmt.getUpperBoundMap();
-        if (rmap != singleSymbol){
-            rval = rmap.getSingleConstantResult();
-        }else{
-            size_t opcode = size_t(mlir::hash_value(for_stmt.getUpperBound().getOperand(0)));
-            auto b_i = getValue(opcode);
-            if (b_i.first == false) return error(for_stmt.getLoc(), "for end need a determined value");
-            rval = b_i.second.ival;
+        if (recording && !traceOverflow){
+            Emitted emitted{gate, {}, op};
+            for (auto q: qbit) emitted.qubits.push_back(q.ival);
+            trace.push_back(std::move(emitted));
         }
-
-        step = for_stmt.getStep();
-        if (step == 0) return error(for_stmt.getLoc(), "for-loop in dead loop, please set step a positive number");
-        // use for loop to visit for-loop-body
-        auto block = for_stmt.getBody();
-        for (int i = lval; i < rval; i += step){
-            auto code = mlir::hash_value(block->getArgument(0));
-            valueTable[code] = varValue(i);
-            if (mlir::failed(visitBlock(block))) return mlir::failure();
+        if (pendingLayer >= 0){
+            pending->push_back(Pending{unsigned(pendingLayer), gate, llvm::SmallVector<varValue, 2>(qbit.begin(), qbit.end())});
+            return;
         }
-        
-        return mlir::success();
+        flushPending();
+        QcisPrint(gate, qbit);
     }
 
-    mlir::LogicalResult visitOp(mlir::arith::CmpIOp op) override{
-        
-        int lval, rval;
-        // get cmp's lhs and rhs value
-        for (auto indexOperand : llvm::enumerate(op->getOperands())){
-            auto operand = indexOperand.value();
-            size_t code = size_t(mlir::hash_value(operand));
-            auto b_i = getValue(code);
-            if (b_i.first == false) return error(op.getLoc(), "condition need determined value");
-            if (indexOperand.index() == 0){
-                lval = b_i.second.ival;
-            }else{
-                rval = b_i.second.ival;
-            }
+    void emitMeasure(varValue qbit, const Instr& in){
+        auto layer = pendingLayer >= 0 ? pendingLayer : (pending ? in.layer : -1);
+        if (layer >= 0){
+            pending->push_back(Pending{unsigned(layer), "M", {qbit}});
+            return;
         }
-        bool ans;
-        int pred = static_cast<int>(op.getPredicate());
-        switch (pred)
-        {
-        case 0:
-            ans = (lval == rval);
-            break;
-        case 1:
-            ans = (lval != rval);
-            break;
-        case 2:
-            ans = (lval < rval);
-            break;
-        case 3:
-            ans = (lval <= rval);
-            break;
-        case 4:
-            ans = (lval > rval);
-            break;
-        case 5:
-            ans = (lval >= rval);
-            break;
+        flushPending();
+        QcisPrint("M", {qbit});
+    }
+
+    // Prints the held back gates by layer. Gates of one layer keep program order.
+    void flushPending(){
+        if (!pending || pending->empty()) return;
+        std::stable_sort(pending->begin(), pending->end(), [](const Pending& a, const Pending& b){
+            return a.layer < b.layer;
+        });
+        for (auto &p: *pending) QcisPrint(p.gate, p.qubits);
+        pending->clear();
+    }
+
+    // Instructions after which gates of earlier layers may be emitted outside the tagged ops.
+    static bool breaksLayers(Code code){
+        switch (code){
+        case Code::Call: case Code::Return: case Code::Jump: case Code::Branch: case Code::If:
+        case Code::ForInit: case Code::ForCheck: case Code::ForNext: case Code::Error:
+            return true;
         default:
-            return error(op.getLoc(), "condition is not support in qcis");
-            break;
+            return false;
         }
-        // set condition value
-        auto code = mlir::hash_value(op->getOpResult(0));
-        valueTable[code] = varValue(int(ans));
-        return mlir::success();
-    }
-
-    mlir::LogicalResult visitOp(mlir::scf::IfOp if_stmt) override{
-        // get condition value
-        auto condition_code = mlir::hash_value(if_stmt.getCondition());
-        auto b_i = getValue(condition_code);
-        if (b_i.first == false) return error(if_stmt.getLoc(), "if need a determined condition");
-        
-        if (b_i.second.ival == 1){
-            return visitBlock(if_stmt.thenBlock());
-        }else{
-            return visitBlock(if_stmt.elseBlock());
-        }
-    }
-
-    mlir::LogicalResult visitOp(mlir::scf::WhileOp while_stmt) override{
-        // while stmt may in dead cycle, user can use for stmt instead. 
-        return error(while_stmt.getLoc(), "qcis don't support while stmt yet, you can use for stmt instead");
-    }
-
-    mlir::LogicalResult error(mlir::Location loc, string msg){
-        emitError(loc, msg);
-        return mlir::failure();
-    }
-
-    string getTmpName(){
-        auto name = tmp_head + to_string(tmp_cnt);
-        tmp_cnt += 1;
-        return name;
     }
 
-    void QcisPrint(string gate, vector<varValue> qbit){
+    void QcisPrint(llvm::StringRef gate, llvm::ArrayRef<varValue> qbit){
         if (gate == "CNOT"){
             QcisPrint("H", {qbit[1]});
             QcisPrint("CZ", qbit);
             QcisPrint("H", {qbit[1]});
+        }else if (target){
+            placeTimed(gate, qbit);
+        }else if (layers){
+            string line;
+            vector<unsigned> wires;
+            for (auto val: qbit) wires.push_back(val.ival);
+            if (binary){
+                llvm::raw_string_ostream encoded(line);
+                QcisWrite(encoded, gate, qbit);
+            }else{
+                line = gate.str();
+                for (auto val: qbit) line += " Q" + to_string(val.ival);
+                line += "\n";
+            }
+            vector<passes::WireBasis> basis(wires.size(), qcisBasis(gate));
+            if (gate == "M"){
+                // Measurement results are reported in order. Qubits start from 1, so wire 0 keeps M ops ordered.
+                wires.push_back(0);
+                basis.push_back(passes::WireBasis::General);
+            }
+            auto layer = scheduler.place(wires, basis);
+            if (layer >= layerText.size()) layerText.resize(layer+1);
+            layerText[layer] += line;
+        }else if (binary){
+            QcisWrite(os, gate, qbit);
         }else{
             os << gate;
             for (auto val: qbit) os << " Q" << val.ival;
@@ -937,48 +1363,75 @@ private:
         }
     }
 
-    bool derivingGate(string gate){
-        auto iter = gateMap.find(gate);
-        if (iter != gateMap.end()) return true;
-        return false;
-    }
-
-    pair<string, int>getIndex(size_t code){
-        
-        auto iter = indexTable.find(code);
-        if (iter != indexTable.end()){
-            return iter->second;
+    // ASAP on the circuit DAG: a gate starts once the previous gates on all its qubits have finished.
+    void placeTimed(llvm::StringRef gate, llvm::ArrayRef<varValue> qbit){
+        if (!timingError.empty()) return;
+        string line = gate.str();
+        for (auto val: qbit) line += " Q" + to_string(val.ival);
+        auto duration = target->duration(gate);
+        if (!duration){
+            timingError = "QCIS target gives no duration for " + gate.str();
+            return;
+        }
+        for (auto val: qbit){
+            if (val.ival < 1 || unsigned(val.ival) > target->size){
+                timingError = line + ": Q" + to_string(val.ival) + " is not on the " + to_string(target->size) + "-qubit target";
+                return;
+            }
+        }
+        if (qbit.size() == 2 && !target->coupled(qbit[0].ival, qbit[1].ival)){
+            timingError = line + ": qubits are not coupled on the target, route them with --isq-route-qubits first";
+            return;
         }
-        return make_pair("", -1);
+        uint64_t start = gate == "M" ? lastMeasure : 0;
+        for (auto val: qbit) start = std::max(start, ready[val.ival]);
+        for (auto val: qbit) ready[val.ival] = start + *duration;
+        if (gate == "M") lastMeasure = start;
+        makespan = std::max(makespan, start + *duration);
+        timed.push_back({start, line + "\n"});
     }
 
-    pair<bool, varValue> getValue(size_t code){
+    static void QcisWrite(llvm::raw_ostream& out, llvm::StringRef gate, llvm::ArrayRef<varValue> qbit){
+        llvm::SmallVector<int64_t, 2> qubits;
+        for (auto val: qbit) qubits.push_back(val.ival);
+        writeQCISInstruction(out, qcisOpcode(gate), qubits);
+    }
 
-        auto iter = valueTable.find(code);
-        if (iter != valueTable.end()){
-            return make_pair(true, iter->second);
-        }
-        return make_pair(false, -1);
+    static passes::WireBasis qcisBasis(llvm::StringRef gate){
+        if (gate == "Z" || gate == "S" || gate == "SD" || gate == "T" || gate == "TD" || gate == "CZ") return passes::WireBasis::Z;
+        if (gate == "X" || gate == "X2P" || gate == "X2M") return passes::WireBasis::X;
+        if (gate == "Y" || gate == "Y2P" || gate == "Y2M") return passes::WireBasis::Y;
+        return passes::WireBasis::General;
     }
 
-    bool outOfBorder(string name, int index){
-        auto iter = symbolTable.find(name);
-        if (iter != symbolTable.end()){
-            auto iiter = iter->second.find(index);
-            if (iiter == iter->second.end()) return true;
+    // Layers are separated by an empty line, or a Layer instruction in binary.
+    void printLayers(){
+        for (auto i = 0; i < layerText.size(); i++){
+            if (i > 0){
+                if (binary) writeQCISInstruction(os, QCISOpcode::Layer, {});
+                else os << "\n";
+            }
+            os << layerText[i];
         }
-        return false;
     }
 
-    varValue getVarValue(string name, int index){
-        auto iter = symbolTable.find(name);
-        auto iiter = iter->second.find(index);
-        return iiter->second;
+    // Each time slot starts with `# start <ns>`, and slots are separated by an empty line like layers.
+    // The total time comes last as `# makespan <ns>`.
+    void printTimed(){
+        std::stable_sort(timed.begin(), timed.end(), [](const Timed& a, const Timed& b){ return a.start < b.start; });
+        for (auto i = 0; i < timed.size(); i++){
+            if (i == 0 || timed[i].start != timed[i-1].start){
+                if (i > 0) os << "\n";
+                os << "# start " << timed[i].start << "\n";
+            }
+            os << timed[i].line;
+        }
+        if (!timed.empty()) os << "\n";
+        os << "# makespan " << makespan << "\n";
     }
 
-    void setVarValue(string name, int index, varValue val){
-        auto iter = symbolTable.find(name);
-        iter->second[index] = val;
+    bool outOfBorder(int sym, int index){
+        return index < 0 || index >= symbols[sym].size();
     }
 
     struct RaiiIndent{
@@ -1004,8 +1457,8 @@ private:
 
 namespace isq {
 namespace ir{
-mlir::LogicalResult generateQCIS(mlir::MLIRContext &context, mlir::ModuleOp &module, llvm::raw_string_ostream &os, bool printast) {
-    return MLIRPassImpl(context, module, os, printast).mlirPass();
+mlir::LogicalResult generateQCIS(mlir::MLIRContext &context, mlir::ModuleOp &module, llvm::raw_ostream &os, bool printast, bool layers, bool binary, llvm::StringRef timing) {
+    return MLIRPassImpl(context, module, os, printast, layers, binary, timing).mlirPass();
 }
 }
 }
\ No newline at end of file
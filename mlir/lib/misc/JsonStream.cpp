@@ -0,0 +1,36 @@
+#include "isq/utils/JsonStream.h"
+#include <llvm/Support/Format.h>
+namespace isq{
+namespace ir{
+
+void JsonStringStream::write_impl(const char* ptr, size_t size){
+    pos += size;
+    // Characters that need no escaping are written in runs.
+    size_t start = 0;
+    for(size_t i = 0; i < size; i++){
+        unsigned char c = ptr[i];
+        const char* escaped = nullptr;
+        switch(c){
+            case '"': escaped = "\\\""; break;
+            case '\\': escaped = "\\\\"; break;
+            case '\n': escaped = "\\n"; break;
+            case '\r': escaped = "\\r"; break;
+            case '\t': escaped = "\\t"; break;
+            case '\b': escaped = "\\b"; break;
+            case '\f': escaped = "\\f"; break;
+            default:
+                if(c >= 0x20) continue;
+        }
+        os.write(ptr + start, i - start);
+        start = i + 1;
+        if(escaped){
+            os << escaped;
+        }else{
+            os << llvm::format("\\u%04x", c);
+        }
+    }
+    os.write(ptr + start, size - start);
+}
+
+}
+}
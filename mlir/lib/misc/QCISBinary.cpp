@@ -0,0 +1,54 @@
+#include "isq/utils/QCISBinary.h"
+#include <cassert>
+#include <llvm/ADT/StringSwitch.h>
+#include <llvm/Support/EndianStream.h>
+#include <llvm/Support/LEB128.h>
+namespace isq{
+namespace ir{
+
+static const uint8_t qcisBinaryVersion = 1;
+
+QCISOpcode qcisOpcode(llvm::StringRef gate){
+    return llvm::StringSwitch<QCISOpcode>(gate)
+        .Case("X", QCISOpcode::X)
+        .Case("Y", QCISOpcode::Y)
+        .Case("Z", QCISOpcode::Z)
+        .Case("H", QCISOpcode::H)
+        .Case("S", QCISOpcode::S)
+        .Case("SD", QCISOpcode::SD)
+        .Case("T", QCISOpcode::T)
+        .Case("TD", QCISOpcode::TD)
+        .Case("X2P", QCISOpcode::X2P)
+        .Case("X2M", QCISOpcode::X2M)
+        .Case("Y2P", QCISOpcode::Y2P)
+        .Case("Y2M", QCISOpcode::Y2M)
+        .Case("CZ", QCISOpcode::CZ)
+        .Case("RX", QCISOpcode::RX)
+        .Case("RY", QCISOpcode::RY)
+        .Case("RZ", QCISOpcode::RZ)
+        .Case("RXY", QCISOpcode::RXY)
+        .Case("M", QCISOpcode::M)
+        .Default(QCISOpcode::Invalid);
+}
+
+void writeQCISHeader(llvm::raw_ostream& os){
+    os << "QCIS";
+    os.write(qcisBinaryVersion);
+}
+
+void writeQCISInstruction(llvm::raw_ostream& os, QCISOpcode op, llvm::ArrayRef<int64_t> qubits, llvm::ArrayRef<double> params){
+    assert(op != QCISOpcode::Invalid && "not a QCIS instruction");
+    os.write(static_cast<uint8_t>(op));
+    if (op == QCISOpcode::M){
+        llvm::encodeULEB128(qubits.size(), os);
+    }
+    for (auto q: qubits){
+        llvm::encodeULEB128(q, os);
+    }
+    for (auto p: params){
+        llvm::support::endian::write(os, p, llvm::support::little);
+    }
+}
+
+}
+}
@@ -0,0 +1,49 @@
+#include "isq/utils/QCISTarget.h"
+#include <llvm/Support/MemoryBuffer.h>
+#include <mlir/IR/Diagnostics.h>
+#include "nlohmann/json.hpp"
+namespace isq{
+namespace ir{
+
+bool QCISTarget::coupled(unsigned a, unsigned b) const{
+    return couplers.count({std::min(a, b), std::max(a, b)}) > 0;
+}
+
+std::optional<uint64_t> QCISTarget::duration(llvm::StringRef gate) const{
+    auto iter = durations.find(gate);
+    if (iter == durations.end()) iter = durations.find("default");
+    if (iter == durations.end()) return std::nullopt;
+    return iter->second;
+}
+
+mlir::FailureOr<QCISTarget> loadQCISTarget(llvm::StringRef path, mlir::Location loc){
+    auto buffer = llvm::MemoryBuffer::getFile(path);
+    if (!buffer){
+        mlir::emitError(loc) << "cannot open QCIS target " << path << ": " << buffer.getError().message();
+        return mlir::failure();
+    }
+    QCISTarget target;
+    try{
+        auto json = nlohmann::json::parse((*buffer)->getBuffer().str());
+        target.size = json.at("qbit_num").get<unsigned>();
+        for (auto& edge: json.at("topo")){
+            auto a = edge.at(0).get<unsigned>();
+            auto b = edge.at(1).get<unsigned>();
+            if (a < 1 || b < 1 || a > target.size || b > target.size){
+                mlir::emitError(loc) << "QCIS target has edge (" << a << ", " << b << ") outside of " << target.size << " qubits";
+                return mlir::failure();
+            }
+            target.couplers.insert({std::min(a, b), std::max(a, b)});
+        }
+        for (auto& [gate, ns]: json.at("durations").items()){
+            target.durations[gate] = ns.get<uint64_t>();
+        }
+    }catch (const nlohmann::json::exception& e){
+        mlir::emitError(loc) << "bad QCIS target " << path << ": " << e.what();
+        return mlir::failure();
+    }
+    return target;
+}
+
+}
+}
@@ -32,6 +32,14 @@ void ISQToolsInitialize(mlir::DialectRegistry &registry) {
     passes::registerGlobalThreadLocal();
     passes::registerReuseQubit();
     passes::registerRedundant();
+    passes::registerCancelGates();
+    passes::registerFuseSQGates();
+    passes::registerPrintCircuitDepth();
+    passes::registerSchedule();
+    passes::registerRouteQubits();
+    passes::registerHoistGates();
+    passes::registerPhasePolynomial();
+    passes::registerRewriteRules();
     isq::contrib::mlir::registerAffineScalarReplacementPass();
     mlir::registerAllDialects(registry);
     registry.insert<isq::ir::ISQDialect>();
@@ -0,0 +1,157 @@
+#include "isq/Operations.h"
+#include "isq/QTypes.h"
+#include "isq/passes/GateInfo.h"
+#include "isq/passes/Passes.h"
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/Support/CommandLine.h>
+#include <mlir/IR/BuiltinOps.h>
+#include <mlir/IR/SymbolTable.h>
+#include <mlir/Pass/Pass.h>
+#include <mlir/Pass/PassRegistry.h>
+namespace isq{
+namespace ir{
+namespace passes{
+
+// Cancels inverse gate pairs on qstate chains, looking through gates that commute with them.
+// For every apply A we walk backward along its first qubit, skipping gates commuting with A on that qubit.
+// The first gate P that is the inverse of A is accepted if all other qubits of A reach P as well.
+// The walk is bounded by `window`, so the pass runs in linear time.
+struct CancelGatesPass : public mlir::PassWrapper<CancelGatesPass, mlir::OperationPass<mlir::ModuleOp>>{
+    Option<unsigned> window{*this, "window", llvm::cl::desc("Maximal number of commuting gates to look through on each qubit."), llvm::cl::init(64)};
+    Statistic numErased{this, "erased-gates", "Number of gates eliminated"};
+    CancelGatesPass() = default;
+    CancelGatesPass(const CancelGatesPass& pass) {}
+
+    struct Walker{
+        mlir::Block* block;
+        const QStateForwarding& forwarding;
+        mlir::SymbolTableCollection& symbols;
+        // Steps one gate backward from `val`. Returns the defining apply and result index of `val`.
+        std::optional<std::pair<ApplyGateOp, unsigned>> step(mlir::Value& val){
+            if(auto stored = forwarding.storedBefore(val)){
+                val = stored;
+            }
+            if(!val.hasOneUse()) return std::nullopt;
+            auto def = val.getDefiningOp<ApplyGateOp>();
+            if(!def || def->getBlock()!=block) return std::nullopt;
+            return std::make_pair(def, val.cast<mlir::OpResult>().getResultNumber());
+        }
+        // Whether `gate` lets a gate acting with `basis` on its `index`-th qubit pass through.
+        bool commutes(ApplyGateOp gate, unsigned index, WireBasis basis){
+            auto info = analyzeAppliedGate(gate, symbols);
+            if(!info) return false;
+            return commuteOnWire(info->basisOn(index), basis);
+        }
+    };
+
+    bool allowPermutation(const AppliedGate& gate){
+        return gate.ctrl.empty() && bitEnumContainsAll(gate.hints, GateTrait::Symmetric);
+    }
+
+    // Walks the `operand`-th qubit of `gate` backward through commuting gates.
+    // Returns the result index at which it meets `partner`.
+    std::optional<unsigned> reach(Walker& walker, const AppliedGate& gate, unsigned operand, ApplyGateOp partner){
+        auto basis = gate.basisOn(operand);
+        mlir::Value val = gate.op.getArgs()[operand];
+        for(unsigned i=0; i<=window; i++){
+            auto prev = walker.step(val);
+            if(!prev) return std::nullopt;
+            if(prev->first==partner) return prev->second;
+            if(!walker.commutes(prev->first, prev->second, basis)) return std::nullopt;
+            val = prev->first.getArgs()[prev->second];
+        }
+        return std::nullopt;
+    }
+
+    // Whether all qubits of `gate` meet `partner`, each on the matching result.
+    bool allReach(Walker& walker, const AppliedGate& gate, ApplyGateOp partner, unsigned first_index, bool permute){
+        auto size = gate.op.getArgs().size();
+        llvm::SmallVector<bool> seen(size, false);
+        seen[first_index] = true;
+        for(unsigned j=1; j<size; j++){
+            auto index = reach(walker, gate, j, partner);
+            if(!index) return false;
+            if(permute){
+                if(seen[*index]) return false;
+                seen[*index] = true;
+            }else if(*index!=j){
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::optional<AppliedGate> findPartner(Walker& walker, const AppliedGate& gate){
+        auto basis = gate.basisOn(0);
+        auto permute = allowPermutation(gate);
+        mlir::Value val = gate.op.getArgs()[0];
+        for(unsigned i=0; i<=window; i++){
+            auto prev = walker.step(val);
+            if(!prev) return std::nullopt;
+            auto [candidate, index] = *prev;
+            auto info = analyzeAppliedGate(candidate, walker.symbols);
+            if(!info) return std::nullopt;
+            if((permute || index==0) && isInversePair(*info, gate) && allReach(walker, gate, candidate, index, permute)){
+                return info;
+            }
+            if(!commuteOnWire(info->basisOn(index), basis)) return std::nullopt;
+            val = candidate.getArgs()[index];
+        }
+        return std::nullopt;
+    }
+
+    static void eraseApply(ApplyGateOp op){
+        for(auto i=0; i<op.getArgs().size(); i++){
+            op->getResult(i).replaceAllUsesWith(op.getArgs()[i]);
+        }
+        op->erase();
+    }
+
+    // Returns the number of erased gates.
+    unsigned runOnBlock(mlir::Block* block, mlir::SymbolTableCollection& symbols){
+        unsigned erased = 0;
+        QStateForwarding forwarding(block);
+        Walker walker{block, forwarding, symbols};
+        for(auto& op: llvm::make_early_inc_range(*block)){
+            auto apply = llvm::dyn_cast<ApplyGateOp>(op);
+            if(!apply || apply.getArgs().empty()) continue;
+            auto gate = analyzeAppliedGate(apply, symbols);
+            if(!gate) continue;
+            auto partner = findPartner(walker, *gate);
+            if(!partner) continue;
+            eraseApply(apply);
+            eraseApply(partner->op);
+            erased += 2;
+        }
+        return erased;
+    }
+
+    void runOnOperation() override{
+        mlir::ModuleOp m = this->getOperation();
+        mlir::SymbolTableCollection symbols;
+        mlir::SmallVector<mlir::Block*> blocks;
+        m->walk([&](mlir::Block* block){
+            blocks.push_back(block);
+        });
+        unsigned erased = 0;
+        for(auto block: blocks){
+            erased += runOnBlock(block, symbols);
+        }
+        numErased += erased;
+        if(erased==0) markAllAnalysesPreserved();
+    }
+    mlir::StringRef getArgument() const final{
+        return "isq-cancel-gates";
+    }
+    mlir::StringRef getDescription() const final{
+        return "Cancel inverse gate pairs separated by commuting gates.";
+    }
+};
+
+void registerCancelGates(){
+    mlir::PassRegistration<CancelGatesPass>();
+}
+
+}
+}
+}
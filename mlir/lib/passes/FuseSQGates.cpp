@@ -0,0 +1,272 @@
+#include "isq/GateDefTypes.h"
+#include "isq/Operations.h"
+#include "isq/QTypes.h"
+#include "isq/passes/GateFingerprint.h"
+#include "isq/passes/GateInfo.h"
+#include "isq/passes/Passes.h"
+#include "isq/utils/Decomposition.h"
+#include <array>
+#include <cmath>
+#include <complex>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/STLExtras.h>
+#include <mlir/Dialect/Arith/IR/Arith.h>
+#include <mlir/Dialect/Func/IR/FuncOps.h>
+#include <mlir/IR/Builders.h>
+#include <mlir/IR/BuiltinOps.h>
+#include <mlir/IR/SymbolTable.h>
+#include <mlir/Pass/Pass.h>
+#include <mlir/Pass/PassRegistry.h>
+#define EPS (1e-6)
+namespace isq{
+namespace ir{
+namespace passes{
+
+using Mat2 = std::array<std::array<std::complex<double>, 2>, 2>;
+
+static Mat2 multiply(const Mat2& a, const Mat2& b){
+    Mat2 c;
+    for(auto i=0; i<2; i++){
+        for(auto j=0; j<2; j++){
+            c[i][j] = a[i][0]*b[0][j] + a[i][1]*b[1][j];
+        }
+    }
+    return c;
+}
+static Mat2 dagger(const Mat2& a){
+    Mat2 c;
+    for(auto i=0; i<2; i++){
+        for(auto j=0; j<2; j++){
+            c[i][j] = std::conj(a[j][i]);
+        }
+    }
+    return c;
+}
+// Whether a and b are equal up to global phase.
+static bool equalUpToPhase(const Mat2& a, const Mat2& b){
+    auto tr = std::conj(a[0][0])*b[0][0] + std::conj(a[1][0])*b[1][0] + std::conj(a[0][1])*b[0][1] + std::conj(a[1][1])*b[1][1];
+    return std::abs(std::abs(tr) - 2.0) < EPS;
+}
+static Mat2 u3Matrix(double theta, double phi, double lam){
+    auto i = std::complex<double>(0, 1.0);
+    return Mat2{{
+        {std::exp(-i*(phi+lam)/2.0) * std::cos(theta/2.0), -std::exp(i*(lam-phi)/2.0) * std::sin(theta/2.0)},
+        {std::exp(i*(phi-lam)/2.0) * std::sin(theta/2.0), std::exp(i*(phi+lam)/2.0) * std::cos(theta/2.0)}
+    }};
+}
+
+// Folds runs of constant single-qubit gates on one qstate chain into a single gate.
+// The fused gate equals the product of the run up to global phase, so only uncontrolled gates are fused, and
+// the enclosing function is marked ISQ_GPHASE_REMOVED as by isq-remove-gphase, so that decorate folding
+// does not control its body.
+// The result is a famous gate if one matches, Rz if the product is diagonal, and U3 otherwise.
+struct FuseSQGatesPass : public mlir::PassWrapper<FuseSQGatesPass, mlir::OperationPass<mlir::ModuleOp>>{
+    Statistic numFused{this, "fused-gates", "Number of single-qubit gates fused"};
+    Statistic numEmitted{this, "emitted-gates", "Number of gates emitted by fusion"};
+    FuseSQGatesPass() = default;
+    FuseSQGatesPass(const FuseSQGatesPass& pass) {}
+
+    mlir::SymbolTableCollection* symbols = nullptr;
+    llvm::DenseMap<mlir::Operation*, std::optional<Mat2>> defgateMatrices;
+    // Famous constant single-qubit gates available in the module, indexed by matrix.
+    llvm::SmallVector<mlir::StringRef> famousNames;
+    GateMatrixIndex famousMatrices;
+    bool hasU3 = false;
+    bool hasRz = false;
+
+    std::optional<Mat2> matrixOfDefgate(DefgateOp defgate){
+        auto it = defgateMatrices.find(defgate);
+        if(it!=defgateMatrices.end()) return it->second;
+        std::optional<Mat2> result;
+        if(defgate.getType().getSize()==1 && defgate.getDefinition()){
+            auto id=0;
+            for(auto def: defgate.getDefinition()->getAsRange<GateDefinition>()){
+                auto d = AllGateDefs::parseGateDefinition(defgate, id, defgate.getType(), def);
+                id++;
+                if(d==std::nullopt) continue;
+                if(auto mat = llvm::dyn_cast_or_null<MatrixDefinition>(&**d)){
+                    auto& m = mat->getMatrix();
+                    result = Mat2{{{m[0][0], m[0][1]}, {m[1][0], m[1][1]}}};
+                    break;
+                }
+            }
+        }
+        defgateMatrices[defgate] = result;
+        return result;
+    }
+
+    std::optional<Mat2> constantMatrix(const AppliedGate& gate){
+        if(!gate.ctrl.empty() || gate.op.getArgs().size()!=1 || !gate.defgate) return std::nullopt;
+        std::optional<Mat2> m;
+        auto famous = gate.famous;
+        if(famous=="rx" || famous=="ry" || famous=="rz"){
+            auto theta = gate.constantParam(0);
+            if(!theta) return std::nullopt;
+            auto c = std::cos(*theta/2.0);
+            auto s = std::sin(*theta/2.0);
+            auto i = std::complex<double>(0, 1.0);
+            if(famous=="rx"){
+                m = Mat2{{{c, -i*s}, {-i*s, c}}};
+            }else if(famous=="ry"){
+                m = Mat2{{{c, -s}, {s, c}}};
+            }else{
+                m = Mat2{{{std::exp(-i**theta/2.0), 0.0}, {0.0, std::exp(i**theta/2.0)}}};
+            }
+        }else if(famous=="u3"){
+            auto theta = gate.constantParam(0);
+            auto phi = gate.constantParam(1);
+            auto lam = gate.constantParam(2);
+            if(!theta || !phi || !lam) return std::nullopt;
+            m = u3Matrix(*theta, *phi, *lam);
+        }else{
+            m = matrixOfDefgate(gate.defgate);
+        }
+        if(m && gate.adjoint){
+            m = dagger(*m);
+        }
+        return m;
+    }
+
+    // The next gate on the chain of the single result of `gate`.
+    std::optional<AppliedGate> nextOnChain(const QStateForwarding& forwarding, ApplyGateOp gate){
+        mlir::Value val = gate->getResult(0);
+        if(!val.hasOneUse()) return std::nullopt;
+        if(auto loaded = forwarding.loadedAfter(val)){
+            val = loaded;
+            if(!val.hasOneUse()) return std::nullopt;
+        }
+        auto next = llvm::dyn_cast<ApplyGateOp>(*val.getUsers().begin());
+        if(!next || next->getBlock()!=gate->getBlock()) return std::nullopt;
+        return analyzeAppliedGate(next, *symbols);
+    }
+
+    // Emits a gate equivalent to `m` up to phase, applied on `qubit`.
+    // Sets `emitted` to false if `m` is identity and no gate is needed.
+    mlir::LogicalResult emitFused(mlir::OpBuilder& builder, mlir::Location loc, const Mat2& m, mlir::Value& qubit, bool& emitted){
+        emitted = false;
+        if(equalUpToPhase(m, Mat2{{{1.0, 0.0}, {0.0, 1.0}}})) return mlir::success();
+        emitted = true;
+        if(auto match = famousMatrices.lookup(GateMatrix{{m[0][0], m[0][1]}, {m[1][0], m[1][1]}})){
+            emitBuiltinGate(builder, famousNames[match->id].str().c_str(), {&qubit});
+            return mlir::success();
+        }
+        std::complex<double> mat[2][2] = {{m[0][0], m[0][1]}, {m[1][0], m[1][1]}};
+        ZYZDecomposition zyz;
+        try{
+            zyz = zyzDecomposition(mat);
+        }catch(const char*){
+            return mlir::failure();
+        }
+        auto constant = [&](double v){
+            return builder.create<mlir::arith::ConstantFloatOp>(loc, llvm::APFloat(v), builder.getF64Type()).getResult();
+        };
+        if(hasRz && std::abs(zyz.theta)<EPS){
+            emitBuiltinGate(builder, "Rz", {&qubit}, {constant(zyz.phi + zyz.lam)});
+        }else{
+            emitBuiltinGate(builder, "U3", {&qubit}, {constant(zyz.theta), constant(zyz.phi), constant(zyz.lam)});
+        }
+        return mlir::success();
+    }
+
+    // Returns whether anything changed.
+    bool runOnBlock(mlir::Block* block){
+        auto changed = false;
+        QStateForwarding forwarding(block);
+        mlir::SmallVector<ApplyGateOp> applies;
+        for(auto apply: block->getOps<ApplyGateOp>()){
+            applies.push_back(apply);
+        }
+        llvm::DenseSet<mlir::Operation*> erased;
+        for(auto apply: applies){
+            // Gates are visited in order, so a gate not fused yet is the head of its run.
+            if(erased.contains(apply.getOperation())) continue;
+            auto head = analyzeAppliedGate(apply, *symbols);
+            if(!head) continue;
+            auto m = constantMatrix(*head);
+            if(!m) continue;
+            mlir::SmallVector<ApplyGateOp> run{apply};
+            auto next = nextOnChain(forwarding, apply);
+            while(next){
+                auto next_m = constantMatrix(*next);
+                if(!next_m) break;
+                m = multiply(*next_m, *m);
+                run.push_back(next->op);
+                next = nextOnChain(forwarding, next->op);
+            }
+            if(run.size()<2) continue;
+            auto last = run.back();
+            mlir::OpBuilder builder(last);
+            mlir::Value qubit = last.getArgs()[0];
+            bool emitted;
+            if(mlir::failed(emitFused(builder, last->getLoc(), *m, qubit, emitted))) continue;
+            numFused += run.size();
+            if(emitted) numEmitted++;
+            changed = true;
+            if(auto fn = apply->getParentOfType<mlir::func::FuncOp>()){
+                fn->setAttr(ISQ_GPHASE_REMOVED, mlir::UnitAttr::get(fn->getContext()));
+            }
+            // The new gate sits at the position of the last one. All others become identity.
+            last->getResult(0).replaceAllUsesWith(qubit);
+            run.pop_back();
+            for(auto gate: run){
+                gate->getResult(0).replaceAllUsesWith(gate.getArgs()[0]);
+            }
+            run.push_back(last);
+            for(auto gate: run){
+                erased.insert(gate.getOperation());
+                gate->erase();
+            }
+        }
+        return changed;
+    }
+
+    void runOnOperation() override{
+        mlir::ModuleOp m = this->getOperation();
+        mlir::SymbolTableCollection symbol_tables;
+        symbols = &symbol_tables;
+        famousNames.clear();
+        famousMatrices = GateMatrixIndex();
+        defgateMatrices.clear();
+        hasU3 = false;
+        hasRz = false;
+        for(auto defgate: m.getOps<DefgateOp>()){
+            if(isFamousGate(defgate, "U3")) hasU3 = true;
+            if(isFamousGate(defgate, "Rz")) hasRz = true;
+            auto famous = defgate->getAttrOfType<mlir::StringAttr>(ISQ_FAMOUS);
+            if(!famous) continue;
+            if(auto mat = matrixOfDefgate(defgate)){
+                famousMatrices.insert(famousNames.size(), GateMatrix{{(*mat)[0][0], (*mat)[0][1]}, {(*mat)[1][0], (*mat)[1][1]}}, false);
+                famousNames.push_back(famous.strref());
+            }
+        }
+        // Fusion may produce arbitrary rotations, which need the builtin U3.
+        if(!hasU3){
+            markAllAnalysesPreserved();
+            return;
+        }
+        mlir::SmallVector<mlir::Block*> blocks;
+        m->walk([&](mlir::Block* block){
+            blocks.push_back(block);
+        });
+        auto changed = false;
+        for(auto block: blocks){
+            changed |= runOnBlock(block);
+        }
+        if(!changed) markAllAnalysesPreserved();
+    }
+    mlir::StringRef getArgument() const final{
+        return "isq-fuse-sq-gates";
+    }
+    mlir::StringRef getDescription() const final{
+        return "Fuse runs of constant single-qubit gates into one gate.";
+    }
+};
+
+void registerFuseSQGates(){
+    mlir::PassRegistration<FuseSQGatesPass>();
+}
+
+}
+}
+}
@@ -0,0 +1,104 @@
+#include "isq/Operations.h"
+#include "isq/passes/Passes.h"
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallVector.h>
+#include <mlir/Dialect/Arith/IR/Arith.h>
+#include <mlir/Dialect/Func/IR/FuncOps.h>
+#include <mlir/Dialect/Math/IR/Math.h>
+#include <mlir/IR/BuiltinOps.h>
+#include <mlir/IR/Dominance.h>
+#include <mlir/IR/OperationSupport.h>
+#include <mlir/Interfaces/SideEffectInterfaces.h>
+#include <mlir/Pass/Pass.h>
+#include <mlir/Pass/PassRegistry.h>
+namespace isq{
+namespace ir{
+namespace passes{
+
+// Hoists gate construction (`isq.use`, `isq.decorate`, `isq.downgrade` and the arith/math ops computing
+// their parameters) out of loops and other regions, as far as its operands allow, then merges identical
+// gate values within each function. Running it before `affine-loop-unroll` keeps unrolled bodies free of
+// repeated gate construction.
+struct HoistGatesPass : public mlir::PassWrapper<HoistGatesPass, mlir::OperationPass<mlir::ModuleOp>>{
+    Statistic numHoisted{this, "hoisted-ops", "Number of gate construction ops moved out of regions"};
+    Statistic numMerged{this, "merged-ops", "Number of duplicate gate construction ops erased"};
+    HoistGatesPass() = default;
+    HoistGatesPass(const HoistGatesPass& pass) {}
+
+    static bool isGateConstruction(mlir::Operation* op){
+        if(llvm::isa<UseGateOp, DecorateOp, DowngradeGateOp>(op)) return true;
+        auto dialect = op->getDialect();
+        if(!llvm::isa_and_nonnull<mlir::arith::ArithDialect, mlir::math::MathDialect>(dialect)) return false;
+        return op->getNumRegions()==0 && mlir::isMemoryEffectFree(op) && mlir::isSpeculatable(op);
+    }
+
+    // Moves `op` before its parent op while all operands are defined outside the parent.
+    static bool hoist(mlir::Operation* op, mlir::func::FuncOp func){
+        bool moved = false;
+        while(true){
+            auto parent = op->getParentOp();
+            if(parent==func || parent->hasTrait<mlir::OpTrait::IsIsolatedFromAbove>()) break;
+            bool invariant = llvm::all_of(op->getOperands(), [&](mlir::Value v){
+                return !parent->isAncestor(v.getParentBlock()->getParentOp());
+            });
+            if(!invariant) break;
+            op->moveBefore(parent);
+            moved = true;
+        }
+        return moved;
+    }
+
+    void runOnOperation() override{
+        mlir::ModuleOp m = this->getOperation();
+        unsigned hoisted = 0;
+        unsigned merged = 0;
+        for(auto func: m.getOps<mlir::func::FuncOp>()){
+            if(func.isExternal()) continue;
+            // Pre-order: operands are hoisted before their users.
+            llvm::SmallVector<mlir::Operation*> candidates;
+            func->walk<mlir::WalkOrder::PreOrder>([&](mlir::Operation* op){
+                if(isGateConstruction(op)) candidates.push_back(op);
+            });
+            for(auto op: candidates){
+                if(hoist(op, func)) hoisted++;
+            }
+            candidates.clear();
+            func->walk<mlir::WalkOrder::PreOrder>([&](mlir::Operation* op){
+                if(isGateConstruction(op)) candidates.push_back(op);
+            });
+            mlir::DominanceInfo dom(func);
+            llvm::DenseMap<llvm::hash_code, llvm::SmallVector<mlir::Operation*>> seen;
+            for(auto op: candidates){
+                auto hash = mlir::OperationEquivalence::computeHash(op, mlir::OperationEquivalence::directHashValue, mlir::OperationEquivalence::ignoreHashValue, mlir::OperationEquivalence::IgnoreLocations);
+                auto& same = seen[hash];
+                auto leader = llvm::find_if(same, [&](mlir::Operation* other){
+                    return mlir::OperationEquivalence::isEquivalentTo(other, op, mlir::OperationEquivalence::IgnoreLocations) && dom.properlyDominates(other, op);
+                });
+                if(leader!=same.end()){
+                    op->replaceAllUsesWith(*leader);
+                    op->erase();
+                    merged++;
+                }else{
+                    same.push_back(op);
+                }
+            }
+        }
+        numHoisted += hoisted;
+        numMerged += merged;
+        if(hoisted==0 && merged==0) markAllAnalysesPreserved();
+    }
+    mlir::StringRef getArgument() const final{
+        return "isq-hoist-gates";
+    }
+    mlir::StringRef getDescription() const final{
+        return "Hoist loop-invariant gate construction and merge identical gate values.";
+    }
+};
+
+void registerHoistGates(){
+    mlir::PassRegistration<HoistGatesPass>();
+}
+
+}
+}
+}
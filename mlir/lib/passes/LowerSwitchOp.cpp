@@ -1,4 +1,5 @@
 #include <iostream>
+#include <set>
 #include <vector>
 
 #include "isq/Dialect.h"
@@ -19,51 +20,63 @@
 #include <mlir/Dialect/Func/IR/FuncOps.h>
 #include <mlir/Pass/PassManager.h>
 #include <mlir/Transforms/Passes.h>
-#include <mlir/IR/IRMapping.h>
+#include <mlir/IR/SymbolTable.h>
 
 namespace isq {
 namespace ir {
 namespace passes {
 
-const void processRegion(SwitchOp op, mlir::PatternRewriter &rewriter, mlir::Region &region, int nqubit, int case_num) {
-    mlir::Value arg = op.getArg();
+const char* SWITCH_FLAG_GATE = "__isq__switch__x";
+
+// Applies `gate` on `targets`, controlled by the qubits of `ctrl_reg` being in basis state `case_num`.
+// Returns the results on the targets.
+static mlir::SmallVector<mlir::Value> applyControlled(SwitchOp op, mlir::PatternRewriter &rewriter, mlir::Value gate, mlir::Value ctrl_reg, int nqubit, int case_num, mlir::ValueRange targets) {
     mlir::Location loc = op.getLoc();
     mlir::MLIRContext *ctx = rewriter.getContext();
+    // Prepare the control array
+    mlir::SmallVector<mlir::Attribute> ctrl;
+    for (int k=nqubit-1; k>=0; k--) {
+        ctrl.push_back(mlir::BoolAttr::get(ctx, (case_num >> k) & 1));
+    }
+    auto origin_type = gate.getType().cast<GateType>();
+    GateTrait trait = DecorateOp::computePostDecorateTrait(GateTrait::General, nqubit, false, case_num == (1 << nqubit) - 1);
+
+    // Create a new gate that has additional control bits
+    int new_gate_size = origin_type.getSize() + nqubit;
+    auto new_type = GateType::get(ctx, new_gate_size, trait);
+    auto new_gate = rewriter.create<DecorateOp>(loc, new_type, gate, false, mlir::ArrayAttr::get(ctx, ctrl));
+
+    // Apply the new gate
+    mlir::SmallVector<mlir::Type> qtype(new_gate_size, QStateType::get(ctx));
+    mlir::SmallVector<mlir::Value> states;
+    for (int k=nqubit-1; k>=0; k--) {
+        mlir::Value idx = rewriter.create<mlir::arith::ConstantIndexOp>(loc, k);
+        auto loaded = rewriter.create<mlir::AffineLoadOp>(loc, ctrl_reg, mlir::ArrayRef<mlir::Value>({idx}));
+        states.push_back(loaded);
+    }
+    for (mlir::Value state : targets) {
+        states.push_back(state);
+    }
+    auto new_apply = rewriter.create<isq::ir::ApplyGateOp>(loc, qtype, new_gate.getResult(), states);
+    for (int k=nqubit-1; k>=0; k--) {
+        mlir::Value idx = rewriter.create<mlir::arith::ConstantIndexOp>(loc, k);
+        rewriter.create<mlir::AffineStoreOp>(loc, new_apply.getResult(nqubit - 1 - k), ctrl_reg, mlir::ArrayRef<mlir::Value>({idx}));
+    }
+    mlir::SmallVector<mlir::Value> results;
+    for (int j=0; j<targets.size(); j++) {
+        results.push_back(new_apply.getResult(j + nqubit));
+    }
+    return results;
+}
+
+// Moves the body of `region` before `op`, with every gate controlled by `ctrl_reg` being in state `case_num`.
+static void processRegion(SwitchOp op, mlir::PatternRewriter &rewriter, mlir::Region &region, mlir::Value ctrl_reg, int nqubit, int case_num) {
     auto range = region.getOps();
     for (mlir::Region::OpIterator it = range.begin(); it != range.end(); ) {
         if (ApplyGateOp apply_op = llvm::dyn_cast_or_null<ApplyGateOp>(*it)) {
-            // Prepare the control array
-            mlir::SmallVector<mlir::Attribute> ctrl;
-            for (int k=nqubit-1; k>=0; k--) {
-                ctrl.push_back(mlir::BoolAttr::get(ctx, (case_num >> k) & 1));
-            }
-            GateTrait trait = DecorateOp::computePostDecorateTrait(GateTrait::General, nqubit, false, case_num == (1 << nqubit) - 1);
-
-            // Create a new gate that has additional control bits
-            auto origin_gate = apply_op.getGate();
-            auto origin_gate_size = origin_gate.getType().getSize();
-            int new_gate_size = origin_gate_size + nqubit;
-            auto new_type = GateType::get(ctx, new_gate_size, trait);
-            auto new_gate = rewriter.create<DecorateOp>(loc, new_type, origin_gate, false, mlir::ArrayAttr::get(ctx, ctrl));
-
-            // Apply the new gate
-            mlir::SmallVector<mlir::Type> qtype(new_gate_size, QStateType::get(ctx));
-            mlir::SmallVector<mlir::Value> states;
-            for (int k=nqubit-1; k>=0; k--) {
-                mlir::Value idx = rewriter.create<mlir::arith::ConstantIndexOp>(loc, k);
-                auto loaded = rewriter.create<mlir::AffineLoadOp>(loc, arg, mlir::ArrayRef<mlir::Value>({idx}));
-                states.push_back(loaded);
-            }
-            for (mlir::Value state : apply_op.getArgs()) {
-                states.push_back(state);
-            }
-            auto new_apply = rewriter.create<isq::ir::ApplyGateOp>(loc, qtype, new_gate.getResult(), states);
-            for (int k=nqubit-1; k>=0; k--) {
-                mlir::Value idx = rewriter.create<mlir::arith::ConstantIndexOp>(loc, k);
-                rewriter.create<mlir::AffineStoreOp>(loc, new_apply.getResult(nqubit - 1 - k), arg, mlir::ArrayRef<mlir::Value>({idx}));
-            }
-            for (int j=0; j<origin_gate_size; j++) {
-                apply_op.getResult(j).replaceAllUsesWith(new_apply.getResult(j + nqubit));
+            auto results = applyControlled(op, rewriter, apply_op.getGate(), ctrl_reg, nqubit, case_num, apply_op.getArgs());
+            for (int j=0; j<results.size(); j++) {
+                apply_op.getResult(j).replaceAllUsesWith(results[j]);
             }
 
             it++;
@@ -77,6 +90,33 @@ const void processRegion(SwitchOp op, mlir::PatternRewriter &rewriter, mlir::Reg
     }
 }
 
+static bool isEmptyRegion(mlir::Region &region) {
+    return region.empty() || llvm::isa<YieldOp>(region.front().front());
+}
+
+static std::set<int64_t> listedCases(SwitchOp op) {
+    std::set<int64_t> listed;
+    for (auto attr : op.getCases()) {
+        listed.insert(attr.cast<mlir::IntegerAttr>().getInt());
+    }
+    return listed;
+}
+
+// Number of basis values of the switch register that run the default region.
+static int64_t unlistedCount(SwitchOp op) {
+    auto mem_type = op.getArg().getType().dyn_cast_or_null<mlir::MemRefType>();
+    return (int64_t(1) << mem_type.getDimSize(0)) - listedCases(op).size();
+}
+
+// Whether the default region is lowered under a flag qubit.
+static bool needsFlag(SwitchOp op) {
+    return !isEmptyRegion(op.getDefaultRegion()) && unlistedCount(op) > 1;
+}
+
+// Lowers `isq.switch` into controlled gates.
+// Each explicit case is controlled by its basis value. The default region is emitted once: a flag qubit
+// is flipped for every explicit case, the default gates are controlled by the flag being 0, and the
+// flag is flipped back. So the output grows with the number of cases instead of the register size.
 class LowerSwitchOp: public mlir::OpRewritePattern<SwitchOp> {
 public:
     LowerSwitchOp(mlir::MLIRContext* ctx): mlir::OpRewritePattern<SwitchOp>(ctx, 1) {}
@@ -86,27 +126,48 @@ public:
         mlir::Type type = arg.getType();
         auto mem_type = type.dyn_cast_or_null<mlir::MemRefType>();
         int nqubit = mem_type.getDimSize(0);
-        int dim = 1 << nqubit;
-        std::vector<bool> shown(dim, false);
+        mlir::Location loc = op.getLoc();
+        mlir::MLIRContext *ctx = rewriter.getContext();
 
         // Process the cases
         mlir::ArrayAttr case_attr = op.getCases();
+        mlir::SmallVector<int> cases;
         int i = 0;
         for (auto attr : case_attr) {
             auto int_attr = attr.dyn_cast_or_null<mlir::IntegerAttr>();
             int case_num = int_attr.getInt();
-            shown[case_num] = true;
-            processRegion(op, rewriter, op.getCaseRegions()[i], nqubit, case_num);
+            cases.push_back(case_num);
+            processRegion(op, rewriter, op.getCaseRegions()[i], arg, nqubit, case_num);
             i++;
         }
 
         // Process default
-        for (int i=0; i<dim; i++) {
-            if (!shown[i]) {
-                mlir::Region region;
-                mlir::IRMapping map;
-                op.getDefaultRegion().cloneInto(&region, map);
-                processRegion(op, rewriter, region, nqubit, i);
+        auto unlisted = unlistedCount(op);
+        if (!isEmptyRegion(op.getDefaultRegion()) && unlisted > 0) {
+            if (unlisted == 1) {
+                // Control on the only missing value directly.
+                auto listed = listedCases(op);
+                int missing = 0;
+                while (listed.count(missing)) missing++;
+                processRegion(op, rewriter, op.getDefaultRegion(), arg, nqubit, missing);
+            } else {
+                auto flag_type = mlir::MemRefType::get({1}, QStateType::get(ctx));
+                auto flag = rewriter.create<mlir::memref::AllocOp>(loc, flag_type);
+                auto x_type = GateType::get(ctx, 1, GateTrait::Hermitian|GateTrait::Antidiagonal|GateTrait::Symmetric);
+                auto flip = [&]() {
+                    for (auto case_num : cases) {
+                        auto x = rewriter.create<UseGateOp>(loc, x_type, mlir::FlatSymbolRefAttr::get(ctx, SWITCH_FLAG_GATE), mlir::ValueRange{});
+                        mlir::Value idx = rewriter.create<mlir::arith::ConstantIndexOp>(loc, 0);
+                        mlir::Value state = rewriter.create<mlir::AffineLoadOp>(loc, flag, mlir::ArrayRef<mlir::Value>({idx}));
+                        auto flipped = applyControlled(op, rewriter, x.getResult(), arg, nqubit, case_num, {state});
+                        rewriter.create<mlir::AffineStoreOp>(loc, flipped[0], flag, mlir::ArrayRef<mlir::Value>({idx}));
+                    }
+                };
+                // The flag is 1 iff the register holds one of the explicit cases.
+                flip();
+                processRegion(op, rewriter, op.getDefaultRegion(), flag, 1, 0);
+                flip();
+                rewriter.create<mlir::memref::DeallocOp>(loc, flag);
             }
         }
 
@@ -189,7 +250,27 @@ struct LowerSwitchOpPass: public mlir::PassWrapper<LowerSwitchOpPass, mlir::Oper
     void runOnOperation() override{
         mlir::ModuleOp m = this->getOperation();
         auto ctx = m->getContext();
-        
+
+        // The flag qubit is flipped by a QIR X, which isq-recognize-famous-gates turns into the builtin X.
+        auto need_flag = false;
+        m->walk([&](SwitchOp op){
+            need_flag |= needsFlag(op);
+        });
+        if (need_flag && !mlir::SymbolTable::lookupSymbolIn(m, SWITCH_FLAG_GATE)) {
+            mlir::OpBuilder builder(ctx);
+            builder.setInsertionPointToEnd(m.getBody());
+            auto loc = mlir::NameLoc::get(builder.getStringAttr("<builtin>"));
+            auto gate_type = GateType::get(ctx, 1, GateTrait::Hermitian|GateTrait::Antidiagonal|GateTrait::Symmetric);
+            mlir::SmallVector<mlir::Attribute> definitions;
+            definitions.push_back(GateDefinition::get(ctx, builder.getStringAttr("qir"), mlir::FlatSymbolRefAttr::get(builder.getStringAttr("__quantum__qis__x__body"))));
+            builder.create<DefgateOp>(loc, mlir::TypeAttr::get(gate_type), builder.getStringAttr(SWITCH_FLAG_GATE), builder.getStringAttr("nested"), mlir::ArrayAttr(), mlir::ArrayAttr::get(ctx, definitions), mlir::ArrayAttr::get(ctx, mlir::ArrayRef<mlir::Attribute>{}));
+            if (!mlir::SymbolTable::lookupSymbolIn(m, "__quantum__qis__x__body")) {
+                mlir::Type qubit_type = QIRQubitType::get(ctx);
+                auto func_type = mlir::FunctionType::get(ctx, qubit_type, {});
+                builder.create<mlir::func::FuncOp>(loc, "__quantum__qis__x__body", func_type, builder.getStringAttr("private"), nullptr, nullptr);
+            }
+        }
+
         mlir::RewritePatternSet rps(ctx);
         rps.add<LowerSwitchOp>(ctx);
         rps.add<IndexSwitchLowering>(ctx);
@@ -3,6 +3,8 @@
 #include "isq/Operations.h"
 #include "isq/QTypes.h"
 #include "isq/GateDefTypes.h"
+#include "isq/passes/GateInfo.h"
+#include "isq/passes/Passes.h"
 #include "mlir/Conversion/ReconcileUnrealizedCasts/ReconcileUnrealizedCasts.h"
 #include "mlir/Dialect/Affine/IR/AffineOps.h"
 #include "mlir/Dialect/Arith/IR/Arith.h"
@@ -30,6 +32,8 @@ namespace isq{
 namespace ir{
 namespace passes{
 
+const char* ISQ_STATIC_QUBIT = "isq_static_qubit";
+
 namespace lower_to_qir{
 
 const char* ISQ_DEINITIALIZED = "isq_deinitialized";
@@ -44,6 +48,13 @@ mlir::Value qubit_unref(mlir::Location loc, mlir::PatternRewriter& rewriter, mli
     return r.getResult(0);
 }
 
+// A qubit with a constant ID. Lowered to `inttoptr` by isq-lower-qir-rep-to-llvm.
+mlir::Value static_qubit(mlir::Location loc, mlir::OpBuilder& builder, mlir::Value id){
+    auto r = builder.create<mlir::UnrealizedConversionCastOp>(loc, mlir::TypeRange{QIRQubitType::get(builder.getContext())}, mlir::ValueRange{id});
+    r->setAttr(ISQ_STATIC_QUBIT, builder.getUnitAttr());
+    return r.getResult(0);
+}
+
 mlir::MemRefType qubit_ref_type(mlir::MLIRContext* ctx, mlir::Location loc, mlir::MemRefType memrefty){
     lower::QIRExternQuantumFunc utils;
     auto new_memrefty = mlir::MemRefType::get(memrefty.getShape(), utils.getQIRQubitType(ctx), memrefty.getLayout(), memrefty.getMemorySpace());
@@ -690,7 +701,222 @@ public:
         return mlir::success();
     }
 };
+/*
+* Static qubit addressing.
+*
+* Qubits of fixed-size global arrays, and of fixed-size arrays allocated at the top level of `__isq__main`,
+* get constant IDs 0..N-1. They are allocated once at the start of `__isq__global_initialize`, relying on the
+* runtime handing out sequential IDs from 0. Every load of such a qubit becomes its constant ID,
+* and the memref holding qubit pointers is removed along with its allocation and release loops.
+*
+* An array qualifies only if all its accesses use constant indices and every store puts back the qubit
+* that was loaded from the same element.
+*/
+class StaticQubitAssignment{
+    struct Root{
+        mlir::Operation* op;
+        int64_t size;
+        int64_t base = 0;
+        // get_global, subview and cast ops, outer ones first.
+        llvm::SmallVector<mlir::Operation*> views;
+        // Loads, stores and deallocs.
+        llvm::SmallVector<mlir::Operation*> accesses;
+    };
+    mlir::ModuleOp module;
+    llvm::SmallVector<Root> roots;
+
+    static std::optional<MemLocation> accessLocation(mlir::Operation* op){
+        if(auto load = llvm::dyn_cast<mlir::memref::LoadOp>(op)){
+            auto map = mlir::AffineMap::getMultiDimIdentityMap(load.getIndices().size(), op->getContext());
+            return resolveMemLocation(load.getMemRef(), map, load.getIndices());
+        }
+        if(auto store = llvm::dyn_cast<mlir::memref::StoreOp>(op)){
+            auto map = mlir::AffineMap::getMultiDimIdentityMap(store.getIndices().size(), op->getContext());
+            return resolveMemLocation(store.getMemRef(), map, store.getIndices());
+        }
+        if(auto load = llvm::dyn_cast<mlir::AffineLoadOp>(op)){
+            return resolveMemLocation(load.getMemRef(), load.getAffineMap(), load.getMapOperands());
+        }
+        if(auto store = llvm::dyn_cast<mlir::AffineStoreOp>(op)){
+            return resolveMemLocation(store.getMemRef(), store.getAffineMap(), store.getMapOperands());
+        }
+        return std::nullopt;
+    }
+    // The load a qstate was read from, followed through gates and quantum operations.
+    static mlir::Operation* originLoad(mlir::Value v){
+        while(true){
+            auto result = v.dyn_cast<mlir::OpResult>();
+            if(!result) return nullptr;
+            auto op = result.getOwner();
+            if(auto apply = llvm::dyn_cast<ApplyGateOp>(op)){
+                v = apply.getArgs()[result.getResultNumber()];
+            }else if(auto call = llvm::dyn_cast<CallQOpOp>(op)){
+                if(result.getResultNumber()>=call.getSize()) return nullptr;
+                v = call->getOperand(result.getResultNumber());
+            }else if(llvm::isa<mlir::memref::LoadOp, mlir::AffineLoadOp>(op)){
+                return op;
+            }else{
+                return nullptr;
+            }
+        }
+    }
+    bool collect(mlir::Value memref, Root& root){
+        for(auto& use: memref.getUses()){
+            auto user = use.getOwner();
+            if(llvm::isa<mlir::memref::SubViewOp, mlir::memref::CastOp>(user)){
+                root.views.push_back(user);
+                if(!collect(user->getResult(0), root)) return false;
+            }else if(llvm::isa<mlir::memref::DeallocOp, mlir::memref::LoadOp, mlir::AffineLoadOp>(user)){
+                root.accesses.push_back(user);
+            }else if(llvm::isa<mlir::memref::StoreOp, mlir::AffineStoreOp>(user) && use.getOperandNumber()==1){
+                root.accesses.push_back(user);
+            }else{
+                return false;
+            }
+        }
+        return true;
+    }
+    bool sameElement(const MemLocation& a, const MemLocation& b){
+        return a.root==b.root && a.indices && b.indices && *a.indices==*b.indices;
+    }
+    bool check(Root& root, const void* key){
+        for(auto access: root.accesses){
+            if(llvm::isa<mlir::memref::DeallocOp>(access)) continue;
+            auto loc = accessLocation(access);
+            if(!loc || loc->root!=key || !loc->indices || loc->indices->size()!=1) return false;
+            auto index = loc->indices->front();
+            if(index<0 || index>=root.size) return false;
+            mlir::Value stored;
+            if(auto store = llvm::dyn_cast<mlir::memref::StoreOp>(access)) stored = store.getValueToStore();
+            if(auto store = llvm::dyn_cast<mlir::AffineStoreOp>(access)) stored = store.getValueToStore();
+            if(!stored) continue;
+            auto origin = originLoad(stored);
+            if(!origin) return false;
+            auto origin_loc = accessLocation(origin);
+            if(!origin_loc || !sameElement(*loc, *origin_loc)) return false;
+        }
+        return true;
+    }
+    static std::optional<int64_t> staticSize(mlir::Type ty){
+        auto memrefty = ty.dyn_cast<mlir::MemRefType>();
+        if(!memrefty || !memrefty.getElementType().isa<QStateType>()) return std::nullopt;
+        if(memrefty.getRank()!=1 || memrefty.isDynamicDim(0)) return std::nullopt;
+        return memrefty.getDimSize(0);
+    }
+public:
+    StaticQubitAssignment(mlir::ModuleOp module): module(module){}
+    // Finds the qualifying arrays. Returns the number of qubits they hold.
+    int64_t analyze(){
+        auto ctx = module->getContext();
+        if(!module.lookupSymbol<mlir::func::FuncOp>("__isq__global_initialize")) return 0;
+        int64_t count = 0;
+        for(auto global: module.getOps<mlir::memref::GlobalOp>()){
+            auto size = staticSize(global.getType());
+            if(!size) continue;
+            auto uses = mlir::SymbolTable::getSymbolUses(global, module);
+            if(!uses) continue;
+            Root root{global.getOperation(), *size};
+            bool ok = true;
+            for(auto use: *uses){
+                auto get_global = llvm::dyn_cast<mlir::memref::GetGlobalOp>(use.getUser());
+                if(!get_global){
+                    ok = false;
+                    break;
+                }
+                root.views.push_back(get_global);
+                if(!collect(get_global.getResult(), root)){
+                    ok = false;
+                    break;
+                }
+            }
+            auto key = mlir::FlatSymbolRefAttr::get(ctx, global.getSymName()).getAsOpaquePointer();
+            if(!ok || !check(root, key)) continue;
+            root.base = count;
+            count += root.size;
+            roots.push_back(std::move(root));
+        }
+        // Arrays allocated at the top level of main live for the whole program.
+        auto main = module.lookupSymbol<mlir::func::FuncOp>("__isq__main");
+        if(main && !main.isExternal()){
+            for(auto alloc: main.getBody().front().getOps<mlir::memref::AllocOp>()){
+                auto size = staticSize(alloc.getType());
+                if(!size) continue;
+                Root root{alloc.getOperation(), *size};
+                if(!collect(alloc.getResult(), root) || !check(root, alloc.getOperation())) continue;
+                root.base = count;
+                count += root.size;
+                roots.push_back(std::move(root));
+            }
+        }
+        return count;
+    }
+    // Replaces loads by constant qubits and removes the arrays.
+    void apply(){
+        mlir::OpBuilder builder(module->getContext());
+        for(auto& root: roots){
+            for(auto access: root.accesses){
+                if(llvm::isa<mlir::memref::LoadOp, mlir::AffineLoadOp>(access)){
+                    auto loc = access->getLoc();
+                    builder.setInsertionPoint(access);
+                    auto id = builder.create<mlir::arith::ConstantIndexOp>(loc, root.base + accessLocation(access)->indices->front());
+                    auto qubit = builder.create<mlir::UnrealizedConversionCastOp>(loc, mlir::TypeRange{QStateType::get(builder.getContext())}, mlir::ValueRange{static_qubit(loc, builder, id)});
+                    access->getResult(0).replaceAllUsesWith(qubit.getResult(0));
+                }
+                access->erase();
+            }
+            for(auto view: llvm::reverse(root.views)){
+                view->erase();
+            }
+            root.op->erase();
+        }
+    }
+};
+
+// Allocates the statically addressed qubits at the start of the program, and releases them at its end.
+class RuleInitDeinitStaticQubits : public mlir::OpRewritePattern<mlir::func::FuncOp>{
+    mlir::ModuleOp rootModule;
+    int64_t count;
+public:
+    RuleInitDeinitStaticQubits(mlir::MLIRContext* ctx, mlir::ModuleOp module, int64_t count): mlir::OpRewritePattern<mlir::func::FuncOp>(ctx, 1), rootModule(module), count(count){}
+    mlir::LogicalResult matchAndRewrite(mlir::func::FuncOp op,  mlir::PatternRewriter &rewriter) const override{
+        lower::QIRExternQuantumFunc utils;
+        auto ctx = op->getContext();
+        bool ctor = op.getSymName()=="__isq__global_initialize";
+        if(!ctor && op.getSymName()!="__isq__global_finalize") return mlir::failure();
+        if(op.isExternal()) return mlir::failure();
+        auto marker = ctor ? ISQ_INITIALIZED : ISQ_DEINITIALIZED;
+        if(op->hasAttr(marker)) return mlir::failure();
+
+        rewriter.updateRootInPlace(op, [&]{
+            op->setAttr(marker, ::mlir::UnitAttr::get(ctx));
+        });
+        mlir::PatternRewriter::InsertionGuard guard(rewriter);
+        // Global arrays have been initialized at the start of the function already. Go before them.
+        rewriter.setInsertionPointToStart(&op.getBody().front());
+        auto loc = op.getLoc();
+        auto lo = rewriter.create<mlir::arith::ConstantIndexOp>(loc, 0);
+        auto hi = rewriter.create<mlir::arith::ConstantIndexOp>(loc, count);
+        auto step = rewriter.create<mlir::arith::ConstantIndexOp>(loc, 1);
+        auto loop =
+          rewriter.create<mlir::scf::ForOp>(loc, lo, hi, step, mlir::ValueRange{}, [&](mlir::OpBuilder& b, mlir::Location loc, mlir::Value iv, mlir::ValueRange iterArgs){
+        });
+        rewriter.updateRootInPlace(loop, [&]{
+            rewriter.setInsertionPointToEnd(loop.getBody());
+            if(ctor){
+                utils.allocQubit(loc, rewriter, rootModule);
+            }else{
+                utils.releaseQubit(loc, rewriter, rootModule, static_qubit(loc, rewriter, loop.getInductionVar()));
+            }
+            rewriter.create<mlir::scf::YieldOp>(loc);
+        });
+        return mlir::success();
+    }
+};
 struct LowerToQIRRepPass : public mlir::PassWrapper<LowerToQIRRepPass, mlir::OperationPass<mlir::ModuleOp>>{
+    Option<bool> staticQubits{*this, "static-qubits", llvm::cl::desc("Give qubits of fixed-size arrays constant IDs instead of runtime-allocated pointers."), llvm::cl::init(false)};
+    Statistic numStatic{this, "static-qubits", "Number of qubits with constant IDs"};
+    LowerToQIRRepPass() = default;
+    LowerToQIRRepPass(const LowerToQIRRepPass& pass) {}
     void populateUsefulPatternSets(mlir::RewritePatternSet& patterns, mlir::TypeConverter& converter ){
         mlir::populateFunctionOpInterfaceTypeConversionPattern<mlir::func::FuncOp>(patterns, converter);
         mlir::populateCallOpTypeConversionPattern(patterns, converter);
@@ -700,6 +926,13 @@ struct LowerToQIRRepPass : public mlir::PassWrapper<LowerToQIRRepPass, mlir::Ope
     void runOnOperation() override {
         mlir::ModuleOp m = this->getOperation();
         auto ctx = m->getContext();
+        int64_t static_count = 0;
+        if(staticQubits){
+            StaticQubitAssignment assignment(m);
+            static_count = assignment.analyze();
+            assignment.apply();
+            numStatic += static_count;
+        }
         
         do{
         mlir::RewritePatternSet rps(ctx);
@@ -718,6 +951,9 @@ struct LowerToQIRRepPass : public mlir::PassWrapper<LowerToQIRRepPass, mlir::Ope
         mlir::RewritePatternSet rps(ctx);
         rps.add<RuleLowerIsqAlloc>(ctx);
         rps.add<RuleLowerIsqDealloc>(ctx);
+        if(static_count){
+            rps.add<RuleInitDeinitStaticQubits>(ctx, m, static_count);
+        }
         mlir::FrozenRewritePatternSet frps(std::move(rps));
         (void)mlir::applyPatternsAndFoldGreedily(m.getOperation(), frps);
         }while(0);
@@ -726,6 +962,8 @@ struct LowerToQIRRepPass : public mlir::PassWrapper<LowerToQIRRepPass, mlir::Ope
         rps2.add<RuleRemoveDeinitAttr<mlir::memref::DeallocOp>>(ctx);
         rps2.add<RuleRemoveInitAttr<mlir::memref::AllocOp>>(ctx);
         rps2.add<RuleRemoveInitAttr<mlir::memref::GlobalOp>>(ctx);
+        rps2.add<RuleRemoveInitAttr<mlir::func::FuncOp>>(ctx);
+        rps2.add<RuleRemoveDeinitAttr<mlir::func::FuncOp>>(ctx);
         rps2.add<RuleErase<DeclareQOpOp>>(ctx);
         rps2.add<RuleErase<UseGateOp>>(ctx);
         rps2.add<RuleErase<DefgateOp>>(ctx);
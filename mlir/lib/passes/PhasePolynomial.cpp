@@ -0,0 +1,214 @@
+#include "isq/Operations.h"
+#include "isq/QTypes.h"
+#include "isq/passes/GateInfo.h"
+#include "isq/passes/Passes.h"
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <vector>
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/StringSwitch.h>
+#include <mlir/IR/Builders.h>
+#include <mlir/IR/BuiltinOps.h>
+#include <mlir/IR/SymbolTable.h>
+#include <mlir/Pass/Pass.h>
+#include <mlir/Pass/PassRegistry.h>
+namespace isq{
+namespace ir{
+namespace passes{
+
+// Merges Z/S/T phase gates acting on the same parity of the qubits, in the spirit of T-par.
+// Along each block every qstate holds an affine parity x_i ^ ... ^ x_j ^ c of path variables:
+// X and CNOT (also as controlled X) update parities, any other gate gives its results fresh variables.
+// A phase gate multiplies the amplitude by a phase of its parity only, so all phase gates on one parity
+// are summed into the first of them. The CNOT network is left as is.
+struct PhasePolynomialPass : public mlir::PassWrapper<PhasePolynomialPass, mlir::OperationPass<mlir::ModuleOp>>{
+    Statistic numMerged{this, "merged-gates", "Number of phase gates merged into others"};
+    Statistic numTBefore{this, "t-count-before", "Number of T gates before merging"};
+    Statistic numTAfter{this, "t-count-after", "Number of T gates after merging"};
+    Statistic numDepthBefore{this, "t-depth-before", "T-depth before merging, summed over blocks"};
+    Statistic numDepthAfter{this, "t-depth-after", "T-depth after merging, summed over blocks"};
+    PhasePolynomialPass() = default;
+    PhasePolynomialPass(const PhasePolynomialPass& pass) {}
+
+    struct Parity{
+        llvm::BitVector vars;
+        bool negated = false;
+        std::pair<std::vector<unsigned>, bool> key() const{
+            std::vector<unsigned> bits(vars.set_bits_begin(), vars.set_bits_end());
+            return {bits, negated};
+        }
+    };
+    struct Term{
+        llvm::SmallVector<ApplyGateOp> gates;
+        // Sum of the phases, in units of pi/4.
+        unsigned phase = 0;
+    };
+
+    // Phase of a Z, S, T or inverse gate, in units of pi/4.
+    static std::optional<unsigned> phaseOf(const AppliedGate& gate){
+        if(!gate.ctrl.empty() || gate.op.getArgs().size()!=1) return std::nullopt;
+        auto k = llvm::StringSwitch<std::optional<unsigned>>(gate.famous)
+            .Case("t", 1).Case("s", 2).Case("z", 4).Case("sinv", 6).Case("tinv", 7)
+            .Default(std::nullopt);
+        if(k && gate.adjoint) k = (8 - *k) % 8;
+        return k;
+    }
+
+    // Emits gates with a total phase of `k` pi/4 on `qubit`, with at most one T.
+    static void emitPhase(mlir::OpBuilder& builder, unsigned k, mlir::Value& qubit){
+        static const char* const GATES[8][2] = {
+            {nullptr, nullptr}, {"T", nullptr}, {"S", nullptr}, {"S", "T"},
+            {"Z", nullptr}, {"Z", "T"}, {"SInv", nullptr}, {"TInv", nullptr}
+        };
+        for(auto name: GATES[k]){
+            if(name) emitBuiltinGate(builder, name, {&qubit});
+        }
+    }
+
+    // T-count and T-depth of a block.
+    static std::pair<unsigned, unsigned> countT(mlir::Block* block, mlir::SymbolTableCollection& symbols){
+        QStateForwarding forwarding(block);
+        llvm::DenseMap<mlir::Value, unsigned> depth;
+        auto depthOf = [&](mlir::Value v){
+            if(auto stored = forwarding.storedBefore(v)) v = stored;
+            return depth.lookup(v);
+        };
+        unsigned count = 0;
+        unsigned max_depth = 0;
+        for(auto& op: *block){
+            unsigned d = 0;
+            for(auto operand: op.getOperands()){
+                if(operand.getType().isa<QStateType>()) d = std::max(d, depthOf(operand));
+            }
+            if(auto apply = llvm::dyn_cast<ApplyGateOp>(op)){
+                auto info = analyzeAppliedGate(apply, symbols);
+                auto k = info ? phaseOf(*info) : std::nullopt;
+                if(k && *k % 2){
+                    count++;
+                    d++;
+                }
+            }
+            for(auto result: op.getResults()){
+                if(result.getType().isa<QStateType>()) depth[result] = d;
+            }
+            max_depth = std::max(max_depth, d);
+        }
+        return {count, max_depth};
+    }
+
+    // Returns the number of phase gates merged.
+    unsigned runOnBlock(mlir::Block* block, mlir::SymbolTableCollection& symbols){
+        QStateForwarding forwarding(block);
+        llvm::DenseMap<mlir::Value, Parity> parities;
+        unsigned num_vars = 0;
+        std::function<Parity(mlir::Value)> parityOf = [&](mlir::Value v){
+            auto it = parities.find(v);
+            if(it!=parities.end()) return it->second;
+            Parity p;
+            if(auto stored = forwarding.storedBefore(v)){
+                p = parityOf(stored);
+            }else{
+                // Block arguments, fresh loads and results of other gates.
+                p.vars.resize(num_vars+1);
+                p.vars.set(num_vars++);
+            }
+            parities[v] = p;
+            return p;
+        };
+        std::map<std::pair<std::vector<unsigned>, bool>, Term> terms;
+        for(auto apply: block->getOps<ApplyGateOp>()){
+            auto info = analyzeAppliedGate(apply, symbols);
+            if(!info) continue;
+            auto args = apply.getArgs();
+            auto famous = info->famous;
+            if(auto k = phaseOf(*info)){
+                auto p = parityOf(args[0]);
+                parities[apply->getResult(0)] = p;
+                auto& term = terms[p.key()];
+                term.gates.push_back(apply);
+                term.phase = (term.phase + *k) % 8;
+            }else if((famous=="x" && info->ctrl.size()<=1) || (famous=="cnot" && info->ctrl.empty())){
+                auto target = parityOf(args.back());
+                if(args.size()==1){
+                    target.negated = !target.negated;
+                }else{
+                    auto control = parityOf(args[0]);
+                    target.vars ^= control.vars;
+                    // A negative control flips the target when the control is 0.
+                    bool negative = famous=="x" && !info->ctrl[0];
+                    target.negated ^= control.negated ^ negative;
+                    parities[apply->getResult(0)] = control;
+                }
+                parities[apply->getResult(args.size()-1)] = target;
+            }else if(famous=="swap" && info->ctrl.empty()){
+                auto a = parityOf(args[0]);
+                auto b = parityOf(args[1]);
+                parities[apply->getResult(0)] = b;
+                parities[apply->getResult(1)] = a;
+            }
+            // Results of any other gate get fresh variables when they are first used.
+        }
+        unsigned merged = 0;
+        for(auto& [key, term]: terms){
+            if(term.gates.size()<2) continue;
+            auto first = term.gates.front();
+            mlir::OpBuilder builder(first);
+            mlir::Value qubit = first.getArgs()[0];
+            emitPhase(builder, term.phase, qubit);
+            first->getResult(0).replaceAllUsesWith(qubit);
+            for(auto gate: llvm::drop_begin(term.gates)){
+                gate->getResult(0).replaceAllUsesWith(gate.getArgs()[0]);
+            }
+            for(auto gate: term.gates){
+                gate->erase();
+            }
+            merged += term.gates.size();
+        }
+        return merged;
+    }
+
+    void runOnOperation() override{
+        mlir::ModuleOp m = this->getOperation();
+        // Merged phases are emitted as builtin gates.
+        for(auto name: {"t", "tinv", "s", "sinv", "z"}){
+            if(!mlir::SymbolTable::lookupSymbolIn(m, getFamousName(name))){
+                markAllAnalysesPreserved();
+                return;
+            }
+        }
+        mlir::SymbolTableCollection symbols;
+        mlir::SmallVector<mlir::Block*> blocks;
+        m->walk([&](mlir::Block* block){
+            blocks.push_back(block);
+        });
+        unsigned merged = 0;
+        for(auto block: blocks){
+            auto [count_before, depth_before] = countT(block, symbols);
+            numTBefore += count_before;
+            numDepthBefore += depth_before;
+            merged += runOnBlock(block, symbols);
+            auto [count_after, depth_after] = countT(block, symbols);
+            numTAfter += count_after;
+            numDepthAfter += depth_after;
+        }
+        numMerged += merged;
+        if(merged==0) markAllAnalysesPreserved();
+    }
+    mlir::StringRef getArgument() const final{
+        return "isq-tpar";
+    }
+    mlir::StringRef getDescription() const final{
+        return "Merge Z/S/T phase gates acting on the same qubit parity to reduce T-count.";
+    }
+};
+
+void registerPhasePolynomial(){
+    mlir::PassRegistration<PhasePolynomialPass>();
+}
+
+}
+}
+}
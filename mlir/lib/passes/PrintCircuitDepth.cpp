@@ -0,0 +1,35 @@
+#include "isq/passes/CircuitDAG.h"
+#include "isq/passes/Passes.h"
+#include <mlir/Dialect/Func/IR/FuncOps.h>
+#include <mlir/IR/Diagnostics.h>
+#include <mlir/Pass/Pass.h>
+#include <mlir/Pass/PassRegistry.h>
+namespace isq{
+namespace ir{
+namespace passes{
+
+// Reports gate count, circuit depth and wire count of every function containing quantum ops.
+struct PrintCircuitDepthPass : public mlir::PassWrapper<PrintCircuitDepthPass, mlir::OperationPass<mlir::func::FuncOp>>{
+    void runOnOperation() override{
+        mlir::func::FuncOp func = this->getOperation();
+        auto& dag = getAnalysis<CircuitDAG>();
+        if(dag.size()>0){
+            mlir::emitRemark(func.getLoc()) << func.getSymName() << ": gates " << dag.size() << ", depth " << dag.depth() << ", wires " << dag.numWires();
+        }
+        markAllAnalysesPreserved();
+    }
+    mlir::StringRef getArgument() const final{
+        return "isq-print-circuit-depth";
+    }
+    mlir::StringRef getDescription() const final{
+        return "Print gate count and depth of the circuit dependency DAG of each function.";
+    }
+};
+
+void registerPrintCircuitDepth(){
+    mlir::PassRegistration<PrintCircuitDepthPass>();
+}
+
+}
+}
+}
@@ -3,6 +3,7 @@
 #include "isq/Operations.h"
 #include "isq/QTypes.h"
 #include "isq/GateDefTypes.h"
+#include "isq/passes/Passes.h"
 #include "mlir/Conversion/AffineToStandard/AffineToStandard.h"
 #include "mlir/Conversion/ArithToLLVM/ArithToLLVM.h"
 #include "mlir/Conversion/MemRefToLLVM/MemRefToLLVM.h"
@@ -170,6 +171,17 @@ struct LowerUnrealizedConversion : public mlir::OpRewritePattern<mlir::Unrealize
     }
 };
 
+// Qubits with constant IDs from `isq-lower-to-qir-rep{static-qubits=1}`.
+struct LowerStaticQubit : public mlir::OpConversionPattern<mlir::UnrealizedConversionCastOp>{
+    LowerStaticQubit(mlir::TypeConverter& converter, mlir::MLIRContext* ctx): mlir::OpConversionPattern<mlir::UnrealizedConversionCastOp>(converter, ctx, 2){}
+    mlir::LogicalResult matchAndRewrite(mlir::UnrealizedConversionCastOp op, OpAdaptor adaptor, mlir::ConversionPatternRewriter& rewriter) const override{
+        if(!op->hasAttr(ISQ_STATIC_QUBIT)) return mlir::failure();
+        auto ty = getTypeConverter()->convertType(op.getResult(0).getType());
+        rewriter.replaceOpWithNewOp<LLVM::IntToPtrOp>(op, ty, adaptor.getInputs()[0]);
+        return mlir::success();
+    }
+};
+
 struct QIRRepToLLVMPass : public mlir::PassWrapper<QIRRepToLLVMPass, mlir::OperationPass<mlir::ModuleOp>>{
 
     void runOnOperation() override {
@@ -199,6 +211,7 @@ struct QIRRepToLLVMPass : public mlir::PassWrapper<QIRRepToLLVMPass, mlir::Opera
         auto module = getOperation();
         auto ctx = module->getContext();
         patterns.add<RuleReplaceAssert>(ctx, module);
+        patterns.add<LowerStaticQubit>(typeConverter, ctx);
         patterns.add<LowerUnrealizedConversion>(ctx);
         if (failed(applyFullConversion(module, target, std::move(patterns))))
             signalPassFailure();
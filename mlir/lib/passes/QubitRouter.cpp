@@ -0,0 +1,149 @@
+#include "isq/passes/QubitRouter.h"
+#include <algorithm>
+#include <deque>
+#include <llvm/ADT/STLExtras.h>
+namespace isq{
+namespace ir{
+namespace passes{
+
+CouplingGraph::CouplingGraph(unsigned size, llvm::ArrayRef<std::pair<unsigned, unsigned>> edges): numQubits(size), adjacency(size){
+    for(auto [a, b]: edges){
+        if(a==b) continue;
+        if(std::find(adjacency[a].begin(), adjacency[a].end(), b)!=adjacency[a].end()) continue;
+        adjacency[a].push_back(b);
+        adjacency[b].push_back(a);
+    }
+    for(auto& n: adjacency){
+        std::sort(n.begin(), n.end());
+    }
+    dist.assign(size*size, UNREACHABLE);
+    std::deque<unsigned> queue;
+    for(unsigned src=0; src<size; src++){
+        auto row = &dist[src*size];
+        row[src] = 0;
+        queue.push_back(src);
+        while(!queue.empty()){
+            auto q = queue.front();
+            queue.pop_front();
+            for(auto n: adjacency[q]){
+                if(row[n]!=UNREACHABLE) continue;
+                row[n] = row[q]+1;
+                queue.push_back(n);
+            }
+        }
+    }
+}
+
+bool CouplingGraph::isConnected() const{
+    for(unsigned q=0; q<numQubits; q++){
+        if(distance(0, q)==UNREACHABLE) return false;
+    }
+    return true;
+}
+
+QubitRouter::QubitRouter(const CouplingGraph& graph, unsigned lookahead, double lookaheadWeight): graph(graph), lookahead(lookahead), lookaheadWeight(lookaheadWeight){}
+
+std::vector<unsigned> QubitRouter::liveDistances(unsigned src, const std::vector<bool>& dead) const{
+    std::vector<unsigned> dist(graph.size(), CouplingGraph::UNREACHABLE);
+    std::deque<unsigned> queue{src};
+    dist[src] = 0;
+    while(!queue.empty()){
+        auto q = queue.front();
+        queue.pop_front();
+        for(auto n: graph.neighbors(q)){
+            if(dead[n] || dist[n]!=CouplingGraph::UNREACHABLE) continue;
+            dist[n] = dist[q]+1;
+            queue.push_back(n);
+        }
+    }
+    return dist;
+}
+
+std::optional<std::vector<llvm::SmallVector<QubitRouter::Swap>>> QubitRouter::route(llvm::ArrayRef<llvm::SmallVector<unsigned, 2>> gates, std::vector<unsigned>& mapping) const{
+    std::vector<llvm::SmallVector<Swap>> swaps(gates.size());
+    std::vector<unsigned> two_qubit;
+    for(unsigned i=0; i<gates.size(); i++){
+        if(gates[i].size()==2) two_qubit.push_back(i);
+    }
+    // Physical to logical. Unused physical qubits map to UNREACHABLE.
+    std::vector<unsigned> inverse(graph.size(), CouplingGraph::UNREACHABLE);
+    for(unsigned l=0; l<mapping.size(); l++){
+        inverse[mapping[l]] = l;
+    }
+    auto apply_swap = [&](unsigned p, unsigned q){
+        auto lp = inverse[p];
+        auto lq = inverse[q];
+        if(lp!=CouplingGraph::UNREACHABLE) mapping[lp] = q;
+        if(lq!=CouplingGraph::UNREACHABLE) mapping[lq] = p;
+        std::swap(inverse[p], inverse[q]);
+    };
+    std::vector<bool> dead(graph.size(), false);
+    auto any_dead = false;
+    unsigned k = 0;
+    for(unsigned gate=0; gate<gates.size(); gate++){
+        if(gates[gate].size()==1){
+            dead[mapping[gates[gate][0]]] = true;
+            any_dead = true;
+            continue;
+        }
+        if(gates[gate].size()!=2) continue;
+        auto a = gates[gate][0];
+        auto b = gates[gate][1];
+        auto window = llvm::ArrayRef<unsigned>(two_qubit).slice(k+1, std::min<size_t>(lookahead, two_qubit.size()-k-1));
+        k++;
+        while(graph.distance(mapping[a], mapping[b])>1){
+            auto pa = mapping[a];
+            auto pb = mapping[b];
+            std::vector<unsigned> to_a, to_b;
+            if(any_dead){
+                to_a = liveDistances(pa, dead);
+                to_b = liveDistances(pb, dead);
+            }
+            // Distance from `q` to the physical qubit `other` of the gate.
+            auto remaining = [&](unsigned q, unsigned other){
+                if(!any_dead) return graph.distance(q, other);
+                return other==pa ? to_a[q] : to_b[q];
+            };
+            auto d = remaining(pa, pb);
+            if(d==CouplingGraph::UNREACHABLE) return std::nullopt;
+            std::optional<Swap> best;
+            double best_cost = 0;
+            auto consider = [&](unsigned from, unsigned to, unsigned other){
+                if(dead[to] || remaining(to, other)>=d) return;
+                apply_swap(from, to);
+                double cost = 0;
+                for(auto next: window){
+                    cost += graph.distance(mapping[gates[next][0]], mapping[gates[next][1]]);
+                }
+                if(!window.empty()) cost = cost*lookaheadWeight/window.size();
+                apply_swap(from, to);
+                if(!best || cost<best_cost){
+                    best = Swap{std::min(from, to), std::max(from, to)};
+                    best_cost = cost;
+                }
+            };
+            for(auto n: graph.neighbors(pa)) consider(pa, n, pb);
+            for(auto n: graph.neighbors(pb)) consider(pb, n, pa);
+            // A shortest path over live qubits always offers a candidate.
+            apply_swap(best->first, best->second);
+            swaps[gate].push_back(*best);
+        }
+    }
+    return swaps;
+}
+
+void QubitRouter::refineInitialMapping(llvm::ArrayRef<llvm::SmallVector<unsigned, 2>> gates, std::vector<unsigned>& mapping, unsigned rounds) const{
+    llvm::SmallVector<llvm::SmallVector<unsigned, 2>> reversed(gates.rbegin(), gates.rend());
+    // Measurements are left out: in the reversed circuit they would come first and cut off everything.
+    llvm::erase_if(reversed, [](const llvm::SmallVector<unsigned, 2>& gate){ return gate.size()==1; });
+    llvm::SmallVector<llvm::SmallVector<unsigned, 2>> forward(reversed.rbegin(), reversed.rend());
+    for(unsigned i=0; i<rounds; i++){
+        // The final mapping of the forward pass is a good start for the reversed circuit, and vice versa.
+        (void)route(forward, mapping);
+        (void)route(reversed, mapping);
+    }
+}
+
+}
+}
+}
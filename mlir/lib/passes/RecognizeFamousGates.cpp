@@ -2,9 +2,12 @@
 #include "isq/GateDefTypes.h"
 #include "isq/Operations.h"
 #include "isq/QTypes.h"
+#include "isq/passes/GateFingerprint.h"
 #include "isq/passes/Passes.h"
+#include <algorithm>
 #include <cctype>
 #include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/Support/Casting.h>
 #include <llvm/Support/raw_ostream.h>
 #include <mlir/IR/BuiltinAttributes.h>
@@ -17,6 +20,7 @@
 #include <mlir/Pass/PassRegistry.h>
 #include <mlir/Rewrite/FrozenRewritePatternSet.h>
 #include <mlir/Transforms/GreedyPatternRewriteDriver.h>
+#define EPS (1e-6)
 namespace isq{
 namespace ir{
 namespace passes{
@@ -38,6 +42,65 @@ struct FamousGateDef{
     }
 };
 
+std::vector<FamousGateDef> FAMOUS_GATES;
+// Indices into FAMOUS_GATES, by QIR name, by lower-case famous name and by matrix.
+llvm::StringMap<unsigned> FAMOUS_BY_QIR;
+llvm::StringMap<unsigned> FAMOUS_BY_NAME;
+GateMatrixIndex FAMOUS_BY_MATRIX;
+
+static std::optional<GateMatrix> matrixOfDefgate(DefgateOp defgate){
+    auto params = defgate.getParameters();
+    if(!defgate.getDefinition() || (params && params.size()>0)) return std::nullopt;
+    auto id=0;
+    for(auto def: defgate.getDefinition()->getAsRange<GateDefinition>()){
+        auto d = AllGateDefs::parseGateDefinition(defgate, id, defgate.getType(), def);
+        id++;
+        if(d==std::nullopt) continue;
+        if(auto mat = llvm::dyn_cast_or_null<MatrixDefinition>(&**d)){
+            return mat->getMatrix();
+        }
+    }
+    return std::nullopt;
+}
+
+// Finds the famous gate implementing `defgate`, either by its QIR definition or, for user gates, by its
+// matrix up to global phase and qubit order.
+static std::optional<GateMatrixIndex::Match> matchFamousGate(DefgateOp defgate){
+    auto defs = *defgate.getDefinition();
+    if(!defs) return std::nullopt;
+    for(auto attr: defs.getValue()){
+        auto def = attr.cast<GateDefinition>();
+        if(def.getType().strref()=="qir"){
+            auto flat_symbol = def.getValue().cast<mlir::FlatSymbolRefAttr>();
+            auto it = FAMOUS_BY_QIR.find(flat_symbol.getValue());
+            if(it!=FAMOUS_BY_QIR.end()){
+                GateMatrixIndex::Match match{it->second, {}};
+                for(auto i=0; i<FAMOUS_GATES[it->second].gate_size; i++) match.perm.push_back(i);
+                return match;
+            }
+        }
+    }
+    if(defgate->hasAttr(ISQ_FAMOUS)) return std::nullopt;
+    auto mat = matrixOfDefgate(defgate);
+    if(!mat) return std::nullopt;
+    return FAMOUS_BY_MATRIX.lookup(*mat);
+}
+
+// Gives the decorates of `gate`, recursively, the traits that follow from its (new) type.
+static void retypeDecorates(mlir::Value gate, mlir::PatternRewriter& rewriter){
+    for(auto user: gate.getUsers()){
+        auto decorate = llvm::dyn_cast<DecorateOp>(user);
+        if(!decorate) continue;
+        auto ctrls = decorate.getCtrl().getAsValueRange<mlir::BoolAttr>();
+        auto all_one = std::all_of(ctrls.begin(), ctrls.end(), [](auto x){return x;});
+        auto hints = DecorateOp::computePostDecorateTrait(gate.getType().cast<GateType>().getHints(), decorate.getCtrl().size(), decorate.getAdjoint(), all_one);
+        rewriter.updateRootInPlace(decorate, [&](){
+            decorate.getResult().setType(GateType::get(rewriter.getContext(), decorate.getType().getSize(), hints));
+        });
+        retypeDecorates(decorate.getResult(), rewriter);
+    }
+}
+
 struct RewritePreferFamousGate : public mlir::OpRewritePattern<UseGateOp>{
     mlir::ModuleOp rootModule;
     const std::vector<FamousGateDef>& famousGates;
@@ -45,34 +108,47 @@ struct RewritePreferFamousGate : public mlir::OpRewritePattern<UseGateOp>{
     }
     mlir::LogicalResult matchAndRewrite(UseGateOp use, mlir::PatternRewriter& rewriter) const override{
         auto defgate = llvm::dyn_cast_or_null<DefgateOp>(mlir::SymbolTable::lookupNearestSymbolFrom(use, use.getName()));
-        if(!defgate) return mlir::failure();
-        auto defs = *defgate.getDefinition();
-        if(!defs) return mlir::failure();
-        for(auto attr: defs.getValue()){
-            auto def = attr.cast<GateDefinition>();
-            if(def.getType().strref()=="qir"){
-                auto flat_symbol = def.getValue().cast<mlir::FlatSymbolRefAttr>();
-                for(auto& famousGate: famousGates){
-                    if(flat_symbol.getValue() == famousGate.qir_name){
-                        if(getFamousName(famousGate.famous_name) != defgate.getSymName()){
-                            rewriter.updateRootInPlace(use, [&](){
-                                use.setNameAttr(mlir::FlatSymbolRefAttr::get(rewriter.getStringAttr(getFamousName(famousGate.famous_name))));
-                            });
-                            return mlir::success();
-                        }else{
-                            return mlir::failure();
-                        }
-                        
-                    }
-                }
-            }
+        if(!defgate || !use.getType().isa<GateType>()) return mlir::failure();
+        auto match = matchFamousGate(defgate);
+        if(!match) return mlir::failure();
+        auto& famousGate = famousGates[match->id];
+        auto famous_name = getFamousName(famousGate.famous_name);
+        if(famous_name == defgate.getSymName()) return mlir::failure();
+        auto famous_ref = mlir::FlatSymbolRefAttr::get(rewriter.getStringAttr(famous_name));
+        auto famous_defgate = llvm::dyn_cast_or_null<DefgateOp>(mlir::SymbolTable::lookupNearestSymbolFrom(use, famous_ref));
+        if(!famous_defgate) return mlir::failure();
+        // The famous gate carries its own traits, which the user gate may lack.
+        auto famous_type = famous_defgate.getTypeWhenUsed();
+        if(match->isIdentityPermutation() && std::abs(match->phase - 1.0) < EPS){
+            rewriter.updateRootInPlace(use, [&](){
+                use.setNameAttr(famous_ref);
+                use.getResult().setType(famous_type);
+            });
+            retypeDecorates(use.getResult(), rewriter);
+            return mlir::success();
         }
-
-        return mlir::failure();
+        // The user gate is the famous gate on reordered qubits, or with another global phase.
+        // Only plain applies can be rewritten: the phase would become relative under control.
+        for(auto user: use->getUsers()){
+            if(!llvm::isa<ApplyGateOp>(user)) return mlir::failure();
+        }
+        auto famous_use = rewriter.create<UseGateOp>(use->getLoc(), famous_type, famous_ref, mlir::ValueRange{});
+        auto& perm = match->perm;
+        for(auto user: llvm::make_early_inc_range(use->getUsers())){
+            auto apply = llvm::cast<ApplyGateOp>(user);
+            mlir::SmallVector<mlir::Value> args;
+            for(auto i: perm) args.push_back(apply.getArgs()[i]);
+            rewriter.setInsertionPoint(apply);
+            auto new_apply = rewriter.create<ApplyGateOp>(apply->getLoc(), apply->getResultTypes(), famous_use.getResult(), args);
+            mlir::SmallVector<mlir::Value> results(perm.size());
+            for(auto i=0; i<perm.size(); i++) results[perm[i]] = new_apply->getResult(i);
+            rewriter.replaceOp(apply, results);
+        }
+        rewriter.eraseOp(use);
+        return mlir::success();
     }
 };
 
-std::vector<FamousGateDef> FAMOUS_GATES;
 
 struct RecognizeFamousGatePass : public mlir::PassWrapper<RecognizeFamousGatePass, mlir::OperationPass<mlir::ModuleOp>>{
     std::vector<FamousGateDef>& famousGates;
@@ -167,6 +243,18 @@ struct RecognizeFamousGatePass : public mlir::PassWrapper<RecognizeFamousGatePas
         famousGates.push_back(FamousGateDef("__quantum__qis__rz__body", "rz", 1, 1, GateTrait::Diagonal | GateTrait::Symmetric));
         famousGates.push_back(FamousGateDef("__quantum__qis__gphase", "gphase", 1, 0, GateTrait::Diagonal | GateTrait::Symmetric | GateTrait::Phase ));
         famousGates.push_back(FamousGateDef("__quantum__qis__u3", "u3", 3, 1, GateTrait::Symmetric));
+        for(auto i=0; i<famousGates.size(); i++){
+            auto& gate = famousGates[i];
+            FAMOUS_BY_QIR[gate.qir_name] = i;
+            FAMOUS_BY_NAME[llvm::StringRef(gate.famous_name).lower()] = i;
+            if(gate.mat_def){
+                GateMatrix mat;
+                for(auto& row: *gate.mat_def){
+                    mat.emplace_back(row.begin(), row.end());
+                }
+                FAMOUS_BY_MATRIX.insert(i, mat);
+            }
+        }
     }
 
     void emitToffoliConstruction(mlir::OpBuilder builder){
@@ -278,25 +366,11 @@ llvm::SmallString<32> getFamousName(const char* famous_gate){
 }
 
 FamousGateDef* findFamousGate(const char* famous_gate){
-    llvm::SmallString<32> name1;
-    while(char ch = *(famous_gate++)){
-        name1+=llvm::toLower(ch);
-    }
-    for(auto i=0; i<FAMOUS_GATES.size(); i++){
-        auto def = &FAMOUS_GATES[i];
-        llvm::SmallString<32> name2;
-
-        const char* known_gate = def->famous_name;
-        while(char ch = *(known_gate++)){
-            name2+=llvm::toLower(ch);
-        }
-        if(name1==name2){
-            return def;
-        }
-        
+    auto it = FAMOUS_BY_NAME.find(llvm::StringRef(famous_gate).lower());
+    if(it==FAMOUS_BY_NAME.end()){
+        llvm_unreachable("famous gate not found");
     }
-    llvm_unreachable("famous gate not found");
-    assert(0);
+    return &FAMOUS_GATES[it->second];
 }
 
 
@@ -1,9 +1,11 @@
 #include "isq/Operations.h"
 #include "isq/QTypes.h"
+#include "isq/passes/GateInfo.h"
 #include "isq/passes/Passes.h"
-#include <llvm/ADT/TypeSwitch.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/StringSet.h>
 #include <llvm/Support/Casting.h>
-#include <llvm/Support/raw_ostream.h>
 #include <mlir/Dialect/Affine/IR/AffineOps.h>
 #include <mlir/Dialect/Arith/IR/Arith.h>
 #include <mlir/Dialect/Func/IR/FuncOps.h>
@@ -11,51 +13,182 @@
 #include <mlir/Dialect/SCF/IR/SCF.h>
 #include <mlir/IR/BuiltinAttributes.h>
 #include <mlir/IR/BuiltinTypes.h>
-#include <mlir/IR/IntegerSet.h>
-#include <mlir/IR/Location.h>
-#include <mlir/IR/PatternMatch.h>
+#include <mlir/IR/Builders.h>
+#include <mlir/IR/SymbolTable.h>
 #include <mlir/IR/Value.h>
 #include <mlir/IR/ValueRange.h>
+#include <mlir/Interfaces/CallInterfaces.h>
 #include <mlir/Pass/Pass.h>
 #include <mlir/Pass/PassRegistry.h>
 #include <mlir/Support/LLVM.h>
 #include <mlir/Support/LogicalResult.h>
-#include <mlir/AsmParser/AsmParser.h>
 namespace isq::ir::passes{
     using mlir::func::FuncOp;
     using mlir::Value;
+
+    static bool isQStateMemRef(mlir::Type type){
+        auto memref = type.dyn_cast<mlir::MemRefType>();
+        return memref && memref.getElementType().isa<QStateType>();
+    }
+    static mlir::MemRefType singleQubitType(mlir::MLIRContext* ctx){
+        return mlir::MemRefType::get({1}, QStateType::get(ctx));
+    }
+
+    // A qubit in a known computational basis state, which can stand in for a fresh qubit.
     struct ReusableQubit{
-        Value memref;
+        MemLocation location;
+        // Rank-1 memref holding the qubit, and the index of the qubit in it.
+        Value root;
+        int64_t index;
+        // Measurement result, or null if the qubit was reset.
         Value measured_result;
-        void restore_state(mlir::RewriterBase& rewriter){
-            auto zero = rewriter.create<mlir::arith::ConstantIndexOp>(rewriter.getUnknownLoc(), 0);
-            auto loaded = rewriter.create<mlir::AffineLoadOp>(rewriter.getUnknownLoc(), memref, mlir::ValueRange{zero->getResult(0)});
-            auto resetted = rewriter.create<CallQOpOp>(rewriter.getUnknownLoc(), mlir::TypeRange{QStateType::get(rewriter.getContext())},mlir::FlatSymbolRefAttr::get(rewriter.getStringAttr("__isq__builtin__reset")), mlir::ValueRange{loaded.getResult()}, 1, mlir::TypeAttr::get(rewriter.getFunctionType({}, {})));
-            rewriter.create<mlir::AffineStoreOp>(rewriter.getUnknownLoc(), resetted.getResult(0), memref, mlir::ValueRange{zero->getResult(0)});
-            auto true_ = rewriter.create<mlir::arith::ConstantIntOp>(rewriter.getUnknownLoc(), 1, 1);
-            auto test_at = rewriter.create<mlir::arith::CmpIOp>(rewriter.getUnknownLoc(), mlir::arith::CmpIPredicate::eq, measured_result, true_.getResult());
-            
-            auto branch_reset =rewriter.create<mlir::scf::IfOp>(rewriter.getUnknownLoc(), test_at.getResult(), false);
-            mlir::RewriterBase::InsertionGuard guard(rewriter);
-            rewriter.setInsertionPointToStart(branch_reset.thenBlock());
-            do{
-                auto loaded = rewriter.create<mlir::AffineLoadOp>(rewriter.getUnknownLoc(), memref, mlir::ValueRange{zero->getResult(0)});
-                auto loaded_qubit = loaded.getResult();
-                emitBuiltinGate(rewriter, "x", {&loaded_qubit});
-                rewriter.create<mlir::AffineStoreOp>(rewriter.getUnknownLoc(), loaded_qubit, memref, mlir::ValueRange{zero->getResult(0)});
-            }while(0);
+        // Whether a callee may access the qubit.
+        bool visible_to_calls;
+        // For a deallocated qubit: the dealloc that released it. Its state is unknown.
+        mlir::memref::DeallocOp released = nullptr;
 
+        // A memref<1x!isq.qstate> viewing the qubit.
+        Value materialize(mlir::OpBuilder& builder, mlir::Location loc){
+            auto type = singleQubitType(builder.getContext());
+            auto memref = root;
+            if(auto get_global = memref.getDefiningOp<mlir::memref::GetGlobalOp>()){
+                memref = builder.create<mlir::memref::GetGlobalOp>(loc, get_global.getType(), get_global.getNameAttr());
+            }
+            if(memref.getType()==type) return memref;
+            auto offset = builder.create<mlir::arith::ConstantIndexOp>(loc, index);
+            auto subview = builder.create<mlir::memref::SubViewOp>(loc, memref,
+                mlir::ArrayRef<mlir::OpFoldResult>{offset.getResult()},
+                mlir::ArrayRef<mlir::OpFoldResult>{builder.getIndexAttr(1)},
+                mlir::ArrayRef<mlir::OpFoldResult>{builder.getIndexAttr(1)});
+            return builder.create<mlir::memref::CastOp>(loc, type, subview.getResult());
+        }
+        // Flips the qubit if it was measured as 1.
+        void flipIfOne(mlir::OpBuilder& builder, mlir::Location loc, Value memref){
+            if(!measured_result) return;
+            auto branch = builder.create<mlir::scf::IfOp>(loc, measured_result, false);
+            mlir::OpBuilder::InsertionGuard guard(builder);
+            builder.setInsertionPointToStart(branch.thenBlock());
+            auto zero = builder.create<mlir::arith::ConstantIndexOp>(loc, 0);
+            auto loaded = builder.create<mlir::AffineLoadOp>(loc, memref, mlir::ValueRange{zero.getResult()});
+            auto loaded_qubit = loaded.getResult();
+            emitBuiltinGate(builder, "x", {&loaded_qubit});
+            builder.create<mlir::AffineStoreOp>(loc, loaded_qubit, memref, mlir::ValueRange{zero.getResult()});
+        }
+        void reset(mlir::OpBuilder& builder, mlir::Location loc, Value memref){
+            auto zero = builder.create<mlir::arith::ConstantIndexOp>(loc, 0);
+            auto loaded = builder.create<mlir::AffineLoadOp>(loc, memref, mlir::ValueRange{zero.getResult()});
+            auto resetted = builder.create<CallQOpOp>(loc, mlir::TypeRange{QStateType::get(builder.getContext())}, mlir::FlatSymbolRefAttr::get(builder.getStringAttr("__isq__builtin__reset")), mlir::ValueRange{loaded.getResult()}, 1, mlir::TypeAttr::get(builder.getFunctionType({}, {})));
+            builder.create<mlir::AffineStoreOp>(loc, resetted.getResult(0), memref, mlir::ValueRange{zero.getResult()});
+        }
+        // Brings the qubit to |0>, as expected from a fresh allocation.
+        void prepare(mlir::OpBuilder& builder, mlir::Location loc, Value memref){
+            if(released){
+                reset(builder, loc, memref);
+                return;
+            }
+            flipIfOne(builder, loc, memref);
+        }
+        // Brings the qubit back to the state it had before being lent.
+        void restore_state(mlir::OpBuilder& builder, mlir::Location loc, Value memref){
+            reset(builder, loc, memref);
+            flipIfOne(builder, loc, memref);
         }
     };
+
+    // The qubit memory a function may access, directly or through its callees.
+    struct QubitEffects{
+        // Whether the function may access anything, e.g. through an unknown callee.
+        bool unknown = false;
+        // Globals it may access, by symbol name.
+        llvm::StringSet<> globals;
+        // Arguments it may access, by number.
+        llvm::DenseSet<unsigned> args;
+    };
+
+    // Interprocedural summary of the qubits each function accesses, so that a call only clobbers
+    // the donors its callee may actually reach.
+    struct QubitEffectAnalysis{
+        mlir::SymbolTableCollection symbols;
+        llvm::DenseMap<mlir::Operation*, QubitEffects> effects;
+        llvm::DenseSet<mlir::Operation*> visiting;
+
+        static void record(QubitEffects& effects, FuncOp func, Value memref){
+            auto base = baseMemRef(memref);
+            if(auto get_global = base.getDefiningOp<mlir::memref::GetGlobalOp>()){
+                effects.globals.insert(get_global.getName());
+            }else if(auto arg = base.dyn_cast<mlir::BlockArgument>()){
+                if(arg.getOwner()==&func.getBody().front()){
+                    effects.args.insert(arg.getArgNumber());
+                }else{
+                    effects.unknown = true;
+                }
+            }else if(!base.getDefiningOp<mlir::memref::AllocOp>()){
+                effects.unknown = true;
+            }
+        }
+        FuncOp calleeOf(mlir::CallOpInterface call){
+            return llvm::dyn_cast_or_null<FuncOp>(call.resolveCallable(&symbols));
+        }
+        QubitEffects of(FuncOp func){
+            auto it = effects.find(func);
+            if(it!=effects.end()) return it->second;
+            QubitEffects result;
+            // Recursive calls are not followed.
+            if(func.isExternal() || !visiting.insert(func).second){
+                result.unknown = true;
+                return result;
+            }
+            func.walk([&](mlir::Operation* op){
+                if(auto call = llvm::dyn_cast<mlir::CallOpInterface>(op)){
+                    auto callee = calleeOf(call);
+                    if(!callee){
+                        result.unknown = true;
+                        return;
+                    }
+                    auto callee_effects = of(callee);
+                    result.unknown |= callee_effects.unknown;
+                    for(auto& global: callee_effects.globals) result.globals.insert(global.getKey());
+                    for(auto i: callee_effects.args){
+                        if(i<call.getArgOperands().size()) record(result, func, call.getArgOperands()[i]);
+                    }
+                    return;
+                }
+                // Views alone do not access the qubit.
+                if(llvm::isa<mlir::memref::SubViewOp, mlir::memref::CastOp>(op)) return;
+                for(auto operand: op->getOperands()){
+                    if(isQStateMemRef(operand.getType())) record(result, func, operand);
+                }
+            });
+            visiting.erase(func);
+            effects[func] = result;
+            return result;
+        }
+    };
+
+    // A fresh qubit served by a measured one during its lifetime.
+    struct Borrow{
+        mlir::memref::AllocOp alloc;
+        mlir::memref::DeallocOp dealloc;
+        ReusableQubit donor;
+    };
+
+    // Finds measured, reset or deallocated qubits that stay untouched over the whole lifetime of a
+    // later single-qubit allocation, and lends them to that allocation. Calls clobber only the
+    // donors their callee may reach, according to QubitEffectAnalysis.
+    // Decisions are made on the original IR and applied afterwards.
     struct ReuseQubitInterpreter{
         FuncOp func;
-        llvm::DenseMap<mlir::Value, mlir::Value> cast_mapping;
-        ReuseQubitInterpreter(FuncOp func): func(func){
+        QubitEffectAnalysis& effects;
+        // Whether the builtin X gate exists to bring measured qubits back to |0>.
+        bool canFlip;
+        llvm::SmallVector<Borrow> borrows;
+        llvm::DenseSet<mlir::Operation*> borrowed;
+        llvm::DenseMap<Value, bool> privateAllocs;
+        ReuseQubitInterpreter(FuncOp func, QubitEffectAnalysis& effects, bool canFlip): func(func), effects(effects), canFlip(canFlip){
 
         }
         // Finds the corresponding dealloc op.
         // If there are more than 1 dealloc, give up.
-        // TODO: introducing lifetime analysis.
         mlir::memref::DeallocOp findDealloc(Value memref){
             mlir::memref::DeallocOp dealloc;
             for(auto user: memref.getUsers()){
@@ -67,169 +200,322 @@ namespace isq::ir::passes{
             }
             return dealloc;
         }
-
-        mlir::LogicalResult visit(mlir::IRRewriter& rewriter, mlir::Operation* op, mlir::SmallVector<ReusableQubit>& measured_qubits){
-            return llvm::TypeSwitch<mlir::Operation*, mlir::LogicalResult>(op)
-            .Case<FuncOp>([&](auto cop){ return visit(rewriter, cop, measured_qubits);})
-            .Case<mlir::AffineIfOp>([&](auto cop){ return visit(rewriter, cop, measured_qubits);})
-            .Case<mlir::memref::AllocOp>([&](auto cop){ return visit(rewriter, cop, measured_qubits);})
-            .Case<mlir::memref::CastOp>([&](auto cop){ return visit(rewriter, cop, measured_qubits);})
-            .Case<CallQOpOp>([&](auto cop){ return visit(rewriter, cop, measured_qubits);})
-            .Case<ApplyGateOp>([&](auto cop){ return visit(rewriter, cop, measured_qubits);})
-            .Case<mlir::scf::IfOp>([&](auto cop){ return visit(rewriter, cop, measured_qubits);})
-            .Default([&](auto op){ return mlir::success();});
-        }
-        mlir::LogicalResult visit(mlir::IRRewriter& rewriter, FuncOp func, mlir::SmallVector<ReusableQubit>& measured_qubits){
-            if(func.getBody().hasOneBlock()){
-                (void)visitBunch(rewriter, &*func.getBody().begin(), measured_qubits);
+        // Whether `memref` is a local allocation only accessed through loads and stores.
+        // Such memory cannot alias block arguments and cannot be touched by callees.
+        bool isPrivate(Value memref){
+            if(!memref.getDefiningOp<mlir::memref::AllocOp>()) return false;
+            auto it = privateAllocs.find(memref);
+            if(it!=privateAllocs.end()) return it->second;
+            auto is_private = true;
+            mlir::SmallVector<Value> worklist{memref};
+            while(is_private && !worklist.empty()){
+                auto val = worklist.pop_back_val();
+                for(auto& use: val.getUses()){
+                    auto user = use.getOwner();
+                    if(llvm::isa<mlir::memref::SubViewOp, mlir::memref::CastOp>(user)){
+                        worklist.push_back(user->getResult(0));
+                    }else if(llvm::isa<mlir::AffineLoadOp, mlir::memref::LoadOp, mlir::memref::DeallocOp>(user)){
+                        continue;
+                    }else if(auto store = llvm::dyn_cast<mlir::AffineStoreOp>(user)){
+                        is_private &= store.getValueToStore()!=val;
+                    }else if(auto store = llvm::dyn_cast<mlir::memref::StoreOp>(user)){
+                        is_private &= store.getValueToStore()!=val;
+                    }else{
+                        is_private = false;
+                    }
+                }
             }
-            return mlir::success();
+            privateAllocs[memref] = is_private;
+            return is_private;
         }
-        mlir::LogicalResult visitBunch(mlir::IRRewriter& rewriter, mlir::Block* block, mlir::SmallVector<ReusableQubit>& measured_qubits){
-            if(!block) return mlir::success();
-            
-            mlir::SmallVector<mlir::Operation*> ops;
-            for(auto& op: block->getOperations()){
-                ops.push_back(&op);
+        bool aliases(Value memref, const MemLocation& loc, const ReusableQubit& qubit){
+            auto base = baseMemRef(memref);
+            if(base!=qubit.root && (isPrivate(base) || isPrivate(qubit.root))) return false;
+            return loc.mayAlias(qubit.location);
+        }
+        bool touchesDirectly(mlir::Operation* op, const ReusableQubit& qubit){
+            if(auto call = llvm::dyn_cast<mlir::CallOpInterface>(op)){
+                if(!qubit.visible_to_calls) return false;
+                auto callee = effects.calleeOf(call);
+                if(!callee) return true;
+                auto callee_effects = effects.of(callee);
+                if(callee_effects.unknown) return true;
+                if(auto get_global = qubit.root.getDefiningOp<mlir::memref::GetGlobalOp>()){
+                    if(callee_effects.globals.contains(get_global.getName())) return true;
+                }else if(!callee_effects.globals.empty()){
+                    // An argument may be a global.
+                    return true;
+                }
+                for(auto i: callee_effects.args){
+                    if(i>=call.getArgOperands().size()) continue;
+                    auto operand = call.getArgOperands()[i];
+                    if(isQStateMemRef(operand.getType()) && aliases(operand, resolveMemLocation(operand), qubit)) return true;
+                }
+                return false;
             }
-            llvm::outs()<<"bunch"<<ops.size()<<"\n";
-            for(auto op: ops){
-                (void)visit(rewriter, op, measured_qubits);
+            if(auto load = llvm::dyn_cast<mlir::AffineLoadOp>(op)){
+                if(!isQStateMemRef(load.getMemRef().getType())) return false;
+                return aliases(load.getMemRef(), resolveMemLocation(load.getMemRef(), load.getAffineMap(), load.getMapOperands()), qubit);
             }
-            return mlir::success();
-        }
-        mlir::LogicalResult visit(mlir::IRRewriter& rewriter, mlir::AffineIfOp op, mlir::SmallVector<ReusableQubit>& measured_qubits){
-            return visitTwoBranches(rewriter, op.getThenBlock(), op.getElseBlock(), measured_qubits);
+            if(auto store = llvm::dyn_cast<mlir::AffineStoreOp>(op)){
+                if(!isQStateMemRef(store.getMemRef().getType())) return false;
+                return aliases(store.getMemRef(), resolveMemLocation(store.getMemRef(), store.getAffineMap(), store.getMapOperands()), qubit);
+            }
+            // Views alone do not access the qubit.
+            if(llvm::isa<mlir::memref::SubViewOp, mlir::memref::CastOp>(op)) return false;
+            for(auto operand: op->getOperands()){
+                if(isQStateMemRef(operand.getType()) && aliases(operand, resolveMemLocation(operand), qubit)) return true;
+            }
+            return false;
         }
-        mlir::LogicalResult visit(mlir::IRRewriter& rewriter, mlir::scf::IfOp op, mlir::SmallVector<ReusableQubit>& measured_qubits){
-            return visitTwoBranches(rewriter, op.thenBlock(), op.elseBlock(), measured_qubits);
+        // Whether `op` or anything nested in it may access the qubit.
+        bool touches(mlir::Operation* op, const ReusableQubit& qubit){
+            return op->walk([&](mlir::Operation* inner){
+                if(touchesDirectly(inner, qubit)) return mlir::WalkResult::interrupt();
+                return mlir::WalkResult::advance();
+            }).wasInterrupted();
         }
 
-        mlir::LogicalResult visitTwoBranches(mlir::IRRewriter& rewriter, mlir::Block* thenBlock, mlir::Block* elseBlock, mlir::SmallVector<ReusableQubit>& measured_qubits){
-            auto branch_1 = mlir::SmallVector(measured_qubits);
-            auto branch_2 = mlir::SmallVector(measured_qubits);
-            auto original = mlir::SmallVector(measured_qubits);
-            (void)visitBunch(rewriter, thenBlock, branch_1);
-            (void)visitBunch(rewriter, elseBlock, branch_2);
+        // Qubit left in a known state by storing the result of a measurement or reset.
+        std::optional<ReusableQubit> donorOf(mlir::Operation* op){
+            Value stored;
+            Value memref;
+            std::optional<MemLocation> loc;
+            if(auto store = llvm::dyn_cast<mlir::AffineStoreOp>(op)){
+                stored = store.getValueToStore();
+                memref = store.getMemRef();
+                loc = resolveMemLocation(memref, store.getAffineMap(), store.getMapOperands());
+            }else if(auto store = llvm::dyn_cast<mlir::memref::StoreOp>(op)){
+                stored = store.getValueToStore();
+                memref = store.getMemRef();
+                loc = resolveMemLocation(memref);
+            }else if(auto dealloc = llvm::dyn_cast<mlir::memref::DeallocOp>(op)){
+                return releasedDonor(dealloc);
+            }else{
+                return std::nullopt;
+            }
+            auto call = stored.getDefiningOp<CallQOpOp>();
+            if(!call || !stored.hasOneUse()) return std::nullopt;
+            auto callee = call.getCallee().getLeafReference().getValue();
+            Value measured_result;
+            if(callee=="__isq__builtin__measure"){
+                if(!canFlip) return std::nullopt;
+                measured_result = call->getResult(1);
+            }else if(callee!="__isq__builtin__reset"){
+                return std::nullopt;
+            }
+            auto root = baseMemRef(memref);
+            auto root_type = root.getType().dyn_cast<mlir::MemRefType>();
+            if(!root_type || root_type.getRank()!=1 || !root_type.getLayout().isIdentity()) return std::nullopt;
+            int64_t index;
+            if(loc->indices && loc->indices->size()==1){
+                index = (*loc->indices)[0];
+            }else if(root_type.getShape()[0]==1){
+                index = 0;
+                loc->indices = std::vector<int64_t>{0};
+            }else{
+                return std::nullopt;
+            }
+            if(auto alloc = root.getDefiningOp<mlir::memref::AllocOp>()){
+                if(borrowed.contains(alloc)) return std::nullopt;
+            }else if(!root.getDefiningOp<mlir::memref::GetGlobalOp>() && !root.isa<mlir::BlockArgument>()){
+                return std::nullopt;
+            }
+            return ReusableQubit{*loc, root, index, measured_result, !isPrivate(root)};
+        }
 
+        // A single-qubit allocation freed by `dealloc`, which may serve a later allocation in the same
+        // block instead. The borrower then frees it in its place.
+        std::optional<ReusableQubit> releasedDonor(mlir::memref::DeallocOp dealloc){
+            auto alloc = dealloc.getMemref().getDefiningOp<mlir::memref::AllocOp>();
+            if(!alloc || borrowed.contains(alloc) || borrowerDealloc(alloc)!=dealloc || !isPrivate(alloc)) return std::nullopt;
+            auto root = alloc.getMemref();
+            auto loc = resolveMemLocation(root);
+            loc.indices = std::vector<int64_t>{0};
+            return ReusableQubit{loc, root, 0, nullptr, false, dealloc};
+        }
 
+        // The alloc of a fresh qubit that may be served by a donor, with its dealloc.
+        mlir::memref::DeallocOp borrowerDealloc(mlir::memref::AllocOp alloc){
+            if(alloc.getType()!=singleQubitType(alloc->getContext())) return nullptr;
+            if(!alloc.getDynamicSizes().empty() || !alloc.getSymbolOperands().empty()) return nullptr;
+            auto dealloc = findDealloc(alloc);
+            if(!dealloc || dealloc->getBlock()!=alloc->getBlock() || !alloc->isBeforeInBlock(dealloc)) return nullptr;
+            return dealloc;
+        }
 
-            measured_qubits.clear();
-            for(auto originally_cleared : original){
-                bool still_clear = false;
-                for(auto also_cleared: branch_1){
-                    if(also_cleared.measured_result == originally_cleared.measured_result && also_cleared.memref == originally_cleared.memref){
-                        still_clear=true; break;
+        void visitBlock(mlir::Block* block, mlir::SmallVector<ReusableQubit> available){
+            // Donors lent to a borrower, keyed by the dealloc ending the borrow.
+            llvm::DenseMap<mlir::Operation*, ReusableQubit> lent;
+            for(auto& op: block->getOperations()){
+                auto it = lent.find(&op);
+                if(it!=lent.end()){
+                    auto donor = it->second;
+                    // A released donor is freed by the borrower's dealloc from now on.
+                    if(donor.released) donor.released = llvm::cast<mlir::memref::DeallocOp>(&op);
+                    available.push_back(donor);
+                    lent.erase(it);
+                    continue;
+                }
+                if(auto alloc = llvm::dyn_cast<mlir::memref::AllocOp>(&op)){
+                    if(!available.empty()){
+                        if(auto dealloc = borrowerDealloc(alloc)){
+                            // Prefer the most recently measured qubit.
+                            for(auto i = available.size(); i-- > 0;){
+                                auto& donor = available[i];
+                                auto clash = false;
+                                for(auto inner = std::next(alloc->getIterator()); &*inner!=dealloc.getOperation() && !clash; ++inner){
+                                    clash = touches(&*inner, donor);
+                                }
+                                if(clash) continue;
+                                borrows.push_back(Borrow{alloc, dealloc, donor});
+                                borrowed.insert(alloc);
+                                lent.insert({dealloc.getOperation(), donor});
+                                available.erase(available.begin()+i);
+                                break;
+                            }
+                            if(borrowed.contains(alloc)) continue;
+                        }
                     }
                 }
-                if(!still_clear) break;
-                still_clear = false;
-                for(auto also_cleared: branch_2){
-                    if(also_cleared.measured_result == originally_cleared.measured_result && also_cleared.memref == originally_cleared.memref){
-                        still_clear=true; break;
+                if(op.getNumRegions()>0){
+                    // Branches run at most once. Other regions (e.g. loop bodies) may run again after
+                    // touching a donor, so only donors untouched by the whole op are passed in.
+                    mlir::SmallVector<ReusableQubit> inherited;
+                    auto once = llvm::isa<mlir::scf::IfOp, mlir::AffineIfOp, mlir::scf::ExecuteRegionOp>(&op);
+                    for(auto& donor: available){
+                        // Released donors stay in their block, where their new dealloc runs exactly once.
+                        if(donor.released) continue;
+                        if(once || !touches(&op, donor)) inherited.push_back(donor);
                     }
+                    for(auto& region: op.getRegions()){
+                        for(auto& inner: region){
+                            // Control flow between blocks is not tracked.
+                            visitBlock(&inner, &inner==&region.front() ? inherited : mlir::SmallVector<ReusableQubit>{});
+                        }
+                    }
+                }
+                llvm::erase_if(available, [&](const ReusableQubit& donor){
+                    return touches(&op, donor);
+                });
+                if(auto donor = donorOf(&op)){
+                    available.push_back(*donor);
                 }
-                if(!still_clear) break;
-                measured_qubits.push_back(originally_cleared);
             }
-            return mlir::success();
         }
 
-        mlir::Value traceMemref(mlir::Value qstate){
-            auto first_loaded_value = traceBackwardQState(qstate);
-            auto first_load = qstate.getDefiningOp<mlir::AffineLoadOp>();
-            if(!first_load) return nullptr;
-            auto memref = first_load.getMemRef();
-            if(memref){
-                if(cast_mapping.count(memref)){
-                    return cast_mapping[memref];
+        void apply(){
+            for(auto& borrow: borrows){
+                auto alloc = borrow.alloc;
+                mlir::OpBuilder builder(alloc);
+                auto memref = borrow.donor.materialize(builder, alloc->getLoc());
+                borrow.donor.prepare(builder, alloc->getLoc(), memref);
+                alloc.getMemref().replaceAllUsesWith(memref);
+                alloc->erase();
+                if(auto released = borrow.donor.released){
+                    // The donor stays allocated until the borrow ends, and is freed there instead.
+                    released->erase();
+                    borrow.dealloc->setOperand(0, memref);
+                    continue;
                 }
+                builder.setInsertionPoint(borrow.dealloc);
+                borrow.donor.restore_state(builder, borrow.dealloc->getLoc(), memref);
+                borrow.dealloc->erase();
             }
-            return memref;
         }
 
-        void taintQState(mlir::Value qstate, mlir::SmallVector<ReusableQubit>& measured_qubits){
-            if(!qstate.getType().isa<QStateType>()) return;
-            auto possible_memref = traceMemref(qstate);
-            if(possible_memref){
-                mlir::SmallVector<ReusableQubit> qubits;
-                for(auto x : measured_qubits){
-                    if(x.memref!=possible_memref){
-                        qubits.push_back(x);
-                    }
-                }
-                measured_qubits = qubits;
-            }else{
-                // conservatively assume all qubits are tainted.
-                measured_qubits.clear();
-            }
-        }
-        mlir::LogicalResult visit(mlir::IRRewriter& rewriter, mlir::memref::CastOp cast_op, mlir::SmallVector<ReusableQubit>& measured_qubits){
-            cast_mapping.insert(std::make_pair(cast_op.getResult(), cast_op.getSource()));
-            return mlir::success();
-        }
-        mlir::LogicalResult visit(mlir::IRRewriter& rewriter, CallQOpOp call_qop, mlir::SmallVector<ReusableQubit>& measured_qubits){
-            llvm::outs()<<"visit callqop\n";
-            for(auto arg: call_qop.getArgs()){
-                taintQState(arg, measured_qubits);
-            }
-            // check if it is measurement.
-            if(call_qop.getCallee().getLeafReference().getValue()=="__isq__builtin__measure"){
-                auto memref = traceMemref(call_qop.getArgs()[0]);
-                if(memref && memref.isa<mlir::BlockArgument>()){
-                    measured_qubits.push_back(ReusableQubit{
-                        .memref = memref,
-                        .measured_result = call_qop->getResult(1)
-                    });
-                }
+        // Returns the number of reused qubits.
+        unsigned run(){
+            for(auto& block: func.getBody()){
+                visitBlock(&block, {});
             }
-            return mlir::success();
-        }
-        mlir::LogicalResult visit(mlir::IRRewriter& rewriter, ApplyGateOp call_qop, mlir::SmallVector<ReusableQubit>& measured_qubits){
-            for(auto arg: call_qop.getArgs()){
-                taintQState(arg, measured_qubits);
-            }
-            return mlir::success();
-        }
-        mlir::LogicalResult visit(mlir::IRRewriter& rewriter, mlir::memref::AllocOp alloc, mlir::SmallVector<ReusableQubit>& measured_qubits){
-            if(measured_qubits.size()){
-                // try reuse
-                auto memref = alloc.getMemref().getType().cast<mlir::MemRefType>();
-                if(memref == mlir::MemRefType::get({1}, QStateType::get(rewriter.getContext()))){
-                    auto dealloc = findDealloc(alloc);
-                    if(dealloc){
-                        // reuse.
-                        auto reused = measured_qubits.back();
-                        measured_qubits.pop_back();
-                        //rewriter.setInsertionPoint(alloc);
-                        rewriter.replaceOp(alloc, {reused.memref});
-                        rewriter.setInsertionPoint(dealloc);
-                        reused.restore_state(rewriter);
-                        rewriter.eraseOp(dealloc);
-                        /*rewriter.create<mlir::memref::SubViewOp>(mlir::UnknownLoc::get(rewriter.getContext()), reused.memref, mlir::ArrayRef<int64_t>{0}, mlir::ArrayRef<int64_t>{1}, mlir::ArrayRef<int64_t>{0});
-                        rewriter.replaceOp(alloc, );*/
+            apply();
+            return borrows.size();
+        }
+    };
+
+    // Static estimate of the peak number of simultaneously allocated qubits.
+    // Qubits allocated in a callee are counted at its call sites.
+    struct LiveQubitCounter{
+        mlir::SymbolTableCollection symbols;
+        llvm::DenseMap<mlir::Operation*, int64_t> funcPeak;
+
+        static int64_t qubitCount(mlir::Type type){
+            if(!isQStateMemRef(type)) return 0;
+            auto memref = type.cast<mlir::MemRefType>();
+            // Dynamic sizes count as a single qubit.
+            return memref.hasStaticShape() ? memref.getNumElements() : 1;
+        }
+        int64_t peakOf(FuncOp func){
+            auto it = funcPeak.find(func);
+            if(it!=funcPeak.end()) return it->second;
+            // Recursive calls are counted once.
+            funcPeak[func] = 0;
+            auto peak = func.isExternal() ? 0 : peakOf(func.getBody(), 0);
+            funcPeak[func] = peak;
+            return peak;
+        }
+        int64_t peakOf(mlir::Region& region, int64_t live){
+            auto peak = live;
+            // Blocks are counted in order, which matches the layout of frontend exit blocks.
+            for(auto& block: region){
+                for(auto& op: block){
+                    if(auto alloc = llvm::dyn_cast<mlir::memref::AllocOp>(&op)){
+                        live += qubitCount(alloc.getType());
+                    }else if(auto dealloc = llvm::dyn_cast<mlir::memref::DeallocOp>(&op)){
+                        if(baseMemRef(dealloc.getMemref()).getDefiningOp<mlir::memref::AllocOp>()){
+                            live = std::max<int64_t>(0, live - qubitCount(dealloc.getMemref().getType()));
+                        }
+                    }else if(auto call = llvm::dyn_cast<mlir::CallOpInterface>(&op)){
+                        if(auto callee = llvm::dyn_cast_or_null<FuncOp>(call.resolveCallable(&symbols))){
+                            peak = std::max(peak, live + peakOf(callee));
+                        }
+                    }
+                    for(auto& inner: op.getRegions()){
+                        peak = std::max(peak, peakOf(inner, live));
                     }
+                    peak = std::max(peak, live);
                 }
             }
-
-            return mlir::success();
-        }
-
-        void run(){
-            mlir::IRRewriter rewriter(func.getContext());
-            mlir::SmallVector<ReusableQubit> measured_qubits;
-            (void)visit(rewriter, func, measured_qubits);
+            return peak;
         }
-        
     };
+
     struct ReuseQubitPass : public mlir::PassWrapper<ReuseQubitPass, mlir::OperationPass<mlir::ModuleOp>>{
+        Option<bool> report{*this, "report", llvm::cl::desc("Emit a remark with the peak number of live qubits of each function, before and after reuse."), llvm::cl::init(false)};
+        Statistic numReused{this, "reused-qubits", "Number of allocations served by measured qubits"};
+        ReuseQubitPass() = default;
+        ReuseQubitPass(const ReuseQubitPass& pass) {}
+
         void runOnOperation() override{
-            getOperation()->walk([](FuncOp func){
-                //FuncOp func = getOperation();
-                ReuseQubitInterpreter interp(func);
-                interp.run();
-            });
-            
+            mlir::ModuleOp m = getOperation();
+            mlir::SmallVector<FuncOp> funcs;
+            for(auto func: m.getOps<FuncOp>()){
+                if(!func.isExternal()) funcs.push_back(func);
+            }
+            LiveQubitCounter before;
+            llvm::DenseMap<mlir::Operation*, int64_t> peak_before;
+            if(report){
+                for(auto func: funcs) peak_before[func] = before.peakOf(func);
+            }
+            unsigned reused = 0;
+            // Lent qubits are restored by a reset, and measured ones flipped back by X.
+            if(mlir::SymbolTable::lookupSymbolIn(m, "__isq__builtin__reset")){
+                auto can_flip = mlir::SymbolTable::lookupSymbolIn(m, getFamousName("x"))!=nullptr;
+                QubitEffectAnalysis effects;
+                for(auto func: funcs){
+                    ReuseQubitInterpreter interp(func, effects, can_flip);
+                    reused += interp.run();
+                }
+            }
+            numReused += reused;
+            if(reused==0) markAllAnalysesPreserved();
+            if(report){
+                LiveQubitCounter after;
+                for(auto func: funcs){
+                    func.emitRemark() << "peak live qubits: " << peak_before[func] << " -> " << after.peakOf(func);
+                }
+            }
         }
     mlir::StringRef getArgument() const final {
         return "isq-reuse-qubit";
@@ -241,4 +527,4 @@ namespace isq::ir::passes{
     void registerReuseQubit(){
         mlir::PassRegistration<ReuseQubitPass>();
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,122 @@
+#include "isq/Operations.h"
+#include "isq/QTypes.h"
+#include "isq/passes/Passes.h"
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SourceMgr.h>
+#include <mlir/Dialect/PDL/IR/PDL.h>
+#include <mlir/Dialect/PDLInterp/IR/PDLInterp.h>
+#include <mlir/IR/BuiltinOps.h>
+#include <mlir/IR/PatternMatch.h>
+#include <mlir/IR/SymbolTable.h>
+#include <mlir/Parser/Parser.h>
+#include <mlir/Pass/Pass.h>
+#include <mlir/Pass/PassRegistry.h>
+#include <mlir/Rewrite/FrozenRewritePatternSet.h>
+#include <mlir/Tools/PDLL/AST/Context.h>
+#include <mlir/Tools/PDLL/AST/Nodes.h>
+#include <mlir/Tools/PDLL/CodeGen/MLIRGen.h>
+#include <mlir/Tools/PDLL/ODS/Context.h>
+#include <mlir/Tools/PDLL/Parser/Parser.h>
+#include <mlir/Transforms/GreedyPatternRewriteDriver.h>
+namespace isq{
+namespace ir{
+namespace passes{
+
+// Native functions callable from rule files. Declare them in PDLL with
+//   Constraint IsFamousGate(gate: Value, name: Attr);
+//   Rewrite UseFamousGate(name: Attr, size: Attr) -> Value;
+
+// Whether `gate` is an undecorated `isq.use` of the builtin gate named by the string attribute `name`.
+static mlir::LogicalResult isFamousGateConstraint(mlir::PatternRewriter& rewriter, mlir::Value gate, mlir::Attribute name){
+    auto use = gate.getDefiningOp<UseGateOp>();
+    auto str = name.dyn_cast<mlir::StringAttr>();
+    if(!use || !str) return mlir::failure();
+    auto defgate = llvm::dyn_cast_or_null<DefgateOp>(mlir::SymbolTable::lookupNearestSymbolFrom(use, use.getName()));
+    return mlir::success(defgate && isFamousGate(defgate, str.str().c_str()));
+}
+
+// Uses the builtin gate named by `name` on `size` qubits.
+static mlir::Value useFamousGateRewrite(mlir::PatternRewriter& rewriter, mlir::Attribute name, mlir::Attribute size){
+    auto str = name.cast<mlir::StringAttr>().str();
+    auto n = size.cast<mlir::IntegerAttr>().getInt();
+    return emitUseBuiltinGate(rewriter, n, str.c_str());
+}
+
+// Applies rewrite rules loaded at run time, so that target-specific peepholes need no rebuild.
+// Rule files are PDLL (`.pdll`) or PDL modules (any other extension). They are compiled once, when the
+// pass is initialized, into a frozen pattern set shared by all runs.
+// `--isq-rewrite-rules=a.pdll,b.mlir` is short for `--isq-rewrite-rules=rules=a.pdll,b.mlir`.
+struct RewriteRulesPass : public mlir::PassWrapper<RewriteRulesPass, mlir::OperationPass<mlir::ModuleOp>>{
+    ListOption<std::string> rules{*this, "rules", llvm::cl::desc("PDLL or PDL files with the rewrite rules.")};
+    ListOption<std::string> includeDirs{*this, "include-dirs", llvm::cl::desc("Directories searched by `#include` in PDLL files.")};
+    RewriteRulesPass() = default;
+    RewriteRulesPass(const RewriteRulesPass& pass) {}
+
+    mlir::FrozenRewritePatternSet patterns;
+
+    void getDependentDialects(mlir::DialectRegistry& registry) const override{
+        registry.insert<mlir::pdl::PDLDialect, mlir::pdl_interp::PDLInterpDialect>();
+    }
+
+    mlir::LogicalResult initializeOptions(mlir::StringRef options) override{
+        if(!options.empty() && !options.contains('=')){
+            return Pass::initializeOptions(("rules=" + options).str());
+        }
+        return Pass::initializeOptions(options);
+    }
+
+    mlir::OwningOpRef<mlir::ModuleOp> loadRules(mlir::MLIRContext* ctx, const std::string& path){
+        llvm::SourceMgr source_mgr;
+        source_mgr.setIncludeDirs(std::vector<std::string>(includeDirs.begin(), includeDirs.end()));
+        auto buffer = llvm::MemoryBuffer::getFile(path);
+        if(!buffer){
+            mlir::emitError(mlir::UnknownLoc::get(ctx)) << "cannot open rewrite rules " << path << ": " << buffer.getError().message();
+            return nullptr;
+        }
+        source_mgr.AddNewSourceBuffer(std::move(*buffer), llvm::SMLoc());
+        if(!llvm::StringRef(path).endswith(".pdll")){
+            return mlir::parseSourceFile<mlir::ModuleOp>(source_mgr, ctx);
+        }
+        mlir::pdll::ods::Context ods_ctx;
+        mlir::pdll::ast::Context ast_ctx(ods_ctx);
+        auto module = mlir::pdll::parsePDLLAST(ast_ctx, source_mgr);
+        if(mlir::failed(module)) return nullptr;
+        return mlir::pdll::codegenPDLLToMLIR(ctx, ast_ctx, source_mgr, **module);
+    }
+
+    mlir::LogicalResult initialize(mlir::MLIRContext* ctx) override{
+        mlir::RewritePatternSet rps(ctx);
+        for(auto& path: rules){
+            auto module = loadRules(ctx, path);
+            if(!module) return mlir::failure();
+            mlir::PDLPatternModule pdl_patterns(std::move(module));
+            pdl_patterns.registerConstraintFunction("IsFamousGate", isFamousGateConstraint);
+            pdl_patterns.registerRewriteFunction("UseFamousGate", useFamousGateRewrite);
+            rps.add(std::move(pdl_patterns));
+        }
+        patterns = mlir::FrozenRewritePatternSet(std::move(rps));
+        return mlir::success();
+    }
+
+    void runOnOperation() override{
+        if(rules.empty()){
+            markAllAnalysesPreserved();
+            return;
+        }
+        (void)mlir::applyPatternsAndFoldGreedily(getOperation(), patterns);
+    }
+    mlir::StringRef getArgument() const final{
+        return "isq-rewrite-rules";
+    }
+    mlir::StringRef getDescription() const final{
+        return "Apply rewrite rules loaded from PDLL or PDL files.";
+    }
+};
+
+void registerRewriteRules(){
+    mlir::PassRegistration<RewriteRulesPass>();
+}
+
+}
+}
+}
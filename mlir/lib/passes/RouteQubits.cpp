@@ -0,0 +1,343 @@
+#include "isq/Operations.h"
+#include "isq/QTypes.h"
+#include "isq/passes/GateInfo.h"
+#include "isq/passes/Passes.h"
+#include "isq/passes/QubitRouter.h"
+#include <chrono>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <mlir/Dialect/Affine/IR/AffineOps.h>
+#include <mlir/Dialect/Func/IR/FuncOps.h>
+#include <mlir/Dialect/MemRef/IR/MemRef.h>
+#include <mlir/IR/Builders.h>
+#include <mlir/IR/BuiltinOps.h>
+#include <mlir/Interfaces/CallInterfaces.h>
+#include <mlir/Pass/Pass.h>
+#include <mlir/Pass/PassRegistry.h>
+#include "nlohmann/json.hpp"
+namespace isq{
+namespace ir{
+namespace passes{
+
+static bool isQStateMemRef(mlir::Type type){
+    auto memref = type.dyn_cast<mlir::MemRefType>();
+    return memref && memref.getElementType().isa<QStateType>();
+}
+
+// Maps qubits onto a device with restricted connectivity by inserting SWAP gates.
+//
+// The device is read from a QCIS mapping config (`qbit_num`, 1-based `topo` edges and `init_map`), the same
+// file given to `isqc compile --qcis-config`. Every function must be straight-line code with all qubits in one
+// array at constant indices, i.e. loops unrolled and gates decomposed into at most two qubits. Logical qubit i
+// starts on physical qubit i, and the array is grown to the device size if needed.
+struct RouteQubitsPass : public mlir::PassWrapper<RouteQubitsPass, mlir::OperationPass<mlir::ModuleOp>>{
+    Option<std::string> config{*this, "config", llvm::cl::desc("QCIS mapping config with `qbit_num`, `topo` and optional `init_map`.")};
+    Option<unsigned> lookahead{*this, "lookahead", llvm::cl::desc("Number of upcoming two-qubit gates considered when choosing a swap."), llvm::cl::init(20)};
+    Option<double> lookaheadWeight{*this, "lookahead-weight", llvm::cl::desc("Weight of upcoming gates relative to tie-breaking order."), llvm::cl::init(0.5)};
+    Statistic numSwaps{this, "inserted-swaps", "Number of SWAP gates inserted"};
+    Statistic numRoutedGates{this, "routed-gates", "Number of two-qubit gates routed"};
+    Statistic routingMicros{this, "routing-time-us", "Time spent in the router, in microseconds"};
+    RouteQubitsPass() = default;
+    RouteQubitsPass(const RouteQubitsPass& pass) {}
+
+    struct Device{
+        unsigned size;
+        std::vector<std::pair<unsigned, unsigned>> edges;
+        std::string initMap = "naive";
+    };
+
+    mlir::FailureOr<Device> loadConfig(mlir::Location loc){
+        auto buffer = llvm::MemoryBuffer::getFile(config);
+        if(!buffer){
+            mlir::emitError(loc) << "cannot open routing config " << config << ": " << buffer.getError().message();
+            return mlir::failure();
+        }
+        Device device;
+        try{
+            auto json = nlohmann::json::parse((*buffer)->getBuffer().str());
+            device.size = json.at("qbit_num").get<unsigned>();
+            for(auto& edge: json.at("topo")){
+                auto a = edge.at(0).get<unsigned>();
+                auto b = edge.at(1).get<unsigned>();
+                if(a<1 || b<1 || a>device.size || b>device.size){
+                    mlir::emitError(loc) << "routing config has edge (" << a << ", " << b << ") outside of " << device.size << " qubits";
+                    return mlir::failure();
+                }
+                device.edges.push_back({a-1, b-1});
+            }
+            if(json.contains("init_map")){
+                device.initMap = json.at("init_map").get<std::string>();
+            }
+        }catch(const nlohmann::json::exception& e){
+            mlir::emitError(loc) << "bad routing config " << config << ": " << e.what();
+            return mlir::failure();
+        }
+        return device;
+    }
+
+    struct Circuit{
+        // Gates in program order, with the accesses loading their operands and storing their results.
+        llvm::SmallVector<mlir::Operation*> gates;
+        llvm::SmallVector<llvm::SmallVector<unsigned, 2>> qubits;
+        mlir::Value root;
+        mlir::MemRefType rootType;
+        // Logical index of every qstate access to the root.
+        llvm::DenseMap<mlir::Operation*, unsigned> accesses;
+    };
+
+    std::optional<unsigned> logicalIndex(Circuit& circuit, mlir::Operation* access, mlir::Value memref, mlir::AffineMap map, mlir::ValueRange operands){
+        auto base = baseMemRef(memref);
+        if(!circuit.root){
+            auto type = base.getType().dyn_cast<mlir::MemRefType>();
+            if(!type || type.getRank()!=1 || !type.hasStaticShape()) return std::nullopt;
+            if(!base.getDefiningOp<mlir::memref::AllocOp>() && !base.getDefiningOp<mlir::memref::GetGlobalOp>()) return std::nullopt;
+            circuit.root = base;
+            circuit.rootType = type;
+        }
+        if(resolveMemLocation(base).root!=resolveMemLocation(circuit.root).root) return std::nullopt;
+        auto loc = resolveMemLocation(memref, map, operands);
+        if(!loc.indices || loc.indices->size()!=1) return std::nullopt;
+        auto index = (*loc.indices)[0];
+        if(index<0 || index>=circuit.rootType.getShape()[0]) return std::nullopt;
+        circuit.accesses[access] = index;
+        return index;
+    }
+
+    mlir::LogicalResult collect(mlir::func::FuncOp func, Circuit& circuit){
+        auto fail = [&](mlir::Operation* op, const char* reason){
+            op->emitError() << "cannot route qubits: " << reason;
+            return mlir::failure();
+        };
+        auto& body = func.getBody();
+        for(auto& op: body.getOps()){
+            if(llvm::isa<ApplyGateOp, CallQOpOp>(&op)) continue;
+            auto bad = op.walk([&](mlir::Operation* inner){
+                if(inner==&op) return mlir::WalkResult::advance();
+                if(llvm::isa<ApplyGateOp, CallQOpOp>(inner)) return mlir::WalkResult::interrupt();
+                return mlir::WalkResult::advance();
+            });
+            if(bad.wasInterrupted()) return fail(&op, "gates inside control flow, unroll loops first");
+            if(auto call = llvm::dyn_cast<mlir::CallOpInterface>(&op)){
+                for(auto arg: call.getArgOperands()){
+                    if(isQStateMemRef(arg.getType())) return fail(&op, "qubits passed to a call, inline it first");
+                }
+            }
+            if(auto store = llvm::dyn_cast<mlir::memref::StoreOp>(&op)){
+                if(store.getValueToStore().getType().isa<QStateType>()) return fail(&op, "qubit accessed with a dynamic index");
+            }
+            if(auto load = llvm::dyn_cast<mlir::memref::LoadOp>(&op)){
+                if(load.getType().isa<QStateType>()) return fail(&op, "qubit accessed with a dynamic index");
+            }
+        }
+        if(!body.hasOneBlock()){
+            for(auto& op: body.getOps()){
+                if(llvm::isa<ApplyGateOp, CallQOpOp>(&op)) return fail(&op, "gates in a function with control flow");
+            }
+            return mlir::success();
+        }
+        for(auto& op: body.front()){
+            mlir::ValueRange args;
+            if(auto apply = llvm::dyn_cast<ApplyGateOp>(&op)){
+                args = apply.getArgs();
+                if(args.size()>2) return fail(&op, "gate on more than two qubits, decompose it first");
+            }else if(auto call = llvm::dyn_cast<CallQOpOp>(&op)){
+                args = call.getArgs();
+            }else{
+                continue;
+            }
+            llvm::SmallVector<unsigned, 2> qubits;
+            for(auto arg: args){
+                auto load = arg.getDefiningOp<mlir::AffineLoadOp>();
+                if(!load || load->getBlock()!=op.getBlock() || !arg.hasOneUse()) return fail(&op, "operand is not loaded from a qubit array");
+                auto index = logicalIndex(circuit, load, load.getMemRef(), load.getAffineMap(), load.getMapOperands());
+                if(!index) return fail(&op, "operand is not a constant position of the routed qubit array");
+                qubits.push_back(*index);
+            }
+            for(auto i=0; i<args.size(); i++){
+                auto result = op.getResult(i);
+                if(result.use_empty()) continue;
+                auto store = result.hasOneUse() ? llvm::dyn_cast<mlir::AffineStoreOp>(*result.getUsers().begin()) : nullptr;
+                if(!store || store->getBlock()!=op.getBlock() || store.getValueToStore()!=result) return fail(&op, "result is not stored back to the qubit array");
+                auto index = logicalIndex(circuit, store, store.getMemRef(), store.getAffineMap(), store.getMapOperands());
+                if(index!=qubits[i]) return fail(&op, "result is stored to another qubit");
+            }
+            circuit.gates.push_back(&op);
+            auto call = llvm::dyn_cast<CallQOpOp>(&op);
+            if(llvm::isa<ApplyGateOp>(&op) && qubits.size()==2){
+                circuit.qubits.push_back(qubits);
+            }else if(call && call.getCallee().getLeafReference().getValue()=="__isq__builtin__measure"){
+                // Measured qubits cannot be used again, so swaps have to go around them.
+                circuit.qubits.push_back({qubits[0]});
+            }else{
+                // Single-qubit gates need no routing.
+                circuit.qubits.push_back({});
+            }
+        }
+        if(circuit.gates.empty()) return mlir::success();
+        // Accesses not belonging to a gate, e.g. from qubit initialization, are remapped as well.
+        for(auto& op: body.front()){
+            if(auto load = llvm::dyn_cast<mlir::AffineLoadOp>(&op)){
+                if(!load.getType().isa<QStateType>() || circuit.accesses.count(&op)) continue;
+                if(!logicalIndex(circuit, &op, load.getMemRef(), load.getAffineMap(), load.getMapOperands())){
+                    return fail(&op, "qubit access outside of the routed qubit array");
+                }
+            }else if(auto store = llvm::dyn_cast<mlir::AffineStoreOp>(&op)){
+                if(!store.getValueToStore().getType().isa<QStateType>() || circuit.accesses.count(&op)) continue;
+                if(!logicalIndex(circuit, &op, store.getMemRef(), store.getAffineMap(), store.getMapOperands())){
+                    return fail(&op, "qubit access outside of the routed qubit array");
+                }
+            }
+        }
+        return mlir::success();
+    }
+
+    // Grows the qubit array to the device size.
+    mlir::LogicalResult resize(mlir::ModuleOp module, Circuit& circuit, unsigned size){
+        if(circuit.rootType.getShape()[0]>=size) return mlir::success();
+        auto type = mlir::MemRefType::get({size}, circuit.rootType.getElementType());
+        if(auto get_global = circuit.root.getDefiningOp<mlir::memref::GetGlobalOp>()){
+            auto global = mlir::SymbolTable::lookupNearestSymbolFrom<mlir::memref::GlobalOp>(get_global, get_global.getNameAttr());
+            if(!global) return mlir::failure();
+            if(global.getInitialValue() && !global.getInitialValue()->isa<mlir::UnitAttr>()){
+                return global->emitError() << "cannot route qubits: qubit array has an initial value";
+            }
+            global.setTypeAttr(mlir::TypeAttr::get(type));
+            module->walk([&](mlir::memref::GetGlobalOp use){
+                if(use.getName()==global.getSymName()) use.getResult().setType(type);
+            });
+        }else{
+            circuit.root.setType(type);
+        }
+        circuit.rootType = type;
+        return mlir::success();
+    }
+
+    static mlir::AffineMap constantMap(mlir::MLIRContext* ctx, int64_t index){
+        return mlir::AffineMap::get(0, 0, mlir::getAffineConstantExpr(index, ctx));
+    }
+
+    void rewrite(Circuit& circuit, llvm::ArrayRef<llvm::SmallVector<QubitRouter::Swap>> swaps, std::vector<unsigned> mapping){
+        auto ctx = circuit.root.getContext();
+        auto block = circuit.gates.front()->getBlock();
+        // Keep every gate next to its loads and stores, so swaps placed before the loads see the right mapping.
+        llvm::DenseMap<mlir::Operation*, unsigned> first_load;
+        for(unsigned index=0; index<circuit.gates.size(); index++){
+            auto gate = circuit.gates[index];
+            mlir::Operation* first = gate;
+            for(auto arg: gate->getOperands()){
+                if(!arg.getType().isa<QStateType>()) continue;
+                auto load = arg.getDefiningOp();
+                load->moveBefore(gate);
+                if(first==gate) first = load;
+            }
+            mlir::Operation* last = gate;
+            for(auto result: gate->getResults()){
+                if(!result.getType().isa<QStateType>() || result.use_empty()) continue;
+                auto store = *result.getUsers().begin();
+                store->moveAfter(last);
+                last = store;
+            }
+            first_load[first] = index;
+        }
+        mlir::Value root = circuit.root;
+        if(auto get_global = root.getDefiningOp<mlir::memref::GetGlobalOp>()){
+            // The accessed arrays may come from several get_global ops. Use one dominating all of them.
+            mlir::OpBuilder builder(ctx);
+            builder.setInsertionPointToStart(block);
+            root = builder.create<mlir::memref::GetGlobalOp>(get_global.getLoc(), circuit.rootType, get_global.getNameAttr());
+        }
+        std::vector<unsigned> inverse(mapping.size());
+        for(unsigned l=0; l<mapping.size(); l++) inverse[mapping[l]] = l;
+        for(auto& op: llvm::make_early_inc_range(*block)){
+            auto gate = first_load.find(&op);
+            if(gate!=first_load.end()){
+                mlir::OpBuilder builder(&op);
+                for(auto [p, q]: swaps[gate->second]){
+                    auto loc = circuit.gates[gate->second]->getLoc();
+                    mlir::Value a = builder.create<mlir::AffineLoadOp>(loc, root, constantMap(ctx, p), mlir::ValueRange{});
+                    mlir::Value b = builder.create<mlir::AffineLoadOp>(loc, root, constantMap(ctx, q), mlir::ValueRange{});
+                    emitBuiltinGate(builder, "SWAP", {&a, &b});
+                    builder.create<mlir::AffineStoreOp>(loc, a, root, constantMap(ctx, p), mlir::ValueRange{});
+                    builder.create<mlir::AffineStoreOp>(loc, b, root, constantMap(ctx, q), mlir::ValueRange{});
+                    std::swap(inverse[p], inverse[q]);
+                    mapping[inverse[p]] = p;
+                    mapping[inverse[q]] = q;
+                    numSwaps++;
+                }
+            }
+            auto access = circuit.accesses.find(&op);
+            if(access==circuit.accesses.end()) continue;
+            auto physical = mapping[access->second];
+            mlir::OpBuilder builder(&op);
+            if(auto load = llvm::dyn_cast<mlir::AffineLoadOp>(&op)){
+                auto new_load = builder.create<mlir::AffineLoadOp>(load.getLoc(), root, constantMap(ctx, physical), mlir::ValueRange{});
+                load.getResult().replaceAllUsesWith(new_load.getResult());
+            }else{
+                auto store = llvm::cast<mlir::AffineStoreOp>(&op);
+                builder.create<mlir::AffineStoreOp>(store.getLoc(), store.getValueToStore(), root, constantMap(ctx, physical), mlir::ValueRange{});
+            }
+            op.erase();
+        }
+    }
+
+    void runOnOperation() override{
+        mlir::ModuleOp m = this->getOperation();
+        if(config.empty()){
+            mlir::emitError(m.getLoc()) << "isq-route-qubits needs a routing config";
+            return signalPassFailure();
+        }
+        auto device = loadConfig(m.getLoc());
+        if(mlir::failed(device)) return signalPassFailure();
+        CouplingGraph graph(device->size, device->edges);
+        if(!graph.isConnected()){
+            mlir::emitError(m.getLoc()) << "routing config " << config << " has a disconnected topology";
+            return signalPassFailure();
+        }
+        QubitRouter router(graph, lookahead, lookaheadWeight);
+        llvm::SmallVector<mlir::func::FuncOp> funcs(m.getOps<mlir::func::FuncOp>());
+        for(auto func: funcs){
+            if(func.isExternal()) continue;
+            Circuit circuit;
+            if(mlir::failed(collect(func, circuit))) return signalPassFailure();
+            if(circuit.gates.empty()) continue;
+            auto logical = circuit.rootType.getShape()[0];
+            if(logical>device->size){
+                func->emitError() << "cannot route " << logical << " qubits on a device with " << device->size << " qubits";
+                return signalPassFailure();
+            }
+            // Unused physical qubits are logical qubits without gates.
+            std::vector<unsigned> mapping(device->size);
+            for(unsigned i=0; i<device->size; i++) mapping[i] = i;
+            auto start = std::chrono::steady_clock::now();
+            if(device->initMap=="simulated_annealing"){
+                router.refineInitialMapping(circuit.qubits, mapping, 2);
+            }
+            auto initial = mapping;
+            auto swaps = router.route(circuit.qubits, mapping);
+            routingMicros += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now()-start).count();
+            if(!swaps){
+                func->emitError() << "cannot route qubits: measured qubits cut the operands of a gate apart";
+                return signalPassFailure();
+            }
+            for(auto& q: circuit.qubits){
+                if(q.size()==2) numRoutedGates++;
+            }
+            if(mlir::failed(resize(m, circuit, device->size))) return signalPassFailure();
+            rewrite(circuit, *swaps, initial);
+        }
+    }
+    mlir::StringRef getArgument() const final{
+        return "isq-route-qubits";
+    }
+    mlir::StringRef getDescription() const final{
+        return "Insert SWAP gates so that two-qubit gates only act on coupled physical qubits.";
+    }
+};
+
+void registerRouteQubits(){
+    mlir::PassRegistration<RouteQubitsPass>();
+}
+
+}
+}
+}
@@ -1,371 +1,426 @@
 #include "isq/Operations.h"
 #include "isq/QTypes.h"
+#include "isq/passes/GateInfo.h"
 #include <cstdint>
+#include <functional>
+#include <map>
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/ADT/StringRef.h>
 #include <llvm/ADT/TypeSwitch.h>
 #include <llvm/Support/Casting.h>
-#include <llvm/Support/raw_ostream.h>
-#include <memory>
 #include <mlir/Dialect/Affine/IR/AffineOps.h>
+#include <mlir/Dialect/Arith/IR/Arith.h>
 #include <mlir/Dialect/Func/IR/FuncOps.h>
 #include <mlir/Dialect/MemRef/IR/MemRef.h>
+#include <mlir/Dialect/Utils/StaticValueUtils.h>
 #include <mlir/IR/AffineExpr.h>
-#include <mlir/IR/AffineExprVisitor.h>
 #include <mlir/IR/AffineMap.h>
-#include <mlir/IR/Attributes.h>
-#include <mlir/IR/BuiltinAttributes.h>
+#include <mlir/IR/Builders.h>
 #include <mlir/IR/BuiltinTypes.h>
+#include <mlir/IR/IRMapping.h>
 #include <mlir/IR/MLIRContext.h>
-#include <mlir/IR/PatternMatch.h>
+#include <mlir/Interfaces/SideEffectInterfaces.h>
 #include <mlir/Pass/PassRegistry.h>
-#include <mlir/Rewrite/FrozenRewritePatternSet.h>
 #include <mlir/Support/LLVM.h>
-#include <mlir/Support/LogicalResult.h>
-#include <mutex>
-#include <nlohmann/json_fwd.hpp>
 #include <optional>
-#include <sstream>
-#include <string>
-#include "mlir/Transforms/GreedyPatternRewriteDriver.h"
+#include <type_traits>
 #include "mlir/Pass/Pass.h"
-#include "nlohmann/json.hpp"
 namespace isq::ir::passes{
-    using nlohmann::json;
-    const char* ISQ_ALLOC_ID = "isq_alloc_id";
-    const char* ISQ_LOOP_ID = "isq_loop_id";
-    const char* ISQ_AFFINE_LOADED = "isq_affine_loaded";
-    const char* ISQ_AFFINE_SRC = "isq_affine_src";
-    struct SWPState{
-        int counter;
-        int loop_counter;
-        std::vector<mlir::memref::AllocOp> alloc_ops;
-        SWPState(){
-            this->counter = 0;
-            this->loop_counter = 0;
+    // Qubit subscript as an affine function of the loop induction variable:
+    // `constant + iv_factor * iv + sum(factor * v)` with loop-invariant values `v`.
+    struct LinearIndex{
+        int64_t constant = 0;
+        int64_t iv_factor = 0;
+        std::map<const void*, int64_t> invariant;
+        static LinearIndex ofConstant(int64_t c){
+            LinearIndex r;
+            r.constant = c;
+            return r;
         }
-        int next_alloc(mlir::memref::AllocOp op){
-            alloc_ops.push_back(op);
-            return counter++;
+        bool isConstant() const{
+            return iv_factor==0 && invariant.empty();
         }
-        int next_loop(){
-            return loop_counter++;
+        LinearIndex operator+(const LinearIndex& other) const{
+            LinearIndex r = *this;
+            r.constant += other.constant;
+            r.iv_factor += other.iv_factor;
+            for(auto& [v, k]: other.invariant){
+                if((r.invariant[v] += k) == 0) r.invariant.erase(v);
+            }
+            return r;
+        }
+        LinearIndex operator*(int64_t k) const{
+            if(k==0) return ofConstant(0);
+            LinearIndex r = *this;
+            r.constant *= k;
+            r.iv_factor *= k;
+            for(auto& [v, f]: r.invariant) f *= k;
+            return r;
+        }
+        bool operator==(const LinearIndex& other) const{
+            return constant==other.constant && iv_factor==other.iv_factor && invariant==other.invariant;
         }
     };
-    struct MarkLoop : public mlir::OpRewritePattern<mlir::AffineForOp>{
-        SWPState* state;
-        MarkLoop(mlir::MLIRContext* ctx, SWPState* state):
-        mlir::OpRewritePattern<mlir::AffineForOp>(ctx, 10), state(state){
 
+    static std::optional<LinearIndex> linearOf(mlir::Value v, mlir::AffineForOp loop);
+    static std::optional<LinearIndex> linearOf(mlir::AffineExpr expr, mlir::ValueRange dims, mlir::ValueRange syms, mlir::AffineForOp loop){
+        return llvm::TypeSwitch<mlir::AffineExpr, std::optional<LinearIndex>>(expr)
+        .Case<mlir::AffineDimExpr>([&](mlir::AffineDimExpr e){
+            return linearOf(dims[e.getPosition()], loop);
+        })
+        .Case<mlir::AffineSymbolExpr>([&](mlir::AffineSymbolExpr e){
+            return linearOf(syms[e.getPosition()], loop);
+        })
+        .Case<mlir::AffineConstantExpr>([&](mlir::AffineConstantExpr e){
+            return LinearIndex::ofConstant(e.getValue());
+        })
+        .Case<mlir::AffineBinaryOpExpr>([&](mlir::AffineBinaryOpExpr e)->std::optional<LinearIndex>{
+            auto lhs = linearOf(e.getLHS(), dims, syms, loop);
+            auto rhs = linearOf(e.getRHS(), dims, syms, loop);
+            if(!lhs || !rhs) return std::nullopt;
+            if(e.getKind()==mlir::AffineExprKind::Add) return *lhs + *rhs;
+            if(e.getKind()==mlir::AffineExprKind::Mul){
+                if(rhs->isConstant()) return *lhs * rhs->constant;
+                if(lhs->isConstant()) return *rhs * lhs->constant;
+            }
+            return std::nullopt;
+        })
+        .Default([](auto _)->std::optional<LinearIndex>{
+            return std::nullopt;
+        });
+    }
+    static std::optional<LinearIndex> linearOf(mlir::Value v, mlir::AffineForOp loop){
+        if(v==loop.getInductionVar()){
+            LinearIndex r;
+            r.iv_factor = 1;
+            return r;
         }
-        mlir::LogicalResult matchAndRewrite(mlir::AffineForOp op, mlir::PatternRewriter& rewriter) const override{
-            if(op->hasAttr(ISQ_LOOP_ID)) return mlir::failure();
-            rewriter.startRootUpdate(op);
-            op->setAttr(ISQ_LOOP_ID,rewriter.getIndexAttr(state->next_loop()));
-            rewriter.finalizeRootUpdate(op);
-            return mlir::success();
+        if(auto c = mlir::getConstantIntValue(v)) return LinearIndex::ofConstant(*c);
+        auto invariant = [&]()->std::optional<LinearIndex>{
+            if(!loop.isDefinedOutsideOfLoop(v)) return std::nullopt;
+            LinearIndex r;
+            r.invariant[v.getAsOpaquePointer()] = 1;
+            return r;
+        };
+        auto op = v.getDefiningOp();
+        if(!op) return invariant();
+        return llvm::TypeSwitch<mlir::Operation*, std::optional<LinearIndex>>(op)
+        .Case<mlir::arith::AddIOp, mlir::arith::SubIOp, mlir::arith::MulIOp>([&](auto op)->std::optional<LinearIndex>{
+            auto lhs = linearOf(op.getLhs(), loop);
+            auto rhs = linearOf(op.getRhs(), loop);
+            if(!lhs || !rhs) return invariant();
+            using OpTy = decltype(op);
+            if constexpr(std::is_same_v<OpTy, mlir::arith::AddIOp>) return *lhs + *rhs;
+            if constexpr(std::is_same_v<OpTy, mlir::arith::SubIOp>) return *lhs + *rhs * -1;
+            if(rhs->isConstant()) return *lhs * rhs->constant;
+            if(lhs->isConstant()) return *rhs * lhs->constant;
+            return invariant();
+        })
+        .Case<mlir::arith::IndexCastOp>([&](mlir::arith::IndexCastOp op){
+            auto r = linearOf(op.getIn(), loop);
+            return r ? r : invariant();
+        })
+        .Case<mlir::AffineApplyOp>([&](mlir::AffineApplyOp op){
+            auto map = op.getAffineMap();
+            auto operands = op.getMapOperands();
+            auto r = linearOf(map.getResult(0), operands.take_front(map.getNumDims()), operands.drop_front(map.getNumDims()), loop);
+            return r ? r : invariant();
+        })
+        .Default([&](auto _){
+            return invariant();
+        });
+    }
+
+    // Qubit touched by an `affine.load`/`affine.store` in one iteration, with subviews and casts folded into the subscripts.
+    struct QubitAccess{
+        MemLocation memory;
+        // Allocated in this function: not reachable through arguments or globals.
+        bool local = false;
+        llvm::SmallVector<LinearIndex> index;
+        bool operator==(const QubitAccess& other) const{
+            return memory.root==other.memory.root && index==other.index;
         }
-        
     };
-    struct MarkAlloc : public mlir::OpRewritePattern<mlir::memref::AllocOp>{
-        SWPState* state;
-        MarkAlloc(mlir::MLIRContext* ctx, SWPState* state):
-        mlir::OpRewritePattern<mlir::memref::AllocOp>(ctx, 10), state(state){
-
+    static std::optional<QubitAccess> resolveAccess(mlir::Value memref, mlir::AffineMap map, mlir::ValueRange operands, mlir::AffineForOp loop){
+        QubitAccess access;
+        for(auto expr: map.getResults()){
+            auto index = linearOf(expr, operands.take_front(map.getNumDims()), operands.drop_front(map.getNumDims()), loop);
+            if(!index) return std::nullopt;
+            access.index.push_back(*index);
         }
-        mlir::LogicalResult matchAndRewrite(mlir::memref::AllocOp op, mlir::PatternRewriter& rewriter) const override{
-            if(op->hasAttr(ISQ_ALLOC_ID)) return mlir::failure();
-            if(!llvm::isa<mlir::func::FuncOp>(op->getParentOp())) return mlir::failure();
-            if(op.getMemref().getType().cast<mlir::MemRefType>().getElementType() == QStateType::get(this->getContext())){
-                rewriter.startRootUpdate(op);
-                op->setAttr(ISQ_ALLOC_ID,rewriter.getIndexAttr(state->next_alloc(op)));
-                rewriter.finalizeRootUpdate(op);
-                return mlir::success();
+        while(true){
+            if(auto cast = memref.getDefiningOp<mlir::memref::CastOp>()){
+                memref = cast.getSource();
+                continue;
             }
-            return mlir::failure();
+            if(auto subview = memref.getDefiningOp<mlir::memref::SubViewOp>()){
+                if(subview.getSourceType().getRank()!=access.index.size()) return std::nullopt;
+                auto offsets = subview.getMixedOffsets();
+                auto strides = subview.getMixedStrides();
+                for(auto i=0; i<access.index.size(); i++){
+                    auto stride = mlir::getConstantIntValue(strides[i]);
+                    if(!stride) return std::nullopt;
+                    std::optional<LinearIndex> offset;
+                    if(auto c = mlir::getConstantIntValue(offsets[i])){
+                        offset = LinearIndex::ofConstant(*c);
+                    }else if(auto v = offsets[i].dyn_cast<mlir::Value>()){
+                        offset = linearOf(v, loop);
+                    }
+                    if(!offset) return std::nullopt;
+                    access.index[i] = *offset + access.index[i] * *stride;
+                }
+                memref = subview.getSource();
+                continue;
+            }
+            break;
         }
-        
-    };
-    struct PropagateLoad : public mlir::OpRewritePattern<mlir::AffineLoadOp>{
-        PropagateLoad(mlir::MLIRContext* ctx): mlir::OpRewritePattern<mlir::AffineLoadOp>(ctx){}
-        std::optional<mlir::Attribute> try_get_loop_id(mlir::Value val) const{
-            auto block = val.getParentBlock();
-            if(!block) return std::nullopt;
-            if(block->getNumArguments()!=1) return std::nullopt;
-            if(block->getArgument(0)!=val) return std::nullopt;
-            // check if from affine loop
-            auto op = val.getParentRegion()->getParentOp();
-            auto loop = llvm::dyn_cast_or_null<mlir::AffineForOp>(op);
-            if(!loop) return std::nullopt;
-            if(!loop->hasAttr(ISQ_LOOP_ID)) return std::nullopt;
-            return loop->getAttr(ISQ_LOOP_ID);
+        access.memory = resolveMemLocation(memref);
+        access.local = memref.getDefiningOp<mlir::memref::AllocOp>() || memref.getDefiningOp<mlir::memref::AllocaOp>();
+        return access;
+    }
+    // Whether `a` in some iteration and `b` in the iteration `shift` (in units of the induction variable) later
+    // may touch the same qubit.
+    static bool mayCollide(const QubitAccess& a, const QubitAccess& b, int64_t shift){
+        if(a.memory.root!=b.memory.root) return !a.local && !b.local && a.memory.mayAlias(b.memory);
+        if(a.index.size()!=b.index.size()) return true;
+        for(auto i=0; i<a.index.size(); i++){
+            auto& x = a.index[i];
+            auto& y = b.index[i];
+            if(x.invariant!=y.invariant || x.iv_factor!=y.iv_factor) continue;
+            // x(iv) == y(iv + shift) for no iv.
+            if(x.constant != y.constant + y.iv_factor * shift) return false;
+        }
+        return true;
+    }
+
+    // Modulo schedule of an innermost affine loop made of qstate loads, stores, gates and pure ops.
+    //
+    // Gates get their layer in the circuit of one iteration, touching qubits by their subscripts.
+    // Iteration j starts `interval` layers after iteration j-1: the smallest interval such that every gate
+    // runs after all gates of earlier iterations that may touch the same qubit, which is checked on the
+    // subscripts for every iteration distance. Gates are then grouped into stages of `interval` layers.
+    //
+    // The loop is rewritten into a prologue, a kernel loop running stage s of iteration t-s for every s,
+    // and an epilogue. Each stage loads the qstates it needs and stores back what it produced.
+    class LoopPipeliner{
+        mlir::AffineForOp loop;
+        int64_t lb = 0, step = 1, trips = 0;
+        llvm::SmallVector<ApplyGateOp> gates;
+        llvm::DenseMap<mlir::Operation*, QubitAccess> accesses;
+        // The load each qstate in the body comes from.
+        llvm::DenseMap<mlir::Value, mlir::AffineLoadOp> origin;
+        llvm::DenseMap<mlir::Operation*, unsigned> layer;
+        llvm::DenseMap<mlir::Operation*, unsigned> stage;
+        unsigned depth = 0;
+        unsigned interval = 0;
+        unsigned numStages = 0;
+
+        bool collide(ApplyGateOp u, ApplyGateOp v, int64_t shift){
+            for(auto a: u.getArgs()){
+                for(auto b: v.getArgs()){
+                    if(mayCollide(accesses[origin[a]], accesses[origin[b]], shift)) return true;
+                }
+            }
+            return false;
         }
-        mlir::LogicalResult matchAndRewrite(mlir::AffineLoadOp op, mlir::PatternRewriter& rewriter) const override{
-            if(op->hasAttr(ISQ_AFFINE_LOADED)) return mlir::failure();
-            auto src = llvm::dyn_cast_or_null<mlir::memref::AllocOp>(op.getMemRef().getDefiningOp());
-            if(!src) return mlir::failure();
-            if(!src->hasAttr(ISQ_ALLOC_ID)) return mlir::failure();
-            auto alloc_id = src->getAttr(ISQ_ALLOC_ID).cast<mlir::IntegerAttr>().getInt();
-            mlir::SmallVector<mlir::Attribute> indices;
-            for(auto arg : op.getIndices()){
-                auto maybe_loop_id = try_get_loop_id(arg);
-                if(maybe_loop_id==std::nullopt){
-                    return mlir::failure();
+        bool collect(){
+            auto qstate = QStateType::get(loop->getContext());
+            for(auto& op: loop.getBody()->without_terminator()){
+                if(auto load = llvm::dyn_cast<mlir::AffineLoadOp>(op)){
+                    if(load.getType()!=qstate) continue;
+                    auto access = resolveAccess(load.getMemRef(), load.getAffineMap(), load.getMapOperands(), loop);
+                    if(!access || !load.getResult().hasOneUse()) return false;
+                    accesses[load] = *access;
+                    origin[load.getResult()] = load;
+                }else if(auto store = llvm::dyn_cast<mlir::AffineStoreOp>(op)){
+                    if(store.getValueToStore().getType()!=qstate) return false;
+                    auto access = resolveAccess(store.getMemRef(), store.getAffineMap(), store.getMapOperands(), loop);
+                    auto from = origin.find(store.getValueToStore());
+                    // Qubits go back where they came from.
+                    if(!access || from==origin.end() || !(*access==accesses[from->second])) return false;
+                }else if(auto apply = llvm::dyn_cast<ApplyGateOp>(op)){
+                    for(auto i=0; i<apply.getArgs().size(); i++){
+                        auto from = origin.find(apply.getArgs()[i]);
+                        if(from==origin.end() || !apply->getResult(i).hasOneUse()) return false;
+                        auto load = from->second;
+                        origin[apply->getResult(i)] = load;
+                    }
+                    gates.push_back(apply);
+                }else if(op.getNumRegions()!=0 || !mlir::isMemoryEffectFree(&op)){
+                    return false;
+                }else if(llvm::any_of(op.getResultTypes(), [&](mlir::Type t){ return t==qstate; })){
+                    return false;
+                }
+            }
+            // Every qubit is loaded once per iteration, so stages can load and store in any order.
+            llvm::SmallVector<mlir::Operation*> loads;
+            for(auto& [op, _]: accesses) loads.push_back(op);
+            for(auto i=0; i<loads.size(); i++){
+                for(auto j=i+1; j<loads.size(); j++){
+                    if(mayCollide(accesses[loads[i]], accesses[loads[j]], 0)) return false;
                 }
-                indices.push_back(*maybe_loop_id);
             }
-            indices.push_back(op.getAffineMapAttr());
-            indices.push_back(rewriter.getIndexAttr(alloc_id));
-            mlir::ArrayAttr attr = rewriter.getArrayAttr(indices);
-            
-            rewriter.startRootUpdate(op);
-            op->setAttr(ISQ_AFFINE_LOADED,attr);
-            rewriter.finalizeRootUpdate(op);
-            return mlir::success();
+            return !gates.empty();
         }
-    };
-    struct PropagateApply : public mlir::OpRewritePattern<ApplyGateOp>{
-        SWPState* state;
-        PropagateApply(mlir::MLIRContext* ctx): mlir::OpRewritePattern<ApplyGateOp>(ctx, 1){
+    public:
+        explicit LoopPipeliner(mlir::AffineForOp loop): loop(loop){}
+        unsigned getDepth() const { return depth; }
+        unsigned getInterval() const { return interval; }
+        unsigned getNumStages() const { return numStages; }
+        int64_t getTripCount() const { return trips; }
+        int64_t pipelinedDepth() const { return (trips-1)*interval + depth; }
 
-        } 
-        mlir::LogicalResult matchAndRewrite(ApplyGateOp op, mlir::PatternRewriter& rewriter) const override{
-            if(op->hasAttr(ISQ_AFFINE_SRC)) return mlir::failure();
-            mlir::SmallVector<mlir::Attribute> affine_exprs;
-            auto gate = op.getGate();
-            auto gate_use = mlir::dyn_cast_or_null<UseGateOp>(gate.getDefiningOp());
-            if(!gate_use) return mlir::failure();
-            affine_exprs.push_back(gate_use.getName());
-            //auto id = 0;
-            for(auto q : op.getArgs()){
-                auto val = q;
-                auto src = val.getDefiningOp();
-                if(!src) return mlir::failure();
-                auto ret = llvm::TypeSwitch<mlir::Operation*, mlir::LogicalResult>(src)
-                .Case<ApplyGateOp>([&](ApplyGateOp op){
-                    if(!op->hasAttr(ISQ_AFFINE_SRC)) return mlir::failure();
-                    auto tup = op->getAttr(ISQ_AFFINE_SRC).cast<mlir::ArrayAttr>();
-                    for(auto i=0; i<op->getNumResults(); i++){
-                        if(op->getResults()[i] == val){
-                            affine_exprs.push_back(tup[i+1]);
+        // Computes the schedule. Returns false if the loop is not supported or overlapping does not help.
+        bool analyze(){
+            if(!loop.hasConstantBounds() || loop.getNumIterOperands()!=0) return false;
+            lb = loop.getConstantLowerBound();
+            step = loop.getStep();
+            auto ub = loop.getConstantUpperBound();
+            trips = ub>lb ? (ub-lb+step-1)/step : 0;
+            if(trips<2 || !collect()) return false;
+            for(auto i=0; i<gates.size(); i++){
+                unsigned l = 0;
+                for(auto j=0; j<i; j++){
+                    if(collide(gates[j], gates[i], 0)) l = std::max(l, layer[gates[j]]+1);
+                }
+                layer[gates[i]] = l;
+                depth = std::max(depth, l+1);
+            }
+            // For a distance of `depth` iterations or more, any interval is fine.
+            interval = 1;
+            auto max_distance = std::min<int64_t>(depth, trips-1);
+            for(auto u: gates){
+                for(auto v: gates){
+                    int64_t gap = int64_t(layer[u]) + 1 - int64_t(layer[v]);
+                    if(gap<=0) continue;
+                    for(int64_t d=1; d<=max_distance; d++){
+                        if(collide(u, v, d*step)){
+                            interval = std::max<unsigned>(interval, (gap+d-1)/d);
                             break;
                         }
                     }
-                    return mlir::success();
-                })
-                .Case<mlir::AffineLoadOp>([&](mlir::AffineLoadOp op){
-                    if(!op->hasAttr(ISQ_AFFINE_LOADED)) return mlir::failure();
-                    auto list = op->getAttr(ISQ_AFFINE_LOADED);
-                    affine_exprs.push_back(list);
-                    return mlir::success();
-                }).Default([&](auto _){
-                    return mlir::failure();
-                });
-                if(mlir::failed(ret)) return mlir::failure();
-                //id++;
+                }
             }
-            rewriter.startRootUpdate(op);
-            op->setAttr(ISQ_AFFINE_SRC, rewriter.getArrayAttr(affine_exprs));
-            rewriter.finalizeRootUpdate(op);
-            return mlir::success();
+            if(interval>=depth) return false;
+            numStages = (depth+interval-1)/interval;
+            if(trips<numStages) return false;
+            for(auto g: gates) stage[g] = layer[g] / interval;
+            return true;
         }
-    };
-    struct SimpleAffineExpr{
-        unsigned dimpos;
-        int64_t factor;
-        int64_t bias;
-        SimpleAffineExpr(): dimpos(-1), factor(0), bias(0){
 
-        }
-        SimpleAffineExpr(unsigned dimpos, int64_t factor, int64_t bias): dimpos(dimpos), factor(factor), bias(bias){
-
-        }
-        nlohmann::json toJson() const{
-            json obj;
-            obj["dimpos"] = dimpos;
-            obj["factor"] = factor;
-            obj["bias"] = bias;
-            return obj;
-        }
-        /*
-        std::string toString() const{
-            return "("+std::to_string(dimpos) + "," + std::to_string(factor)+","+std::to_string(bias)+")";
-        }
-        */
-        static std::optional<SimpleAffineExpr> fromAffineExpr(mlir::AffineExpr expr){
-            return llvm::TypeSwitch<mlir::AffineExpr, std::optional<SimpleAffineExpr>>(expr)
-            .Case<mlir::AffineDimExpr>([](mlir::AffineDimExpr expr)->std::optional<SimpleAffineExpr>{
-                return SimpleAffineExpr(expr.getPosition(), 1, 0);
-            })
-            .Case<mlir::AffineConstantExpr>([](mlir::AffineConstantExpr expr)->std::optional<SimpleAffineExpr>{
-                return SimpleAffineExpr(-1, 0, expr.getValue());
-            })
-            .Case<mlir::AffineBinaryOpExpr>([](mlir::AffineBinaryOpExpr expr)->std::optional<SimpleAffineExpr>{
-                auto maybe_lhs = fromAffineExpr(expr.getLHS());
-                auto maybe_rhs = fromAffineExpr(expr.getRHS());
-                if(!maybe_lhs) return std::nullopt;
-                if(!maybe_rhs) return std::nullopt;
-                auto lhs = *maybe_lhs;
-                auto rhs = *maybe_rhs;
-                switch(expr.getKind()){
-                    case mlir::AffineExprKind::Add:
-                    {
-                        if(lhs.dimpos == rhs.dimpos){
-                            return SimpleAffineExpr(lhs.dimpos, lhs.factor + rhs.factor, lhs.bias+rhs.bias);
-                        }
-                        if(lhs.factor==0){
-                            return SimpleAffineExpr(rhs.dimpos, rhs.factor, lhs.bias + rhs.bias);
-                        }
-                        if(rhs.factor==0){
-                            return SimpleAffineExpr(lhs.dimpos, lhs.factor, lhs.bias + rhs.bias);
-                        }
-                        return std::nullopt;
-                    }
-                    break;
-                    case mlir::AffineExprKind::Mul:
-                    {
-                        if(lhs.factor==0){
-                            return SimpleAffineExpr(rhs.dimpos, rhs.factor * lhs.bias, lhs.bias * rhs.bias);
-                        }
-                        // k1x+b1 * b2
-                        if(rhs.factor==0){
-                            return SimpleAffineExpr(lhs.dimpos, lhs.factor * rhs.bias, lhs.bias * rhs.bias);
-                        }
-                        return std::nullopt;
+        void rewrite(){
+            mlir::OpBuilder builder(loop);
+            auto loc = loop.getLoc();
+            auto constant_iv = [&](int64_t j){
+                return builder.create<mlir::arith::ConstantIndexOp>(loc, lb + j*step).getResult();
+            };
+            // Stages of older iterations go first, keeping gates of one qubit in program order.
+            for(int64_t t=0; t<numStages-1; t++){
+                for(int64_t s=t; s>=0; s--) emitStage(builder, s, constant_iv(t-s));
+            }
+            auto kernel = builder.create<mlir::AffineForOp>(loc, lb + (numStages-1)*step, lb + trips*step, step);
+            {
+                mlir::OpBuilder::InsertionGuard guard(builder);
+                builder.setInsertionPoint(kernel.getBody()->getTerminator());
+                auto t = kernel.getInductionVar();
+                for(int64_t s=numStages-1; s>=0; s--){
+                    mlir::Value iv = t;
+                    if(s>0){
+                        auto map = mlir::AffineMap::get(1, 0, builder.getAffineDimExpr(0) - s*step);
+                        iv = builder.create<mlir::AffineApplyOp>(loc, map, mlir::ValueRange{t});
                     }
-                    break;
-                    default:
-                    return std::nullopt;
+                    emitStage(builder, s, iv);
                 }
-            })
-            .Default([](auto _)->std::optional<SimpleAffineExpr>{
-                return std::nullopt;
-            });
-        }
-    };
-    struct QubitArrayRef{
-        int alloc_id;
-        mlir::SmallVector<int> used_loop_vars;
-        mlir::SmallVector<SimpleAffineExpr> array_subscripts;
-    };
-    struct ExportedGate{
-        std::string exported_name;
-        mlir::SmallVector<QubitArrayRef> args;
-        
-        ExportedGate(llvm::StringRef name, mlir::SmallVector<QubitArrayRef>&& args) : exported_name(name), args(args){
-            
+            }
+            for(int64_t t=trips; t<trips+numStages-1; t++){
+                for(int64_t s=numStages-1; s>t-trips; s--) emitStage(builder, s, constant_iv(t-s));
+            }
+            loop->erase();
         }
-        json toJson() const{
-            json obj;
-            obj["gate"] = exported_name;
-            llvm::SmallVector<json> json_args;
-            for(auto& arg: args){
-                json term;
-                term["alloc_id"] = arg.alloc_id;
-                term["loop_vars"] = json(arg.used_loop_vars);
-                mlir::SmallVector<json> subscripts;
-                for(auto& expr : arg.array_subscripts){
-                    subscripts.push_back(std::move(expr.toJson()));
+    private:
+        // Emits the gates of stage `s` for the iteration with induction variable `iv`.
+        void emitStage(mlir::OpBuilder& builder, unsigned s, mlir::Value iv){
+            mlir::IRMapping mapping;
+            mapping.map(loop.getInductionVar(), iv);
+            // Pure values are cloned into every stage using them.
+            std::function<mlir::Value(mlir::Value)> materialize = [&](mlir::Value v)->mlir::Value{
+                if(auto mapped = mapping.lookupOrNull(v)) return mapped;
+                if(loop.isDefinedOutsideOfLoop(v)) return v;
+                auto op = v.getDefiningOp();
+                for(auto operand: op->getOperands()) materialize(operand);
+                builder.clone(*op, mapping);
+                return mapping.lookup(v);
+            };
+            auto operands_of = [&](mlir::AffineLoadOp load){
+                llvm::SmallVector<mlir::Value> operands;
+                for(auto operand: load.getMapOperands()) operands.push_back(materialize(operand));
+                return operands;
+            };
+            llvm::SmallVector<ApplyGateOp> in_stage;
+            for(auto g: gates){
+                if(stage[g]==s) in_stage.push_back(g);
+            }
+            for(auto g: in_stage){
+                for(auto arg: g.getArgs()){
+                    auto producer = arg.getDefiningOp<ApplyGateOp>();
+                    if(producer && stage[producer]==s) continue;
+                    auto from = origin[arg];
+                    auto load = builder.create<mlir::AffineLoadOp>(from.getLoc(), materialize(from.getMemRef()), from.getAffineMap(), operands_of(from));
+                    mapping.map(arg, load.getResult());
+                }
+                materialize(g.getGate());
+                builder.clone(*g.getOperation(), mapping);
+            }
+            for(auto g: in_stage){
+                for(auto r: g->getResults()){
+                    auto user = llvm::dyn_cast<ApplyGateOp>(*r.getUsers().begin());
+                    if(user && stage[user]==s) continue;
+                    auto from = origin[r];
+                    builder.create<mlir::AffineStoreOp>(from.getLoc(), mapping.lookup(r), materialize(from.getMemRef()), from.getAffineMap(), operands_of(from));
                 }
-                term["array_subscripts"] = json(subscripts);
-                json_args.push_back(std::move(term));
             }
-            obj["args"] = json(json_args);
-            return obj;
         }
     };
+
     struct SWPipelinePass : public mlir::PassWrapper<SWPipelinePass, mlir::OperationPass<mlir::func::FuncOp>>{
-        std::shared_ptr<std::mutex> mutex;
-        SWPipelinePass(): mutex(std::make_shared<std::mutex>()){
+        Option<bool> report{*this, "report", llvm::cl::desc("Emit a remark with the circuit depth of each pipelined loop, before and after."), llvm::cl::init(false)};
+        Statistic numPipelined{this, "pipelined-loops", "Number of software-pipelined loops"};
+        Statistic depthBefore{this, "depth-before", "Circuit depth of pipelined loops, iterations in sequence"};
+        Statistic depthAfter{this, "depth-after", "Circuit depth of pipelined loops, iterations overlapped"};
+        SWPipelinePass() = default;
+        SWPipelinePass(const SWPipelinePass& pass) {}
 
-        }
         void runOnOperation() override{
-            auto func = this->getOperation();
-            auto ctx = func->getContext();
-            SWPState state;
-            do{
-                mlir::RewritePatternSet rps(ctx);
-                rps.add<MarkLoop>(ctx, &state);
-                rps.add<MarkAlloc>(ctx, &state);
-                rps.add<PropagateLoad>(ctx);
-                rps.add<PropagateApply>(ctx);
-                mlir::FrozenRewritePatternSet frps(std::move(rps));
-                mlir::GreedyRewriteConfig config;
-                config.maxIterations = mlir::GreedyRewriteConfig::kNoLimit;
-                (void)mlir::applyPatternsAndFoldGreedily(func, frps, config);
-            }while(0);
-            // collect all allocate ops.
-            // find and extract all loops
-            
+            llvm::SmallVector<mlir::AffineForOp> loops;
             this->getOperation()->walk([&](mlir::AffineForOp op){
-                bool all_apply_marked = true;
-                
-                op->walk([&](ApplyGateOp apply){
-                    if(!all_apply_marked) return;
-                    if(!apply->hasAttr(ISQ_AFFINE_SRC)){
-                        all_apply_marked = false;
-                    }
-                });
-                if(!all_apply_marked) return ;
-                all_apply_marked = true;
-                
-                mlir::SmallVector<json> exported_gates;
-                op->walk([&](ApplyGateOp apply){
-                    if(!all_apply_marked) return;
-                    auto attr = apply->getAttrOfType<mlir::ArrayAttr>(ISQ_AFFINE_SRC);
-                    if(!attr){
-                        all_apply_marked=false; return;
-                    }
-                    auto name = attr.getValue()[0].cast<mlir::SymbolRefAttr>();
-                    llvm::SmallVector<QubitArrayRef> args;
-                    for(auto i=0; i<apply->getNumResults(); i++){
-                        auto arg = attr.getValue()[i+1].cast<mlir::ArrayAttr>();
-                        auto dims_and_affinemap_and_allocid = arg.getValue();
-                        llvm::SmallVector<int> dims;
-                        for(auto i=0; i<dims_and_affinemap_and_allocid.size()-2; i++){
-                            dims.push_back(dims_and_affinemap_and_allocid[i].cast<mlir::IntegerAttr>().getInt());
-                        }
-                        auto alloc_id = dims_and_affinemap_and_allocid.back().cast<mlir::IntegerAttr>().getInt();
-                        auto affinemap = (*(dims_and_affinemap_and_allocid.end()-2)).cast<mlir::AffineMapAttr>().getAffineMap();
-                        mlir::SmallVector<SimpleAffineExpr> subscripts;
-                        for(auto subscript : affinemap.getResults()){
-                            auto simple_expr = SimpleAffineExpr::fromAffineExpr(subscript);
-                            if(!simple_expr){
-                                all_apply_marked = false;
-                                return;
-                            }
-                            subscripts.push_back(*simple_expr);
-                        }
-                        QubitArrayRef ref = {
-                            .alloc_id = static_cast<int>(alloc_id),
-                            .used_loop_vars = dims,
-                            .array_subscripts = subscripts,
-                        };
-                        args.push_back(std::move(ref));
-                    }
-                    auto exported = ExportedGate(name.getLeafReference().str(), std::move(args));
-                    exported_gates.push_back(std::move(exported.toJson()));
-                });
-                if(!all_apply_marked) return ;
-                auto s = json(exported_gates);
-                std::string str = s.dump();
-                mutex->lock();
-                llvm::outs()<<"json:\n"<<str<<"\n";
-                mutex->unlock();
+                loops.push_back(op);
             });
-            // export all loops to qswp and get the schedule back.
-
-            // erase attributes.
-
+            bool changed = false;
+            for(auto loop: loops){
+                LoopPipeliner pipeliner(loop);
+                if(!pipeliner.analyze()) continue;
+                auto before = pipeliner.getTripCount() * pipeliner.getDepth();
+                auto after = pipeliner.pipelinedDepth();
+                if(report){
+                    loop.emitRemark() << "pipelined: depth " << before << " -> " << after << " (" << pipeliner.getNumStages() << " stages, interval " << pipeliner.getInterval() << ")";
+                }
+                pipeliner.rewrite();
+                numPipelined++;
+                depthBefore += before;
+                depthAfter += after;
+                changed = true;
+            }
+            if(!changed) markAllAnalysesPreserved();
         }
         mlir::StringRef getArgument() const final override{
             return "isq-affine-swp";
         }
         mlir::StringRef getDescription() const final override{
-            return "(Experimental) perform software pipelining on affine loops";
+            return "Software-pipeline affine loops of gates, overlapping iterations that touch different qubits.";
         }
     };
     void registerAffineSWP(){
         mlir::PassRegistration<SWPipelinePass>();
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,87 @@
+#include "isq/Operations.h"
+#include "isq/passes/CircuitDAG.h"
+#include "isq/passes/GateInfo.h"
+#include "isq/passes/LayerScheduler.h"
+#include "isq/passes/Passes.h"
+#include <llvm/Support/CommandLine.h>
+#include <mlir/Dialect/Func/IR/FuncOps.h>
+#include <mlir/IR/Builders.h>
+#include <mlir/IR/SymbolTable.h>
+#include <mlir/Pass/Pass.h>
+#include <mlir/Pass/PassRegistry.h>
+namespace isq{
+namespace ir{
+namespace passes{
+
+const char* ISQ_LAYER = "isq.layer";
+
+// Assigns every gate of a function to a parallel layer, moving commuting gates past each other.
+// The schedule is computed on the circuit DAG with `LayerScheduler`, so it may be shallower than the DAG itself.
+// Layers are written to the `isq.layer` attribute if `tag-layers` is set. The order of ops is left unchanged:
+// qstates flow through memory, so emitters do the reordering. `isq-opt --target=qcis` emits the gates of tagged
+// ops in layer order, up to the next call or control flow.
+struct SchedulePass : public mlir::PassWrapper<SchedulePass, mlir::OperationPass<mlir::func::FuncOp>>{
+    Option<bool> alap{*this, "alap", llvm::cl::desc("Schedule gates as late as possible instead of as soon as possible."), llvm::cl::init(false)};
+    Option<bool> tagLayers{*this, "tag-layers", llvm::cl::desc("Attach the layer index to each gate as `isq.layer`."), llvm::cl::init(false)};
+    Statistic depthBefore{this, "depth-before", "Circuit depth in program order"};
+    Statistic depthAfter{this, "depth-after", "Circuit depth after scheduling"};
+    SchedulePass() = default;
+    SchedulePass(const SchedulePass& pass) {}
+
+    void runOnOperation() override{
+        mlir::func::FuncOp func = this->getOperation();
+        auto& dag = getAnalysis<CircuitDAG>();
+        if(dag.size()==0){
+            markAllAnalysesPreserved();
+            return;
+        }
+        mlir::SymbolTableCollection symbols;
+        auto n = dag.size();
+        std::vector<unsigned> layers(n);
+        LayerScheduler scheduler;
+        for(unsigned k=0; k<n; k++){
+            auto id = alap ? n-1-k : k;
+            if(dag.isBarrier(id)){
+                layers[id] = scheduler.placeBarrier();
+                continue;
+            }
+            auto wires = dag.wires(id);
+            llvm::SmallVector<WireBasis> basis(wires.size(), WireBasis::General);
+            if(auto apply = llvm::dyn_cast<ApplyGateOp>(dag.getOp(id))){
+                if(auto gate = analyzeAppliedGate(apply, symbols)){
+                    for(auto i=0; i<wires.size(); i++){
+                        basis[i] = gate->basisOn(i);
+                    }
+                }
+            }
+            layers[id] = scheduler.place(wires, basis);
+        }
+        auto depth = scheduler.depth();
+        depthBefore += dag.depth();
+        depthAfter += depth;
+        if(!tagLayers){
+            markAllAnalysesPreserved();
+            return;
+        }
+        mlir::Builder builder(func->getContext());
+        for(unsigned id=0; id<n; id++){
+            auto layer = alap ? depth-1-layers[id] : layers[id];
+            dag.getOp(id)->setAttr(ISQ_LAYER, builder.getI64IntegerAttr(layer));
+        }
+        markAnalysesPreserved<CircuitDAG>();
+    }
+    mlir::StringRef getArgument() const final{
+        return "isq-schedule";
+    }
+    mlir::StringRef getDescription() const final{
+        return "Schedule gates into parallel layers to minimize circuit depth.";
+    }
+};
+
+void registerSchedule(){
+    mlir::PassRegistration<SchedulePass>();
+}
+
+}
+}
+}
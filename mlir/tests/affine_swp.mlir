@@ -0,0 +1,98 @@
+isq.defgate @h {definition = [{type = "qir", value = "__quantum__qis__h__body"}]} : !isq.gate<1, hermitian, symmetric>
+isq.defgate @t {definition = [{type = "qir", value = "__quantum__qis__t__body"}]} : !isq.gate<1, diagonal, phase, symmetric>
+isq.defgate @cnot {definition = [{type = "qir", value = "__quantum__qis__cnot"}]} : !isq.gate<2, hermitian>
+func.func private @__quantum__qis__h__body(!isq.qir.qubit)
+func.func private @__quantum__qis__t__body(!isq.qir.qubit)
+func.func private @__quantum__qis__cnot(!isq.qir.qubit, !isq.qir.qubit)
+isq.declare_qop @__isq__builtin__measure : [1]()->i1
+
+// Run with: isq-opt --pass-pipeline="builtin.module(func.func(isq-affine-swp{report=1}),cse)" --mlir-pass-statistics
+// Expected: 3 pipelined-loops, depth-before 46, depth-after 23.
+// Gates of every qubit must stay in program order; the remarks give the depth of each loop.
+
+// Iterations touch disjoint pairs. H, CNOT, T take 3 layers; iteration i+1 starts one layer after iteration i.
+// Expected: "depth 24 -> 10 (3 stages, interval 1)". Prologue: stage 0 of iteration 0, then stage 1 of 0 and stage 0 of 1.
+// Kernel: affine.for %t = 2 to 8 running T of %t-2, CNOT of %t-1 and H of %t. Epilogue: iterations 6 and 7 finish.
+func.func @pairs(%q: memref<16x!isq.qstate>){
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %t = isq.use @t : !isq.gate<1, diagonal, phase, symmetric>
+    %cnot = isq.use @cnot : !isq.gate<2, hermitian>
+    affine.for %i = 0 to 8 {
+        %a0 = affine.load %q[%i * 2] : memref<16x!isq.qstate>
+        %b0 = affine.load %q[%i * 2 + 1] : memref<16x!isq.qstate>
+        %a1 = isq.apply %h(%a0) : !isq.gate<1, hermitian, symmetric>
+        %a2, %b1 = isq.apply %cnot(%a1, %b0) : !isq.gate<2, hermitian>
+        %b2 = isq.apply %t(%b1) : !isq.gate<1, diagonal, phase, symmetric>
+        affine.store %a2, %q[%i * 2] : memref<16x!isq.qstate>
+        affine.store %b2, %q[%i * 2 + 1] : memref<16x!isq.qstate>
+    }
+    return
+}
+
+// CNOT ladder written the way the frontend does, through subviews. Iteration i+1 needs q[i+1] right after
+// the CNOT of iteration i, but the T on q[i] can run next to it.
+// Expected: "depth 14 -> 8 (2 stages, interval 1)". The kernel runs T of %t-1 before the CNOT of %t.
+func.func @ladder(%q: memref<8x!isq.qstate>){
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %t = isq.use @t : !isq.gate<1, diagonal, phase, symmetric>
+    %cnot = isq.use @cnot : !isq.gate<2, hermitian>
+    affine.for %i = 0 to 7 {
+        %i1 = arith.addi %i, %c1 : index
+        %sa = memref.subview %q[%i][1][1] : memref<8x!isq.qstate> to memref<1x!isq.qstate, strided<[1], offset: ?>>
+        %sb = memref.subview %q[%i1][1][1] : memref<8x!isq.qstate> to memref<1x!isq.qstate, strided<[1], offset: ?>>
+        %a0 = affine.load %sa[%c0] : memref<1x!isq.qstate, strided<[1], offset: ?>>
+        %b0 = affine.load %sb[%c0] : memref<1x!isq.qstate, strided<[1], offset: ?>>
+        %a1, %b1 = isq.apply %cnot(%a0, %b0) : !isq.gate<2, hermitian>
+        %a2 = isq.apply %t(%a1) : !isq.gate<1, diagonal, phase, symmetric>
+        affine.store %a2, %sa[%c0] : memref<1x!isq.qstate, strided<[1], offset: ?>>
+        affine.store %b1, %sb[%c0] : memref<1x!isq.qstate, strided<[1], offset: ?>>
+    }
+    return
+}
+
+// Every iteration uses the ancilla %a, so the CNOTs stay serial, but the H on q[i] overlaps the next CNOT.
+// Expected: "depth 8 -> 5 (2 stages, interval 1)".
+func.func @ancilla(%q: memref<4x!isq.qstate>){
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %cnot = isq.use @cnot : !isq.gate<2, hermitian>
+    %a = memref.alloc() : memref<1x!isq.qstate>
+    affine.for %i = 0 to 4 {
+        %q0 = affine.load %q[%i] : memref<4x!isq.qstate>
+        %a0 = affine.load %a[0] : memref<1x!isq.qstate>
+        %q1, %a1 = isq.apply %cnot(%q0, %a0) : !isq.gate<2, hermitian>
+        %q2 = isq.apply %h(%q1) : !isq.gate<1, hermitian, symmetric>
+        affine.store %q2, %q[%i] : memref<4x!isq.qstate>
+        affine.store %a1, %a[0] : memref<1x!isq.qstate>
+    }
+    memref.dealloc %a : memref<1x!isq.qstate>
+    return
+}
+
+// Not pipelined: the H of iteration i+1 acts on q[i+1] right after the CNOT of iteration i, so no layer can overlap.
+func.func @serial_ladder(%q: memref<8x!isq.qstate>){
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %cnot = isq.use @cnot : !isq.gate<2, hermitian>
+    affine.for %i = 0 to 7 {
+        %a0 = affine.load %q[%i] : memref<8x!isq.qstate>
+        %b0 = affine.load %q[%i + 1] : memref<8x!isq.qstate>
+        %a1 = isq.apply %h(%a0) : !isq.gate<1, hermitian, symmetric>
+        %a2, %b1 = isq.apply %cnot(%a1, %b0) : !isq.gate<2, hermitian>
+        affine.store %a2, %q[%i] : memref<8x!isq.qstate>
+        affine.store %b1, %q[%i + 1] : memref<8x!isq.qstate>
+    }
+    return
+}
+
+// Not pipelined: measurements are not moved across iterations.
+func.func @measured(%q: memref<8x!isq.qstate>){
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    affine.for %i = 0 to 8 {
+        %q0 = affine.load %q[%i] : memref<8x!isq.qstate>
+        %q1 = isq.apply %h(%q0) : !isq.gate<1, hermitian, symmetric>
+        %q2, %m = isq.call_qop @__isq__builtin__measure(%q1) : [1]()->i1
+        %q3 = isq.apply %h(%q2) : !isq.gate<1, hermitian, symmetric>
+        affine.store %q3, %q[%i] : memref<8x!isq.qstate>
+    }
+    return
+}
@@ -0,0 +1,72 @@
+isq.defgate @h {definition = [{type = "qir", value = "__quantum__qis__h__body"}]} : !isq.gate<1, hermitian, symmetric>
+isq.defgate @t {definition = [{type = "qir", value = "__quantum__qis__t__body"}]} : !isq.gate<1, diagonal, phase, symmetric>
+isq.defgate @x {definition = [{type = "qir", value = "__quantum__qis__x__body"}]} : !isq.gate<1, hermitian, antidiagonal, symmetric>
+isq.defgate @rz(f64) {definition = [{type = "qir", value = "__quantum__qis__rz__body"}]} : !isq.gate<1, diagonal, symmetric>
+isq.defgate @cnot {definition = [{type = "qir", value = "__quantum__qis__cnot"}]} : !isq.gate<2, hermitian>
+func.func private @__quantum__qis__h__body(!isq.qir.qubit)
+func.func private @__quantum__qis__t__body(!isq.qir.qubit)
+func.func private @__quantum__qis__x__body(!isq.qir.qubit)
+func.func private @__quantum__qis__rz__body(f64, !isq.qir.qubit)
+func.func private @__quantum__qis__cnot(!isq.qir.qubit, !isq.qir.qubit)
+
+// Run with: isq-opt --isq-recognize-famous-gates --isq-cancel-gates --canonicalize --mlir-pass-statistics
+
+// CNOT(a,b) T(a) X(b) CNOT(a,b): T commutes with the control, X with the target. Both CNOTs cancel, T and X remain.
+func.func @cnot_through_commuting(%a: !isq.qstate, %b: !isq.qstate)->(!isq.qstate, !isq.qstate){
+    %cnot = isq.use @cnot : !isq.gate<2, hermitian>
+    %t = isq.use @t : !isq.gate<1, diagonal, phase, symmetric>
+    %x = isq.use @x : !isq.gate<1, hermitian, antidiagonal, symmetric>
+    %a1, %b1 = isq.apply %cnot(%a, %b) : !isq.gate<2, hermitian>
+    %a2 = isq.apply %t(%a1) : !isq.gate<1, diagonal, phase, symmetric>
+    %b2 = isq.apply %x(%b1) : !isq.gate<1, hermitian, antidiagonal, symmetric>
+    %a3, %b3 = isq.apply %cnot(%a2, %b2) : !isq.gate<2, hermitian>
+    return %a3, %b3 : !isq.qstate, !isq.qstate
+}
+
+// Rz(0.5) and Rz(-0.5) cancel through a T gate. The H pair then becomes adjacent and cancels too.
+func.func @nested_pairs(%a: !isq.qstate)->!isq.qstate{
+    %p = arith.constant 0.5 : f64
+    %m = arith.constant -0.5 : f64
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %t = isq.use @t : !isq.gate<1, diagonal, phase, symmetric>
+    %rzp = isq.use @rz(%p) : (f64) -> !isq.gate<1, diagonal, symmetric>
+    %rzm = isq.use @rz(%m) : (f64) -> !isq.gate<1, diagonal, symmetric>
+    %a1 = isq.apply %h(%a) : !isq.gate<1, hermitian, symmetric>
+    %a2 = isq.apply %rzp(%a1) : !isq.gate<1, diagonal, symmetric>
+    %a3 = isq.apply %t(%a2) : !isq.gate<1, diagonal, phase, symmetric>
+    %a4 = isq.apply %rzm(%a3) : !isq.gate<1, diagonal, symmetric>
+    %a5 = isq.apply %h(%a4) : !isq.gate<1, hermitian, symmetric>
+    return %a5 : !isq.qstate
+}
+
+// Same as above, but qubits go through memory as emitted by the frontend.
+func.func @through_memory(){
+    %q = memref.alloc() : memref<2x!isq.qstate>
+    %cnot = isq.use @cnot : !isq.gate<2, hermitian>
+    %t = isq.use @t : !isq.gate<1, diagonal, phase, symmetric>
+    %q0 = affine.load %q[0] : memref<2x!isq.qstate>
+    %q1 = affine.load %q[1] : memref<2x!isq.qstate>
+    %q2, %q3 = isq.apply %cnot(%q0, %q1) : !isq.gate<2, hermitian>
+    affine.store %q2, %q[0] : memref<2x!isq.qstate>
+    affine.store %q3, %q[1] : memref<2x!isq.qstate>
+    %q4 = affine.load %q[0] : memref<2x!isq.qstate>
+    %q5 = isq.apply %t(%q4) : !isq.gate<1, diagonal, phase, symmetric>
+    affine.store %q5, %q[0] : memref<2x!isq.qstate>
+    %q6 = affine.load %q[0] : memref<2x!isq.qstate>
+    %q7 = affine.load %q[1] : memref<2x!isq.qstate>
+    %q8, %q9 = isq.apply %cnot(%q6, %q7) : !isq.gate<2, hermitian>
+    affine.store %q8, %q[0] : memref<2x!isq.qstate>
+    affine.store %q9, %q[1] : memref<2x!isq.qstate>
+    memref.dealloc %q : memref<2x!isq.qstate>
+    return
+}
+
+// H(a) CNOT(a,b) H(a): H does not commute with the control. Nothing is removed.
+func.func @dont_cancel(%a: !isq.qstate, %b: !isq.qstate)->(!isq.qstate, !isq.qstate){
+    %cnot = isq.use @cnot : !isq.gate<2, hermitian>
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %a1 = isq.apply %h(%a) : !isq.gate<1, hermitian, symmetric>
+    %a2, %b1 = isq.apply %cnot(%a1, %b) : !isq.gate<2, hermitian>
+    %a3 = isq.apply %h(%a2) : !isq.gate<1, hermitian, symmetric>
+    return %a3, %b1 : !isq.qstate, !isq.qstate
+}
@@ -0,0 +1,36 @@
+isq.defgate @h {definition = [{type = "qir", value = "__quantum__qis__h__body"}]} : !isq.gate<1, hermitian, symmetric>
+isq.defgate @cnot {definition = [{type = "qir", value = "__quantum__qis__cnot"}]} : !isq.gate<2, hermitian>
+func.func private @__quantum__qis__h__body(!isq.qir.qubit)
+func.func private @__quantum__qis__cnot(!isq.qir.qubit, !isq.qir.qubit)
+
+// Run with: isq-opt --pass-pipeline="builtin.module(func.func(isq-print-circuit-depth))"
+// Expected: gates 5, depth 3, wires 3.
+
+// H(q0) H(q1) H(q2) in layer 0, CNOT(q0,q1) in layer 1, CNOT(q1,q2) in layer 2.
+func.func @ghz(){
+    %q = memref.alloc() : memref<3x!isq.qstate>
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %cnot = isq.use @cnot : !isq.gate<2, hermitian>
+    %s = memref.subview %q[1][2][1] : memref<3x!isq.qstate> to memref<2x!isq.qstate, strided<[1], offset: 1>>
+    %a0 = affine.load %q[0] : memref<3x!isq.qstate>
+    %a1 = isq.apply %h(%a0) : !isq.gate<1, hermitian, symmetric>
+    affine.store %a1, %q[0] : memref<3x!isq.qstate>
+    %b0 = affine.load %s[0] : memref<2x!isq.qstate, strided<[1], offset: 1>>
+    %b1 = isq.apply %h(%b0) : !isq.gate<1, hermitian, symmetric>
+    affine.store %b1, %s[0] : memref<2x!isq.qstate, strided<[1], offset: 1>>
+    %c0 = affine.load %q[2] : memref<3x!isq.qstate>
+    %c1 = isq.apply %h(%c0) : !isq.gate<1, hermitian, symmetric>
+    affine.store %c1, %q[2] : memref<3x!isq.qstate>
+    %x0 = affine.load %q[0] : memref<3x!isq.qstate>
+    %y0 = affine.load %q[1] : memref<3x!isq.qstate>
+    %x1, %y1 = isq.apply %cnot(%x0, %y0) : !isq.gate<2, hermitian>
+    affine.store %x1, %q[0] : memref<3x!isq.qstate>
+    affine.store %y1, %q[1] : memref<3x!isq.qstate>
+    %y2 = affine.load %s[0] : memref<2x!isq.qstate, strided<[1], offset: 1>>
+    %z0 = affine.load %s[1] : memref<2x!isq.qstate, strided<[1], offset: 1>>
+    %y3, %z1 = isq.apply %cnot(%y2, %z0) : !isq.gate<2, hermitian>
+    affine.store %y3, %s[0] : memref<2x!isq.qstate, strided<[1], offset: 1>>
+    affine.store %z1, %s[1] : memref<2x!isq.qstate, strided<[1], offset: 1>>
+    memref.dealloc %q : memref<3x!isq.qstate>
+    return
+}
@@ -0,0 +1,28 @@
+isq.defgate @x {definition = [{type = "qir", value = "__quantum__qis__x__body"}]} : !isq.gate<1, hermitian, symmetric>
+func.func private @__quantum__qis__x__body(!isq.qir.qubit)
+memref.global @q : memref<4x!isq.qstate> = uninitialized
+
+// Run with: isq-opt --target=eqasm
+// Expected: the loop counter %i, %j, %k and %b live in R3.. and are never stored to the stack. The only LD/ST
+// in the loop move the qubit address of %s. With --eqasm-registers=0 each of them is stored to CSTACK where
+// it is defined and loaded back at every use.
+// scripts/count-eqasm.py compares the two for all of mlir/tests.
+func.func @__isq__main(){
+    %q = memref.get_global @q : memref<4x!isq.qstate>
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %c4 = arith.constant 4 : index
+    %x = isq.use @x : !isq.gate<1, hermitian, symmetric>
+    scf.for %i = %c0 to %c4 step %c1 {
+        %j = arith.muli %i, %i : index
+        %k = arith.addi %j, %c1 : index
+        %b = arith.cmpi slt, %k, %c4 : index
+        scf.if %b {
+            %s = memref.subview %q[%i][1][1] : memref<4x!isq.qstate> to memref<1x!isq.qstate, affine_map<(d0)[s0]->(d0+s0)>>
+            %a = affine.load %s[0] : memref<1x!isq.qstate, affine_map<(d0)[s0]->(d0+s0)>>
+            %a1 = isq.apply %x(%a) : !isq.gate<1, hermitian, symmetric>
+            affine.store %a1, %s[0] : memref<1x!isq.qstate, affine_map<(d0)[s0]->(d0+s0)>>
+        }
+    }
+    return
+}
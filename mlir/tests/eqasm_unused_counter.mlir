@@ -0,0 +1,24 @@
+isq.defgate @x {definition = [{type = "qir", value = "__quantum__qis__x__body"}]} : !isq.gate<1, hermitian, symmetric>
+func.func private @__quantum__qis__x__body(!isq.qir.qubit)
+memref.global @q : memref<4x!isq.qstate> = uninitialized
+
+// Run with: isq-opt --target=eqasm --eqasm-registers=2
+// The body never reads the loop counter %i, but the ADD and CMP closing each iteration do.
+// Expected: %i and %k are in different registers (R3 and R4), so computing %k does not overwrite the counter.
+func.func @__isq__main(){
+    %q = memref.get_global @q : memref<4x!isq.qstate>
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %c4 = arith.constant 4 : index
+    %x = isq.use @x : !isq.gate<1, hermitian, symmetric>
+    scf.for %i = %c0 to %c4 step %c1 {
+        %k = arith.addi %c1, %c1 : index
+        %b = arith.cmpi slt, %k, %c4 : index
+        scf.if %b {
+            %a = affine.load %q[0] : memref<4x!isq.qstate>
+            %a1 = isq.apply %x(%a) : !isq.gate<1, hermitian, symmetric>
+            affine.store %a1, %q[0] : memref<4x!isq.qstate>
+        }
+    }
+    return
+}
@@ -0,0 +1,67 @@
+isq.defgate @h {definition = [{type = "qir", value = "__quantum__qis__h__body"}]} : !isq.gate<1, hermitian, symmetric>
+isq.defgate @s {definition = [{type = "qir", value = "__quantum__qis__s__body"}]} : !isq.gate<1, diagonal, phase, symmetric>
+isq.defgate @t {definition = [{type = "qir", value = "__quantum__qis__t__body"}]} : !isq.gate<1, diagonal, phase, symmetric>
+isq.defgate @rz(f64) {definition = [{type = "qir", value = "__quantum__qis__rz__body"}]} : !isq.gate<1, diagonal, symmetric>
+isq.defgate @u3(f64, f64, f64) {definition = [{type = "qir", value = "__quantum__qis__u3"}]} : !isq.gate<1>
+isq.defgate @cnot {definition = [{type = "qir", value = "__quantum__qis__cnot"}]} : !isq.gate<2, hermitian>
+func.func private @__quantum__qis__h__body(!isq.qir.qubit)
+func.func private @__quantum__qis__s__body(!isq.qir.qubit)
+func.func private @__quantum__qis__t__body(!isq.qir.qubit)
+func.func private @__quantum__qis__rz__body(f64, !isq.qir.qubit)
+func.func private @__quantum__qis__u3(f64, f64, f64, !isq.qir.qubit)
+func.func private @__quantum__qis__cnot(!isq.qir.qubit, !isq.qir.qubit)
+
+// Run with: isq-opt --isq-recognize-famous-gates --isq-fuse-sq-gates --canonicalize --mlir-pass-statistics
+// Every function below loses global phase and is marked ISQ_GPHASE_REMOVED.
+
+// T T -> S.
+func.func @to_famous(%a: !isq.qstate)->!isq.qstate{
+    %t = isq.use @t : !isq.gate<1, diagonal, phase, symmetric>
+    %a1 = isq.apply %t(%a) : !isq.gate<1, diagonal, phase, symmetric>
+    %a2 = isq.apply %t(%a1) : !isq.gate<1, diagonal, phase, symmetric>
+    return %a2 : !isq.qstate
+}
+
+// S T Rz(0.3) -> one Rz.
+func.func @to_rz(%a: !isq.qstate)->!isq.qstate{
+    %theta = arith.constant 0.3 : f64
+    %s = isq.use @s : !isq.gate<1, diagonal, phase, symmetric>
+    %t = isq.use @t : !isq.gate<1, diagonal, phase, symmetric>
+    %rz = isq.use @rz(%theta) : (f64) -> !isq.gate<1, diagonal, symmetric>
+    %a1 = isq.apply %s(%a) : !isq.gate<1, diagonal, phase, symmetric>
+    %a2 = isq.apply %t(%a1) : !isq.gate<1, diagonal, phase, symmetric>
+    %a3 = isq.apply %rz(%a2) : !isq.gate<1, diagonal, symmetric>
+    return %a3 : !isq.qstate
+}
+
+// H T H U3(0.1, 0.2, 0.3) -> one U3. The run is broken by the CNOT on the other side.
+func.func @to_u3(%a: !isq.qstate, %b: !isq.qstate)->(!isq.qstate, !isq.qstate){
+    %p1 = arith.constant 0.1 : f64
+    %p2 = arith.constant 0.2 : f64
+    %p3 = arith.constant 0.3 : f64
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %t = isq.use @t : !isq.gate<1, diagonal, phase, symmetric>
+    %u3 = isq.use @u3(%p1, %p2, %p3) : (f64, f64, f64) -> !isq.gate<1>
+    %cnot = isq.use @cnot : !isq.gate<2, hermitian>
+    %a1 = isq.apply %h(%a) : !isq.gate<1, hermitian, symmetric>
+    %a2 = isq.apply %t(%a1) : !isq.gate<1, diagonal, phase, symmetric>
+    %a3 = isq.apply %h(%a2) : !isq.gate<1, hermitian, symmetric>
+    %a4 = isq.apply %u3(%a3) : !isq.gate<1>
+    %a5, %b1 = isq.apply %cnot(%a4, %b) : !isq.gate<2, hermitian>
+    %a6 = isq.apply %h(%a5) : !isq.gate<1, hermitian, symmetric>
+    return %a6, %b1 : !isq.qstate, !isq.qstate
+}
+
+// The same run through memory: H H is removed entirely.
+func.func @through_memory(){
+    %q = memref.alloc() : memref<1x!isq.qstate>
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %q0 = affine.load %q[0] : memref<1x!isq.qstate>
+    %q1 = isq.apply %h(%q0) : !isq.gate<1, hermitian, symmetric>
+    affine.store %q1, %q[0] : memref<1x!isq.qstate>
+    %q2 = affine.load %q[0] : memref<1x!isq.qstate>
+    %q3 = isq.apply %h(%q2) : !isq.gate<1, hermitian, symmetric>
+    affine.store %q3, %q[0] : memref<1x!isq.qstate>
+    memref.dealloc %q : memref<1x!isq.qstate>
+    return
+}
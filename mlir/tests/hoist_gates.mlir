@@ -0,0 +1,50 @@
+isq.defgate @h {definition = [{type = "qir", value = "__quantum__qis__h__body"}]} : !isq.gate<1, hermitian, symmetric>
+isq.defgate @rz(f64) {definition = [{type = "qir", value = "__quantum__qis__rz__body"}]} : !isq.gate<1, diagonal, symmetric>
+func.func private @__quantum__qis__h__body(!isq.qir.qubit)
+func.func private @__quantum__qis__rz__body(f64, !isq.qir.qubit)
+
+// Run with: isq-opt --isq-hoist-gates --mlir-pass-statistics
+// Expected: 7 hoisted-ops, 4 merged-ops.
+// @loop: the constant, the rotation angle, both isq.use and the isq.decorate move before the affine.for.
+// The isq.use of @h inside the loop is merged with the one before it. The angle depending on %i stays in the loop.
+// @branches: the isq.use in each branch moves before the scf.if and both merge with the entry one.
+func.func @loop(%q: memref<8x!isq.qstate>){
+    %h0 = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    affine.for %i = 0 to 8 {
+        %c = arith.constant 0.5 : f64
+        %theta = arith.mulf %c, %c : f64
+        %rz = isq.use @rz(%theta) : (f64) -> !isq.gate<1, diagonal, symmetric>
+        %crz = isq.decorate(%rz : !isq.gate<1, diagonal, symmetric>) {ctrl = [true], adjoint = false} : !isq.gate<2>
+        %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+        %ii = arith.index_cast %i : index to i64
+        %fi = arith.sitofp %ii : i64 to f64
+        %phi = arith.mulf %fi, %c : f64
+        %rzi = isq.use @rz(%phi) : (f64) -> !isq.gate<1, diagonal, symmetric>
+        %a0 = affine.load %q[%i] : memref<8x!isq.qstate>
+        %a1 = isq.apply %h(%a0) : !isq.gate<1, hermitian, symmetric>
+        %a2 = isq.apply %rzi(%a1) : !isq.gate<1, diagonal, symmetric>
+        affine.store %a2, %q[%i] : memref<8x!isq.qstate>
+    }
+    %a0 = affine.load %q[0] : memref<8x!isq.qstate>
+    %a1 = affine.load %q[1] : memref<8x!isq.qstate>
+    %h1 = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %b0 = isq.apply %h1(%a0) : !isq.gate<1, hermitian, symmetric>
+    affine.store %b0, %q[0] : memref<8x!isq.qstate>
+    affine.store %a1, %q[1] : memref<8x!isq.qstate>
+    return
+}
+func.func @branches(%c: i1, %a: !isq.qstate) -> !isq.qstate{
+    %h0 = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %a1 = isq.apply %h0(%a) : !isq.gate<1, hermitian, symmetric>
+    %r = scf.if %c -> !isq.qstate {
+        %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+        %b = isq.apply %h(%a1) : !isq.gate<1, hermitian, symmetric>
+        scf.yield %b : !isq.qstate
+    } else {
+        %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+        %b = isq.apply %h(%a1) : !isq.gate<1, hermitian, symmetric>
+        %b2 = isq.apply %h(%b) : !isq.gate<1, hermitian, symmetric>
+        scf.yield %b2 : !isq.qstate
+    }
+    return %r : !isq.qstate
+}
@@ -0,0 +1,34 @@
+isq.defgate @h {definition = [{type = "qir", value = "__quantum__qis__h__body"}]} : !isq.gate<1, hermitian, symmetric>
+isq.defgate @z {definition = [{type = "qir", value = "__quantum__qis__z__body"}]} : !isq.gate<1, hermitian, diagonal, symmetric>
+func.func private @__quantum__qis__h__body(!isq.qir.qubit)
+func.func private @__quantum__qis__z__body(!isq.qir.qubit)
+
+// Run with: isq-opt --pass-pipeline="builtin.module(isq-lower-switch,isq-recognize-famous-gates)"
+// Expected: case 2 and case 5 each give one 3-controlled H. The default gives one Z controlled by a
+// flag qubit being 0, between two rounds of 3-controlled X flipping the flag for 2 and 5.
+// Before, the default body was cloned for each of the 6 remaining basis values.
+func.func @switch(%r: memref<3x!isq.qstate>, %t: memref<1x!isq.qstate>){
+    isq.switch %r : memref<3x!isq.qstate>
+    case 2 {
+        %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+        %0 = affine.load %t[0] : memref<1x!isq.qstate>
+        %1 = isq.apply %h(%0) : !isq.gate<1, hermitian, symmetric>
+        affine.store %1, %t[0] : memref<1x!isq.qstate>
+        isq.yield
+    }
+    case 5 {
+        %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+        %0 = affine.load %t[0] : memref<1x!isq.qstate>
+        %1 = isq.apply %h(%0) : !isq.gate<1, hermitian, symmetric>
+        affine.store %1, %t[0] : memref<1x!isq.qstate>
+        isq.yield
+    }
+    default {
+        %z = isq.use @z : !isq.gate<1, hermitian, diagonal, symmetric>
+        %0 = affine.load %t[0] : memref<1x!isq.qstate>
+        %1 = isq.apply %z(%0) : !isq.gate<1, hermitian, diagonal, symmetric>
+        affine.store %1, %t[0] : memref<1x!isq.qstate>
+        isq.yield
+    }
+    return
+}
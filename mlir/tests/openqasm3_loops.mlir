@@ -0,0 +1,60 @@
+isq.defgate @h {definition = [{type = "qir", value = "__quantum__qis__h__body"}]} : !isq.gate<1, hermitian, symmetric>
+isq.defgate @x {definition = [{type = "qir", value = "__quantum__qis__x__body"}]} : !isq.gate<1, hermitian, symmetric>
+isq.defgate @rz(f64) {definition = [{type = "qir", value = "__quantum__qis__rz__body"}]} : !isq.gate<1, diagonal, symmetric>
+func.func private @__quantum__qis__h__body(!isq.qir.qubit)
+func.func private @__quantum__qis__x__body(!isq.qir.qubit)
+func.func private @__quantum__qis__rz__body(f64, !isq.qir.qubit)
+memref.global @q : memref<100000x!isq.qstate> = uninitialized
+
+// Run with: scripts/roundtrip-openqasm3.py isqc mlir/tests/openqasm3_loops.mlir
+// The script runs isq-opt --target=openqasm3, parses the output with the openqasm3 package and fails unless
+// every Check line below is a line of the output. The loops stay loops and @bell, @phase become gate definitions,
+// so the output is as long as the input.
+// Check: gate bell arg1, arg2 {
+// Check: ctrl @ x arg1, arg2;
+// Check: gate phase(arg1) arg2 {
+// Check: for int arg1 in [0:99998] {
+// Check: bell q[arg1], q[(arg1+1)];
+// Check: for int arg2 in [0:2:99997] {
+// Check: h q[(arg2+1)];
+// Check: phase(0.500000) q[0];
+func.func @bell(%a: memref<1x!isq.qstate, affine_map<(d0)[s0]->(d0+s0)>>, %b: memref<1x!isq.qstate, affine_map<(d0)[s0]->(d0+s0)>>){
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %x = isq.use @x : !isq.gate<1, hermitian, symmetric>
+    %cx = isq.decorate(%x : !isq.gate<1, hermitian, symmetric>) {ctrl = [true], adjoint = false} : !isq.gate<2>
+    %qa = affine.load %a[0] : memref<1x!isq.qstate, affine_map<(d0)[s0]->(d0+s0)>>
+    %qb = affine.load %b[0] : memref<1x!isq.qstate, affine_map<(d0)[s0]->(d0+s0)>>
+    %qa1 = isq.apply %h(%qa) : !isq.gate<1, hermitian, symmetric>
+    %qa2, %qb1 = isq.apply %cx(%qa1, %qb) : !isq.gate<2>
+    affine.store %qa2, %a[0] : memref<1x!isq.qstate, affine_map<(d0)[s0]->(d0+s0)>>
+    affine.store %qb1, %b[0] : memref<1x!isq.qstate, affine_map<(d0)[s0]->(d0+s0)>>
+    return
+}
+func.func @phase(%theta: f64, %a: memref<1x!isq.qstate, affine_map<(d0)[s0]->(d0+s0)>>){
+    %rz = isq.use @rz(%theta) : (f64) -> !isq.gate<1, diagonal, symmetric>
+    %qa = affine.load %a[0] : memref<1x!isq.qstate, affine_map<(d0)[s0]->(d0+s0)>>
+    %qa1 = isq.apply %rz(%qa) : !isq.gate<1, diagonal, symmetric>
+    affine.store %qa1, %a[0] : memref<1x!isq.qstate, affine_map<(d0)[s0]->(d0+s0)>>
+    return
+}
+func.func @__isq__main(){
+    %q = memref.get_global @q : memref<100000x!isq.qstate>
+    %c1 = arith.constant 1 : index
+    affine.for %i = 0 to 99999 {
+        %i1 = arith.addi %i, %c1 : index
+        %a = memref.subview %q[%i][1][1] : memref<100000x!isq.qstate> to memref<1x!isq.qstate, affine_map<(d0)[s0]->(d0+s0)>>
+        %b = memref.subview %q[%i1][1][1] : memref<100000x!isq.qstate> to memref<1x!isq.qstate, affine_map<(d0)[s0]->(d0+s0)>>
+        func.call @bell(%a, %b) : (memref<1x!isq.qstate, affine_map<(d0)[s0]->(d0+s0)>>, memref<1x!isq.qstate, affine_map<(d0)[s0]->(d0+s0)>>) -> ()
+    }
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    affine.for %i = 0 to 99998 step 2 {
+        %qi = affine.load %q[%i + 1] : memref<100000x!isq.qstate>
+        %qi1 = isq.apply %h(%qi) : !isq.gate<1, hermitian, symmetric>
+        affine.store %qi1, %q[%i + 1] : memref<100000x!isq.qstate>
+    }
+    %theta = arith.constant 0.5 : f64
+    %c0 = arith.constant 0 : index
+    %s = memref.subview %q[%c0][1][1] : memref<100000x!isq.qstate> to memref<1x!isq.qstate, affine_map<(d0)[s0]->(d0+s0)>>
+    func.call @phase(%theta, %s) : (f64, memref<1x!isq.qstate, affine_map<(d0)[s0]->(d0+s0)>>) -> ()
+    return
+}
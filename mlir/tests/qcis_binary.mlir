@@ -0,0 +1,25 @@
+isq.defgate @H {definition = [{type = "qir", value = "__quantum__qis__h__body"}]} : !isq.gate<1, hermitian, symmetric>
+isq.defgate @CZ {definition = [{type = "qir", value = "__quantum__qis__cz"}]} : !isq.gate<2, hermitian, diagonal, symmetric>
+func.func private @__quantum__qis__h__body(!isq.qir.qubit)
+func.func private @__quantum__qis__cz(!isq.qir.qubit, !isq.qir.qubit)
+isq.declare_qop @__isq__builtin__measure : [1] () -> i1
+memref.global @q : memref<2x!isq.qstate> = uninitialized
+
+// Run with: isq-opt --target=qcis --qcis-binary -o bell.qcisb && xxd bell.qcisb
+// Expected: the header, then H Q1, CZ Q1 Q2, M Q1, M Q2 in 2-3 bytes each instead of 5-8 characters:
+// 00000000: 5143 4953 0103 010c 0102 1101 0111 0102  QCIS............
+// `simulator bell.qcisb --qcis --qcis-binary --shots 100` replays it like the text output with --qcis.
+func.func @__isq__main(){
+    %q = memref.get_global @q : memref<2x!isq.qstate>
+    %h = isq.use @H : !isq.gate<1, hermitian, symmetric>
+    %cz = isq.use @CZ : !isq.gate<2, hermitian, diagonal, symmetric>
+    %a = affine.load %q[0] : memref<2x!isq.qstate>
+    %b = affine.load %q[1] : memref<2x!isq.qstate>
+    %a1 = isq.apply %h(%a) : !isq.gate<1, hermitian, symmetric>
+    %a2, %b1 = isq.apply %cz(%a1, %b) : !isq.gate<2, hermitian, diagonal, symmetric>
+    %a3, %ma = isq.call_qop @__isq__builtin__measure(%a2) : [1]()->i1
+    %b2, %mb = isq.call_qop @__isq__builtin__measure(%b1) : [1]()->i1
+    affine.store %a3, %q[0] : memref<2x!isq.qstate>
+    affine.store %b2, %q[1] : memref<2x!isq.qstate>
+    return
+}
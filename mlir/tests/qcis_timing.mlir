@@ -0,0 +1,56 @@
+isq.defgate @H {definition = [{type = "qir", value = "__quantum__qis__h__body"}]} : !isq.gate<1, hermitian, symmetric>
+isq.defgate @X {definition = [{type = "qir", value = "__quantum__qis__x__body"}]} : !isq.gate<1, hermitian, symmetric>
+isq.defgate @CZ {definition = [{type = "qir", value = "__quantum__qis__cz"}]} : !isq.gate<2, hermitian, diagonal, symmetric>
+func.func private @__quantum__qis__h__body(!isq.qir.qubit)
+func.func private @__quantum__qis__x__body(!isq.qir.qubit)
+func.func private @__quantum__qis__cz(!isq.qir.qubit, !isq.qir.qubit)
+isq.declare_qop @__isq__builtin__measure : [1] () -> i1
+memref.global @q : memref<4x!isq.qstate> = uninitialized
+
+// Run with: isq-opt --target=qcis --qcis-timing=qcis_target.json
+// Expected: on the line Q1-Q2-Q3-Q4 with H 20ns, CZ 40ns, M 1500ns and 30ns otherwise, gates grouped by start time.
+// The X on Q3 overlaps CZ Q1 Q2, and M Q1 Q2 start before CZ Q3 Q4 has finished:
+// # start 0
+// H Q1
+// H Q3
+//
+// # start 20
+// CZ Q1 Q2
+// X Q3
+//
+// # start 50
+// CZ Q3 Q4
+//
+// # start 60
+// M Q1
+// M Q2
+//
+// # start 90
+// M Q3
+// M Q4
+//
+// # makespan 1590
+func.func @__isq__main(){
+    %q = memref.get_global @q : memref<4x!isq.qstate>
+    %h = isq.use @H : !isq.gate<1, hermitian, symmetric>
+    %x = isq.use @X : !isq.gate<1, hermitian, symmetric>
+    %cz = isq.use @CZ : !isq.gate<2, hermitian, diagonal, symmetric>
+    %a = affine.load %q[0] : memref<4x!isq.qstate>
+    %b = affine.load %q[1] : memref<4x!isq.qstate>
+    %c = affine.load %q[2] : memref<4x!isq.qstate>
+    %d = affine.load %q[3] : memref<4x!isq.qstate>
+    %a1 = isq.apply %h(%a) : !isq.gate<1, hermitian, symmetric>
+    %c1 = isq.apply %h(%c) : !isq.gate<1, hermitian, symmetric>
+    %a2, %b1 = isq.apply %cz(%a1, %b) : !isq.gate<2, hermitian, diagonal, symmetric>
+    %c2 = isq.apply %x(%c1) : !isq.gate<1, hermitian, symmetric>
+    %c3, %d1 = isq.apply %cz(%c2, %d) : !isq.gate<2, hermitian, diagonal, symmetric>
+    %a3, %ma = isq.call_qop @__isq__builtin__measure(%a2) : [1]()->i1
+    %b2, %mb = isq.call_qop @__isq__builtin__measure(%b1) : [1]()->i1
+    %c4, %mc = isq.call_qop @__isq__builtin__measure(%c3) : [1]()->i1
+    %d2, %md = isq.call_qop @__isq__builtin__measure(%d1) : [1]()->i1
+    affine.store %a3, %q[0] : memref<4x!isq.qstate>
+    affine.store %b2, %q[1] : memref<4x!isq.qstate>
+    affine.store %c4, %q[2] : memref<4x!isq.qstate>
+    affine.store %d2, %q[3] : memref<4x!isq.qstate>
+    return
+}
@@ -0,0 +1,49 @@
+#s = #isq.complex<0.7071067811865475, 0.0>
+#is = #isq.complex<0.0, 0.7071067811865475>
+#nis = #isq.complex<0.0, -0.7071067811865475>
+#one = #isq.complex<1.0, 0.0>
+#none = #isq.complex<-1.0, 0.0>
+#i = #isq.complex<0.0, 1.0>
+#zero = #isq.complex<0.0, 0.0>
+#neart = #isq.complex<0.7068238819130737, 0.7073895673229379>
+
+// Run with: isq-opt --isq-recognize-famous-gates
+// User gates are matched against the builtin matrices by fingerprint, up to global phase and qubit order.
+// A rewritten isq.use takes the type of the builtin gate, e.g. !isq.gate<1, hermitian, symmetric> for H,
+// and the decorates on it are retyped to match.
+
+// H times i. Expected: the apply uses $__isq__builtin__h.
+isq.defgate @ih {definition = [{type = "unitary", value = [[#is, #is], [#is, #nis]]}]} : !isq.gate<1>
+// CNOT controlled by its second qubit. Expected: $__isq__builtin__cnot applied on (%b, %a), results swapped back.
+isq.defgate @rcx {definition = [{type = "unitary", value = [
+    [#one, #zero, #zero, #zero],
+    [#zero, #zero, #zero, #one],
+    [#zero, #zero, #one, #zero],
+    [#zero, #one, #zero, #zero]]}]} : !isq.gate<2>
+// CZ. Expected: renamed in place to $__isq__builtin__cz, also under the decorate, which becomes
+// !isq.gate<3, hermitian, symmetric, diagonal, phase>.
+isq.defgate @mycz {definition = [{type = "unitary", value = [
+    [#one, #zero, #zero, #zero],
+    [#zero, #one, #zero, #zero],
+    [#zero, #zero, #one, #zero],
+    [#zero, #zero, #zero, #none]]}]} : !isq.gate<2>
+// X times i. Expected: kept, since the phase becomes relative under the control.
+isq.defgate @ix {definition = [{type = "unitary", value = [[#zero, #i], [#i, #zero]]}]} : !isq.gate<1>
+// diag(1, e^{i(pi/4+4e-4)}). Expected: kept, the angle is 4e-4 away from T.
+isq.defgate @neart {definition = [{type = "unitary", value = [[#one, #zero], [#zero, #neart]]}]} : !isq.gate<1>
+
+func.func @main(%a: !isq.qstate, %b: !isq.qstate, %c: !isq.qstate)->(!isq.qstate, !isq.qstate, !isq.qstate){
+    %ih = isq.use @ih : !isq.gate<1>
+    %a1 = isq.apply %ih(%a) : !isq.gate<1>
+    %rcx = isq.use @rcx : !isq.gate<2>
+    %a2, %b1 = isq.apply %rcx(%a1, %b) : !isq.gate<2>
+    %cz = isq.use @mycz : !isq.gate<2>
+    %ccz = isq.decorate(%cz: !isq.gate<2>) {ctrl = [true], adjoint = false} : !isq.gate<3>
+    %a3, %b2, %c1 = isq.apply %ccz(%a2, %b1, %c) : !isq.gate<3>
+    %ix = isq.use @ix : !isq.gate<1>
+    %cix = isq.decorate(%ix: !isq.gate<1>) {ctrl = [true], adjoint = false} : !isq.gate<2>
+    %b3, %c2 = isq.apply %cix(%b2, %c1) : !isq.gate<2>
+    %neart = isq.use @neart : !isq.gate<1>
+    %a4 = isq.apply %neart(%a3) : !isq.gate<1>
+    return %a4, %b3, %c2 : !isq.qstate, !isq.qstate, !isq.qstate
+}
@@ -0,0 +1,129 @@
+isq.declare_qop @__isq__builtin__measure : [1]()->i1
+isq.declare_qop @__isq__builtin__reset : [1]()->()
+isq.defgate @h {definition = [{type = "qir", value = "__quantum__qis__h__body"}]} : !isq.gate<1, hermitian, symmetric>
+isq.defgate @cnot {definition = [{type = "qir", value = "__quantum__qis__cnot"}]} : !isq.gate<2, hermitian>
+// Flips measured qubits back to |0>. Without it, only reset and deallocated qubits are lent.
+isq.defgate @"$__isq__builtin__x" {definition = [{type = "qir", value = "__quantum__qis__x__body"}], isq_famous = "x"} : !isq.gate<1, hermitian, antidiagonal, symmetric>
+func.func private @__quantum__qis__h__body(!isq.qir.qubit)
+func.func private @__quantum__qis__cnot(!isq.qir.qubit, !isq.qir.qubit)
+func.func private @__quantum__qis__x__body(!isq.qir.qubit)
+memref.global @g : memref<1x!isq.qstate> = uninitialized
+
+// Run with: isq-opt --pass-pipeline="builtin.module(isq-reuse-qubit{report=1})" --mlir-pass-statistics
+// Expected: 6 reused-qubits.
+// @chain: peak live qubits: 2 -> 1. %b and then %c borrow %a.
+// @branch: peak live qubits: 3 -> 2. %t borrows q[1] inside the branch, %u in the loop body borrows q[0].
+// @call: peak live qubits: 3 -> 1. @chain only touches its own allocations, so %a borrows the argument across the call.
+// @touch_global: peak live qubits: 0 -> 0.
+// @global_call: peak live qubits: 1 -> 1. @touch_global touches @g, so %a is not served by it.
+// @released: peak live qubits: 1 -> 1. %b borrows %a after its dealloc: %a is reset instead of freed, and
+// freed where %b was. There is one allocation instead of two.
+
+func.func @chain() -> (i1, i1, i1){
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %a = memref.alloc() : memref<1x!isq.qstate>
+    %a0 = affine.load %a[0] : memref<1x!isq.qstate>
+    %a1 = isq.apply %h(%a0) : !isq.gate<1, hermitian, symmetric>
+    %a2, %ma = isq.call_qop @__isq__builtin__measure(%a1) : [1]()->i1
+    affine.store %a2, %a[0] : memref<1x!isq.qstate>
+    %b = memref.alloc() : memref<1x!isq.qstate>
+    %b0 = affine.load %b[0] : memref<1x!isq.qstate>
+    %b1 = isq.apply %h(%b0) : !isq.gate<1, hermitian, symmetric>
+    %b2, %mb = isq.call_qop @__isq__builtin__measure(%b1) : [1]()->i1
+    affine.store %b2, %b[0] : memref<1x!isq.qstate>
+    memref.dealloc %b : memref<1x!isq.qstate>
+    %c = memref.alloc() : memref<1x!isq.qstate>
+    %c0 = affine.load %c[0] : memref<1x!isq.qstate>
+    %c1 = isq.apply %h(%c0) : !isq.gate<1, hermitian, symmetric>
+    %c2, %mc = isq.call_qop @__isq__builtin__measure(%c1) : [1]()->i1
+    affine.store %c2, %c[0] : memref<1x!isq.qstate>
+    memref.dealloc %c : memref<1x!isq.qstate>
+    memref.dealloc %a : memref<1x!isq.qstate>
+    return %ma, %mb, %mc : i1, i1, i1
+}
+
+func.func @branch(%cond: i1){
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %cnot = isq.use @cnot : !isq.gate<2, hermitian>
+    %q = memref.alloc() : memref<2x!isq.qstate>
+    %q0 = affine.load %q[0] : memref<2x!isq.qstate>
+    %q1 = affine.load %q[1] : memref<2x!isq.qstate>
+    %q2, %q3 = isq.apply %cnot(%q0, %q1) : !isq.gate<2, hermitian>
+    %q4, %m0 = isq.call_qop @__isq__builtin__measure(%q2) : [1]()->i1
+    affine.store %q4, %q[0] : memref<2x!isq.qstate>
+    %q5 = isq.call_qop @__isq__builtin__reset(%q3) : [1]()->()
+    affine.store %q5, %q[1] : memref<2x!isq.qstate>
+    scf.if %cond {
+        %t = memref.alloc() : memref<1x!isq.qstate>
+        %t0 = affine.load %t[0] : memref<1x!isq.qstate>
+        %t1 = isq.apply %h(%t0) : !isq.gate<1, hermitian, symmetric>
+        affine.store %t1, %t[0] : memref<1x!isq.qstate>
+        memref.dealloc %t : memref<1x!isq.qstate>
+    }
+    affine.for %i = 0 to 4 {
+        %u = memref.alloc() : memref<1x!isq.qstate>
+        %u0 = affine.load %u[0] : memref<1x!isq.qstate>
+        %u1 = isq.apply %h(%u0) : !isq.gate<1, hermitian, symmetric>
+        affine.store %u1, %u[0] : memref<1x!isq.qstate>
+        memref.dealloc %u : memref<1x!isq.qstate>
+        // q[1] is touched in the loop, so it cannot be lent to %u.
+        %v0 = affine.load %q[1] : memref<2x!isq.qstate>
+        %v1 = isq.apply %h(%v0) : !isq.gate<1, hermitian, symmetric>
+        affine.store %v1, %q[1] : memref<2x!isq.qstate>
+    }
+    memref.dealloc %q : memref<2x!isq.qstate>
+    return
+}
+
+func.func @call(%q: memref<1x!isq.qstate>){
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %q0 = affine.load %q[0] : memref<1x!isq.qstate>
+    %q1, %m = isq.call_qop @__isq__builtin__measure(%q0) : [1]()->i1
+    affine.store %q1, %q[0] : memref<1x!isq.qstate>
+    %a = memref.alloc() : memref<1x!isq.qstate>
+    %r:3 = func.call @chain() : () -> (i1, i1, i1)
+    %a0 = affine.load %a[0] : memref<1x!isq.qstate>
+    %a1 = isq.apply %h(%a0) : !isq.gate<1, hermitian, symmetric>
+    affine.store %a1, %a[0] : memref<1x!isq.qstate>
+    memref.dealloc %a : memref<1x!isq.qstate>
+    return
+}
+
+func.func @touch_global(){
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %g = memref.get_global @g : memref<1x!isq.qstate>
+    %g0 = affine.load %g[0] : memref<1x!isq.qstate>
+    %g1 = isq.apply %h(%g0) : !isq.gate<1, hermitian, symmetric>
+    affine.store %g1, %g[0] : memref<1x!isq.qstate>
+    return
+}
+
+func.func @global_call(){
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %g = memref.get_global @g : memref<1x!isq.qstate>
+    %g0 = affine.load %g[0] : memref<1x!isq.qstate>
+    %g1, %m = isq.call_qop @__isq__builtin__measure(%g0) : [1]()->i1
+    affine.store %g1, %g[0] : memref<1x!isq.qstate>
+    %a = memref.alloc() : memref<1x!isq.qstate>
+    func.call @touch_global() : () -> ()
+    %a0 = affine.load %a[0] : memref<1x!isq.qstate>
+    %a1 = isq.apply %h(%a0) : !isq.gate<1, hermitian, symmetric>
+    affine.store %a1, %a[0] : memref<1x!isq.qstate>
+    memref.dealloc %a : memref<1x!isq.qstate>
+    return
+}
+
+func.func @released(){
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %a = memref.alloc() : memref<1x!isq.qstate>
+    %a0 = affine.load %a[0] : memref<1x!isq.qstate>
+    %a1 = isq.apply %h(%a0) : !isq.gate<1, hermitian, symmetric>
+    affine.store %a1, %a[0] : memref<1x!isq.qstate>
+    memref.dealloc %a : memref<1x!isq.qstate>
+    %b = memref.alloc() : memref<1x!isq.qstate>
+    %b0 = affine.load %b[0] : memref<1x!isq.qstate>
+    %b1 = isq.apply %h(%b0) : !isq.gate<1, hermitian, symmetric>
+    affine.store %b1, %b[0] : memref<1x!isq.qstate>
+    memref.dealloc %b : memref<1x!isq.qstate>
+    return
+}
@@ -0,0 +1,17 @@
+isq.defgate @h {definition = [{type = "qir", value = "__quantum__qis__h__body"}]} : !isq.gate<1, hermitian, symmetric>
+isq.defgate @x {definition = [{type = "qir", value = "__quantum__qis__x__body"}]} : !isq.gate<1, hermitian, antidiagonal, symmetric>
+func.func private @__quantum__qis__h__body(!isq.qir.qubit)
+func.func private @__quantum__qis__x__body(!isq.qir.qubit)
+
+// Run with: isq-opt --isq-recognize-famous-gates --isq-rewrite-rules=rewrite_rules.pdll --canonicalize
+// Expected: @main applies a single $__isq__builtin__z to %a and returns %b untouched.
+func.func @main(%a: !isq.qstate, %b: !isq.qstate)->(!isq.qstate, !isq.qstate){
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %x = isq.use @x : !isq.gate<1, hermitian, antidiagonal, symmetric>
+    %a1 = isq.apply %h(%a) : !isq.gate<1, hermitian, symmetric>
+    %a2 = isq.apply %x(%a1) : !isq.gate<1, hermitian, antidiagonal, symmetric>
+    %a3 = isq.apply %h(%a2) : !isq.gate<1, hermitian, symmetric>
+    %b1 = isq.apply %h(%b) : !isq.gate<1, hermitian, symmetric>
+    %b2 = isq.apply %h(%b1) : !isq.gate<1, hermitian, symmetric>
+    return %a3, %b2 : !isq.qstate, !isq.qstate
+}
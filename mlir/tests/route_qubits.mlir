@@ -0,0 +1,25 @@
+isq.defgate @qcis.H {definition = [#isq.gatedef<type = "qir", value = @__quantum__qis__h__body>]} : !isq.gate<1>
+func.func private @__quantum__qis__h__body(!isq.qir.qubit)
+isq.defgate @qcis.CZ {definition = [#isq.gatedef<type = "qir", value = @__quantum__qis__cz>]} : !isq.gate<2>
+func.func private @__quantum__qis__cz(!isq.qir.qubit, !isq.qir.qubit)
+isq.declare_qop @__isq__builtin__measure : [1] () -> i1
+
+// Run with: isq-opt --isq-recognize-famous-gates --isq-route-qubits=config=route_qubits.json --mlir-pass-statistics
+// On the line Q1-Q2-Q3-Q4, CZ Q1 Q3 needs one SWAP. The measurement then reads the moved qubit.
+func.func @__isq__entry() {
+    %Q = memref.alloc() : memref<3x!isq.qstate>
+    %h = isq.use @qcis.H : !isq.gate<1>
+    %cz = isq.use @qcis.CZ : !isq.gate<2>
+    %0 = affine.load %Q[0] : memref<3x!isq.qstate>
+    %1 = isq.apply %h(%0) : !isq.gate<1>
+    affine.store %1, %Q[0] : memref<3x!isq.qstate>
+    %2 = affine.load %Q[0] : memref<3x!isq.qstate>
+    %3 = affine.load %Q[2] : memref<3x!isq.qstate>
+    %4, %5 = isq.apply %cz(%2, %3) : !isq.gate<2>
+    affine.store %4, %Q[0] : memref<3x!isq.qstate>
+    affine.store %5, %Q[2] : memref<3x!isq.qstate>
+    %6 = affine.load %Q[0] : memref<3x!isq.qstate>
+    %7, %8 = isq.call_qop @__isq__builtin__measure(%6) : [1]()->i1
+    affine.store %7, %Q[0] : memref<3x!isq.qstate>
+    return
+}
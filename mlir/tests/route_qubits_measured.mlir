@@ -0,0 +1,20 @@
+isq.defgate @qcis.CZ {definition = [#isq.gatedef<type = "qir", value = @__quantum__qis__cz>]} : !isq.gate<2>
+func.func private @__quantum__qis__cz(!isq.qir.qubit, !isq.qir.qubit)
+isq.declare_qop @__isq__builtin__measure : [1] () -> i1
+
+// Run with: isq-opt --isq-recognize-famous-gates --isq-route-qubits=config=route_qubits.json
+// Expected: error "cannot route qubits: measured qubits cut the operands of a gate apart".
+// On the line Q1-Q2-Q3-Q4, CZ Q1 Q3 would need a SWAP through Q2, which is already measured.
+func.func @__isq__entry() {
+    %Q = memref.alloc() : memref<3x!isq.qstate>
+    %cz = isq.use @qcis.CZ : !isq.gate<2>
+    %0 = affine.load %Q[1] : memref<3x!isq.qstate>
+    %1, %2 = isq.call_qop @__isq__builtin__measure(%0) : [1]()->i1
+    affine.store %1, %Q[1] : memref<3x!isq.qstate>
+    %3 = affine.load %Q[0] : memref<3x!isq.qstate>
+    %4 = affine.load %Q[2] : memref<3x!isq.qstate>
+    %5, %6 = isq.apply %cz(%3, %4) : !isq.gate<2>
+    affine.store %5, %Q[0] : memref<3x!isq.qstate>
+    affine.store %6, %Q[2] : memref<3x!isq.qstate>
+    return
+}
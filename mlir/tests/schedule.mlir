@@ -0,0 +1,48 @@
+isq.defgate @x {definition = [{type = "qir", value = "__quantum__qis__x__body"}]} : !isq.gate<1, hermitian, antidiagonal, symmetric>
+isq.defgate @cz {definition = [{type = "qir", value = "__quantum__qis__cz"}]} : !isq.gate<2, hermitian, diagonal, symmetric>
+isq.defgate @X {definition = [{type = "qir", value = "__quantum__qis__x__body"}]} : !isq.gate<1, hermitian, antidiagonal, symmetric>
+isq.defgate @CZ {definition = [{type = "qir", value = "__quantum__qis__cz"}]} : !isq.gate<2, hermitian, diagonal, symmetric>
+func.func private @__quantum__qis__x__body(!isq.qir.qubit)
+func.func private @__quantum__qis__cz(!isq.qir.qubit, !isq.qir.qubit)
+isq.declare_qop @__isq__builtin__measure : [1] () -> i1
+memref.global @q : memref<3x!isq.qstate> = uninitialized
+
+// Run with: isq-opt --isq-recognize-famous-gates --pass-pipeline="builtin.module(func.func(isq-schedule{tag-layers=true}))" --mlir-pass-statistics
+
+// X(b) CZ(a,b) CZ(a,c): in program order the depth is 3.
+// Both CZs act diagonally on a, so CZ(a,c) moves to layer 0 next to X(b) and the depth becomes 2.
+func.func @commuting_cz(%a: !isq.qstate, %b: !isq.qstate, %c: !isq.qstate)->(!isq.qstate, !isq.qstate, !isq.qstate){
+    %x = isq.use @x : !isq.gate<1, hermitian, antidiagonal, symmetric>
+    %cz = isq.use @cz : !isq.gate<2, hermitian, diagonal, symmetric>
+    %b1 = isq.apply %x(%b) : !isq.gate<1, hermitian, antidiagonal, symmetric>
+    %a1, %b2 = isq.apply %cz(%a, %b1) : !isq.gate<2, hermitian, diagonal, symmetric>
+    %a2, %c1 = isq.apply %cz(%a1, %c) : !isq.gate<2, hermitian, diagonal, symmetric>
+    return %a2, %b2, %c1 : !isq.qstate, !isq.qstate, !isq.qstate
+}
+
+// Run with: isq-opt --pass-pipeline="builtin.module(func.func(isq-schedule{tag-layers=true}))" --target=qcis
+// Expected: the same circuit on Q1 Q2 Q3, emitted by layer. M Q3 only follows CZ Q1 Q3, so it joins layer 1:
+// X Q2
+// CZ Q1 Q3
+// CZ Q1 Q2
+// M Q3
+// M Q1
+// M Q2
+func.func @__isq__main(){
+    %q = memref.get_global @q : memref<3x!isq.qstate>
+    %x = isq.use @X : !isq.gate<1, hermitian, antidiagonal, symmetric>
+    %cz = isq.use @CZ : !isq.gate<2, hermitian, diagonal, symmetric>
+    %a = affine.load %q[0] : memref<3x!isq.qstate>
+    %b = affine.load %q[1] : memref<3x!isq.qstate>
+    %c = affine.load %q[2] : memref<3x!isq.qstate>
+    %b1 = isq.apply %x(%b) : !isq.gate<1, hermitian, antidiagonal, symmetric>
+    %a1, %b2 = isq.apply %cz(%a, %b1) : !isq.gate<2, hermitian, diagonal, symmetric>
+    %a2, %c1 = isq.apply %cz(%a1, %c) : !isq.gate<2, hermitian, diagonal, symmetric>
+    %a3, %ma = isq.call_qop @__isq__builtin__measure(%a2) : [1]()->i1
+    %b3, %mb = isq.call_qop @__isq__builtin__measure(%b2) : [1]()->i1
+    %c2, %mc = isq.call_qop @__isq__builtin__measure(%c1) : [1]()->i1
+    affine.store %a3, %q[0] : memref<3x!isq.qstate>
+    affine.store %b3, %q[1] : memref<3x!isq.qstate>
+    affine.store %c2, %q[2] : memref<3x!isq.qstate>
+    return
+}
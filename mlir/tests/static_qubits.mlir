@@ -0,0 +1,46 @@
+isq.defgate @h {definition = [{type = "qir", value = "__quantum__qis__h__body"}]} : !isq.gate<1, hermitian, symmetric>
+isq.defgate @cnot {definition = [{type = "qir", value = "__quantum__qis__cnot"}]} : !isq.gate<2, hermitian>
+func.func private @__quantum__qis__h__body(!isq.qir.qubit)
+func.func private @__quantum__qis__cnot(!isq.qir.qubit, !isq.qir.qubit)
+isq.declare_qop @__isq__builtin__measure : [1]()->i1
+
+memref.global @q : memref<2x!isq.qstate> = uninitialized
+memref.global @r : memref<2x!isq.qstate> = uninitialized
+
+// Run with: isq-opt --pass-pipeline="builtin.module(isq-lower-to-qir-rep{static-qubits=1},cse,canonicalize,isq-lower-qir-rep-to-llvm)" --mlir-pass-statistics
+// Expected: 4 static-qubits. @q gets IDs 0-1 and %a gets IDs 2-3, all accessed by `llvm.inttoptr` of constants.
+// __isq__global_initialize allocates 4 qubits before the loop for @r, and __isq__global_finalize releases them.
+// @r keeps its array: it is indexed by a function argument in @flip.
+func.func @flip(%i: index){
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %r = memref.get_global @r : memref<2x!isq.qstate>
+    %0 = memref.load %r[%i] : memref<2x!isq.qstate>
+    %1 = isq.apply %h(%0) : !isq.gate<1, hermitian, symmetric>
+    memref.store %1, %r[%i] : memref<2x!isq.qstate>
+    return
+}
+func.func @__isq__main() -> i1{
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %cnot = isq.use @cnot : !isq.gate<2, hermitian>
+    %c0 = arith.constant 0 : index
+    %c1 = arith.constant 1 : index
+    %q = memref.get_global @q : memref<2x!isq.qstate>
+    %a = memref.alloc() : memref<2x!isq.qstate>
+    %q0 = memref.load %q[%c0] : memref<2x!isq.qstate>
+    %q1 = isq.apply %h(%q0) : !isq.gate<1, hermitian, symmetric>
+    %a1 = memref.subview %a[1][1][1] : memref<2x!isq.qstate> to memref<1x!isq.qstate, strided<[1], offset: 1>>
+    %a10 = affine.load %a1[0] : memref<1x!isq.qstate, strided<[1], offset: 1>>
+    %q2, %a11 = isq.apply %cnot(%q1, %a10) : !isq.gate<2, hermitian>
+    %a12, %m = isq.call_qop @__isq__builtin__measure(%a11) : [1]()->i1
+    affine.store %a12, %a1[0] : memref<1x!isq.qstate, strided<[1], offset: 1>>
+    memref.store %q2, %q[%c0] : memref<2x!isq.qstate>
+    func.call @flip(%c1) : (index) -> ()
+    memref.dealloc %a : memref<2x!isq.qstate>
+    return %m : i1
+}
+func.func @__isq__global_initialize(){
+    return
+}
+func.func @__isq__global_finalize(){
+    return
+}
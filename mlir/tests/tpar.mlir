@@ -0,0 +1,56 @@
+isq.defgate @h {definition = [{type = "qir", value = "__quantum__qis__h__body"}]} : !isq.gate<1, hermitian, symmetric>
+isq.defgate @t {definition = [{type = "qir", value = "__quantum__qis__t__body"}]} : !isq.gate<1, diagonal, phase, symmetric>
+isq.defgate @x {definition = [{type = "qir", value = "__quantum__qis__x__body"}]} : !isq.gate<1, hermitian, antidiagonal, symmetric>
+isq.defgate @cnot {definition = [{type = "qir", value = "__quantum__qis__cnot"}]} : !isq.gate<2, hermitian>
+func.func private @__quantum__qis__h__body(!isq.qir.qubit)
+func.func private @__quantum__qis__t__body(!isq.qir.qubit)
+func.func private @__quantum__qis__x__body(!isq.qir.qubit)
+func.func private @__quantum__qis__cnot(!isq.qir.qubit, !isq.qir.qubit)
+
+// Run with: isq-opt --isq-recognize-famous-gates --isq-tpar --canonicalize --mlir-pass-statistics
+// Expected: 6 merged-gates, t-count 15 -> 11, t-depth 13 -> 9.
+// This includes the Toffoli decomposition added by isq-recognize-famous-gates (7 T, depth 5),
+// where the final S and the T-dagger on the same parity of the second qubit become one T.
+
+// T(a) CNOT(a,b) T(b) CNOT(a,b) T(a): the first and last T act on parity a. They become one S at the first T.
+// Expected: S(a) CNOT(a,b) T(b) CNOT(a,b). T-depth 3 -> 1.
+func.func @fold(%a: !isq.qstate, %b: !isq.qstate)->(!isq.qstate, !isq.qstate){
+    %t = isq.use @t : !isq.gate<1, diagonal, phase, symmetric>
+    %cnot = isq.use @cnot : !isq.gate<2, hermitian>
+    %a1 = isq.apply %t(%a) : !isq.gate<1, diagonal, phase, symmetric>
+    %a2, %b1 = isq.apply %cnot(%a1, %b) : !isq.gate<2, hermitian>
+    %b2 = isq.apply %t(%b1) : !isq.gate<1, diagonal, phase, symmetric>
+    %a3, %b3 = isq.apply %cnot(%a2, %b2) : !isq.gate<2, hermitian>
+    %a4 = isq.apply %t(%a3) : !isq.gate<1, diagonal, phase, symmetric>
+    return %a4, %b3 : !isq.qstate, !isq.qstate
+}
+
+// T(a) X(a) T(a) X(a) T†(a), through memory: the middle T acts on parity a^1 and stays.
+// The first T and the T† cancel. Expected: X(a) T(a) X(a). T-depth 3 -> 1.
+func.func @negated(%q: memref<1x!isq.qstate>){
+    %t = isq.use @t : !isq.gate<1, diagonal, phase, symmetric>
+    %tinv = isq.decorate(%t: !isq.gate<1, diagonal, phase, symmetric>) {ctrl = [], adjoint = true} : !isq.gate<1, diagonal, phase, symmetric>
+    %x = isq.use @x : !isq.gate<1, hermitian, antidiagonal, symmetric>
+    %0 = affine.load %q[0] : memref<1x!isq.qstate>
+    %1 = isq.apply %t(%0) : !isq.gate<1, diagonal, phase, symmetric>
+    %2 = isq.apply %x(%1) : !isq.gate<1, hermitian, antidiagonal, symmetric>
+    affine.store %2, %q[0] : memref<1x!isq.qstate>
+    %3 = affine.load %q[0] : memref<1x!isq.qstate>
+    %4 = isq.apply %t(%3) : !isq.gate<1, diagonal, phase, symmetric>
+    %5 = isq.apply %x(%4) : !isq.gate<1, hermitian, antidiagonal, symmetric>
+    affine.store %5, %q[0] : memref<1x!isq.qstate>
+    %6 = affine.load %q[0] : memref<1x!isq.qstate>
+    %7 = isq.apply %tinv(%6) : !isq.gate<1, diagonal, phase, symmetric>
+    affine.store %7, %q[0] : memref<1x!isq.qstate>
+    return
+}
+
+// T(a) H(a) T(a): H gives a fresh variable, so nothing merges.
+func.func @hadamard(%a: !isq.qstate)->!isq.qstate{
+    %t = isq.use @t : !isq.gate<1, diagonal, phase, symmetric>
+    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>
+    %a1 = isq.apply %t(%a) : !isq.gate<1, diagonal, phase, symmetric>
+    %a2 = isq.apply %h(%a1) : !isq.gate<1, hermitian, symmetric>
+    %a3 = isq.apply %t(%a2) : !isq.gate<1, diagonal, phase, symmetric>
+    return %a3 : !isq.qstate
+}
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#include <isq/IR.h>
+#include <isq/utils/DispatchOperation.h>
+
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/Arith/IR/Arith.h"
+#include "mlir/Dialect/ControlFlow/IR/ControlFlow.h"
+#include "mlir/Dialect/Func/IR/FuncOps.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/SCF/IR/SCF.h"
+#include "mlir/IR/Builders.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/MLIRContext.h"
+
+#include "llvm/Support/CommandLine.h"
+
+// Measures OpVisitor dispatch on a block of a million ops, using the op list of the eQASM and OpenQASM 3
+// code generators: once through the TypeID table and once through the dyn_cast chain it replaced.
+
+namespace cl = llvm::cl;
+static cl::opt<int> numOps("n", cl::desc("number of ops to visit"), cl::init(1000000));
+static cl::opt<int> repeat("repeat", cl::desc("runs per visitor; the best is reported"), cl::init(5));
+
+namespace{
+using namespace isq::ir;
+using namespace mlir;
+using namespace mlir::arith;
+using namespace mlir::memref;
+using namespace mlir::scf;
+
+// The previous OpVisitor: tries a dyn_cast for each op type in turn.
+template<typename ... OpTypes> class ChainVisitor{};
+template<> class ChainVisitor<>{
+protected:
+    LogicalResult visitOperation(Operation* op){
+        return visitOp(op);
+    }
+    virtual LogicalResult visitOp(Operation* op){
+        return failure();
+    }
+};
+template<typename CurrOp, typename ...OpTypes>
+class ChainVisitor<CurrOp, OpTypes...>: protected ChainVisitor<OpTypes...>{
+private:
+    using Parent = ChainVisitor<OpTypes...>;
+protected:
+    using Parent::visitOp;
+    virtual LogicalResult visitOp(CurrOp op){
+        return success();
+    }
+    LogicalResult visitOperation(Operation* op){
+        CurrOp wrapped = dyn_cast<CurrOp>(op);
+        if(wrapped){
+            return visitOp(wrapped);
+        }else{
+            return Parent::visitOperation(op);
+        }
+    }
+};
+
+template<template<typename...> class Visitor>
+using CodegenVisitor = Visitor<
+    func::FuncOp, scf::IfOp, scf::ForOp, scf::ExecuteRegionOp,
+    GetGlobalOp, GlobalOp,
+    arith::ConstantOp, arith::ExtUIOp, arith::IndexCastOp, arith::SIToFPOp,
+    memref::AllocOp, memref::DeallocOp, memref::LoadOp, memref::StoreOp, SubViewOp, memref::CastOp, CmpIOp,
+    AddIOp, SubIOp, MulIOp, DivSIOp, RemSIOp, AddFOp, SubFOp, MulFOp, DivFOp, NegFOp, AndIOp,
+    UseGateOp, DecorateOp, ApplyGateOp, CallQOpOp, AccumulateGPhase, DeclareQOpOp, AssertOp,
+    func::CallOp, func::ReturnOp, DefgateOp, scf::WhileOp, ConditionOp,
+    ModuleOp, PassOp, AffineYieldOp, scf::YieldOp,
+    cf::CondBranchOp, cf::BranchOp, AffineLoadOp, AffineStoreOp
+    >;
+
+template<typename Visitor>
+class Counter: public Visitor{
+public:
+    size_t listed = 0, unlisted = 0;
+    LogicalResult visitOp(AddIOp) override{
+        listed++;
+        return success();
+    }
+    LogicalResult visitOp(MulIOp) override{
+        listed++;
+        return success();
+    }
+    LogicalResult visitOp(CmpIOp) override{
+        listed++;
+        return success();
+    }
+    LogicalResult visitOp(Operation*) override{
+        unlisted++;
+        return success();
+    }
+    LogicalResult visitBlock(Block& block){
+        for(auto& op: block){
+            if(failed(this->visitOperation(&op))) return failure();
+        }
+        return success();
+    }
+};
+
+template<typename Visitor>
+double bench(Block& block){
+    double best = 1e30;
+    for(int i = 0; i < repeat; i++){
+        Counter<Visitor> visitor;
+        auto start = std::chrono::steady_clock::now();
+        (void)visitor.visitBlock(block);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+}
+
+int main(int argc, char **argv){
+    cl::ParseCommandLineOptions(argc, argv, "OpVisitor dispatch benchmark\n");
+    MLIRContext context;
+    context.loadDialect<arith::ArithDialect, func::FuncDialect>();
+    auto loc = UnknownLoc::get(&context);
+    auto module = ModuleOp::create(loc);
+    OpBuilder builder(module.getBodyRegion());
+    auto func = builder.create<func::FuncOp>(loc, "bench", builder.getFunctionType({}, {}));
+    auto& block = *func.addEntryBlock();
+    builder.setInsertionPointToStart(&block);
+    // Listed ops at several depths of the list, and an unlisted one that fails every cast of the chain.
+    Value x = builder.create<arith::ConstantIndexOp>(loc, 1);
+    for(int i = 0; i < numOps; i++){
+        switch(i % 4){
+            case 0: x = builder.create<AddIOp>(loc, x, x); break;
+            case 1: x = builder.create<MulIOp>(loc, x, x); break;
+            case 2: x = builder.create<XOrIOp>(loc, x, x); break;
+            default: builder.create<CmpIOp>(loc, CmpIPredicate::slt, x, x); break;
+        }
+    }
+    builder.create<func::ReturnOp>(loc);
+
+    auto ops = block.getOperations().size();
+    auto table = bench<CodegenVisitor<OpVisitor>>(block);
+    auto chain = bench<CodegenVisitor<ChainVisitor>>(block);
+    printf("%-12s%14s%14s\n", "dispatch", "time/s", "ns/op");
+    printf("%-12s%14.4f%14.2f\n", "typeid", table, table * 1e9 / ops);
+    printf("%-12s%14.4f%14.2f\n", "dyn_cast", chain, chain * 1e9 / ops);
+    printf("speedup: %.2f\n", chain / table);
+    module.erase();
+    return 0;
+}
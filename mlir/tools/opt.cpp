@@ -4,6 +4,7 @@
 
 #include "isq/Dialect.h"
 #include <isq/IR.h>
+#include "isq/utils/JsonStream.h"
 
 #include "mlir/Dialect/Affine/Passes.h"
 #include "mlir/ExecutionEngine/ExecutionEngine.h"
@@ -16,6 +17,7 @@
 #include "mlir/Parser/Parser.h"
 #include "mlir/Pass/Pass.h"
 #include "mlir/Pass/PassManager.h"
+#include "mlir/Support/FileUtilities.h"
 #include "mlir/Target/LLVMIR/Dialect/LLVMIR/LLVMToLLVMIRTranslation.h"
 #include "mlir/Target/LLVMIR/Export.h"
 #include "mlir/Transforms/Passes.h"
@@ -27,6 +29,7 @@
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/raw_ostream.h"
 #include <nlohmann/json.hpp>
 
@@ -48,6 +51,12 @@ static cl::opt<std::string> inputFilename(
     cl::init("-"),
     cl::value_desc("filename")
 );
+static cl::opt<std::string> outputFilename(
+    "o",
+    cl::desc("Output filename"),
+    cl::value_desc("filename"),
+    cl::init("-")
+);
 static cl::opt<bool> formatOutput(
     "format-out",
     cl::desc("format output/error through json"),
@@ -69,6 +78,22 @@ static cl::opt<enum BackendType> emitBackend(
 static cl::opt<bool> printAst(
     "printast", cl::desc("print mlir ast."));
 
+static cl::opt<bool> qcisLayers(
+    "qcis-layers", cl::desc("with --target=qcis, group gates into parallel layers separated by empty lines."),
+    cl::init(false));
+
+static cl::opt<bool> qcisBinary(
+    "qcis-binary", cl::desc("with --target=qcis, write compact binary QCIS instead of text."),
+    cl::init(false));
+
+static cl::opt<std::string> qcisTiming(
+    "qcis-timing", cl::desc("with --target=qcis, schedule gates on the QCIS target description in the given file and print them by start time."),
+    cl::value_desc("filename"), cl::init(""));
+
+static cl::opt<int> eqasmRegisters(
+    "eqasm-registers", cl::desc("with --target=eqasm, number of registers given to classical values; 0 keeps them all on the stack."),
+    cl::init(26));
+
 
 struct qLoc{
     std::string source_file;
@@ -101,6 +126,16 @@ int isq_mlir_codegen_main(int argc, char **argv) {
     mlir::registerPassManagerCLOptions();
     mlir::PassPipelineCLParser passPipeline("", "Compiler passes to run");
     cl::ParseCommandLineOptions(argc, argv, "isQ MLIR Dialect Codegen\n");
+
+    // Results and errors are written to the output as they are produced.
+    std::string errorMessage;
+    auto output = mlir::openOutputFile(outputFilename, &errorMessage);
+    if (!output){
+        llvm::errs() << errorMessage << "\n";
+        return 1;
+    }
+    output->keep();
+    auto& out = output->os();
     
     mlir::DiagnosticEngine &engine = context.getDiagEngine();
 
@@ -136,7 +171,7 @@ int isq_mlir_codegen_main(int argc, char **argv) {
     });
 
     if (mlir::failed(res)){
-        llvm::outs() << err.dump();
+        out << err.dump();
         return 0;
     }
 
@@ -144,7 +179,7 @@ int isq_mlir_codegen_main(int argc, char **argv) {
     if (std::error_code EC = fileOrErr.getError()) {
         nlohmann::json ec_err = gen_err_info(qLoc(inputFilename, 0, 0), "FileNotFound", EC.message());
         err["Left"].insert(err["Left"].end(), ec_err);
-        llvm::outs() << err.dump();
+        out << err.dump();
         return 0;
     }
 
@@ -152,52 +187,69 @@ int isq_mlir_codegen_main(int argc, char **argv) {
     sourceMgr.AddNewSourceBuffer(std::move(*fileOrErr), llvm::SMLoc());
     mlir::OwningOpRef<mlir::ModuleOp> module = mlir::parseSourceFile<mlir::ModuleOp>(sourceMgr, &context);
     if (!module) {
-        llvm::outs() << err.dump();
+        out << err.dump();
         //llvm::errs() << "Error: can't load file " << inputFilename << "\n";
         return 0;
     }
 
     auto module_op = module.get();
     if (mlir::failed(pm.run(module_op))){
-        llvm::outs() << err.dump();
+        out << err.dump();
         return 0;
     }
 
 
-    std::string s;
-    llvm::raw_string_ostream os(s);
-
-    if (emitBackend==None){
-        module->print(os);
-    }else if(emitBackend==OpenQASM3){
-        if(failed(isq::ir::generateOpenQASM3Logic(context, module_op, os))){
-            llvm::outs() << err.dump();
-            return 0;
-        }
-    }else if (emitBackend==QCIS){
-        if(failed(isq::ir::generateQCIS(context, module_op, os, printAst))){
-            llvm::outs() << err.dump();
-            return 0;
+    // Backends write straight to the output. With --format-out the text is escaped into the "Right"
+    // string while it is generated, and errors raised on the way are appended as "Left".
+    auto generate = [&](llvm::raw_ostream& os) -> mlir::LogicalResult{
+        if (emitBackend==None){
+            module->print(os);
+            return mlir::success();
+        }else if(emitBackend==OpenQASM3){
+            return isq::ir::generateOpenQASM3Logic(context, module_op, os);
+        }else if (emitBackend==QCIS){
+            return isq::ir::generateQCIS(context, module_op, os, printAst, qcisLayers, qcisBinary, qcisTiming);
+        }else if (emitBackend==EQASM){
+            return isq::ir::generateEQASM(context, module_op, os, printAst, eqasmRegisters);
         }
-    }else if (emitBackend==EQASM){
-        if(failed(isq::ir::generateEQASM(context, module_op, os, printAst))){
-            llvm::outs() << err.dump();
-            return 0;
-        }
-    }else{
         nlohmann::json backend_err = gen_err_info(qLoc("", 0, 0), "BackendError", "Bad backend");
         err["Left"].insert(err["Left"].end(), backend_err);
-        llvm::outs() << err.dump();
+        return mlir::failure();
+    };
+
+    if (formatOutput && qcisBinary){
+        // Binary QCIS is not text, so it cannot be carried in the JSON string.
+        nlohmann::json backend_err = gen_err_info(qLoc("", 0, 0), "BackendError", "--qcis-binary cannot be used with --format-out");
+        err["Left"].insert(err["Left"].end(), backend_err);
+        out << err.dump();
+        return 0;
+    }
+    if (qcisBinary && !qcisTiming.empty()){
+        // Binary QCIS has no start times.
+        nlohmann::json backend_err = gen_err_info(qLoc("", 0, 0), "BackendError", "--qcis-binary cannot be used with --qcis-timing");
+        err["Left"].insert(err["Left"].end(), backend_err);
+        out << err.dump();
         return 0;
     }
-
     if (formatOutput){
-        nlohmann::json out_json = {
-            {"Right", s}
-        };
-        llvm::outs() << out_json.dump();
+        out << "{\"Right\":\"";
+        mlir::LogicalResult result = mlir::success();
+        {
+            isq::ir::JsonStringStream json(out);
+            result = generate(json);
+        }
+        if (failed(result)){
+            out << "\",\"Left\":" << err["Left"].dump() << "}";
+        }else{
+            out << "\"}";
+        }
     }else{
-        llvm::outs() << s;
+        // Plain output is streamed too. A failed backend may leave partial text behind, so the error
+        // goes to stderr with a non-zero exit status.
+        if (failed(generate(out))){
+            llvm::errs() << err.dump() << "\n";
+            return 1;
+        }
     }
     return 0;
 }
@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <isq/IR.h>
+
+#include "mlir/ExecutionEngine/ExecutionEngine.h"
+#include "mlir/ExecutionEngine/OptUtils.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/Parser/Parser.h"
+#include "mlir/Pass/PassManager.h"
+#include "mlir/Pass/PassRegistry.h"
+#include "mlir/Target/LLVMIR/Dialect/Builtin/BuiltinToLLVMIRTranslation.h"
+#include "mlir/Target/LLVMIR/Dialect/LLVMIR/LLVMToLLVMIRTranslation.h"
+#include "mlir/Target/LLVMIR/Export.h"
+
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/CodeGen.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+
+// Runs an optimized isQ program (`isqc compile --emit mlir-optimized`) in-process:
+// the module is lowered to LLVM, linked with the simulator stub and JIT-compiled against
+// libisq_simulator.so, instead of going through llc, lld and the `simulator` binary.
+
+namespace cl = llvm::cl;
+static cl::opt<std::string> inputFilename(
+    cl::Positional,
+    cl::desc("<input file>"),
+    cl::init("-"),
+    cl::value_desc("filename")
+);
+static cl::opt<int64_t> shots(
+    "shots", cl::desc("number of shots"), cl::init(1));
+static cl::list<int64_t> intPar(
+    "i", cl::desc("integer parameter"), cl::ZeroOrMore);
+static cl::list<double> doublePar(
+    "d", cl::desc("double parameter"), cl::ZeroOrMore);
+static cl::opt<int64_t> qubitNum(
+    "qn", cl::desc("qubit capacity of the naive simulator"), cl::init(100));
+static cl::opt<bool> noop(
+    "noop", cl::desc("run on the no-op device instead of the naive simulator"), cl::init(false));
+static cl::opt<bool> staticQubits(
+    "static-qubits", cl::desc("lower with isq-lower-to-qir-rep{static-qubits=1}"), cl::init(false));
+static cl::opt<unsigned> optLevel(
+    "O", cl::desc("LLVM optimization level"), cl::Prefix, cl::init(3));
+static cl::opt<std::string> stubPath(
+    "stub", cl::desc("simulator stub (default: $ISQ_ROOT/share/isq-simulator/isq-simulator.bc)"), cl::init(""));
+static cl::opt<std::string> runtimePath(
+    "runtime", cl::desc("simulator runtime (default: $ISQ_ROOT/share/isq-simulator/libisq_simulator.so)"), cl::init(""));
+static cl::opt<bool> reportTime(
+    "report-time", cl::desc("print compile time and time to first shot to stderr"), cl::init(false));
+
+// Same as the QIR pipeline of isqc (`llvm_flags` in isqc/src/main.rs), without global-thread-local:
+// there is only one rank. Keep the two in sync.
+static const char* LOWER_TO_LLVM = "builtin.module(cse,isq-remove-gphase,lower-affine,{0},cse,canonicalize,func.func(convert-math-to-llvm),arith-expand,expand-strided-metadata,memref-expand,convert-math-to-funcs,isq-lower-qir-rep-to-llvm,canonicalize,cse,symbol-dce,llvm-legalize-for-export)";
+
+// Must match `facades::qir::embed` in the simulator.
+using BeginShot = bool (*)(int64_t device, int64_t qn);
+using EndShot = size_t (*)(char* result, size_t capacity);
+static const size_t SHOT_FAILED = SIZE_MAX;
+using Entry = void (*)(const int64_t*, const int64_t*, int64_t, int64_t, int64_t,
+                       const double*, const double*, int64_t, int64_t, int64_t,
+                       int64_t);
+
+static std::string sharePath(const std::string& given, const char* name){
+    if(!given.empty()) return given;
+    const char* root = std::getenv("ISQ_ROOT");
+    return std::string(root ? root : ".") + "/share/isq-simulator/" + name;
+}
+
+int isq_mlir_run_main(int argc, char **argv) {
+    mlir::DialectRegistry registry;
+    isq::ir::ISQToolsInitialize(registry);
+    mlir::registerBuiltinDialectTranslation(registry);
+    mlir::registerLLVMDialectTranslation(registry);
+    mlir::MLIRContext context(registry);
+    mlir::registerPassManagerCLOptions();
+    cl::ParseCommandLineOptions(argc, argv, "isQ in-process JIT runner\n");
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    auto start = std::chrono::steady_clock::now();
+    auto seconds = [&](){
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    std::string runtime = sharePath(runtimePath, "libisq_simulator.so");
+    std::string err_msg;
+    if(llvm::sys::DynamicLibrary::LoadLibraryPermanently(runtime.c_str(), &err_msg)){
+        llvm::errs() << "Error: can't load runtime " << runtime << ": " << err_msg << "\n";
+        return 1;
+    }
+    auto begin_shot = (BeginShot)llvm::sys::DynamicLibrary::SearchForAddressOfSymbol("isq_simulator_begin_shot");
+    auto end_shot = (EndShot)llvm::sys::DynamicLibrary::SearchForAddressOfSymbol("isq_simulator_end_shot");
+    if(!begin_shot || !end_shot){
+        llvm::errs() << "Error: " << runtime << " is not an isQ simulator runtime\n";
+        return 1;
+    }
+
+    llvm::SourceMgr sourceMgr;
+    auto fileOrErr = llvm::MemoryBuffer::getFileOrSTDIN(inputFilename);
+    if(std::error_code EC = fileOrErr.getError()){
+        llvm::errs() << "Error: can't load file " << inputFilename << ": " << EC.message() << "\n";
+        return 1;
+    }
+    sourceMgr.AddNewSourceBuffer(std::move(*fileOrErr), llvm::SMLoc());
+    mlir::OwningOpRef<mlir::ModuleOp> module = mlir::parseSourceFile<mlir::ModuleOp>(sourceMgr, &context);
+    if(!module) return 1;
+
+    mlir::PassManager pm(&context, mlir::OpPassManager::Nesting::Implicit);
+    mlir::applyPassManagerCLOptions(pm);
+    auto pipeline = llvm::formatv(LOWER_TO_LLVM, staticQubits ? "isq-lower-to-qir-rep{static-qubits=1}" : "isq-lower-to-qir-rep").str();
+    if(mlir::failed(mlir::parsePassPipeline(pipeline, pm, llvm::errs())) || mlir::failed(pm.run(*module))){
+        return 1;
+    }
+
+    std::string stub = sharePath(stubPath, "isq-simulator.bc");
+    auto build_module = [&](mlir::Operation* op, llvm::LLVMContext& llvm_ctx) -> std::unique_ptr<llvm::Module>{
+        auto llvm_module = mlir::translateModuleToLLVMIR(op, llvm_ctx, "isq");
+        llvm::SMDiagnostic diag;
+        auto stub_module = llvm::parseIRFile(stub, diag, llvm_ctx);
+        if(!llvm_module || !stub_module || llvm::Linker::linkModules(*llvm_module, std::move(stub_module))){
+            if(!stub_module) diag.print("isq-run", llvm::errs());
+            return nullptr;
+        }
+        return llvm_module;
+    };
+    auto transformer = mlir::makeOptimizingTransformer(optLevel, 0, nullptr);
+    mlir::ExecutionEngineOptions options;
+    options.llvmModuleBuilder = build_module;
+    options.transformer = transformer;
+    options.jitCodeGenOptLevel = llvm::CodeGenOpt::Level(std::min(optLevel.getValue(), 3u));
+    llvm::SmallVector<llvm::StringRef, 1> libs{runtime};
+    options.sharedLibPaths = libs;
+    auto engine = mlir::ExecutionEngine::create(*module, options);
+    if(!engine){
+        llvm::errs() << "Error: " << llvm::toString(engine.takeError()) << "\n";
+        return 1;
+    }
+    auto entry = (*engine)->lookup("__isq__entry");
+    if(!entry){
+        llvm::errs() << "Error: " << llvm::toString(entry.takeError()) << "\n";
+        return 1;
+    }
+    auto proc = (Entry)*entry;
+    double compile_time = seconds();
+
+    std::vector<int64_t> par_int(intPar.begin(), intPar.end());
+    std::vector<double> par_double(doublePar.begin(), doublePar.end());
+    std::map<std::string, int64_t> res_map;
+    std::string res(64, '\0');
+    for(int64_t i = 0; i < shots; i++){
+        if(!begin_shot(noop ? 1 : 0, qubitNum)){
+            llvm::errs() << "Error: bad device\n";
+            return 1;
+        }
+        proc(par_int.data(), par_int.data(), 0, par_int.size(), 1,
+             par_double.data(), par_double.data(), 0, par_double.size(), 1, 0);
+        size_t len = end_shot(res.data(), res.size());
+        if(len == SHOT_FAILED){
+            llvm::errs() << "Error: shot " << i << " leaked resources\n";
+            return 1;
+        }
+        if(len > res.size()){
+            // Reading the result again is harmless.
+            res.resize(len);
+            end_shot(res.data(), res.size());
+        }
+        res_map[res.substr(0, len)]++;
+        if(i == 0 && reportTime){
+            llvm::errs() << llvm::formatv("compile: {0:f3}s, first shot: {1:f3}s\n", compile_time, seconds());
+        }
+    }
+    if(reportTime){
+        llvm::errs() << llvm::formatv("total: {0:f3}s for {1} shots\n", seconds(), shots.getValue());
+    }
+    // Same format as the `simulator` binary.
+    llvm::outs() << "{";
+    bool first = true;
+    for(auto& [k, v] : res_map){
+        if(!first) llvm::outs() << ", ";
+        first = false;
+        llvm::outs() << "\"" << k << "\": " << v;
+    }
+    llvm::outs() << "}\n";
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    return isq_mlir_run_main(argc, argv);
+}
@@ -0,0 +1,48 @@
+#!/usr/bin/env python
+# Measures the OpenQASM 3 and eQASM generators of isq-opt on a large unrolled program, optionally against a baseline.
+# bench-codegen.py [isq-opt] [baseline isq-opt|-] [gates]
+# The program applies H to each qubit of a register in turn, each gate on its own subview, so the generators'
+# per-value tables hold several entries per gate.
+import os
+import tempfile
+from benchlib import Table, arg, timed
+
+TARGETS = ["openqasm3", "eqasm"]
+
+def program(gates, qubits=64):
+    lines = [
+        'isq.defgate @h {definition = [{type = "qir", value = "__quantum__qis__h__body"}]} : !isq.gate<1, hermitian, symmetric>',
+        "func.func private @__quantum__qis__h__body(!isq.qir.qubit)",
+        "memref.global @q : memref<{}x!isq.qstate> = uninitialized".format(qubits),
+        "func.func @__isq__main(){",
+        "    %q = memref.get_global @q : memref<{}x!isq.qstate>".format(qubits),
+        "    %h = isq.use @h : !isq.gate<1, hermitian, symmetric>",
+    ]
+    view = "memref<1x!isq.qstate, affine_map<(d0)[s0]->(d0+s0)>>"
+    for i in range(gates):
+        lines += [
+            "    %c{} = arith.constant {} : index".format(i, i % qubits),
+            "    %s{} = memref.subview %q[%c{}][1][1] : memref<{}x!isq.qstate> to {}".format(i, i, qubits, view),
+            "    %a{} = affine.load %s{}[0] : {}".format(i, i, view),
+            "    %b{} = isq.apply %h(%a{}) : !isq.gate<1, hermitian, symmetric>".format(i, i),
+            "    affine.store %b{}, %s{}[0] : {}".format(i, i, view),
+        ]
+    lines += ["    return", "}"]
+    return "\n".join(lines) + "\n"
+
+def main():
+    isq_opt = arg(1, "isq-opt")
+    baseline = arg(2)
+    gates = int(arg(3, 100000))
+    table = Table([("target", 12, ""), ("gates", 10, ""), ("time/s", 14, ".3f"), ("gates/s", 16, ".0f"), ("baseline/s", 14, ".3f"), ("speedup", 16, ".2f")])
+    with tempfile.TemporaryDirectory() as tmp:
+        mlir = os.path.join(tmp, "unrolled.mlir")
+        with open(mlir, "w") as f:
+            f.write(program(gates))
+        for target in TARGETS:
+            t = timed([isq_opt, "--target=" + target, mlir], repeat=3)
+            b = timed([baseline, "--target=" + target, mlir], repeat=3) if baseline else None
+            table.row(target, gates, t, gates / t, b, b / t if b else None)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,41 @@
+#!/usr/bin/env python
+# Measures simulated gates per second with the regular and the batched simulator stub.
+# bench-gates.py [isqc] [examples/bench]
+# Every program is compiled twice, with and without `--batch-gates`, and run once on the naive simulator.
+import os
+import subprocess
+import tempfile
+from benchlib import Table, arg, ghz_size, programs, timed
+
+# Dynamic gate counts of the benchmark programs, measurements excluded.
+def gate_count(name):
+    size = ghz_size(name)
+    if size:
+        # H and n-1 CNOTs per round.
+        return size[0] * size[1]
+    if name == "gates-loop.isq":
+        return 3 * 1000000
+    return None
+
+def run(isqc, source, output, batch):
+    args = [isqc, "compile", source, "-o", output]
+    if batch:
+        args.append("--batch-gates")
+    subprocess.run(args, check=True)
+    return timed([isqc, "simulate", output])
+
+def main():
+    isqc = arg(1, "isqc")
+    table = Table([("program", 16, ""), ("gates", 10, ""), ("time/s", 14, ".3f"), ("batched/s", 14, ".3f"), ("gates/s", 16, ".0f"), ("batched gates/s", 16, ".0f")])
+    with tempfile.TemporaryDirectory() as tmp:
+        for name, source in programs(arg(2)):
+            gates = gate_count(name)
+            if gates is None:
+                continue
+            output = os.path.join(tmp, name + ".so")
+            plain = run(isqc, source, output, False)
+            batched = run(isqc, source, output, True)
+            table.row(name, gates, plain, batched, gates / plain, gates / batched)
+
+if __name__ == "__main__":
+    main()
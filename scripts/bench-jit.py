@@ -0,0 +1,30 @@
+#!/usr/bin/env python
+# Measures time to first shot of the regular flow against in-process JIT execution with isq-run.
+# bench-jit.py [isqc] [isq-run] [examples/bench]
+# Regular: `isqc compile` (llc, lld) and `simulator` loading the shared library.
+# JIT: `isqc compile --emit mlir-optimized` and `isq-run` lowering and JIT-compiling the module.
+# Both include the frontend and the isQ optimization pipeline. Every program is run for one shot.
+import os
+import tempfile
+from benchlib import Table, arg, programs, timed
+
+def regular(isqc, source, tmp):
+    output = os.path.join(tmp, "a.so")
+    return timed([isqc, "compile", source, "-o", output], quiet=False) + timed([isqc, "simulate", output])
+
+def jit(isqc, isq_run, source, tmp):
+    output = os.path.join(tmp, "a.opt.mlir")
+    return timed([isqc, "compile", source, "--emit", "mlir-optimized", "-o", output], quiet=False) + timed([isq_run, output])
+
+def main():
+    isqc = arg(1, "isqc")
+    isq_run = arg(2, "isq-run")
+    table = Table([("program", 16, ""), ("regular/s", 14, ".3f"), ("jit/s", 14, ".3f"), ("speedup", 10, ".2f")])
+    with tempfile.TemporaryDirectory() as tmp:
+        for name, source in programs(arg(3)):
+            a = regular(isqc, source, tmp)
+            b = jit(isqc, isq_run, source, tmp)
+            table.row(name, a, b, a / b)
+
+if __name__ == "__main__":
+    main()
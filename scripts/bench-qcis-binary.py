@@ -0,0 +1,78 @@
+#!/usr/bin/env python
+# Compares text and binary QCIS on a generated program: file size and `simulator --qcis` replay time.
+# bench-qcis-binary.py [simulator] [gates] [shots]
+# Measurements are terminal, so the replay time should barely depend on the number of shots.
+# The binary encoding follows simulator/src/sim/qcisbin.rs.
+import os
+import random
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+OPCODES = ["X", "Y", "Z", "H", "S", "SD", "T", "TD", "X2P", "X2M", "Y2P", "Y2M", "CZ", "RX", "RY", "RZ", "RXY", "M"]
+ONE_QUBIT = ["X", "Y", "Z", "H", "S", "SD", "T", "TD", "X2P", "X2M", "Y2P", "Y2M"]
+
+def program(gates, qubits=12, seed=0):
+    rng = random.Random(seed)
+    insts = []
+    for _ in range(gates):
+        kind = rng.random()
+        a = rng.randint(1, qubits)
+        if kind < 0.3:
+            b = rng.choice([q for q in range(1, qubits + 1) if q != a])
+            insts.append(("CZ", [a, b], []))
+        elif kind < 0.4:
+            insts.append((rng.choice(["RX", "RY", "RZ"]), [a], [rng.uniform(-3.14, 3.14)]))
+        else:
+            insts.append((rng.choice(ONE_QUBIT), [a], []))
+    insts.append(("M", list(range(1, qubits + 1)), []))
+    return insts
+
+def text(insts):
+    return "".join(" ".join([op] + ["Q{}".format(q) for q in qubits] + [repr(p) for p in params]) + "\n" for op, qubits, params in insts)
+
+def varint(v):
+    out = bytearray()
+    while True:
+        b = v & 0x7f
+        v >>= 7
+        if v == 0:
+            out.append(b)
+            return out
+        out.append(b | 0x80)
+
+def binary(insts):
+    out = bytearray(b"QCIS\x01")
+    for op, qubits, params in insts:
+        out.append(OPCODES.index(op))
+        if op == "M":
+            out += varint(len(qubits))
+        for q in qubits:
+            out += varint(q)
+        for p in params:
+            out += struct.pack("<d", p)
+    return bytes(out)
+
+def replay(simulator, path, flags, shots):
+    start = time.time()
+    subprocess.run([simulator, path, "--qcis", "--shots", str(shots)] + flags, check=True, capture_output=True)
+    return time.time() - start
+
+def main():
+    simulator = sys.argv[1] if len(sys.argv) > 1 else "simulator"
+    gates = int(sys.argv[2]) if len(sys.argv) > 2 else 1000000
+    shots = int(sys.argv[3]) if len(sys.argv) > 3 else 1
+    insts = program(gates)
+    print("{:<8}{:>14}{:>12}{:>14}".format("format", "size/B", "B/gate", "replay/s"))
+    with tempfile.TemporaryDirectory() as tmp:
+        for name, data, flags in [("text", text(insts).encode(), []), ("binary", binary(insts), ["--qcis-binary"])]:
+            path = os.path.join(tmp, "bench." + name)
+            with open(path, "wb") as f:
+                f.write(data)
+            t = replay(simulator, path, flags, shots)
+            print("{:<8}{:>14}{:>12.2f}{:>14.3f}".format(name, len(data), len(data) / gates, t))
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,32 @@
+#!/usr/bin/env python
+# Measures QCIS generation speed of `isq-opt --target=qcis`, optionally against a baseline build.
+# bench-qcisgen.py [isqc] [isq-opt] [baseline isq-opt|-] [examples/bench]
+# Every ghz program is compiled once to optimized MLIR, which is then lowered to QCIS by each isq-opt.
+import os
+import subprocess
+import tempfile
+from benchlib import Table, arg, ghz_size, programs, timed
+
+# Emitted QCIS lines of the ghz programs, measurements excluded: H, then H CZ H per CNOT, per round.
+def gate_count(name):
+    size = ghz_size(name)
+    return (3 * size[0] - 2) * size[1] if size else None
+
+def main():
+    isqc = arg(1, "isqc")
+    isq_opt = arg(2, "isq-opt")
+    baseline = arg(3)
+    table = Table([("program", 16, ""), ("gates", 10, ""), ("time/s", 14, ".3f"), ("gates/s", 16, ".0f"), ("baseline/s", 14, ".3f"), ("speedup", 16, ".2f")])
+    with tempfile.TemporaryDirectory() as tmp:
+        for name, source in programs(arg(4)):
+            gates = gate_count(name)
+            if gates is None:
+                continue
+            mlir = os.path.join(tmp, name + ".mlir")
+            subprocess.run([isqc, "compile", source, "--target", "qcis", "--emit", "mlir-optimized", "-o", mlir], check=True)
+            t = timed([isq_opt, "--target=qcis", mlir], repeat=3)
+            b = timed([baseline, "--target=qcis", mlir], repeat=3) if baseline else None
+            table.row(name, gates, t, gates / t, b, b / t if b else None)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,106 @@
+#!/usr/bin/env python
+# Compares the native isq-route-qubits pass with the Python SAHS routing plugin.
+# bench-routing.py <path to qcis-routing> [isq-opt]
+# Both routers get the same QCIS circuits on a grid device. Reports SWAP count and wall time of each.
+import json
+import os
+import random
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+def grid(width, height):
+    edges = []
+    for y in range(height):
+        for x in range(width):
+            q = y*width + x + 1
+            if x+1 < width: edges.append([q, q+1])
+            if y+1 < height: edges.append([q, q+width])
+    return edges
+
+def ghz(n):
+    return ["H Q1"] + ["CZ Q{} Q{}".format(i, i+1) for i in range(1, n)]
+
+def all_pairs(n):
+    # QFT-like interaction pattern.
+    return ["CZ Q{} Q{}".format(i, j) for i in range(1, n+1) for j in range(i+1, n+1)]
+
+def random_cz(n, gates, seed):
+    rng = random.Random(seed)
+    lines = []
+    for _ in range(gates):
+        a, b = rng.sample(range(1, n+1), 2)
+        lines.append("H Q{}".format(b))
+        lines.append("CZ Q{} Q{}".format(a, b))
+    return lines
+
+# Same as generate_qcis_program_isqir in simulator/src/devices/qcisgen.rs, without routing.
+def to_isq_mlir(lines, qbit_num):
+    gates = sorted({l.split(" ")[0] for l in lines})
+    qir = {"H": "__quantum__qis__h__body", "CZ": "__quantum__qis__cz", "SWAP": "__quantum__qis__swap"}
+    size = {"H": 1, "CZ": 2, "SWAP": 2}
+    out = []
+    for g in set(gates) | {"SWAP"}:
+        out.append('isq.defgate @qcis.{} {{definition = [#isq.gatedef<type = "qir", value = @{}>]}} : !isq.gate<{}>'.format(g, qir[g], size[g]))
+        out.append("func.func private @{}({})".format(qir[g], ", ".join(["!isq.qir.qubit"]*size[g])))
+    out.append("func.func @__isq__entry() {")
+    out.append("    %Q = memref.alloc() : memref<{}x!isq.qstate>".format(qbit_num))
+    ssa = 0
+    for l in lines:
+        parts = l.split(" ")
+        qs = [int(q[1:])-1 for q in parts[1:]]
+        ins = ["%v{}".format(ssa+i) for i in range(len(qs))]
+        outs = ["%v{}".format(ssa+len(qs)+i) for i in range(len(qs))]
+        use = "%v{}".format(ssa+2*len(qs))
+        ssa += 2*len(qs)+1
+        for q, v in zip(qs, ins):
+            out.append("    {} = affine.load %Q[{}] : memref<{}x!isq.qstate>".format(v, q, qbit_num))
+        out.append("    {} = isq.use @qcis.{} : !isq.gate<{}>".format(use, parts[0], len(qs)))
+        out.append("    {} = isq.apply {}({}) : !isq.gate<{}>".format(", ".join(outs), use, ", ".join(ins), len(qs)))
+        for q, v in zip(qs, outs):
+            out.append("    affine.store {}, %Q[{}] : memref<{}x!isq.qstate>".format(v, q, qbit_num))
+    out.append("    return")
+    out.append("}")
+    return "\n".join(out)
+
+def run_python(plugin, config, lines):
+    data = dict(config)
+    data["qcis"] = "\n".join(lines)
+    start = time.time()
+    out = subprocess.run([plugin], input=json.dumps(data), capture_output=True, text=True, check=True).stdout
+    elapsed = time.time() - start
+    return sum(1 for g in json.loads(out) if g["ty"] == "SWAP"), elapsed
+
+def run_native(isq_opt, config, lines):
+    with tempfile.NamedTemporaryFile("w", suffix=".json", delete=False) as f:
+        json.dump(config, f)
+    try:
+        start = time.time()
+        res = subprocess.run([isq_opt, "--pass-pipeline=builtin.module(isq-recognize-famous-gates,isq-route-qubits{{config={}}})".format(f.name), "--mlir-pass-statistics"],
+            input=to_isq_mlir(lines, config["qbit_num"]), capture_output=True, text=True, check=True)
+        elapsed = time.time() - start
+    finally:
+        os.unlink(f.name)
+    swaps = re.search(r"(\d+)\s+inserted-swaps", res.stderr)
+    return int(swaps.group(1)) if swaps else 0, elapsed
+
+def main():
+    plugin = sys.argv[1]
+    isq_opt = sys.argv[2] if len(sys.argv) > 2 else "isq-opt"
+    cases = []
+    for w, h in [(5, 4), (8, 8), (10, 10)]:
+        n = w*h
+        config = {"qbit_num": n, "topo": grid(w, h), "init_map": "naive"}
+        cases.append(("ghz{}".format(n), config, ghz(n)))
+        cases.append(("allpairs{}".format(min(n, 30)), config, all_pairs(min(n, 30))))
+        cases.append(("random{}".format(n), config, random_cz(n, 10*n, n)))
+    print("{:<14}{:>12}{:>12}{:>14}{:>14}".format("circuit", "swaps(py)", "swaps(c++)", "time(py)/s", "time(c++)/s"))
+    for name, config, lines in cases:
+        py_swaps, py_time = run_python(plugin, config, lines)
+        cc_swaps, cc_time = run_native(isq_opt, config, lines)
+        print("{:<14}{:>12}{:>12}{:>14.3f}{:>14.3f}".format(name, py_swaps, cc_swaps, py_time, cc_time))
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,48 @@
+# Shared helpers of the bench-*.py scripts: positional arguments, the benchmark programs, timing and tables.
+import os
+import re
+import subprocess
+import sys
+import time
+
+BENCH_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "examples", "bench")
+
+# Positional argument `i` (from 1), or `default` if it is missing or "-".
+def arg(i, default=None):
+    if len(sys.argv) > i and sys.argv[i] != "-":
+        return sys.argv[i]
+    return default
+
+# The .isq programs of a benchmark directory, sorted, as (name, path).
+def programs(bench=None):
+    bench = bench or BENCH_DIR
+    return [(name, os.path.join(bench, name)) for name in sorted(os.listdir(bench)) if name.endswith(".isq")]
+
+# Qubits and rounds of a ghz<qubits>-<rounds>.isq program, or None.
+def ghz_size(name):
+    m = re.match(r"ghz(\d+)-(\d+)\.isq$", name)
+    return (int(m.group(1)), int(m.group(2))) if m else None
+
+# Wall time of a command, the best of `repeat` runs. Output is captured unless `quiet` is False.
+def timed(args, repeat=1, quiet=True):
+    best = None
+    for _ in range(repeat):
+        start = time.time()
+        subprocess.run(args, check=True, capture_output=quiet)
+        elapsed = time.time() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+# A fixed-width table. `columns` is a list of (title, width, format); the first column is left-aligned.
+class Table:
+    def __init__(self, columns):
+        self.columns = columns
+        print("".join(self.cell(i, title) for i, (title, _, _) in enumerate(columns)))
+
+    def cell(self, i, text):
+        width = self.columns[i][1]
+        return "{:<{}}".format(text, width) if i == 0 else "{:>{}}".format(text, width)
+
+    # None values are printed as "-".
+    def row(self, *values):
+        print("".join(self.cell(i, "-" if v is None else ("{:" + self.columns[i][2] + "}").format(v)) for i, v in enumerate(values)))
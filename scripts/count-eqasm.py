@@ -0,0 +1,35 @@
+#!/usr/bin/env python
+# Counts the eQASM instructions emitted by `isq-opt --target=eqasm` with and without register allocation.
+# count-eqasm.py [isq-opt] [programs...]
+# Defaults to mlir/tests. Programs the eQASM backend rejects are skipped.
+import glob
+import os
+import subprocess
+import sys
+
+def count(isq_opt, source, registers):
+    result = subprocess.run([isq_opt, "--target=eqasm", "--eqasm-registers={}".format(registers), source], capture_output=True, text=True)
+    # isq-opt reports backend errors as JSON on stdout and still exits with 0.
+    if result.returncode != 0 or result.stdout.startswith('{"Left"'):
+        return None
+    ops = [line.split()[0] for line in result.stdout.splitlines() if line.startswith("  ") and line.strip()]
+    memory = sum(1 for op in ops if op in ("LD", "ST"))
+    return len(ops), memory
+
+def main():
+    isq_opt = sys.argv[1] if len(sys.argv) > 1 else "isq-opt"
+    sources = sys.argv[2:] or sorted(glob.glob(os.path.join(os.path.dirname(__file__), "..", "mlir", "tests", "*.mlir")))
+    print("{:<32}{:>12}{:>12}{:>12}{:>12}".format("program", "insts", "LD/ST", "insts(RA)", "LD/ST(RA)"))
+    total = [0, 0, 0, 0]
+    for source in sources:
+        before = count(isq_opt, source, 0)
+        after = count(isq_opt, source, 26)
+        if before is None or after is None:
+            continue
+        row = [before[0], before[1], after[0], after[1]]
+        total = [t + r for t, r in zip(total, row)]
+        print("{:<32}{:>12}{:>12}{:>12}{:>12}".format(os.path.basename(source), *row))
+    print("{:<32}{:>12}{:>12}{:>12}{:>12}".format("total", *total))
+
+if __name__ == "__main__":
+    main()
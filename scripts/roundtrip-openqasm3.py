@@ -0,0 +1,61 @@
+#!/usr/bin/env python
+# Compiles isQ programs to OpenQASM 3 and parses the output back with the `openqasm3` package.
+# roundtrip-openqasm3.py [isqc] [programs...]
+# Defaults to examples/bench. Also reports the output size against the source size, which should stay
+# proportional now that loops and gate functions are kept.
+# .mlir programs are compiled with isq-opt --target=openqasm3 ($ISQ_OPT, default isq-opt) instead, and every
+# `// Check: <line>` comment in them must also be a line of the output.
+import glob
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+import openqasm3
+
+def compile_mlir(source):
+    isq_opt = os.environ.get("ISQ_OPT", "isq-opt")
+    return subprocess.run([isq_opt, "--target=openqasm3", source], check=True, capture_output=True, text=True).stdout
+
+def missing_checks(source, qasm):
+    with open(source) as f:
+        checks = [line.split("// Check:", 1)[1].strip() for line in f if line.startswith("// Check:")]
+    lines = set(line.strip() for line in qasm.splitlines())
+    return [check for check in checks if check not in lines]
+
+def main():
+    isqc = sys.argv[1] if len(sys.argv) > 1 else "isqc"
+    sources = sys.argv[2:] or sorted(glob.glob(os.path.join(os.path.dirname(__file__), "..", "examples", "bench", "*.isq")))
+    failed = 0
+    print("{:<24}{:>12}{:>12}{:>10}  {}".format("program", "source/B", "qasm/B", "ratio", "parse"))
+    with tempfile.TemporaryDirectory() as tmp:
+        for source in sources:
+            name = os.path.basename(source)
+            if source.endswith(".mlir"):
+                qasm = compile_mlir(source)
+            else:
+                # isqc ignores -o for open-qasm3 and writes <source>.qasm3 next to the source, so compile a copy.
+                copy = os.path.join(tmp, name)
+                shutil.copy(source, copy)
+                subprocess.run([isqc, "compile", copy, "--target", "open-qasm3"], check=True)
+                out = copy[:-4] + ".qasm3"
+                with open(out) as f:
+                    qasm = f.read()
+            try:
+                openqasm3.parse(qasm)
+                status = "ok"
+            except Exception as e:
+                status = "error: {}".format(e)
+                failed += 1
+            if source.endswith(".mlir"):
+                missing = missing_checks(source, qasm)
+                if missing:
+                    status += "; missing: {}".format(" | ".join(missing))
+                    failed += 1
+            size = os.path.getsize(source)
+            print("{:<24}{:>12}{:>12}{:>10.2f}  {}".format(name, size, len(qasm), len(qasm) / size, status))
+    sys.exit(1 if failed else 0)
+
+if __name__ == "__main__":
+    main()
@@ -39,6 +39,8 @@ in
     $src/src/facades/qir/shim/qsharp_core/shim.ll  \
     $src/src/facades/qir/shim/qsharp_foundation/shim.ll \
     $src/src/facades/qir/shim/isq/shim.ll -o $simulator_stub_path
+    ${llvm_tools}/bin/llvm-link $simulator_stub_path --override $src/src/facades/qir/shim/batch/shim.ll \
+    -o $bin/share/isq-simulator/isq-simulator-batched.bc
     echo "#!/usr/bin/env bash" > $bin/bin/isq-simulator-stub
     echo "echo $simulator_stub_path" >> $bin/bin/isq-simulator-stub
     chmod +x $bin/bin/isq-simulator-stub
@@ -1,7 +1,7 @@
 #![feature(panic_info_message)]
 use isq_simulator::{
     devices::{checked::CheckedDevice, naive::NaiveSimulator, sq2u3::SQ2U3Device, noop::NoopDevice},
-    facades::qir::{context::{get_current_context, make_context_current, QIRContext, RANK_REF}}, qdevice::QDevice,
+    facades::qir::{context::{flush_pending_gates, get_current_context, make_context_current, QIRContext, RANK_REF}}, qdevice::QDevice,
 };
 
 #[cfg(feature = "qcis")]
@@ -46,6 +46,9 @@ struct SimulatorArgs {
     noop: bool,
     #[clap(long)]
     qcis: bool,
+    // With --qcis, read binary QCIS; with --qcisgen, write it.
+    #[clap(long)]
+    qcis_binary: bool,
     #[clap(long)]
     shots: Option<i64>,
     #[clap(long)]
@@ -108,6 +111,10 @@ fn main() -> std::io::Result<()> {
         #[cfg(feature = "qcis")]
         {
             let input_path = Path::new(&args.qir_shared_library);
+            if args.qcis_binary{
+                qcis::sim_binary(|| Ok(std::io::BufReader::new(File::open(input_path)?)), shots, args.qn)?;
+                return Ok(());
+            }
             let mut f = File::open(input_path)?;
             let mut buf = String::new();
             f.read_to_string(&mut buf).unwrap();
@@ -156,7 +163,11 @@ fn main() -> std::io::Result<()> {
                 #[cfg(feature = "qcis")]
                 {
                     use isq_simulator::devices::qcisgen::QCISCodegen;
-                    Box::new(CheckedDevice::new(QCISCodegen::new()))
+                    if args.qcis_binary{
+                        Box::new(CheckedDevice::new(QCISCodegen::new_binary()))
+                    }else{
+                        Box::new(CheckedDevice::new(QCISCodegen::new()))
+                    }
                 }
                 
             }else if args.noop{
@@ -203,6 +214,7 @@ fn main() -> std::io::Result<()> {
                     let entrypoint = rx_string.recv().unwrap();
                     let proc = library.get::<SimulatorEntry>(entrypoint.as_bytes()).unwrap();
                     (proc)(par_int_ptr, par_int_ptr, 0, par_int_size, 1, par_double_ptr, par_double_ptr, 0, par_double_size, 1, rank);
+                    flush_pending_gates();
                 });
                 for v in &par_int {
                     tx_int.send(*v).unwrap();
@@ -54,6 +54,20 @@ impl NaiveSimulator {
             .for_each(|x| *x = Complex64::new(0.0, 0.0));
         self.state[0] = Complex64::new(1.0, 0.0);
     }
+    // Probabilities of the outcomes of measuring `qubits` together, leaving the state as it is.
+    // Bit k of an outcome is the value of qubits[k].
+    pub fn probabilities(&self, qubits: &[usize]) -> Vec<f64> {
+        let ids: Vec<usize> = qubits.iter().map(|q| self.qubit_to_state_id(q)).collect();
+        let mut probs = vec![0.0; 1 << qubits.len()];
+        for (i, x) in self.state.iter().enumerate() {
+            let mut outcome = 0;
+            for (k, id) in ids.iter().enumerate() {
+                outcome |= ((i >> id) & 1) << k;
+            }
+            probs[outcome] += x.norm_sqr();
+        }
+        probs
+    }
     // Move a qubit to most-significant bit.
     // This is used to simplify the qubit freeing.
     // TODO: performance test against version without if-then-else.
@@ -3,6 +3,7 @@ use itertools::Itertools;
 use serde::{Serialize, Deserialize};
 
 use crate::qdevice::QDevice;
+use crate::sim::qcisbin::{Encoder, Opcode};
 
 //pub const QCIS_ROUTE_BIN_PATH : Option<&'static str> = option_env!("ISQ_ROOT");
 
@@ -15,7 +16,10 @@ pub fn qcis_route_bin_path()->&'static str{
 #[derive(Serialize, Deserialize)]
 struct QCISImport{
     ty: String,
-    q: Vec<usize>
+    q: Vec<usize>,
+    // Angles of RX, RY and RZ. The routing plugin does not produce them.
+    #[serde(default)]
+    params: Vec<f64>
 }
 
 #[derive(Serialize, Deserialize)]
@@ -44,10 +48,19 @@ fn generate_qcis_program_isqir(config: &QCISConfig, program: &[QCISImport])->Str
         ("Y2P","__quantum__qis__y2p", 1),
         ("SWAP","__quantum__qis__swap", 2),
     ];
+    let rotation_gates = [
+        ("RX","__quantum__qis__rx__body"),
+        ("RY","__quantum__qis__ry__body"),
+        ("RZ","__quantum__qis__rz__body"),
+    ];
     for gate in predefined_gates.iter(){
         lines.push(format!("isq.defgate @qcis.{} {{definition = [#isq.gatedef<type = \"qir\", value = @{}>]}} : !isq.gate<{}>", gate.0, gate.1, gate.2));
         lines.push(format!("func.func private @{}({})", gate.1, (0..gate.2).into_iter().map(|_| "!isq.qir.qubit").join(", ")));
     }
+    for gate in rotation_gates.iter(){
+        lines.push(format!("isq.defgate @qcis.{}(f64) {{definition = [#isq.gatedef<type = \"qir\", value = @{}>]}} : !isq.gate<1>", gate.0, gate.1));
+        lines.push(format!("func.func private @{}(f64, !isq.qir.qubit)", gate.1));
+    }
     let nq = config.qbit_num;
     lines.push("isq.declare_qop @__isq__builtin__measure : [1] () -> i1".to_owned());
     lines.push("func.func @__isq__entry() {".to_owned());
@@ -74,6 +87,18 @@ fn generate_qcis_program_isqir(config: &QCISConfig, program: &[QCISImport])->Str
                 operands.iter().map(|x| format!("%{}", x.1)).join(", "),
                 operands.len()
             ));
+        }else if !inst.params.is_empty(){
+            // Angles are written as the bits of the f64, so they survive exactly.
+            let angle = ssa;
+            ssa+=1;
+            lines.push(format!("    %{} = arith.constant 0x{:016X} : f64", angle, inst.params[0].to_bits()));
+            lines.push(format!("    %{} = isq.use @qcis.{}(%{}) : (f64) -> !isq.gate<{}>", use_gate, inst.ty, angle, operands.len()));
+            lines.push(format!("    {} = isq.apply %{}({}) : !isq.gate<{}>",
+                operands.iter().map(|x| format!("%{}", x.2)).join(", "),
+                use_gate,
+                operands.iter().map(|x| format!("%{}", x.1)).join(", "),
+                operands.len()
+            ));
         }else{
             lines.push(format!("    %{} = isq.use @qcis.{} : !isq.gate<{}>", use_gate, inst.ty, operands.len()));
             lines.push(format!("    {} = isq.apply %{}({}) : !isq.gate<{}>",
@@ -105,6 +130,29 @@ pub fn run_qcis_route(code: String)->String{
         config_file.read_to_string(&mut config).expect("qcis read failed");
         drop(config_file);
         let mut config_json = serde_json::from_str::<QCISConfig>(&config).expect("qcis json parse failed of schema invalid");
+        if std::env::var("QCIS_ROUTE_NATIVE").map(|x| x!="0").unwrap_or(false){
+            // Leave routing to `isq-opt --isq-route-qubits=config=<config>`.
+            // Generated qubits count from 0, while the program (like the plugin output) counts from 1.
+            let qcis_program : Vec<QCISImport> = code.lines().filter(|x| !x.is_empty()).map(|line|{
+                let mut parts = line.split_whitespace();
+                let ty = match parts.next().unwrap(){
+                    "SD" => "Sinv",
+                    "TD" => "Tinv",
+                    ty => ty
+                }.to_owned();
+                let mut q = vec![];
+                let mut params = vec![];
+                for part in parts{
+                    if let Some(n) = part.strip_prefix('Q'){
+                        q.push(n.parse::<usize>().expect("bad qcis qubit") + 1);
+                    }else{
+                        params.push(part.parse::<f64>().expect("bad qcis parameter"));
+                    }
+                }
+                QCISImport{ty, q, params}
+            }).collect();
+            return generate_qcis_program_isqir(&config_json, &qcis_program);
+        }
         config_json.qcis = Some(code);
         let input = serde_json::to_string(&config_json).expect("internal qcis error");
         let qcis_root_bin = qcis_route_bin_path();
@@ -136,24 +184,53 @@ pub struct QCISCodegen{
     qcis_qubit_counter: usize,
     finalized: bool,
     generated_code: Vec<String>,
-    measured_qubits: Vec<usize>
+    measured_qubits: Vec<usize>,
+    // With `--qcis-binary`, instructions are encoded as they are generated instead of kept as text.
+    binary: Option<Encoder<Vec<u8>>>
 }
 
 impl QCISCodegen{
     pub fn new()->Self{
-        Self{qcis_qubit_counter: 0, finalized: false, generated_code: vec![], measured_qubits: vec![]}
+        Self{qcis_qubit_counter: 0, finalized: false, generated_code: vec![], measured_qubits: vec![], binary: None}
+    }
+    pub fn new_binary()->Self{
+        let mut codegen = Self::new();
+        codegen.binary = Some(Encoder::new(Vec::new()).expect("internal qcis error"));
+        codegen
     }
     pub fn append_op(&mut self, op: &str, args: &[&usize]){
-        let args_separated = args.iter().map(|x| {
+        for x in args.iter(){
             if self.measured_qubits.contains(x){
                 panic!("measured qubit Q{} cannot be used again", x)
             }
-            format!("Q{}", x)
-        }).join(" ");
-        self.generated_code.push(format!("{} {}", op, args_separated));
+        }
+        self.append_param_op(op, args, &[]);
+    }
+    fn append_param_op(&mut self, op: &str, args: &[&usize], parameters: &[f64]){
+        if let Some(encoder) = &mut self.binary{
+            let qubits: Vec<usize> = args.iter().map(|x| **x).collect();
+            encoder.inst(Opcode::from_name(op).unwrap(), &qubits, parameters).expect("internal qcis error");
+            return;
+        }
+        let args_separated = args.iter().map(|x| format!("Q{}", x)).join(" ");
+        if parameters.is_empty(){
+            self.generated_code.push(format!("{} {}", op, args_separated));
+        }else{
+            self.generated_code.push(format!("{} {} {}", op, args_separated, parameters.iter().join(" ")));
+        }
     }
     pub fn finalize_route(&mut self){
         extern crate std;
+        if let Some(encoder) = self.binary.take(){
+            use std::io::Write;
+            if std::env::var("QCIS_ROUTE_CONFIG").is_ok(){
+                panic!("binary qcis output cannot be routed");
+            }
+            let mut stdout = std::io::stdout();
+            stdout.write_all(&encoder.into_inner()).expect("failed to write qcis");
+            stdout.flush().expect("failed to write qcis");
+            return;
+        }
         let output = run_qcis_route(self.generated_code.join("\n"));
         std::println!("{}", output);
     }
@@ -213,10 +290,7 @@ impl QDevice for QCISCodegen{
             _ => panic!("bad op type {:?}", op_type)
         };
         match op_name {
-            "RX" | "RY" | "RZ" => {
-                let args_separated = qubits.iter().map(|x| format!("Q{}", x)).join(" ");
-                self.generated_code.push(format!("{} {} {}", op_name, args_separated, parameters[0]))
-            }
+            "RX" | "RY" | "RZ" => self.append_param_op(op_name, qubits, &parameters[..1]),
             _ => self.append_op(op_name, qubits)
         }
     }
@@ -240,6 +314,11 @@ impl QDevice for QCISCodegen{
             Rx=>"RX", Ry=>"RY", Rz=>"RZ",
             _ => panic!("bad op type {:?}", op_type)
         };
+        if self.binary.is_some(){
+            let parameter = parameters.parse::<f64>().expect("binary qcis needs numeric parameters");
+            self.append_param_op(op_name, qubits, &[parameter]);
+            return;
+        }
         let args_separated = qubits.iter().map(|x| format!("Q{}", x)).join(" ");
         self.generated_code.push(format!("{} {} {}", op_name, args_separated, parameters));
         return;
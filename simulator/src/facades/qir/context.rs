@@ -13,6 +13,7 @@ use crate::qdevice::QDevice;
 
 use super::resource::ResourceManagerExt;
 use super::resource::ResourceMap;
+use super::shim::batch::drain_gate_batch;
 use super::shim::qsharp_foundation::types::QIRArray;
 pub struct QIRContext {
     device: Box<dyn QDevice<Qubit = usize>>,
@@ -95,12 +96,20 @@ pub fn make_context_current(a: Arc<Mutex<QIRContext>>) {
 }
 
 pub fn get_current_context() -> Arc<Mutex<QIRContext>> {
-    unsafe {
+    let context = unsafe {
         QIR_CURRENT_CONTEXT
             .as_ref()
             .expect("No QIR context made current")
             .clone()
-    }
+    };
+    // Gates batched by the program must reach the device before anything else does.
+    drain_gate_batch(&context);
+    context
+}
+
+// Drains gates batched by the current thread. Called when the program returns.
+pub fn flush_pending_gates() {
+    get_current_context();
 }
 
 thread_local! {
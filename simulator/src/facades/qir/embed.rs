@@ -0,0 +1,60 @@
+// C interface for hosts that run a QIR program in their own process instead of through the `simulator` binary,
+// e.g. `isq-run`, which JIT-compiles the program against `libisq_simulator.so`.
+// A shot is `isq_simulator_begin_shot`, a call to the program entry and `isq_simulator_end_shot`.
+extern crate std;
+use alloc::boxed::Box;
+use alloc::sync::Arc;
+use std::println;
+use std::sync::Mutex;
+
+use crate::devices::{checked::CheckedDevice, naive::NaiveSimulator, noop::NoopDevice, sq2u3::SQ2U3Device};
+use crate::qdevice::QDevice;
+
+use super::context::{flush_pending_gates, get_current_context, make_context_current, QIRContext};
+
+pub const ISQ_SIMULATOR_NAIVE: i64 = 0;
+pub const ISQ_SIMULATOR_NOOP: i64 = 1;
+
+// Makes a fresh context current. Returns false for an unknown device.
+#[no_mangle]
+pub extern "C" fn isq_simulator_begin_shot(device: i64, qn: i64) -> bool {
+    let device: Box<dyn QDevice<Qubit = usize>> = match device {
+        ISQ_SIMULATOR_NAIVE => Box::new(CheckedDevice::new(SQ2U3Device::new(NaiveSimulator::new(qn as usize)))),
+        ISQ_SIMULATOR_NOOP => Box::new(CheckedDevice::new(SQ2U3Device::new(NoopDevice::new()))),
+        _ => return false,
+    };
+    let context = QIRContext::new(
+        device,
+        Box::new(|s| {
+            println!("{}", s);
+        }),
+        1,
+    );
+    make_context_current(Arc::new(Mutex::new(context)));
+    true
+}
+
+// Copies the measurement result of the shot into `result`, truncated to `capacity` bytes,
+// and returns its full length. Returns `ISQ_SIMULATOR_SHOT_FAILED` if the shot leaked resources:
+// `leak_check` panics, and a panic must not unwind across `extern "C"`.
+pub const ISQ_SIMULATOR_SHOT_FAILED: usize = usize::MAX;
+#[no_mangle]
+pub extern "C" fn isq_simulator_end_shot(result: *mut u8, capacity: usize) -> usize {
+    let shot = std::panic::catch_unwind(|| {
+        flush_pending_gates();
+        let ctx_ = get_current_context();
+        let mut ctx = ctx_.lock().unwrap();
+        let r = ctx.get_device_mut().get_measure_res();
+        ctx.get_classical_resource_manager().leak_check();
+        r
+    });
+    let r = match shot {
+        Ok(r) => r,
+        Err(_) => return ISQ_SIMULATOR_SHOT_FAILED,
+    };
+    let n = core::cmp::min(r.len(), capacity);
+    unsafe {
+        core::ptr::copy_nonoverlapping(r.as_ptr(), result, n);
+    }
+    r.len()
+}
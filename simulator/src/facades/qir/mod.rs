@@ -25,6 +25,7 @@ pub mod array;
 pub mod bigint;
 pub mod callable;
 pub mod context;
+pub mod embed;
 pub mod resource;
 mod shim;
 pub mod string;
@@ -0,0 +1,71 @@
+// Gate batching for programs linked against `isq-simulator-batched.bc` (see `shim.ll`).
+// Non-controlled gates are appended by the program itself to a per-thread buffer owned by the simulator,
+// without taking the context lock. The buffer is drained under a single lock when it is full,
+// and before any other shim gets the context, so the device sees gates in program order.
+extern crate std;
+use core::cell::UnsafeCell;
+use std::sync::Mutex;
+use std::thread_local;
+
+use crate::devices::qdevice::QuantumOp::{self, *};
+use crate::facades::qir::context::QIRContext;
+
+// Must match `shim.ll`.
+pub const GATE_BATCH_CAPACITY: usize = 256;
+const BATCHED_OPS: [QuantumOp; 18] = [
+    X, Y, Z, H, S, SInv, T, TInv, X2P, X2M, Y2P, Y2M, CNOT, CZ, Rz, U3, Rx, Ry,
+];
+
+#[repr(C)]
+#[derive(Copy, Clone)]
+pub struct GateRecord {
+    op: i64,
+    q0: usize,
+    q1: usize,
+    params: [f64; 3],
+}
+
+#[repr(C)]
+pub struct GateBatch {
+    len: i64,
+    gates: [GateRecord; GATE_BATCH_CAPACITY],
+}
+
+thread_local! {
+    static GATE_BATCH: UnsafeCell<GateBatch> = UnsafeCell::new(GateBatch {
+        len: 0,
+        gates: [GateRecord { op: 0, q0: 0, q1: 0, params: [0.0; 3] }; GATE_BATCH_CAPACITY],
+    });
+}
+
+pub fn drain_gate_batch(context: &Mutex<QIRContext>) {
+    GATE_BATCH.with(|batch| {
+        let batch = unsafe { &mut *batch.get() };
+        if batch.len == 0 {
+            return;
+        }
+        let mut ctx = context.lock().unwrap();
+        let device = ctx.get_device_mut();
+        for gate in batch.gates[..batch.len as usize].iter() {
+            let op = BATCHED_OPS[gate.op as usize];
+            let params = &gate.params[..op.get_parameter_count()];
+            if op.get_qubit_count() == 1 {
+                device.controlled_qop(op, &[], &[&gate.q0], params);
+            } else {
+                device.controlled_qop(op, &[], &[&gate.q0, &gate.q1], params);
+            }
+        }
+        batch.len = 0;
+    });
+}
+
+#[no_mangle]
+pub extern "C" fn __isq__qir__shim__gate_batch() -> *mut i8 {
+    GATE_BATCH.with(|batch| batch.get() as *mut i8)
+}
+
+#[no_mangle]
+pub extern "C" fn __isq__qir__shim__gate_flush() -> () {
+    trace!("calling __isq__qir__shim__gate_flush()");
+    super::super::context::flush_pending_gates();
+}
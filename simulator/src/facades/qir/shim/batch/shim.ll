@@ -0,0 +1,142 @@
+; Batched gate shims. Linked with `llvm-link --override` over the other shims to form isq-simulator-batched.bc.
+; Each gate is written into the simulator-owned buffer of the calling thread (see mod.rs) instead of
+; calling into the simulator, which would lock the context and dispatch on every gate.
+%Qubit = type opaque
+%GateRecord = type { i64, i64, i64, [3 x double] }
+%GateBatch = type { i64, [256 x %GateRecord] }
+
+@__isq__gate_batch = internal thread_local(localdynamic) global %GateBatch* null
+
+declare dllimport i8* @__isq__qir__shim__gate_batch()
+declare dllimport void @__isq__qir__shim__gate_flush()
+
+define internal void @__isq__gate_batch_push (i64 %op, %Qubit* %q0, %Qubit* %q1, double %p0, double %p1, double %p2) alwaysinline {
+entry:
+    %x0 = load %GateBatch*, %GateBatch** @__isq__gate_batch
+    %x1 = icmp eq %GateBatch* %x0, null
+    br i1 %x1, label %fetch, label %push
+fetch:
+    %x2 = call i8* @__isq__qir__shim__gate_batch()
+    %x3 = bitcast i8* %x2 to %GateBatch*
+    store %GateBatch* %x3, %GateBatch** @__isq__gate_batch
+    br label %push
+push:
+    %batch = phi %GateBatch* [%x0, %entry], [%x3, %fetch]
+    %len_ptr = getelementptr inbounds %GateBatch, %GateBatch* %batch, i64 0, i32 0
+    %len = load i64, i64* %len_ptr
+    %op_ptr = getelementptr inbounds %GateBatch, %GateBatch* %batch, i64 0, i32 1, i64 %len, i32 0
+    %q0_ptr = getelementptr inbounds %GateBatch, %GateBatch* %batch, i64 0, i32 1, i64 %len, i32 1
+    %q1_ptr = getelementptr inbounds %GateBatch, %GateBatch* %batch, i64 0, i32 1, i64 %len, i32 2
+    %p0_ptr = getelementptr inbounds %GateBatch, %GateBatch* %batch, i64 0, i32 1, i64 %len, i32 3, i64 0
+    %p1_ptr = getelementptr inbounds %GateBatch, %GateBatch* %batch, i64 0, i32 1, i64 %len, i32 3, i64 1
+    %p2_ptr = getelementptr inbounds %GateBatch, %GateBatch* %batch, i64 0, i32 1, i64 %len, i32 3, i64 2
+    %q0_key = ptrtoint %Qubit* %q0 to i64
+    %q1_key = ptrtoint %Qubit* %q1 to i64
+    store i64 %op, i64* %op_ptr
+    store i64 %q0_key, i64* %q0_ptr
+    store i64 %q1_key, i64* %q1_ptr
+    store double %p0, double* %p0_ptr
+    store double %p1, double* %p1_ptr
+    store double %p2, double* %p2_ptr
+    %new_len = add i64 %len, 1
+    store i64 %new_len, i64* %len_ptr
+    %full = icmp eq i64 %new_len, 256
+    br i1 %full, label %flush, label %done
+flush:
+    call void @__isq__qir__shim__gate_flush()
+    br label %done
+done:
+    ret void
+}
+
+; Opcodes index BATCHED_OPS in mod.rs.
+define void @__quantum__qis__x__body (%Qubit* %x0) alwaysinline {
+entry:
+    call void @__isq__gate_batch_push(i64 0, %Qubit* %x0, %Qubit* null, double 0.0, double 0.0, double 0.0)
+    ret void
+}
+define void @__quantum__qis__y__body (%Qubit* %x0) alwaysinline {
+entry:
+    call void @__isq__gate_batch_push(i64 1, %Qubit* %x0, %Qubit* null, double 0.0, double 0.0, double 0.0)
+    ret void
+}
+define void @__quantum__qis__z__body (%Qubit* %x0) alwaysinline {
+entry:
+    call void @__isq__gate_batch_push(i64 2, %Qubit* %x0, %Qubit* null, double 0.0, double 0.0, double 0.0)
+    ret void
+}
+define void @__quantum__qis__h__body (%Qubit* %x0) alwaysinline {
+entry:
+    call void @__isq__gate_batch_push(i64 3, %Qubit* %x0, %Qubit* null, double 0.0, double 0.0, double 0.0)
+    ret void
+}
+define void @__quantum__qis__s__body (%Qubit* %x0) alwaysinline {
+entry:
+    call void @__isq__gate_batch_push(i64 4, %Qubit* %x0, %Qubit* null, double 0.0, double 0.0, double 0.0)
+    ret void
+}
+define void @__quantum__qis__s__adj (%Qubit* %x0) alwaysinline {
+entry:
+    call void @__isq__gate_batch_push(i64 5, %Qubit* %x0, %Qubit* null, double 0.0, double 0.0, double 0.0)
+    ret void
+}
+define void @__quantum__qis__t__body (%Qubit* %x0) alwaysinline {
+entry:
+    call void @__isq__gate_batch_push(i64 6, %Qubit* %x0, %Qubit* null, double 0.0, double 0.0, double 0.0)
+    ret void
+}
+define void @__quantum__qis__t__adj (%Qubit* %x0) alwaysinline {
+entry:
+    call void @__isq__gate_batch_push(i64 7, %Qubit* %x0, %Qubit* null, double 0.0, double 0.0, double 0.0)
+    ret void
+}
+define void @__quantum__qis__x2p (%Qubit* %x0) alwaysinline {
+entry:
+    call void @__isq__gate_batch_push(i64 8, %Qubit* %x0, %Qubit* null, double 0.0, double 0.0, double 0.0)
+    ret void
+}
+define void @__quantum__qis__x2m (%Qubit* %x0) alwaysinline {
+entry:
+    call void @__isq__gate_batch_push(i64 9, %Qubit* %x0, %Qubit* null, double 0.0, double 0.0, double 0.0)
+    ret void
+}
+define void @__quantum__qis__y2p (%Qubit* %x0) alwaysinline {
+entry:
+    call void @__isq__gate_batch_push(i64 10, %Qubit* %x0, %Qubit* null, double 0.0, double 0.0, double 0.0)
+    ret void
+}
+define void @__quantum__qis__y2m (%Qubit* %x0) alwaysinline {
+entry:
+    call void @__isq__gate_batch_push(i64 11, %Qubit* %x0, %Qubit* null, double 0.0, double 0.0, double 0.0)
+    ret void
+}
+define void @__quantum__qis__cnot (%Qubit* %x0, %Qubit* %x1) alwaysinline {
+entry:
+    call void @__isq__gate_batch_push(i64 12, %Qubit* %x0, %Qubit* %x1, double 0.0, double 0.0, double 0.0)
+    ret void
+}
+define void @__quantum__qis__cz (%Qubit* %x0, %Qubit* %x1) alwaysinline {
+entry:
+    call void @__isq__gate_batch_push(i64 13, %Qubit* %x0, %Qubit* %x1, double 0.0, double 0.0, double 0.0)
+    ret void
+}
+define void @__quantum__qis__rz__body (double %x0, %Qubit* %x1) alwaysinline {
+entry:
+    call void @__isq__gate_batch_push(i64 14, %Qubit* %x1, %Qubit* null, double %x0, double 0.0, double 0.0)
+    ret void
+}
+define void @__quantum__qis__u3 (double %x0, double %x1, double %x2, %Qubit* %x3) alwaysinline {
+entry:
+    call void @__isq__gate_batch_push(i64 15, %Qubit* %x3, %Qubit* null, double %x0, double %x1, double %x2)
+    ret void
+}
+define void @__quantum__qis__rx__body (double %x0, %Qubit* %x1) alwaysinline {
+entry:
+    call void @__isq__gate_batch_push(i64 16, %Qubit* %x1, %Qubit* null, double %x0, double 0.0, double 0.0)
+    ret void
+}
+define void @__quantum__qis__ry__body (double %x0, %Qubit* %x1) alwaysinline {
+entry:
+    call void @__isq__gate_batch_push(i64 17, %Qubit* %x1, %Qubit* null, double %x0, double 0.0, double 0.0)
+    ret void
+}
@@ -52,6 +52,7 @@ pub(crate) fn sq_op(controls: Option<K<QIRArray>>, op: QuantumOp, arg: &[f64], q
     device.controlled_qop(op, &controls_refs, &[&qubit], arg);
 }
 
+pub mod batch;
 pub mod qir_builtin;
 pub mod qsharp_core;
 pub mod qsharp_foundation;
@@ -1,2 +1,4 @@
 #[cfg(feature = "qcis")]
-pub mod qcis;
\ No newline at end of file
+pub mod qcis;
+#[cfg(feature = "qcis")]
+pub mod qcisbin;
\ No newline at end of file
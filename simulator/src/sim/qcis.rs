@@ -1,133 +1,208 @@
 use crate::{
     devices::naive::NaiveSimulator,
     devices::sq2u3,
-    qdevice::{QuantumOp, QDevice}
+    qdevice::{QuantumOp, QDevice},
+    sim::qcisbin::{Decoder, Inst, Opcode}
 };
 
 extern crate std;
 use std::collections::HashMap;
-use alloc::{string::{String, ToString}, vec::Vec};
-use regex::Regex;
+use std::io::{self, BufRead};
+use core::f64::consts::FRAC_PI_2;
+use alloc::{string::String, vec::Vec};
 
-fn reg(qcis: &Vec<&str>) -> bool{
-    
-    let mut reg_map = HashMap::new();
-    reg_map.insert("X", Regex::new(r"^X(?:\s(?:Q(?:[1][0-2]|[1-9]))){1}$").unwrap());
-    reg_map.insert("Y", Regex::new(r"^Y(?:\s(?:Q(?:[1][0-2]|[1-9]))){1}$").unwrap());
-    reg_map.insert("Z", Regex::new(r"^Z(?:\s(?:Q(?:[1][0-2]|[1-9]))){1}$").unwrap());
-    reg_map.insert("X2P", Regex::new(r"^X2P(?:\s(?:Q(?:[1][0-2]|[1-9]))){1}$").unwrap());
-    reg_map.insert("X2M", Regex::new(r"^X2M(?:\s(?:Q(?:[1][0-2]|[1-9]))){1}$").unwrap());
-    reg_map.insert("Y2P", Regex::new(r"^Y2P(?:\s(?:Q(?:[1][0-2]|[1-9]))){1}$").unwrap());
-    reg_map.insert("Y2M", Regex::new(r"^Y2M(?:\s(?:Q(?:[1][0-2]|[1-9]))){1}$").unwrap());
-    reg_map.insert("H", Regex::new(r"^H(?:\s(?:Q(?:[1][0-2]|[1-9]))){1}$").unwrap());
-    reg_map.insert("S", Regex::new(r"^S(?:\s(?:Q(?:[1][0-2]|[1-9]))){1}$").unwrap());
-    reg_map.insert("SD", Regex::new(r"^SD(?:\s(?:Q(?:[1][0-2]|[1-9]))){1}$").unwrap());
-    reg_map.insert("T", Regex::new(r"^T(?:\s(?:Q(?:[1][0-2]|[1-9]))){1}$").unwrap());
-    reg_map.insert("TD", Regex::new(r"^TD(?:\s(?:Q(?:[1][0-2]|[1-9]))){1}$").unwrap());
-    reg_map.insert("CZ", Regex::new(r"^CZ(?:\s+(?:Q(?:[1][0-2]|[1-9]))){2}$").unwrap());
-    reg_map.insert("RX", Regex::new(r"^RX\s(?:Q(?:[1][0-2]|[1-9]))\s([+-]?([0-9]*[.])?([0-9]+|[0-9]+[E][+-]?[0-9]+))$").unwrap());
-    reg_map.insert("RY", Regex::new(r"^RY\s(?:Q(?:[1][0-2]|[1-9]))\s([+-]?([0-9]*[.])?([0-9]+|[0-9]+[E][+-]?[0-9]+))$").unwrap());
-    reg_map.insert("RZ", Regex::new(r"^RZ\s(?:Q(?:[1][0-2]|[1-9]))\s([+-]?([0-9]*[.])?([0-9]+|[0-9]+[E][+-]?[0-9]+))$").unwrap());
-    reg_map.insert("RXY", Regex::new(r"^RXY\s(?:Q(?:[1-5][0-9]|60|[1-9]))\s([+-]?([0-9]*[.])?([0-9]+|[0-9]+[E][+-]?[0-9]+))\s([+-]?([0-9]*[.])?([0-9]+|[0-9]+[E][+-]?[0-9]+))$").unwrap());
-    reg_map.insert("M", Regex::new(r"^M(?:\s+(?:Q(?:[1][0-2]|[1-9])))+$").unwrap());
-    
-    for &s in qcis{
-        if s.is_empty(){continue;}
-        let gate = s.split(' ').next().unwrap();
-        if !reg_map.contains_key(gate){ return false; }
-        let reg = reg_map.get(gate).unwrap();
-        if !reg.is_match(s){ return false; }
+// Highest qubit number accepted in QCIS text; RXY accepts up to Q60.
+const MAX_QUBIT: usize = 12;
+const MAX_RXY_QUBIT: usize = 60;
+
+// Parses and checks QCIS text in one pass. A multi-qubit M becomes one M per qubit, as in `qcisbin`.
+// Lines starting with `#` are comments, such as the start times of `isq-opt --qcis-timing`.
+fn parse(code: &str) -> Result<Vec<Inst>, String>{
+    let mut insts = vec![];
+    for (line, s) in code.split('\n').enumerate(){
+        if s.is_empty() || s.starts_with('#'){continue;}
+        let err = |msg: &str| format!("line {}: {}: {}", line + 1, msg, s);
+        let mut tokens = s.split_whitespace();
+        let op = tokens.next().and_then(Opcode::from_name).ok_or_else(|| err("unknown gate"))?;
+        let max = if op == Opcode::RXY {MAX_RXY_QUBIT} else {MAX_QUBIT};
+        let mut inst = Inst{op, qubits: [0; 2], params: [0.0; 2]};
+        let (mut nq, mut np) = (0, 0);
+        for token in tokens{
+            if let Some(q) = token.strip_prefix('Q'){
+                if np > 0{
+                    return Err(err("qubit after parameter"));
+                }
+                let q = q.parse::<usize>().ok().filter(|q| (1..=max).contains(q)).ok_or_else(|| err("bad qubit"))?;
+                if op == Opcode::M{
+                    inst.qubits[0] = q;
+                    insts.push(inst);
+                }else if nq < op.qubits(){
+                    inst.qubits[nq] = q;
+                }else{
+                    return Err(err("too many qubits"));
+                }
+                nq += 1;
+            }else if np < op.params(){
+                inst.params[np] = token.parse::<f64>().map_err(|_| err("bad parameter"))?;
+                np += 1;
+            }else{
+                return Err(err("too many parameters"));
+            }
+        }
+        if op == Opcode::M{
+            if nq == 0{
+                return Err(err("missing qubit"));
+            }
+        }else{
+            if nq != op.qubits() || np != op.params(){
+                return Err(err("missing operand"));
+            }
+            insts.push(inst);
+        }
     }
-    return true;
+    Ok(insts)
 }
 
-
-fn get_single_mat(s: &str, parameters: &[f64]) -> [f64; 8]{
-    let op = match s{
-        "X" => QuantumOp::X,
-        "Y" => QuantumOp::Y,
-        "Z" => QuantumOp::Z,
-        "X2P" => QuantumOp::X2P,
-        "X2M" => QuantumOp::X2M,
-        "Y2P" => QuantumOp::Y2P,
-        "Y2M" => QuantumOp::Y2M,
-        "H" => QuantumOp::H,
-        "S" => QuantumOp::S,
-        "SD" => QuantumOp::SInv,
-        "T" => QuantumOp::T,
-        "TD" => QuantumOp::TInv,
-        "RX" => QuantumOp::Rx,
-        "RY" => QuantumOp::Ry,
-        "RZ" => QuantumOp::Rz,
-        _ => QuantumOp::AnySQ
+fn get_single_mat(op: Opcode, parameters: &[f64]) -> [f64; 8]{
+    let mat = match op{
+        // RXY(phi, theta) rotates by theta around cos(phi)X+sin(phi)Y.
+        Opcode::RXY => {
+            let (phi, theta) = (parameters[0], parameters[1]);
+            sq2u3::translate_sq_gate_to_matrix(QuantumOp::U3, &[theta, phi - FRAC_PI_2, FRAC_PI_2 - phi])
+        }
+        _ => {
+            let qop = match op{
+                Opcode::X => QuantumOp::X,
+                Opcode::Y => QuantumOp::Y,
+                Opcode::Z => QuantumOp::Z,
+                Opcode::X2P => QuantumOp::X2P,
+                Opcode::X2M => QuantumOp::X2M,
+                Opcode::Y2P => QuantumOp::Y2P,
+                Opcode::Y2M => QuantumOp::Y2M,
+                Opcode::H => QuantumOp::H,
+                Opcode::S => QuantumOp::S,
+                Opcode::SD => QuantumOp::SInv,
+                Opcode::T => QuantumOp::T,
+                Opcode::TD => QuantumOp::TInv,
+                Opcode::RX => QuantumOp::Rx,
+                Opcode::RY => QuantumOp::Ry,
+                Opcode::RZ => QuantumOp::Rz,
+                _ => QuantumOp::AnySQ
+            };
+            sq2u3::translate_sq_gate_to_matrix(qop, parameters)
+        }
     };
-    let mat = sq2u3::translate_sq_gate_to_matrix(op, parameters);
     let par = unsafe {core::mem::transmute::<_, [f64; 8]>(mat)};
     par
 }
 
-pub fn sim(code: String, shots: i64, capacity: usize){
-    
-    let mut dev = NaiveSimulator::new(capacity);
-    let qcis: Vec<&str> = code.split("\n").collect();
-
-    if !reg(&qcis){
-        panic!("format error!");
-    }
-
-    let mut qmap: HashMap<&str, usize> = HashMap::new();
-    let mut qidx:usize = 0;
-    let mut mi:Vec<usize> = vec![];
+// The state after one pass over a program.
+struct Run{
+    dev: NaiveSimulator,
+    // Measured qubits in order, as simulator qubits.
+    measured: Vec<usize>,
+    // Results of in-place measurements.
+    result: String,
+    // Whether every measurement is the last operation on its qubit.
+    terminal: bool
+}
 
-    for s in qcis{
-        if s.is_empty(){continue;}
-        let mut tmp = s.split(' ');
-        let gate = tmp.next().unwrap();
+// Applies a program to a fresh state. With `collapse`, qubits are measured where M appears; otherwise
+// measurements are only recorded, to be sampled from the final state.
+fn execute<I: Iterator<Item = io::Result<Inst>>>(insts: I, capacity: usize, collapse: bool) -> io::Result<Run>{
+    let mut run = Run{dev: NaiveSimulator::new(capacity), measured: vec![], result: String::new(), terminal: true};
+    // QCIS qubit numbers to simulator qubits, in order of first use.
+    let mut qmap: HashMap<usize, usize> = HashMap::new();
+    let mut is_measured: Vec<bool> = vec![];
 
-        let qbit = tmp.next().unwrap();
-        if !qmap.contains_key(qbit){
-            qmap.insert(qbit, qidx);
-            qidx += 1;
-            dev.alloc_qubit();
-        }
-
-        if gate == "CZ"{
-            let qbit1 = tmp.next().unwrap();
-            if !qmap.contains_key(qbit1){
-                qmap.insert(qbit1, qidx);
-                qidx += 1;
+    for inst in insts{
+        let inst = inst?;
+        if inst.op == Opcode::Layer{continue;}
+        let mut qubits = [0usize; 2];
+        for (i, q) in inst.qubits().iter().enumerate(){
+            let next = qmap.len();
+            let dev = &mut run.dev;
+            qubits[i] = *qmap.entry(*q).or_insert_with(|| {
                 dev.alloc_qubit();
+                next
+            });
+            if qubits[i] == is_measured.len(){
+                is_measured.push(false);
+            }
+            if is_measured[qubits[i]]{
+                run.terminal = false;
             }
-            let q1 = qmap.get(qbit1).unwrap();
-            dev.controlled_qop(QuantumOp::CZ, &[], &[qmap.get(qbit).unwrap(), q1], &[]);
+        }
 
-        }else if gate.starts_with('R'){
-            let theta = tmp.next().unwrap().parse::<f64>().unwrap();
-            dev.controlled_qop(QuantumOp::AnySQ, &[], &[qmap.get(qbit).unwrap()], &get_single_mat(gate, &[theta]));
-        }else if gate == "M"{
-            mi.push(*qmap.get(qbit).unwrap());
-        }else{
-            dev.controlled_qop(QuantumOp::AnySQ, &[], &[qmap.get(qbit).unwrap()], &get_single_mat(gate, &[]));
+        match inst.op{
+            Opcode::M => {
+                if collapse{
+                    run.result.push(if run.dev.measure(&qubits[0]) {'1'} else {'0'});
+                }
+                is_measured[qubits[0]] = true;
+                run.measured.push(qubits[0]);
+            }
+            Opcode::CZ => run.dev.controlled_qop(QuantumOp::CZ, &[], &[&qubits[0], &qubits[1]], &[]),
+            _ => run.dev.controlled_qop(QuantumOp::AnySQ, &[], &[&qubits[0]], &get_single_mat(inst.op, inst.params()))
         }
     }
-    
-    let mut res_map: HashMap<String, i32> = HashMap::new();
+    Ok(run)
+}
+
+// Draws `shots` outcomes from `probs`, returning how often each was drawn.
+fn sample(probs: &[f64], shots: i64) -> Vec<i32>{
+    let mut cumulative = Vec::with_capacity(probs.len());
+    let mut total = 0.0;
+    for p in probs{
+        total += p;
+        cumulative.push(total);
+    }
+    let mut counts = vec![0; probs.len()];
     for _ in 0..shots{
-        let mut tmp = dev.clone();
-        let mut s = "".to_string();
-        
-        for qbit in mi.clone(){
-            let x = tmp.measure(&qbit);
-            match x{
-                true => s += &"1".to_string(),
-                false => s += &"0".to_string()
-            };
+        let r = rand::random::<f64>() * total;
+        let outcome = cumulative.partition_point(|&c| c <= r).min(probs.len() - 1);
+        counts[outcome] += 1;
+    }
+    counts
+}
+
+// Simulates the program `program()` yields. Usually all measurements are terminal: the program then runs once
+// and every shot is sampled from the final state. Otherwise it runs once per shot.
+fn run<I, F>(mut program: F, shots: i64, capacity: usize) -> io::Result<()>
+where I: Iterator<Item = io::Result<Inst>>, F: FnMut() -> io::Result<I>{
+    let first = execute(program()?, capacity, false)?;
+    let mut res_map: HashMap<String, i32> = HashMap::new();
+    if first.terminal{
+        let probs = first.dev.probabilities(&first.measured);
+        for (outcome, count) in sample(&probs, shots).into_iter().enumerate(){
+            if count == 0{continue;}
+            let s: String = (0..first.measured.len()).map(|k| if outcome >> k & 1 == 1 {'1'} else {'0'}).collect();
+            res_map.insert(s, count);
+        }
+    }else{
+        for _ in 0..shots{
+            let run = execute(program()?, capacity, true)?;
+            let count = res_map.entry(run.result).or_insert(0);
+            *count += 1;
         }
-        
-        let count = res_map.entry(s).or_insert(0);
-        *count += 1;
     }
 
     std::println!("{:?}", res_map);
+    Ok(())
+}
 
-}
\ No newline at end of file
+pub fn sim(code: String, shots: i64, capacity: usize){
+    
+    let insts = match parse(&code){
+        Ok(insts) => insts,
+        Err(msg) => panic!("format error! {}", msg)
+    };
+
+    run(|| Ok(insts.iter().copied().map(Ok)), shots, capacity).unwrap();
+}
+
+// Simulates binary QCIS (see `qcisbin`), decoding it while the gates are applied. `open` is called again
+// for each shot when the program measures a qubit before its last use.
+pub fn sim_binary<R: BufRead, F: FnMut() -> io::Result<R>>(mut open: F, shots: i64, capacity: usize) -> io::Result<()>{
+    run(|| Decoder::new(open()?), shots, capacity)
+}
@@ -0,0 +1,282 @@
+// Compact binary QCIS.
+//
+// A program starts with the magic `QCIS` and a version byte. Each instruction is an opcode byte,
+// its qubits as LEB128 varints (the `n` of `Qn`) and its parameters as little-endian f64.
+// `M` has a varint count before its qubits; `Layer` separates the parallel layers of
+// `isq-opt --qcis-layers` output. `isq-opt --target=qcis --qcis-binary` writes the same format
+// (mlir/include/isq/utils/QCISBinary.h); the opcodes must stay in sync.
+extern crate std;
+use std::io::{self, BufRead, Write};
+
+pub const MAGIC: &[u8; 4] = b"QCIS";
+pub const VERSION: u8 = 1;
+
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+#[repr(u8)]
+pub enum Opcode{
+    X, Y, Z, H, S, SD, T, TD, X2P, X2M, Y2P, Y2M, CZ, RX, RY, RZ, RXY, M, Layer
+}
+
+const OPCODES: [Opcode; 19] = {
+    use Opcode::*;
+    [X, Y, Z, H, S, SD, T, TD, X2P, X2M, Y2P, Y2M, CZ, RX, RY, RZ, RXY, M, Layer]
+};
+
+impl Opcode{
+    pub fn from_byte(b: u8)->Option<Self>{
+        OPCODES.get(b as usize).copied()
+    }
+    pub fn from_name(name: &str)->Option<Self>{
+        OPCODES.iter().copied().find(|op| op.name() == name && *op != Opcode::Layer)
+    }
+    pub fn name(self)->&'static str{
+        use Opcode::*;
+        match self{
+            X=>"X", Y=>"Y", Z=>"Z", H=>"H", S=>"S", SD=>"SD", T=>"T", TD=>"TD",
+            X2P=>"X2P", X2M=>"X2M", Y2P=>"Y2P", Y2M=>"Y2M", CZ=>"CZ",
+            RX=>"RX", RY=>"RY", RZ=>"RZ", RXY=>"RXY", M=>"M", Layer=>""
+        }
+    }
+    // Qubit operands. `M` takes any number, so it is encoded with a count.
+    pub fn qubits(self)->usize{
+        match self{
+            Opcode::CZ => 2,
+            Opcode::M | Opcode::Layer => 0,
+            _ => 1
+        }
+    }
+    pub fn params(self)->usize{
+        match self{
+            Opcode::RX | Opcode::RY | Opcode::RZ => 1,
+            Opcode::RXY => 2,
+            _ => 0
+        }
+    }
+}
+
+// A decoded instruction. A multi-qubit `M` is decoded as one `M` per qubit, in order.
+#[derive(Copy, Clone, Debug, PartialEq)]
+pub struct Inst{
+    pub op: Opcode,
+    pub qubits: [usize; 2],
+    pub params: [f64; 2]
+}
+
+impl Inst{
+    pub fn qubits(&self)->&[usize]{
+        &self.qubits[..if self.op == Opcode::M {1} else {self.op.qubits()}]
+    }
+    pub fn params(&self)->&[f64]{
+        &self.params[..self.op.params()]
+    }
+}
+
+fn invalid(msg: &str)->io::Error{
+    io::Error::new(io::ErrorKind::InvalidData, msg)
+}
+
+pub struct Encoder<W: Write>{
+    out: W
+}
+
+impl<W: Write> Encoder<W>{
+    pub fn new(mut out: W)->io::Result<Self>{
+        out.write_all(MAGIC)?;
+        out.write_all(&[VERSION])?;
+        Ok(Self{out})
+    }
+    fn varint(&mut self, mut v: u64)->io::Result<()>{
+        let mut buf = [0u8; 10];
+        let mut n = 0;
+        loop{
+            let b = (v & 0x7f) as u8;
+            v >>= 7;
+            if v == 0{
+                buf[n] = b;
+                n += 1;
+                break;
+            }
+            buf[n] = b | 0x80;
+            n += 1;
+        }
+        self.out.write_all(&buf[..n])
+    }
+    pub fn inst(&mut self, op: Opcode, qubits: &[usize], params: &[f64])->io::Result<()>{
+        if op == Opcode::M{
+            if qubits.is_empty() || !params.is_empty(){
+                return Err(invalid("M takes one or more qubits and no parameters"));
+            }
+        }else if qubits.len() != op.qubits() || params.len() != op.params(){
+            return Err(invalid("wrong number of operands"));
+        }
+        self.out.write_all(&[op as u8])?;
+        if op == Opcode::M{
+            self.varint(qubits.len() as u64)?;
+        }
+        for q in qubits{
+            self.varint(*q as u64)?;
+        }
+        for p in params{
+            self.out.write_all(&p.to_le_bytes())?;
+        }
+        Ok(())
+    }
+    // Encodes QCIS text. An empty line after an instruction starts a new layer; `#` comments are skipped.
+    pub fn text(&mut self, code: &str)->io::Result<()>{
+        let mut layer_open = false;
+        for line in code.lines(){
+            if line.starts_with('#'){
+                continue;
+            }
+            let mut parts = line.split_whitespace();
+            let name = match parts.next(){
+                Some(name) => name,
+                None => {
+                    if layer_open{
+                        self.inst(Opcode::Layer, &[], &[])?;
+                        layer_open = false;
+                    }
+                    continue;
+                }
+            };
+            let op = Opcode::from_name(name).ok_or_else(|| invalid("unknown QCIS gate"))?;
+            let mut qubits = [0usize; 2];
+            let mut measured = vec![];
+            let mut params = [0f64; 2];
+            let mut nq = 0;
+            let mut np = 0;
+            for part in parts{
+                if let Some(q) = part.strip_prefix('Q'){
+                    let q = q.parse::<usize>().map_err(|_| invalid("bad QCIS qubit"))?;
+                    if op == Opcode::M{
+                        measured.push(q);
+                    }else if nq < 2{
+                        qubits[nq] = q;
+                        nq += 1;
+                    }else{
+                        return Err(invalid("too many qubits"));
+                    }
+                }else if np < 2{
+                    params[np] = part.parse::<f64>().map_err(|_| invalid("bad QCIS parameter"))?;
+                    np += 1;
+                }else{
+                    return Err(invalid("too many parameters"));
+                }
+            }
+            if op == Opcode::M{
+                self.inst(op, &measured, &params[..np])?;
+            }else{
+                self.inst(op, &qubits[..nq], &params[..np])?;
+            }
+            layer_open = true;
+        }
+        Ok(())
+    }
+    pub fn into_inner(self)->W{
+        self.out
+    }
+}
+
+// Decodes instructions as they are read, so a program never has to be held in memory.
+pub struct Decoder<R: BufRead>{
+    input: R,
+    measures_left: u64
+}
+
+impl<R: BufRead> Decoder<R>{
+    pub fn new(mut input: R)->io::Result<Self>{
+        let mut header = [0u8; 5];
+        input.read_exact(&mut header)?;
+        if &header[..4] != MAGIC{
+            return Err(invalid("not a binary QCIS program"));
+        }
+        if header[4] != VERSION{
+            return Err(invalid("unsupported binary QCIS version"));
+        }
+        Ok(Self{input, measures_left: 0})
+    }
+    fn byte(&mut self)->io::Result<Option<u8>>{
+        let b = match self.input.fill_buf()?.first(){
+            Some(b) => *b,
+            None => return Ok(None)
+        };
+        self.input.consume(1);
+        Ok(Some(b))
+    }
+    fn varint(&mut self)->io::Result<u64>{
+        let mut v = 0u64;
+        let mut shift = 0;
+        loop{
+            let b = self.byte()?.ok_or_else(|| invalid("truncated binary QCIS"))?;
+            if shift >= 64{
+                return Err(invalid("varint overflow"));
+            }
+            v |= ((b & 0x7f) as u64) << shift;
+            if b & 0x80 == 0{
+                return Ok(v);
+            }
+            shift += 7;
+        }
+    }
+    fn qubit(&mut self)->io::Result<usize>{
+        Ok(self.varint()? as usize)
+    }
+    fn f64(&mut self)->io::Result<f64>{
+        let mut buf = [0u8; 8];
+        self.input.read_exact(&mut buf)?;
+        Ok(f64::from_le_bytes(buf))
+    }
+    fn decode(&mut self)->io::Result<Option<Inst>>{
+        loop{
+            if self.measures_left > 0{
+                self.measures_left -= 1;
+                let q = self.qubit()?;
+                return Ok(Some(Inst{op: Opcode::M, qubits: [q, 0], params: [0.0; 2]}));
+            }
+            let b = match self.byte()?{
+                Some(b) => b,
+                None => return Ok(None)
+            };
+            let op = Opcode::from_byte(b).ok_or_else(|| invalid("bad binary QCIS opcode"))?;
+            if op == Opcode::M{
+                self.measures_left = self.varint()?;
+                continue;
+            }
+            let mut inst = Inst{op, qubits: [0; 2], params: [0.0; 2]};
+            for i in 0..op.qubits(){
+                inst.qubits[i] = self.qubit()?;
+            }
+            for i in 0..op.params(){
+                inst.params[i] = self.f64()?;
+            }
+            return Ok(Some(inst));
+        }
+    }
+}
+
+impl<R: BufRead> Iterator for Decoder<R>{
+    type Item = io::Result<Inst>;
+    fn next(&mut self)->Option<Self::Item>{
+        self.decode().transpose()
+    }
+}
+
+#[cfg(test)]
+mod test{
+    use super::*;
+    use alloc::vec::Vec;
+
+    #[test]
+    fn roundtrip(){
+        let mut enc = Encoder::new(Vec::new()).unwrap();
+        enc.text("H Q1\nCZ Q1 Q300\nRXY Q2 0.5 -1.25\n\nM Q1 Q2\n").unwrap();
+        let bytes = enc.into_inner();
+        assert_eq!(&bytes[..5], b"QCIS\x01");
+        let insts: Vec<Inst> = Decoder::new(&bytes[..]).unwrap().map(|x| x.unwrap()).collect();
+        let ops: Vec<Opcode> = insts.iter().map(|x| x.op).collect();
+        assert_eq!(ops, [Opcode::H, Opcode::CZ, Opcode::RXY, Opcode::Layer, Opcode::M, Opcode::M]);
+        assert_eq!(insts[1].qubits(), &[1, 300]);
+        assert_eq!(insts[2].params(), &[0.5, -1.25]);
+        assert_eq!(insts[5].qubits(), &[2]);
+    }
+}